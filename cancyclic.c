@@ -0,0 +1,196 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "cancyclic.h"
+#include "mcp2515registers.h"
+#include "mcp2515prof.h"
+
+#if CAN_CYCLIC_BUFFERS
+
+/******************************************************************************
+ * Timer2 runs in CTC mode at F_CPU/128 and interrupts once per               *
+ * CAN_CYCLIC_TICK_US. At 16 MHz the default 1 ms tick is a compare value of  *
+ * 124.                                                                       *
+ ******************************************************************************/
+#define CYCLIC_TIMER_TOP ((F_CPU / 128UL) * CAN_CYCLIC_TICK_US / 1000000UL - 1)
+
+#if (CYCLIC_TIMER_TOP < 1) || (CYCLIC_TIMER_TOP > 255)
+#error "CAN_CYCLIC_TICK_US does not fit Timer2 at F_CPU/128"
+#endif
+
+/******************************************************************************
+ * One entry per running cyclic message. "data" is what the application wants *
+ * sent next, "shadow" is what the transmit buffer holds right now; only the  *
+ * bytes where the two differ are written before the next REQUEST TO SEND.    *
+ * "countdown" counts the ticks left until the message is due and "period" is *
+ * what it is reloaded with; a zero "period" marks a free entry.              *
+ ******************************************************************************/
+typedef struct {
+    uint8_t  device;
+    uint8_t  buffer;
+    uint8_t  length;
+    uint16_t period;
+    uint16_t countdown;
+    uint8_t  data[8];
+    uint8_t  shadow[8];
+} cyclicMessage;
+
+static cyclicMessage messages[CAN_CYCLIC_MAX];
+
+/******************************************************************************
+ * Starts Timer2 as the cyclic message clock. Call it once, after             *
+ * initController(); global interrupts are left to the application's sei().   *
+ ******************************************************************************/
+void cyclicInit(void) {
+    // Clear Timer on Compare Match, F_CPU/128
+    // Interrupt on every compare match
+    TCCR2A  = (1<<WGM21);
+    TCCR2B  = (1<<CS22) | (1<<CS20);
+    OCR2A   = CYCLIC_TIMER_TOP;
+    TIMSK2 |= (1<<OCIE2A);
+
+    return;
+}
+
+/******************************************************************************
+ * Pins "frame" to transmit buffer "buffer" (one of CAN_CYCLIC_BUFFERS) of    *
+ * "device", sends it once straight away and then every "period" ticks (at    *
+ * least 1). Returns the message number for cyclicUpdate() and cyclicStop(),  *
+ * or CAN_CYCLIC_NONE if every entry is in use, the buffer is already pinned  *
+ * or it could not be loaded.                                                 *
+ ******************************************************************************/
+uint8_t cyclicStart(uint8_t device, uint8_t buffer, const canFrame *frame, uint8_t priority,
+                    uint16_t period) {
+    uint8_t free = CAN_CYCLIC_NONE;
+
+    if (buffer > 2 || !(CAN_CYCLIC_BUFFERS & (1<<buffer)) || !period) {
+        return CAN_CYCLIC_NONE;
+    }
+
+    for (uint8_t i = 0; i < CAN_CYCLIC_MAX; i++) {
+        if (!messages[i].period) {
+            if (free == CAN_CYCLIC_NONE) {
+                free = i;
+            }
+        } else if (messages[i].device == device && messages[i].buffer == buffer) {
+            return CAN_CYCLIC_NONE;
+        }
+    }
+
+    if (free == CAN_CYCLIC_NONE || !canPreload(device, buffer, frame, priority)) {
+        return CAN_CYCLIC_NONE;
+    }
+
+    cyclicMessage *message = &messages[free];
+
+    message->device    = device;
+    message->buffer    = buffer;
+    message->length    = canGetLength(frame);
+    message->countdown = period;
+    memcpy(message->data, frame->data, sizeof(message->data));
+    memcpy(message->shadow, frame->data, sizeof(message->shadow));
+
+    requestToSend(device, 1<<buffer);
+
+    // Setting the period last hands the entry over to the timer interrupt
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        message->period = period;
+    }
+
+    return free;
+}
+
+/******************************************************************************
+ * Replaces the data bytes of cyclic message "message" from the next period   *
+ * on. "data" holds as many bytes as the DLC the message was started with.    *
+ ******************************************************************************/
+void cyclicUpdate(uint8_t message, const uint8_t *data) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(messages[message].data, data, messages[message].length);
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Stops cyclic message "message". A transmission already requested still     *
+ * goes out. The buffer stays reserved for cyclic messages and can be used    *
+ * again by the next cyclicStart().                                           *
+ ******************************************************************************/
+void cyclicStop(uint8_t message) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        messages[message].period = 0;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Sends one period of a cyclic message. The changed data bytes are found by  *
+ * comparing "data" with "shadow" and the run from the first to the last of   *
+ * them is written, either from TXBnD0 with the LOAD TX BUFFER instruction,   *
+ * which needs no address byte, or, when the run starts further in, with a    *
+ * WRITE from its first byte, whichever clocks fewer bytes. The buffer is     *
+ * reserved for this message, so nothing else loads it and no READ STATUS is  *
+ * needed first; the period has to be long enough for the frame before to be  *
+ * on the bus by then (see cancyclic.h).                                      *
+ ******************************************************************************/
+static void cyclicSend(cyclicMessage *message) {
+    uint8_t first = 0;
+    uint8_t last  = message->length;
+
+    while (first < last && message->data[first] == message->shadow[first]) {
+        first++;
+    }
+    while (last > first && message->data[last - 1] == message->shadow[last - 1]) {
+        last--;
+    }
+
+    if (first < last) {
+        // LOAD TX BUFFER costs 1 + last bytes, WRITE 2 + last - first
+        if (first <= 1) {
+            first = 0;
+            loadTxData(message->device, message->buffer, message->data, last);
+        } else {
+            writeRegisters(message->device, TXB0D0 + (message->buffer << 4) + first,
+                           &message->data[first], last - first);
+        }
+        memcpy(&message->shadow[first], &message->data[first], last - first);
+    }
+
+    requestToSend(message->device, 1<<message->buffer);
+
+    return;
+}
+
+/******************************************************************************
+ * Timer2 tick. Every message that falls due is sent. While the asynchronous  *
+ * SPI engine owns the bus the message is kept due and retried on the next    *
+ * tick, since waiting for the engine with interrupts disabled would never    *
+ * end.                                                                       *
+ ******************************************************************************/
+ISR(TIMER2_COMPA_vect) {
+    PROF_ISR_BEGIN();
+
+    for (uint8_t i = 0; i < CAN_CYCLIC_MAX; i++) {
+        cyclicMessage *message = &messages[i];
+
+        if (!message->period || --message->countdown) {
+            continue;
+        }
+
+        if (spiBusy()) {
+            message->countdown = 1;
+            continue;
+        }
+
+        message->countdown = message->period;
+        cyclicSend(message);
+    }
+
+    PROF_ISR_END();
+}
+
+#endif
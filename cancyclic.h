@@ -0,0 +1,35 @@
+#ifndef _CANCYCLIC_H_
+#define _CANCYCLIC_H_
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/******************************************************************************
+ * Cyclic messages                                                            *
+ *                                                                            *
+ * Each cyclic message is pinned to one transmit buffer from                  *
+ * CAN_CYCLIC_BUFFERS and sent every "period" Timer2 ticks of                 *
+ * CAN_CYCLIC_TICK_US. The identifier and DLC are loaded once; after that a   *
+ * period costs a one-byte REQUEST TO SEND when the data has not changed.     *
+ * Changed data adds a LOAD TX BUFFER of the bytes from TXBnD0 up to the last *
+ * changed one (1 + that many bytes), or a WRITE of just the changed run (2 + *
+ * its length) when that starts past TXBnD1, so a change to the first byte    *
+ * costs 3 bytes and a full 8-byte update 10.                                 *
+ *                                                                            *
+ * The buffer is not checked for a frame still waiting to go out before it is *
+ * written, so "period" must give a frame time to get onto the bus, busy or   *
+ * not, before the next one is due.                                           *
+ ******************************************************************************/
+#define CAN_CYCLIC_NONE 0xFF
+
+/******************************************************************************
+ * Cyclic Message API                                                         *
+ ******************************************************************************/
+void    cyclicInit(void);
+uint8_t cyclicStart(uint8_t device, uint8_t buffer, const canFrame *frame, uint8_t priority,
+                    uint16_t period);
+void    cyclicUpdate(uint8_t message, const uint8_t *data);
+void    cyclicStop(uint8_t message);
+
+
+#endif
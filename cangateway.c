@@ -0,0 +1,152 @@
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "cangateway.h"
+
+#if CAN_GATEWAY
+
+#ifdef CAN_GATEWAY_ROUTES_HEADER
+#include CAN_GATEWAY_ROUTES_HEADER
+#else
+#include "cangatewayroutes.h"
+#endif
+
+#if CAN_GATEWAY_DEVICES > MCP2515_DEVICE_COUNT
+#error "The routing table names more devices than MCP2515_DEVICE_COUNT"
+#endif
+
+#if CAN_GATEWAY_RATE_SLOTS && !CAN_TIMESTAMPS
+#error "Rate limited gateway routes need CAN_TIMESTAMPS"
+#endif
+
+/******************************************************************************
+ * Receive timestamp of the last copy each rate limited route let through,    *
+ * and whether it has let one through yet.                                    *
+ ******************************************************************************/
+#if CAN_GATEWAY_RATE_SLOTS
+static uint32_t lastForward[CAN_GATEWAY_RATE_SLOTS];
+static uint8_t  forwardedOnce[(CAN_GATEWAY_RATE_SLOTS + 7) / 8];
+#endif
+
+static canGatewayCounters gatewayCounters;
+
+/******************************************************************************
+ * Adds one to a gateway counter, stopping at its maximum.                    *
+ ******************************************************************************/
+static void countRoute(uint16_t *counter) {
+    if (*counter != 0xFFFF) {
+        (*counter)++;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Index of the first route for packed identifier "id", or of the first route *
+ * after it when there is none.                                               *
+ ******************************************************************************/
+static uint8_t findRoute(canPackedId id) {
+    uint8_t low  = 0;
+    uint8_t high = CAN_GATEWAY_ROUTE_COUNT;
+
+    while (low < high) {
+        uint8_t middle = (low + high) >> 1;
+
+        if (gatewayRoutes[middle].id < id) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+#if CAN_GATEWAY_RATE_SLOTS
+// Returns 1 if the rate limit of "route" lets a copy of a frame received at "now" through
+static uint8_t rateAllows(const canRoute *route, uint32_t now) {
+    uint8_t slot = route->slot;
+    uint8_t bit  = 1 << (slot & 7);
+
+    if ((forwardedOnce[slot >> 3] & bit) && (uint32_t)(now - lastForward[slot]) < route->interval) {
+        return 0;
+    }
+
+    forwardedOnce[slot >> 3] |= bit;
+    lastForward[slot]         = now;
+
+    return 1;
+}
+#endif
+
+/******************************************************************************
+ * Called by the INT handler of "device" for every frame it takes off the     *
+ * MCP2515, with "frame" still in its ring buffer slot (or on the stack for a *
+ * filter handler). Each route for the frame's identifier and device sends a  *
+ * copy to its destination with canWrite(), which streams it straight from    *
+ * "frame" into a free transmit buffer and only copies it into the transmit   *
+ * queue when none is free. A rewritten identifier is put into "frame" for    *
+ * the copy and taken out again afterwards.                                   *
+ *                                                                            *
+ * Returns 1 if the frame is to be delivered on "device" as well, which is    *
+ * the case when no route for it exists or one of its routes has              *
+ * CAN_ROUTE_LOCAL.                                                           *
+ ******************************************************************************/
+uint8_t gatewayForward(uint8_t device, canFrame *frame) {
+    canPackedId id      = canFramePackedId(frame);
+    uint8_t     matched = 0;
+    uint8_t     local   = 0;
+
+    for (uint8_t i = findRoute(id); i < CAN_GATEWAY_ROUTE_COUNT && gatewayRoutes[i].id == id; i++) {
+        const canRoute *route = &gatewayRoutes[i];
+        canPackedId     original;
+
+        if (route->source != device) {
+            continue;
+        }
+        matched  = 1;
+        local   |= route->flags & CAN_ROUTE_LOCAL;
+
+#if CAN_GATEWAY_RATE_SLOTS
+        if (route->interval && !rateAllows(route, canHandlerTimestamp(device))) {
+            countRoute(&gatewayCounters.limited);
+            continue;
+        }
+#endif
+
+        if (route->flags & CAN_ROUTE_REWRITE) {
+            memcpy(&original, frame, sizeof(original));
+            memcpy(frame, &route->rewrite, sizeof(route->rewrite));
+        }
+
+        if (canWrite(route->destination, frame, route->flags & CAN_ROUTE_PRIORITY_MASK)) {
+            countRoute(&gatewayCounters.forwarded);
+        } else {
+            countRoute(&gatewayCounters.rejected);
+        }
+
+        if (route->flags & CAN_ROUTE_REWRITE) {
+            memcpy(frame, &original, sizeof(original));
+        }
+    }
+
+    return !matched || local;
+}
+
+/******************************************************************************
+ * Copies the gateway counters into "counters" and, if "clear" is set, starts *
+ * them again from zero.                                                      *
+ ******************************************************************************/
+void readGatewayCounters(canGatewayCounters *counters, uint8_t clear) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        *counters = gatewayCounters;
+        if (clear) {
+            memset(&gatewayCounters, 0, sizeof(canGatewayCounters));
+        }
+    }
+
+    return;
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _CANGATEWAY_H_
+#define _CANGATEWAY_H_
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/******************************************************************************
+ * Gateway routes                                                             *
+ *                                                                            *
+ * One route forwards the frames that "source" receives with packed           *
+ * identifier "id" (data and remote frames alike) to "destination", through   *
+ * its transmit queue at the priority in the low bits of "flags". With        *
+ * CAN_ROUTE_REWRITE the copy goes out with the packed identifier "rewrite"   *
+ * instead; with CAN_ROUTE_LOCAL the frame is also delivered on "source" as   *
+ * usual (ring buffer or filter handler), otherwise the gateway consumes it.  *
+ * A non-zero "interval" drops copies sent less than that many microseconds   *
+ * after the previous one, measured between receive timestamps; "slot"        *
+ * numbers the rate limited routes.                                           *
+ *                                                                            *
+ * The routing table is generated by tools/cangwgen.py, sorted by "id" so the *
+ * INT handler finds a frame's routes with a binary search. Several routes    *
+ * may share an identifier to forward it to more than one device.             *
+ ******************************************************************************/
+#define CAN_ROUTE_PRIORITY_MASK 0x03
+#define CAN_ROUTE_REWRITE       0x04
+#define CAN_ROUTE_LOCAL         0x08
+
+typedef struct {
+    canPackedId id;
+    canPackedId rewrite;
+    uint32_t    interval;
+    uint8_t     source;
+    uint8_t     destination;
+    uint8_t     flags;
+    uint8_t     slot;
+} canRoute;
+
+/******************************************************************************
+ * Gateway counters (see readGatewayCounters()). "forwarded" counts the       *
+ * copies handed to a transmit queue, "limited" the copies a rate limit       *
+ * dropped and "rejected" the copies dropped because the destination's        *
+ * transmit queue was full. The counters stop at their maximum instead of     *
+ * wrapping.                                                                  *
+ ******************************************************************************/
+typedef struct {
+    uint16_t forwarded;
+    uint16_t limited;
+    uint16_t rejected;
+} canGatewayCounters;
+
+/******************************************************************************
+ * Gateway API                                                                *
+ ******************************************************************************/
+uint8_t gatewayForward(uint8_t device, canFrame *frame);
+void    readGatewayCounters(canGatewayCounters *counters, uint8_t clear);
+
+
+#endif
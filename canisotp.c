@@ -0,0 +1,688 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "canisotp.h"
+#include "mcp2515registers.h"
+#include "mcp2515prof.h"
+
+#if CAN_ISOTP_CHANNELS
+
+/******************************************************************************
+ * Timer0 runs in CTC mode at F_CPU/64 and interrupts once per                *
+ * CAN_ISOTP_TICK_US, but only while some channel has a timer running. At 16  *
+ * MHz the default 100 us tick is a compare value of 24.                      *
+ ******************************************************************************/
+#define ISOTP_TIMER_TOP ((F_CPU / 64UL) * CAN_ISOTP_TICK_US / 1000000UL - 1)
+
+#if (ISOTP_TIMER_TOP < 1) || (ISOTP_TIMER_TOP > 255)
+#error "CAN_ISOTP_TICK_US does not fit Timer0 at F_CPU/64"
+#endif
+
+#define ISOTP_TIMEOUT_TICKS ((uint16_t)(CAN_ISOTP_TIMEOUT_MS * 1000UL / CAN_ISOTP_TICK_US))
+
+// Protocol control information, the high nibble of the first data byte
+#define PCI_TYPE_MASK   0xF0
+#define PCI_SINGLE      0x00
+#define PCI_FIRST       0x10
+#define PCI_CONSECUTIVE 0x20
+#define PCI_FLOW        0x30
+
+// Flow status of a flow control frame
+#define FLOW_CONTINUE 0
+#define FLOW_WAIT     1
+#define FLOW_OVERFLOW 2
+
+// segmentPriority() when no priority keeps the frame in order
+#define NO_PRIORITY 0xFF
+
+/******************************************************************************
+ * Transmit phases. PHASE_START waits for the next tick to send the single or *
+ * first frame, PHASE_FLOW for a flow control frame (N_Bs), PHASE_BURST for a *
+ * free transmit buffer and PHASE_SEPARATION for STmin to pass after a        *
+ * consecutive frame went out. PHASE_SENT has every frame loaded and waits    *
+ * for the last ones to go out.                                               *
+ ******************************************************************************/
+#define PHASE_IDLE       0
+#define PHASE_START      1
+#define PHASE_FLOW       2
+#define PHASE_BURST      3
+#define PHASE_SEPARATION 4
+#define PHASE_SENT       5
+
+/******************************************************************************
+ * One entry per channel. "head" is the identifier and DLC of the channel's   *
+ * frames, followed by the protocol control bytes of the frame being sent.    *
+ * "blockSize" and "separation" are what the flow control frames of the       *
+ * channel ask the peer for.                                                  *
+ *                                                                            *
+ * On the transmit side "txOffset" counts the bytes of "txData" already       *
+ * loaded, "txPending" the frames loaded but not out yet, and "txBlockLeft"   *
+ * and "txSeparation" (in ticks) are the peer's flow control. On the receive  *
+ * side "rxOffset" counts the bytes of the "rxLength" byte message already in *
+ * "rxData", and "rxReceiving" is set between the first and the last frame.   *
+ * "txTimer" and "rxTimer" count down ticks, 0 when stopped.                  *
+ ******************************************************************************/
+typedef struct {
+    canFrame          head;
+    canPackedId       rxId;
+    uint8_t           open;
+    uint8_t           device;
+    uint8_t           blockSize;
+    uint8_t           separation;
+    const uint8_t    *txData;
+    uint16_t          txLength;
+    uint16_t          txOffset;
+    uint16_t          txSeparation;
+    volatile uint16_t txTimer;
+    uint8_t           txPhase;
+    uint8_t           txSequence;
+    uint8_t           txBlockLeft;
+    uint8_t           txPending;
+    volatile uint8_t  txStatus;
+    uint8_t          *rxData;
+    uint16_t          rxSize;
+    uint16_t          rxLength;
+    uint16_t          rxOffset;
+    volatile uint16_t rxTimer;
+    uint8_t           rxSequence;
+    uint8_t           rxBlockLeft;
+    uint8_t           rxReceiving;
+    volatile uint8_t  rxStatus;
+} isotpChannel;
+
+/******************************************************************************
+ * Per device, the transmit buffers holding an ISO-TP frame that has not gone *
+ * out yet ("pending"), and for each of them the channel it belongs to and    *
+ * its order key, TXP * 3 + buffer number. The MCP2515 sends the pending      *
+ * buffer with the highest key first.                                         *
+ ******************************************************************************/
+typedef struct {
+    uint8_t pending;
+    uint8_t key[3];
+    uint8_t owner[3];
+} isotpDevice;
+
+static isotpChannel channels[CAN_ISOTP_CHANNELS];
+static isotpDevice  devices[MCP2515_DEVICE_COUNT];
+
+/******************************************************************************
+ * Starts Timer0 as the ISO-TP clock; its interrupt stays off until a         *
+ * transfer needs it. Call it once, after initController(); global interrupts *
+ * are left to the application's sei().                                       *
+ ******************************************************************************/
+void isotpInit(void) {
+    // Clear Timer on Compare Match, F_CPU/64
+    TCCR0A = (1<<WGM01);
+    TCCR0B = (1<<CS01) | (1<<CS00);
+    OCR0A  = ISOTP_TIMER_TOP;
+
+    return;
+}
+
+/******************************************************************************
+ * Opens channel "channel" on "device", sending on "txId" and receiving on    *
+ * "rxId". "blockSize" and "separation" (STmin, encoded as on the bus) go     *
+ * into the flow control frames sent to the peer. The acceptance filters have *
+ * to let "rxId" through. Call it while the channel is idle.                  *
+ ******************************************************************************/
+void isotpSetup(uint8_t channel, uint8_t device, uint32_t txId, uint32_t rxId,
+                uint8_t blockSize, uint8_t separation) {
+    isotpChannel *c = &channels[channel];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(c, 0, sizeof(isotpChannel));
+        canSetId(&c->head, txId);
+        canSetLength(&c->head, 8);
+        c->rxId       = canPackId(rxId);
+        c->device     = device;
+        c->blockSize  = blockSize;
+        c->separation = separation;
+        c->open       = 1;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Starts timer "timer" with "ticks" ticks, and the tick interrupt with it if *
+ * it was off. Called with interrupts disabled.                               *
+ ******************************************************************************/
+static void startTimer(volatile uint16_t *timer, uint16_t ticks) {
+    *timer = ticks;
+
+    if (!(TIMSK0 & (1<<OCIE0A))) {
+        TCNT0   = 0;
+        TIFR0   = (1<<OCF0A);
+        TIMSK0 |= (1<<OCIE0A);
+    }
+
+    return;
+}
+
+// Ticks to wait for STmin "stmin", one more than it takes for the partial first tick
+static uint16_t separationTicks(uint8_t stmin) {
+    uint32_t us;
+
+    if (stmin <= 0x7F) {
+        us = stmin * 1000UL;
+    } else if (stmin >= 0xF1 && stmin <= 0xF9) {
+        us = (stmin - 0xF0) * 100UL;
+    } else {
+        // Reserved values mean the longest STmin
+        us = 127000UL;
+    }
+
+    if (!us) {
+        return 0;
+    }
+
+    return (us + CAN_ISOTP_TICK_US - 1) / CAN_ISOTP_TICK_US + 1;
+}
+
+/******************************************************************************
+ * Returns the non-reserved transmit buffers of "device" that are free, by    *
+ * the same READ STATUS test as findFreeTxBuffer() in mcp2515.c.              *
+ ******************************************************************************/
+static uint8_t freeBuffers(uint8_t device) {
+    uint8_t status = readStatus(device, SPI_READ_STATUS);
+    uint8_t free   = 0;
+
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        if (!(status & (3<<(STATUS_TX0REQ + 2 * buffer)))) {
+            free |= (1<<buffer);
+        }
+    }
+
+    return free & ~MCP2515_RESERVED_TX_BUFFERS;
+}
+
+/******************************************************************************
+ * Returns the highest transmit priority that puts a frame in "buffer" of     *
+ * "device" behind every ISO-TP frame still pending there, or NO_PRIORITY if  *
+ * even the lowest would not. With nothing pending a frame gets key 9 to 11,  *
+ * and each frame loaded behind it one less, so a burst can run ahead of the  *
+ * oldest frame by up to twelve frames before it has to wait for the buffers  *
+ * to drain.                                                                  *
+ ******************************************************************************/
+static uint8_t segmentPriority(uint8_t device, uint8_t buffer) {
+    isotpDevice *d     = &devices[device];
+    uint8_t      floor = 12;
+
+    for (uint8_t b = 0; b < 3; b++) {
+        if ((d->pending & (1<<b)) && d->key[b] < floor) {
+            floor = d->key[b];
+        }
+    }
+
+    if (floor <= buffer) {
+        return NO_PRIORITY;
+    }
+
+    return (floor - 1 - buffer) / 3;
+}
+
+/******************************************************************************
+ * Sends the next frame of channel "index" through "buffer" at "priority":    *
+ * the single or first frame in PHASE_START, a consecutive frame otherwise.   *
+ * Its protocol control bytes are put behind the identifier in "head" and its *
+ * data bytes streamed from the caller's buffer by transmitSegment().         *
+ ******************************************************************************/
+static void sendSegment(uint8_t index, uint8_t buffer, uint8_t priority) {
+    isotpChannel *c      = &channels[index];
+    isotpDevice  *d      = &devices[c->device];
+    uint16_t      left   = c->txLength - c->txOffset;
+    uint8_t       pci    = 1;
+    uint8_t       length = (left > 7) ? 7 : left;
+
+    if (c->txPhase != PHASE_START) {
+        c->head.data[0] = PCI_CONSECUTIVE | c->txSequence;
+        c->txSequence   = (c->txSequence + 1) & 0x0F;
+    } else if (c->txLength <= 7) {
+        c->head.data[0] = PCI_SINGLE | c->txLength;
+    } else {
+        c->head.data[0] = PCI_FIRST | (c->txLength >> 8);
+        c->head.data[1] = c->txLength;
+        pci    = 2;
+        length = 6;
+    }
+
+    d->pending      |= (1<<buffer);
+    d->key[buffer]   = priority * 3 + buffer;
+    d->owner[buffer] = index;
+    c->txPending++;
+
+    transmitSegment(c->device, buffer, priority, &c->head, pci, c->txData + c->txOffset, length,
+                    CAN_ISOTP_PADDING);
+    c->txOffset += length;
+
+    return;
+}
+
+// Ends the message on the transmit side of "c" with "status"
+static void finishSend(isotpChannel *c, uint8_t status) {
+    c->txPhase  = PHASE_IDLE;
+    c->txTimer  = 0;
+    c->txStatus = status;
+
+    return;
+}
+
+/******************************************************************************
+ * Loads consecutive frames of channel "index" into the buffers in "free",    *
+ * highest buffer number first, for as long as flow control lets it. A full   *
+ * block waits for the next flow control frame and, with an STmin, every      *
+ * frame waits for the one before it to go out. Returns the buffers left      *
+ * free.                                                                      *
+ ******************************************************************************/
+static uint8_t sendBurst(uint8_t index, uint8_t free) {
+    isotpChannel *c = &channels[index];
+
+    for (int8_t buffer = 2; buffer >= 0 && c->txPhase == PHASE_BURST; buffer--) {
+        uint8_t priority;
+
+        if (!(free & (1<<buffer))) {
+            continue;
+        }
+        priority = segmentPriority(c->device, buffer);
+        if (priority == NO_PRIORITY) {
+            continue;
+        }
+
+        sendSegment(index, buffer, priority);
+        free &= ~(1<<buffer);
+
+        if (c->txOffset == c->txLength) {
+            c->txPhase = PHASE_SENT;
+        } else if (c->txBlockLeft && !--c->txBlockLeft) {
+            c->txPhase = PHASE_FLOW;
+            startTimer(&c->txTimer, ISOTP_TIMEOUT_TICKS);
+        } else if (c->txSeparation) {
+            c->txPhase = PHASE_SEPARATION;
+        }
+    }
+
+    return free;
+}
+
+/******************************************************************************
+ * Sends the single or first frame of channel "index" through the highest     *
+ * free buffer, or tries again on the next tick when none is free.            *
+ ******************************************************************************/
+static void sendFirst(uint8_t index) {
+    isotpChannel *c    = &channels[index];
+    uint8_t       free = freeBuffers(c->device);
+
+    for (int8_t buffer = 2; buffer >= 0; buffer--) {
+        uint8_t priority = segmentPriority(c->device, buffer);
+
+        if (!(free & (1<<buffer)) || priority == NO_PRIORITY) {
+            continue;
+        }
+
+        sendSegment(index, buffer, priority);
+        if (c->txOffset == c->txLength) {
+            c->txPhase = PHASE_SENT;
+        } else {
+            c->txPhase = PHASE_FLOW;
+            startTimer(&c->txTimer, ISOTP_TIMEOUT_TICKS);
+        }
+
+        return;
+    }
+
+    c->txTimer = 1;
+
+    return;
+}
+
+/******************************************************************************
+ * Sends the "length" bytes at "data" on channel "channel". The data is read  *
+ * while it is being sent, so it has to stay untouched until                  *
+ * isotpSendStatus() no longer reports ISOTP_BUSY. Returns 0 if the channel   *
+ * is still busy or the length is not 1 to ISOTP_MAX_LENGTH.                  *
+ ******************************************************************************/
+uint8_t isotpSend(uint8_t channel, const uint8_t *data, uint16_t length) {
+    isotpChannel *c    = &channels[channel];
+    uint8_t       sent = 0;
+
+    if (!length || length > ISOTP_MAX_LENGTH) {
+        return 0;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (c->open && c->txStatus != ISOTP_BUSY) {
+            c->txData     = data;
+            c->txLength   = length;
+            c->txOffset   = 0;
+            c->txSequence = 1;
+            c->txPhase    = PHASE_START;
+            c->txStatus   = ISOTP_BUSY;
+            // The first frame goes out from the tick, where the SPI bus is known to be free
+            startTimer(&c->txTimer, 1);
+            sent = 1;
+        }
+    }
+
+    return sent;
+}
+
+// Transmit status of channel "channel"
+uint8_t isotpSendStatus(uint8_t channel) {
+    return channels[channel].txStatus;
+}
+
+/******************************************************************************
+ * Gets channel "channel" ready to receive one message of up to "size" bytes  *
+ * into "buffer". isotpReceiveStatus() reports ISOTP_BUSY until the message   *
+ * is complete; a message that arrives while no buffer is given is refused.   *
+ ******************************************************************************/
+uint8_t isotpReceive(uint8_t channel, uint8_t *buffer, uint16_t size) {
+    isotpChannel *c = &channels[channel];
+
+    if (!c->open) {
+        return 0;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        c->rxData      = buffer;
+        c->rxSize      = size;
+        c->rxLength    = 0;
+        c->rxReceiving = 0;
+        c->rxTimer     = 0;
+        c->rxStatus    = ISOTP_BUSY;
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+ * Receive status of channel "channel". Once it is ISOTP_DONE, "length" (if   *
+ * not NULL) is set to the length of the message.                             *
+ ******************************************************************************/
+uint8_t isotpReceiveStatus(uint8_t channel, uint16_t *length) {
+    isotpChannel *c = &channels[channel];
+    uint8_t status;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        status = c->rxStatus;
+        if (length) {
+            *length = c->rxLength;
+        }
+    }
+
+    return status;
+}
+
+// Sends a flow control frame with flow status "status" from channel "c"
+static void sendFlowControl(isotpChannel *c, uint8_t status) {
+    canFrame frame = c->head;
+
+    memset(frame.data, CAN_ISOTP_PADDING, sizeof(frame.data));
+    frame.data[0] = PCI_FLOW | status;
+    frame.data[1] = c->blockSize;
+    frame.data[2] = c->separation;
+
+    canWrite(c->device, &frame, CAN_PRIORITY_HIGHEST);
+
+    return;
+}
+
+/******************************************************************************
+ * Takes in a first or single frame of "length" bytes of which "data" holds   *
+ * the "count" that came with it. A message that does not fit, or arrives     *
+ * with no buffer given, is refused with an overflow flow control frame.      *
+ ******************************************************************************/
+static void receiveFirst(isotpChannel *c, uint16_t length, const uint8_t *data, uint8_t count, uint8_t first) {
+    if (c->rxStatus != ISOTP_BUSY || length > c->rxSize) {
+        if (c->rxStatus == ISOTP_BUSY) {
+            c->rxStatus    = ISOTP_OVERFLOW;
+            c->rxReceiving = 0;
+            c->rxTimer     = 0;
+        }
+        if (first) {
+            sendFlowControl(c, FLOW_OVERFLOW);
+        }
+        return;
+    }
+
+    memcpy(c->rxData, data, count);
+    c->rxLength = length;
+    c->rxOffset = count;
+
+    if (!first) {
+        c->rxReceiving = 0;
+        c->rxTimer     = 0;
+        c->rxStatus    = ISOTP_DONE;
+        return;
+    }
+
+    c->rxReceiving = 1;
+    c->rxSequence  = 1;
+    c->rxBlockLeft = c->blockSize;
+    sendFlowControl(c, FLOW_CONTINUE);
+    startTimer(&c->rxTimer, ISOTP_TIMEOUT_TICKS);
+
+    return;
+}
+
+// Takes in a consecutive frame with sequence number "sequence" and "count" bytes at "data"
+static void receiveConsecutive(isotpChannel *c, uint8_t sequence, const uint8_t *data, uint8_t count) {
+    uint16_t left = c->rxLength - c->rxOffset;
+
+    if (!c->rxReceiving) {
+        return;
+    }
+
+    if (sequence != c->rxSequence) {
+        c->rxReceiving = 0;
+        c->rxTimer     = 0;
+        c->rxStatus    = ISOTP_ERROR;
+        return;
+    }
+
+    if (count > left) {
+        count = left;
+    }
+    memcpy(c->rxData + c->rxOffset, data, count);
+    c->rxOffset  += count;
+    c->rxSequence = (c->rxSequence + 1) & 0x0F;
+
+    if (c->rxOffset == c->rxLength) {
+        c->rxReceiving = 0;
+        c->rxTimer     = 0;
+        c->rxStatus    = ISOTP_DONE;
+        return;
+    }
+
+    if (c->rxBlockLeft && !--c->rxBlockLeft) {
+        c->rxBlockLeft = c->blockSize;
+        sendFlowControl(c, FLOW_CONTINUE);
+    }
+    startTimer(&c->rxTimer, ISOTP_TIMEOUT_TICKS);
+
+    return;
+}
+
+// Acts on a flow control frame from the peer of channel "index"
+static void receiveFlowControl(uint8_t index, const uint8_t *data, uint8_t count) {
+    isotpChannel *c = &channels[index];
+
+    if (c->txPhase != PHASE_FLOW || count < 3) {
+        return;
+    }
+
+    switch (data[0] & 0x0F) {
+    case FLOW_CONTINUE:
+        c->txBlockLeft  = data[1];
+        c->txSeparation = separationTicks(data[2]);
+        c->txTimer      = 0;
+        if (c->txSeparation && c->txOffset > 6) {
+            // STmin also keeps the last frame of a block apart from the next one
+            c->txPhase = PHASE_SEPARATION;
+            if (!c->txPending) {
+                startTimer(&c->txTimer, c->txSeparation);
+            }
+        } else {
+            c->txPhase = PHASE_BURST;
+            sendBurst(index, freeBuffers(c->device));
+        }
+        break;
+    case FLOW_WAIT:
+        startTimer(&c->txTimer, ISOTP_TIMEOUT_TICKS);
+        break;
+    case FLOW_OVERFLOW:
+        finishSend(c, ISOTP_OVERFLOW);
+        break;
+    default:
+        finishSend(c, ISOTP_ERROR);
+        break;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Called by the INT handler of "device" for every frame it takes off the     *
+ * MCP2515. A frame on the receive identifier of one of the device's channels *
+ * is taken in (or acted on, for flow control) and consumed, and 1 is         *
+ * returned; every other frame is left to the driver.                         *
+ ******************************************************************************/
+uint8_t isotpReceived(uint8_t device, const canFrame *frame) {
+    canPackedId id    = canFramePackedId(frame);
+    uint8_t     count = canGetLength(frame);
+
+    for (uint8_t i = 0; i < CAN_ISOTP_CHANNELS; i++) {
+        isotpChannel  *c    = &channels[i];
+        const uint8_t *data = frame->data;
+
+        if (!c->open || c->device != device || c->rxId != id) {
+            continue;
+        }
+
+        switch (count ? data[0] & PCI_TYPE_MASK : 0xFF) {
+        case PCI_SINGLE:
+            if ((data[0] & 0x0F) && (data[0] & 0x0F) < count) {
+                receiveFirst(c, data[0] & 0x0F, data + 1, data[0] & 0x0F, 0);
+            }
+            break;
+        case PCI_FIRST:
+            if (count == 8 && (((data[0] & 0x0F) << 8) | data[1]) > 7) {
+                receiveFirst(c, ((data[0] & 0x0F) << 8) | data[1], data + 2, 6, 1);
+            }
+            break;
+        case PCI_CONSECUTIVE:
+            receiveConsecutive(c, data[0] & 0x0F, data + 1, count - 1);
+            break;
+        case PCI_FLOW:
+            receiveFlowControl(i, data, count);
+            break;
+        }
+
+        return 1;
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Called by the INT handler of "device" for every transmit buffer it         *
+ * services, after the transmit queue had its turn at refilling it. "buffer"  *
+ * is the buffer that just emptied and "free" the transmit buffers nobody is  *
+ * using now.                                                                 *
+ *                                                                            *
+ * Frames of one message have to reach the bus in order, but the MCP2515      *
+ * sends pending buffers by priority, and by buffer number between equal      *
+ * priorities, not by load order. So every frame is loaded at a priority that *
+ * puts it behind all of the device's ISO-TP frames still pending (see        *
+ * segmentPriority()), and the emptied buffer is refilled with the next       *
+ * consecutive frame here, so a burst keeps all three buffers busy. Without   *
+ * the ordering a frame that lost arbitration could come out after one loaded *
+ * later.                                                                     *
+ ******************************************************************************/
+void isotpTransmitted(uint8_t device, uint8_t buffer, uint8_t free) {
+    isotpDevice *d = &devices[device];
+
+    if (d->pending & (1<<buffer)) {
+        isotpChannel *c = &channels[d->owner[buffer]];
+
+        d->pending &= ~(1<<buffer);
+        c->txPending--;
+
+        if (c->txPhase == PHASE_SEPARATION && !c->txPending) {
+            startTimer(&c->txTimer, c->txSeparation);
+        } else if (c->txPhase == PHASE_SENT && !c->txPending) {
+            finishSend(c, ISOTP_DONE);
+        }
+    }
+
+    for (uint8_t i = 0; i < CAN_ISOTP_CHANNELS && free; i++) {
+        if (channels[i].device == device && channels[i].txPhase == PHASE_BURST) {
+            free = sendBurst(i, free);
+        }
+    }
+
+    return;
+}
+
+// A transmit timer of "index" ran out
+static void transmitTimeout(uint8_t index) {
+    isotpChannel *c = &channels[index];
+
+    switch (c->txPhase) {
+    case PHASE_START:
+        sendFirst(index);
+        break;
+    case PHASE_SEPARATION:
+        c->txPhase = PHASE_BURST;
+        sendBurst(index, freeBuffers(c->device));
+        break;
+    case PHASE_FLOW:
+        finishSend(c, ISOTP_TIMEOUT);
+        break;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Timer0 tick. It counts down the timers of every channel: a transmit timer  *
+ * that runs out sends the single or first frame, ends an STmin wait or times *
+ * out a missing flow control frame, and a receive timer that runs out times  *
+ * out a missing consecutive frame. Sending waits for the next tick while the *
+ * asynchronous SPI engine owns the bus, as in the cyclic message tick. The   *
+ * interrupt turns itself off when no timer is left running.                  *
+ ******************************************************************************/
+ISR(TIMER0_COMPA_vect) {
+    PROF_ISR_BEGIN();
+
+    uint8_t running = 0;
+
+    for (uint8_t i = 0; i < CAN_ISOTP_CHANNELS; i++) {
+        isotpChannel *c = &channels[i];
+
+        if (c->txTimer && !--c->txTimer) {
+            if (spiBusy() && c->txPhase != PHASE_FLOW) {
+                c->txTimer = 1;
+            } else {
+                transmitTimeout(i);
+            }
+        }
+
+        if (c->rxTimer && !--c->rxTimer) {
+            c->rxReceiving = 0;
+            c->rxStatus    = ISOTP_TIMEOUT;
+        }
+
+        running |= c->txTimer || c->rxTimer;
+    }
+
+    if (!running) {
+        TIMSK0 &= ~(1<<OCIE0A);
+    }
+
+    PROF_ISR_END();
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef _CANISOTP_H_
+#define _CANISOTP_H_
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/******************************************************************************
+ * ISO-TP channels                                                            *
+ *                                                                            *
+ * A channel carries messages of up to 4095 bytes to and from one peer on one *
+ * device, sending on "txId" and receiving on "rxId" (normal addressing,      *
+ * identifiers as for canSetId()). Both directions stream: single, first and  *
+ * consecutive frames are written into the transmit buffers straight out of   *
+ * the caller's data, and received segments are copied straight out of the    *
+ * frame into the caller's buffer.                                            *
+ *                                                                            *
+ * Flow control runs entirely in interrupt handlers. A flow control frame     *
+ * from the peer is acted on by the INT handler as it is received, and every  *
+ * consecutive frame that completes refills its transmit buffer from the INT  *
+ * handler, so with a block size of 0 and no STmin all three buffers stay     *
+ * busy for the whole message. Frames of one message are put into the buffers *
+ * with transmit priorities that keep them in order on the bus, see           *
+ * isotpTransmitted().                                                        *
+ ******************************************************************************/
+#define ISOTP_MAX_LENGTH 4095
+
+/******************************************************************************
+ * Transfer status, as returned by isotpSendStatus() and                      *
+ * isotpReceiveStatus(). ISOTP_OVERFLOW on the sending side means the peer    *
+ * had no room for the message, on the receiving side that the message was    *
+ * larger than the buffer (the peer is told so with a flow control frame).    *
+ * ISOTP_ERROR is a consecutive frame out of sequence or an unknown flow      *
+ * status.                                                                    *
+ ******************************************************************************/
+#define ISOTP_IDLE     0
+#define ISOTP_BUSY     1
+#define ISOTP_DONE     2
+#define ISOTP_TIMEOUT  3
+#define ISOTP_OVERFLOW 4
+#define ISOTP_ERROR    5
+
+/******************************************************************************
+ * ISO-TP API                                                                 *
+ ******************************************************************************/
+void    isotpInit(void);
+void    isotpSetup(uint8_t channel, uint8_t device, uint32_t txId, uint32_t rxId,
+                   uint8_t blockSize, uint8_t separation);
+uint8_t isotpSend(uint8_t channel, const uint8_t *data, uint16_t length);
+uint8_t isotpSendStatus(uint8_t channel);
+uint8_t isotpReceive(uint8_t channel, uint8_t *buffer, uint16_t size);
+uint8_t isotpReceiveStatus(uint8_t channel, uint16_t *length);
+
+// Called by the INT handler (mcp2515.c)
+uint8_t isotpReceived(uint8_t device, const canFrame *frame);
+void    isotpTransmitted(uint8_t device, uint8_t buffer, uint8_t free);
+
+
+#endif
@@ -0,0 +1,259 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "canlog.h"
+#include "canuart.h"
+#include "mcp2515registers.h"
+#include "mcp2515prof.h"
+
+#if CAN_LOG_BUFFER
+
+#if !CAN_TIMESTAMPS
+#error "CAN_LOG_BUFFER needs CAN_TIMESTAMPS"
+#endif
+
+#ifndef F_CPU
+#error "CAN_LOG_BUFFER needs F_CPU"
+#endif
+
+#if CAN_UART_UBRR(CAN_LOG_BAUD) > 4095
+#error "CAN_LOG_BAUD is too slow for F_CPU"
+#endif
+
+#if !CAN_UART_FITS(CAN_LOG_BAUD)
+#error "CAN_LOG_BAUD cannot be reached within 2% from F_CPU"
+#endif
+
+/******************************************************************************
+ * Longest records on the wire: a frame record with a 4-byte delta, an        *
+ * extended identifier and 8 data bytes is 17 bytes, plus the COBS code byte  *
+ * and the 0x00 delimiter. No record reaches 254 bytes, so the COBS encoding  *
+ * never needs more than that one extra byte.                                 *
+ ******************************************************************************/
+#define LOG_FRAME_RAW    17
+#define LOG_FRAME_MAX    (LOG_FRAME_RAW + 2)
+#define LOG_DEVICE_MAX   3
+#define LOG_NO_DEVICE    0xFF
+
+/******************************************************************************
+ * The two transmit buffers. The main context appends records to "fillBuffer" *
+ * with interrupts off; the data register empty interrupt sends "drainBuffer" *
+ * and, once it is through, swaps the two if the fill buffer holds anything,  *
+ * or turns itself off.                                                       *
+ ******************************************************************************/
+static uint8_t           logBuffers[2][CAN_LOG_BUFFER];
+static uint8_t          *fillBuffer  = logBuffers[0];
+static uint8_t          *drainBuffer = logBuffers[1];
+static volatile uint8_t  fillLength;
+static uint8_t           drainLength;
+static uint8_t           drainPosition;
+
+static uint8_t           logDevice = LOG_NO_DEVICE;
+static uint32_t          logTime;
+static uint16_t          lostFrames[MCP2515_DEVICE_COUNT];
+
+// Hands the fill buffer to the transmitter; interrupts are off
+static void swapBuffers(void) {
+    uint8_t *drained = drainBuffer;
+
+    drainBuffer   = fillBuffer;
+    drainLength   = fillLength;
+    drainPosition = 0;
+    fillBuffer    = drained;
+    fillLength    = 0;
+
+    return;
+}
+
+/******************************************************************************
+ * Data register empty interrupt: sends the next byte of the drain buffer.    *
+ ******************************************************************************/
+ISR(USART_UDRE_vect) {
+    PROF_ISR_BEGIN();
+
+    UART_PUT(drainBuffer[drainPosition]);
+
+    if (++drainPosition == drainLength) {
+        if (fillLength) {
+            swapBuffers();
+        } else {
+            UCSR0B &= ~(1<<UDRIE0);
+        }
+    }
+
+    PROF_ISR_END();
+}
+
+// Free bytes in the fill buffer; a swap in the meantime only makes more
+static uint8_t logRoom(void) {
+    return CAN_LOG_BUFFER - fillLength;
+}
+
+/******************************************************************************
+ * Appends an encoded record to the fill buffer, or nothing if it does not    *
+ * fit, and starts the transmitter on it if it was idle. Returns 1 if the     *
+ * record was taken.                                                          *
+ ******************************************************************************/
+static uint8_t logWrite(const uint8_t *record, uint8_t length) {
+    uint8_t written = 0;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (logRoom() >= length) {
+            memcpy(fillBuffer + fillLength, record, length);
+            fillLength += length;
+            written     = 1;
+
+            if (!(UCSR0B & (1<<UDRIE0))) {
+                swapBuffers();
+                UCSR0B |= (1<<UDRIE0);
+            }
+        }
+    }
+
+    return written;
+}
+
+/******************************************************************************
+ * COBS-encodes "length" bytes of "raw" (fewer than 254) into "record",       *
+ * 0x00 delimiter included, and writes it out. Every 0x00 in "raw" becomes    *
+ * the distance to the next one, or to the end, kept in the byte where the    *
+ * run before it starts.                                                      *
+ ******************************************************************************/
+static uint8_t encodeRecord(const uint8_t *raw, uint8_t length) {
+    uint8_t record[LOG_FRAME_MAX];
+    uint8_t code  = 0;
+    uint8_t count = 1;
+
+    for (uint8_t i = 0; i < length; i++) {
+        if (raw[i]) {
+            record[count++] = raw[i];
+        } else {
+            record[code] = count - code;
+            code         = count++;
+        }
+    }
+    record[code]    = count - code;
+    record[count++] = 0;
+
+    return logWrite(record, count);
+}
+
+// Event record with a "size"-byte little-endian "value" after the header
+static uint8_t logEvent(uint8_t header, uint16_t value, uint8_t size) {
+    uint8_t raw[3] = {header, (uint8_t)value, (uint8_t)(value >> 8)};
+
+    return encodeRecord(raw, 1 + size);
+}
+
+/******************************************************************************
+ * Starts the logger on the UART. The first delta counts from now.            *
+ ******************************************************************************/
+void logStart(void) {
+    static const uint8_t delimiter = 0;
+
+    uartInit(CAN_UART_UBRR(CAN_LOG_BAUD));
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        fillLength = 0;
+        logDevice  = LOG_NO_DEVICE;
+        logTime    = canTimestamp();
+        memset(lostFrames, 0, sizeof(lostFrames));
+    }
+
+    logWrite(&delimiter, 1);
+
+    return;
+}
+
+/******************************************************************************
+ * Logs "frame" of "device", received at "timestamp" (see                     *
+ * canReadTimestamped()), behind a device record if the previous frame was    *
+ * another device's. Returns 0 if the fill buffer had no room for it; the     *
+ * frame is then not logged and the next delta still counts from the frame    *
+ * before it.                                                                 *
+ ******************************************************************************/
+uint8_t logFrame(uint8_t device, const canFrame *frame, uint32_t timestamp) {
+    uint8_t  raw[LOG_FRAME_RAW];
+    uint32_t delta    = timestamp - logTime;
+    uint8_t  width    = (delta >> 24) ? 4 : (delta >> 16) ? 3 : (delta >> 8) ? 2 : 1;
+    uint8_t  idLength = ((frame->sidl >> IDE) & 1) ? 4 : 2;
+    uint8_t  length   = canGetLength(frame);
+    uint8_t  count    = 0;
+
+    if (device != logDevice) {
+        if (!logEvent(CAN_LOG_DEVICE | device, 0, 0)) {
+            return 0;
+        }
+        logDevice = device;
+    }
+
+    raw[count++] = (frame->dlc & ((1<<RTR) | DLC_MASK)) | ((width - 1) << 4);
+    for (uint8_t i = 0; i < width; i++) {
+        raw[count++] = (uint8_t)(delta >> (8 * i));
+    }
+    memcpy(raw + count, frame, idLength);
+    count += idLength;
+    memcpy(raw + count, frame->data, length);
+    count += length;
+
+    if (!encodeRecord(raw, count)) {
+        return 0;
+    }
+    logTime = timestamp;
+
+    return 1;
+}
+
+/******************************************************************************
+ * Moves frames from the receive ring of "device" to the log for as long as   *
+ * the fill buffer has room for one more, after a lost-frame record if the    *
+ * device dropped any since the last one. Counts that find no room either     *
+ * add up until there is. Returns the number of frames logged.                *
+ ******************************************************************************/
+uint8_t logPoll(uint8_t device) {
+    canOverflowCounters overflow;
+    uint32_t            lost;
+    uint8_t             logged = 0;
+
+    readOverflowCounters(device, &overflow, 1);
+    lost = (uint32_t)lostFrames[device] + overflow.rxOverflow[0] + overflow.rxOverflow[1] +
+           overflow.ringOverrun;
+    lostFrames[device] = (lost > 0xFFFF) ? 0xFFFF : lost;
+
+    if (lostFrames[device] && logRoom() >= LOG_DEVICE_MAX + 5) {
+        if (device != logDevice && logEvent(CAN_LOG_DEVICE | device, 0, 0)) {
+            logDevice = device;
+        }
+        if (device == logDevice && logEvent(CAN_LOG_LOST, lostFrames[device], 2)) {
+            lostFrames[device] = 0;
+        }
+    }
+
+    while (logRoom() >= LOG_DEVICE_MAX + LOG_FRAME_MAX) {
+        uint32_t timestamp;
+#if CAN_FRAME_POOL
+        uint8_t  slot;
+
+        // Encoded straight from the pool slot the INT handler read it into
+        if (!canReadSlot(device, &slot, &timestamp)) {
+            break;
+        }
+        logFrame(device, canSlotFrame(slot), timestamp);
+        canFreeSlot(slot);
+#else
+        canFrame frame;
+
+        if (!canReadTimestamped(device, &frame, &timestamp)) {
+            break;
+        }
+        logFrame(device, &frame, timestamp);
+#endif
+        logged++;
+    }
+
+    return logged;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _CANLOG_H_
+#define _CANLOG_H_
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/******************************************************************************
+ * Frame logger                                                               *
+ *                                                                            *
+ * logPoll(), called from the main loop, moves the frames of a device's       *
+ * receive ring (see canRead()) to the UART in a compact binary stream, with  *
+ * their receive timestamps, for a host to record at full bus load;           *
+ * tools/canlogdecode.py turns the stream into a candump log or a pcap file.  *
+ * The UART sends from two buffers of CAN_LOG_BUFFER bytes: its data register *
+ * empty interrupt drains one while logPoll() fills the other, and they       *
+ * change places once the first one is empty. logPoll() takes no frame off    *
+ * the ring unless a whole record fits in the fill buffer, so a host link     *
+ * that cannot keep up backs up into the ring, whose overruns are then        *
+ * counted, rather than into the INT handler.                                 *
+ *                                                                            *
+ * Every record is COBS-encoded and ends in a 0x00 byte, so a host that       *
+ * starts listening halfway picks up at the next record. Decoded, a frame     *
+ * record is                                                                  *
+ *                                                                            *
+ *   header     RTR in bit 6, delta width - 1 in bits 5-4, DLC in bits 3-0    *
+ *   delta      1 to 4 bytes, little-endian                                   *
+ *   SIDH SIDL  EID8 EID0 as well when SIDL has the IDE bit set               *
+ *   data       as many bytes as canGetLength() gives                         *
+ *                                                                            *
+ * with the identifier bytes as the receive buffer holds them. The delta is   *
+ * the frame's timestamp less that of the frame logged before it, in          *
+ * microseconds and modulo 2^32, using as few bytes as it fits into: a frame  *
+ * from another device's ring can be older than the one before it and comes   *
+ * out as a large delta that the host takes as negative. A header with bit 7  *
+ * set starts an event record instead:                                        *
+ *                                                                            *
+ *   0x80 + count    lost frames, 16-bit little-endian                        *
+ *   0x90 + device   the frames that follow are from "device"                 *
+ *                                                                            *
+ * The first are the frames both receive buffers and the ring had no room for *
+ * since the last count (see readOverflowCounters(), which is cleared). A     *
+ * device record comes before the first frame of every run of frames from one *
+ * device. logStart() sends a lone 0x00 to end whatever the host caught       *
+ * before it.                                                                 *
+ ******************************************************************************/
+#define CAN_LOG_LOST   0x80
+#define CAN_LOG_DEVICE 0x90
+
+/******************************************************************************
+ * Frame logger API                                                           *
+ ******************************************************************************/
+void    logStart(void);
+uint8_t logFrame(uint8_t device, const canFrame *frame, uint32_t timestamp);
+uint8_t logPoll(uint8_t device);
+
+
+#endif
@@ -0,0 +1,355 @@
+#include <avr/io.h>
+#include <util/atomic.h>
+#include <stdint.h>
+#include <string.h>
+#include "canmonitor.h"
+#include "canuart.h"
+#include "mcp2515registers.h"
+
+#if CAN_MONITOR_IDS
+
+#if !CAN_TIMESTAMPS
+#error "CAN_MONITOR_IDS needs CAN_TIMESTAMPS"
+#endif
+
+#ifndef F_CPU
+#error "CAN_MONITOR_IDS needs F_CPU"
+#endif
+
+#if CAN_UART_UBRR(CAN_MONITOR_BAUD) > 4095
+#error "CAN_MONITOR_BAUD is too slow for F_CPU"
+#endif
+
+#if !CAN_UART_FITS(CAN_MONITOR_BAUD)
+#error "CAN_MONITOR_BAUD cannot be reached within 2% from F_CPU"
+#endif
+
+#define MONITOR_OFF    0xFF
+#define MONITOR_EMPTY  0xFFFFFFFFUL
+#define MONITOR_FREED  0xFFFFFFFEUL
+#define MONITOR_PROBES ((CAN_MONITOR_IDS < 8) ? CAN_MONITOR_IDS : 8)
+
+/******************************************************************************
+ * One identifier in the table. "id" is its packed identifier (MONITOR_EMPTY, *
+ * or MONITOR_FREED once monitorPoll() has let it go; both have bits set that *
+ * a packed identifier never has), "last" the receive time of its latest      *
+ * frame. "frames" and the gap figures cover the current window; "gaps" is    *
+ * the number of gaps summed into "gapSum", one less than "frames" in the     *
+ * window the identifier first shows up in. The counters stop at their        *
+ * maximum instead of wrapping.                                               *
+ ******************************************************************************/
+typedef struct {
+    canPackedId id;
+    uint32_t    last;
+    uint32_t    gapMin;
+    uint32_t    gapMax;
+    uint32_t    gapSum;
+    uint16_t    frames;
+    uint16_t    gaps;
+} monitorEntry;
+
+/******************************************************************************
+ * Totals of the current window: the frames taken, their nominal length in    *
+ * bits and the stuff bits they could carry at most, and the frames of        *
+ * identifiers the table had no room for.                                     *
+ ******************************************************************************/
+typedef struct {
+    uint32_t frames;
+    uint32_t bits;
+    uint32_t stuffBits;
+    uint16_t untracked;
+} monitorWindow;
+
+static monitorEntry     monitorTable[CAN_MONITOR_IDS];
+static monitorWindow    window;
+static volatile uint8_t monitorDevice = MONITOR_OFF;
+static uint32_t         windowStart;
+static uint32_t         windowLength;
+
+// Starts the window of an entry over; "id" and "last" carry on
+static void clearEntry(monitorEntry *entry) {
+    entry->gapMin = 0xFFFFFFFFUL;
+    entry->gapMax = 0;
+    entry->gapSum = 0;
+    entry->frames = 0;
+    entry->gaps   = 0;
+
+    return;
+}
+
+/******************************************************************************
+ * Folds the four bytes of a packed identifier into a table index. The low    *
+ * byte of a standard identifier's SIDL only holds its three lowest bits at   *
+ * the top, so the high nibble is folded onto the low one as well.            *
+ ******************************************************************************/
+static uint8_t hashId(canPackedId id) {
+    uint8_t hash = (uint8_t)id ^ (uint8_t)(id >> 8) ^ (uint8_t)(id >> 16) ^ (uint8_t)(id >> 24);
+
+    return (hash ^ (hash >> 4)) & (CAN_MONITOR_IDS - 1);
+}
+
+/******************************************************************************
+ * Entry of packed identifier "id", or the free entry it is to take, looking  *
+ * at no more than MONITOR_PROBES entries from its hash on (linear probing),  *
+ * so a full table costs the INT handler a bounded search. A freed entry is   *
+ * probed past, since the identifier may sit further on, but is the one taken *
+ * if the identifier does not turn up; an empty one ends the search. Returns  *
+ * 0 if neither turned up.                                                    *
+ ******************************************************************************/
+static monitorEntry *findEntry(canPackedId id) {
+    uint8_t       index = hashId(id);
+    monitorEntry *freed = 0;
+
+    for (uint8_t probe = 0; probe < MONITOR_PROBES; probe++) {
+        monitorEntry *entry = &monitorTable[index];
+
+        if (entry->id == id) {
+            return entry;
+        }
+        if (entry->id == MONITOR_EMPTY) {
+            return freed ? freed : entry;
+        }
+        if (entry->id == MONITOR_FREED && !freed) {
+            freed = entry;
+        }
+        index = (index + 1) & (CAN_MONITOR_IDS - 1);
+    }
+
+    return freed;
+}
+
+/******************************************************************************
+ * Called by the INT handler of "device" for every frame it takes off the     *
+ * device. Returns 0 unless "device" is the monitored one; its frames are     *
+ * counted and consumed (1), with the receive timestamp dispatchFrame() has   *
+ * just taken.                                                                *
+ *                                                                            *
+ * A data frame with n data bytes is 47 + 8n bits long on the bus with a      *
+ * standard identifier and 67 + 8n with an extended one, counting the 3-bit   *
+ * intermission. Stuff bits can only appear from the start of frame to the    *
+ * end of the CRC, 34 + 8n bits (54 + 8n), and at most one after the first    *
+ * five and after every four more.                                            *
+ ******************************************************************************/
+uint8_t monitorReceived(uint8_t device, const canFrame *frame) {
+    if (device != monitorDevice) {
+        return 0;
+    }
+
+    uint32_t      now      = canHandlerTimestamp(device);
+    uint8_t       extended = (frame->sidl >> IDE) & 1;
+    uint8_t       stuffed  = (extended ? 54 : 34) + 8 * canGetLength(frame);
+    canPackedId   id       = canFramePackedId(frame);
+    monitorEntry *entry    = findEntry(id);
+
+    window.frames++;
+    window.bits      += stuffed + 13;
+    window.stuffBits += (stuffed - 1) >> 2;
+
+    if (!entry) {
+        if (window.untracked != 0xFFFF) {
+            window.untracked++;
+        }
+        return 1;
+    }
+
+    if (entry->id == id) {
+        uint32_t gap = now - entry->last;
+
+        if (gap < entry->gapMin) {
+            entry->gapMin = gap;
+        }
+        if (gap > entry->gapMax) {
+            entry->gapMax = gap;
+        }
+        if (entry->gaps != 0xFFFF) {
+            entry->gapSum += gap;
+            entry->gaps++;
+        }
+    } else {
+        entry->id = id;
+    }
+
+    entry->last = now;
+    if (entry->frames != 0xFFFF) {
+        entry->frames++;
+    }
+
+    return 1;
+}
+
+/******************************************************************************
+ * Turns "device" into the bus monitor, with a snapshot every "period"        *
+ * milliseconds (at least 1); the UART is set up for it. The acceptance       *
+ * filters should let every frame through (setAcceptanceFilters(device, 0,    *
+ * 0)) for the statistics to cover the whole bus. Returns 0 if the device did *
+ * not change into Listen-only mode (see setMode()).                          *
+ ******************************************************************************/
+uint8_t monitorStart(uint8_t device, uint16_t period) {
+    monitorDevice = MONITOR_OFF;
+
+    for (uint8_t index = 0; index < CAN_MONITOR_IDS; index++) {
+        monitorTable[index].id = MONITOR_EMPTY;
+        clearEntry(&monitorTable[index]);
+    }
+
+    uartInit(CAN_UART_UBRR(CAN_MONITOR_BAUD));
+
+    if (!setMode(device, MODE_LISTEN)) {
+        return 0;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memset(&window, 0, sizeof(window));
+        windowStart   = canTimestamp();
+        windowLength  = (period ? period : 1) * 1000UL;
+        monitorDevice = device;
+    }
+
+    return 1;
+}
+
+// Sends one byte as soon as the transmit register is free
+static void uartPut(uint8_t data) {
+    while (!(UCSR0A & (1<<UDRE0))) {;}
+    UART_PUT(data);
+
+    return;
+}
+
+static void printDecimal(uint32_t value) {
+    char    digits[10];
+    uint8_t count = 0;
+
+    do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    while (count) {
+        uartPut(digits[--count]);
+    }
+
+    return;
+}
+
+static void printHex(uint32_t value, uint8_t digits) {
+    while (digits--) {
+        uint8_t nibble = (value >> (4 * digits)) & 0x0F;
+
+        uartPut(nibble < 10 ? '0' + nibble : 'A' - 10 + nibble);
+    }
+
+    return;
+}
+
+// Share of "bits" in what the bus could have carried in "elapsed" microseconds, as a percentage
+static void printLoad(uint32_t bits, uint32_t elapsed) {
+    uint32_t permille = (uint32_t)((uint64_t)bits * 1000000000ULL / ((uint64_t)CAN_BITRATE * elapsed));
+
+    uartPut(' ');
+    printDecimal(permille / 10);
+    uartPut('.');
+    uartPut('0' + permille % 10);
+
+    return;
+}
+
+static void printField(uint32_t value) {
+    uartPut(' ');
+    printDecimal(value);
+
+    return;
+}
+
+/******************************************************************************
+ * Writes a snapshot once the window has run for its period and starts the    *
+ * next one; returns 1 if it did. The window totals change over in one step;  *
+ * each identifier's figures are then taken and started over one entry at a   *
+ * time, so a frame that arrives while the snapshot is being written counts   *
+ * in the next window, whichever entry it belongs to. An identifier with no   *
+ * frames in the window just written gives its entry up to the next new one.  *
+ * The UART is polled while the snapshot goes out, and the INT handler        *
+ * carries on counting meanwhile.                                             *
+ ******************************************************************************/
+uint8_t monitorPoll(void) {
+    uint8_t device = monitorDevice;
+
+    if (device == MONITOR_OFF || (uint32_t)(canTimestamp() - windowStart) < windowLength) {
+        return 0;
+    }
+
+    monitorWindow taken;
+    uint32_t      elapsed;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        uint32_t now = canTimestamp();
+
+        taken       = window;
+        elapsed     = now - windowStart;
+        windowStart = now;
+        memset(&window, 0, sizeof(window));
+    }
+
+    canOverflowCounters overflow;
+
+    readOverflowCounters(device, &overflow, 1);
+
+    uartPut('S');
+    printField(elapsed / 1000);
+    printField(taken.frames);
+    printLoad(taken.bits, elapsed);
+    printLoad(taken.bits + taken.stuffBits, elapsed);
+    printField(taken.untracked);
+    printField((uint32_t)overflow.rxOverflow[0] + overflow.rxOverflow[1]);
+    uartPut('\n');
+
+    for (uint8_t index = 0; index < CAN_MONITOR_IDS; index++) {
+        monitorEntry entry;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            entry = monitorTable[index];
+            clearEntry(&monitorTable[index]);
+            if (!entry.frames && entry.id != MONITOR_EMPTY) {
+                monitorTable[index].id = MONITOR_FREED;
+            }
+        }
+
+        if (!entry.frames) {
+            continue;
+        }
+
+        canFrame frame;
+        uint32_t id;
+
+        // Back from the packed layout through a frame with no RTR bit
+        memcpy(&frame, &entry.id, sizeof(entry.id));
+        frame.dlc = 0;
+        id        = canGetId(&frame);
+
+        uartPut('I');
+        uartPut(' ');
+        if (id & CAN_EXTENDED_FLAG) {
+            printHex(id & CAN_EXTENDED_MASK, 8);
+        } else {
+            printHex(id, 3);
+        }
+        printField(entry.frames);
+        if (entry.gaps) {
+            printField(entry.gapMin);
+            printField(entry.gapSum / entry.gaps);
+            printField(entry.gapMax);
+        } else {
+            uartPut(' ');
+            uartPut('-');
+            uartPut(' ');
+            uartPut('-');
+            uartPut(' ');
+            uartPut('-');
+        }
+        uartPut('\n');
+    }
+
+    return 1;
+}
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _CANMONITOR_H_
+#define _CANMONITOR_H_
+
+#include <stdint.h>
+#include "mcp2515.h"
+
+/******************************************************************************
+ * Bus monitor                                                                *
+ *                                                                            *
+ * monitorStart() puts one device into Listen-only mode and makes a bus       *
+ * analyser of it. Its INT handler takes every frame off the device, counts   *
+ * it against its identifier in an open-addressing hash table of              *
+ * CAN_MONITOR_IDS entries and times the gap since the identifier's previous  *
+ * frame from the receive timestamps; the frames themselves are not           *
+ * delivered. Each frame also adds its length in bits to the bus load, worked *
+ * out from its DLC alone: once nominally and once with the most stuff bits a *
+ * frame of that length can carry, so the real load lies between the two      *
+ * figures.                                                                   *
+ *                                                                            *
+ * monitorPoll(), called from the main loop, writes a snapshot to the UART    *
+ * every "period" milliseconds and starts the next window with it: one line   *
+ * for the window and one for each identifier seen in it.                     *
+ *                                                                            *
+ *   S <window ms> <frames> <load %> <worst-case load %> <untracked> <lost>   *
+ *   I <identifier> <frames> <min gap us> <avg gap us> <max gap us>           *
+ *                                                                            *
+ * Identifiers are in hex, with 3 digits for a standard and 8 for an extended *
+ * one. The gaps include the one from the identifier's last frame in the      *
+ * previous window, and are "-" when its first frame is the only one in the   *
+ * window. An identifier gives its table entry up after a window without      *
+ * frames, so a bus whose identifiers change over time keeps finding room for *
+ * them; the first frame after such a window starts without a gap again.      *
+ * "untracked" counts the frames of identifiers that found no room in the     *
+ * table, "lost" the frames the MCP2515 dropped because both receive buffers  *
+ * were full (taken from readOverflowCounters(), which starts over with every *
+ * snapshot).                                                                 *
+ ******************************************************************************/
+
+/******************************************************************************
+ * Bus monitor API                                                            *
+ ******************************************************************************/
+uint8_t monitorStart(uint8_t device, uint16_t period);
+uint8_t monitorPoll(void);
+
+// Called by the INT handler (mcp2515.c)
+uint8_t monitorReceived(uint8_t device, const canFrame *frame);
+
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _CANUART_H_
+#define _CANUART_H_
+
+#include <avr/io.h>
+#include <stdint.h>
+#include "mcp2515config.h"
+
+/******************************************************************************
+ * UART0 of the ATmega328, shared by the bus monitor (canmonitor.c) and the   *
+ * frame logger (canlog.c), so only one of them can be built in. Every byte   *
+ * sent goes through UART_PUT(), which the host simulation (sim/) defines to  *
+ * watch the transmitter.                                                     *
+ *                                                                            *
+ * CAN_UART_UBRR() is the baud rate divider for "baud" at double speed (F_CPU *
+ * / 8 per count), rounded to the nearest count, and CAN_UART_FITS() tells    *
+ * whether the rate it gives is within 2% of "baud", as 8N1 needs. Both are   *
+ * for the preprocessor.                                                      *
+ ******************************************************************************/
+#ifndef UART_PUT
+#define UART_PUT(data) (UDR0 = (data))
+#endif
+
+#define CAN_UART_UBRR(baud)   ((F_CPU + 4UL * (baud)) / (8UL * (baud)) - 1)
+#define CAN_UART_ACTUAL(baud) (F_CPU / (8UL * (CAN_UART_UBRR(baud) + 1)))
+#define CAN_UART_FITS(baud)   ((CAN_UART_ACTUAL(baud) > (baud) ? CAN_UART_ACTUAL(baud) - (baud) : \
+                                                                (baud) - CAN_UART_ACTUAL(baud)) * 50 <= (baud))
+
+// Sets the transmitter up for 8 data bits, no parity and 1 stop bit at double speed
+static inline void uartInit(uint16_t ubrr) {
+    UBRR0  = ubrr;
+    UCSR0A = (1<<U2X0);
+    UCSR0B = (1<<TXEN0);
+    UCSR0C = (1<<UCSZ01) | (1<<UCSZ00);
+}
+
+
+#endif
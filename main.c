@@ -0,0 +1,27 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include "mcp2515.h"
+
+/******************************************************************************
+ * Example application, linked against libmcp2515.a by the default target.    *
+ * Every frame device 0 receives is sent back through the transmit queue. It  *
+ * keeps the receive and transmit paths alive through --gc-sections, so the   *
+ * "size" and "cycles" reports measure what an application really links.      *
+ ******************************************************************************/
+int main() {
+    canFrame frame;
+
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    sei();
+
+    for (;;) {
+        if (canRead(0, &frame)) {
+            canWrite(0, &frame, CAN_PRIORITY_LOW);
+        }
+    }
+
+    return 0;
+}
@@ -1,26 +1,354 @@
-#include <avr/io.h>
-#include <util/delay.h>
 #include <stdint.h>
+#include <string.h>
 #include "mcp2515.h"
-
-#define CHIP_SELECT   2
-#define INTERRUPT_LOW 2
-#define SERIAL_CLK    5
-#define MOSI          4
-#define MISO          3
+#include "mcp2515registers.h"
+#include "mcp2515timing.h"
+#include "mcp2515hal.h"
+#include "mcp2515prof.h"
+#if CAN_GATEWAY
+#include "cangateway.h"
+#endif
+#if CAN_ISOTP_CHANNELS
+#include "canisotp.h"
+#endif
+#if CAN_MONITOR_IDS
+#include "canmonitor.h"
+#endif
 
 #define FILLER 0xFF
 
+// Layers that see every received frame before it is delivered (offerFrame())
+#define FRAME_HOOKS (CAN_GATEWAY || CAN_ISOTP_CHANNELS || CAN_MONITOR_IDS)
+
+#define COMPILER_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/******************************************************************************
+ * Asynchronous SPI engine state. "spiCurrent" is the transaction being       *
+ * clocked out by the SPI Transfer Complete interrupt (NULL while the engine  *
+ * is idle), "spiLast" is the tail of the queue behind it, and "spiPosition"  *
+ * counts the bytes of "spiCurrent" already sent.                             *
+ ******************************************************************************/
+static spiTransaction * volatile spiCurrent;
+static spiTransaction *spiLast;
+static uint8_t spiPosition;
+
+// Bus scheduler state, see serviceBus()
+static uint8_t busQueue[MCP2515_DEVICE_COUNT];
+static uint8_t busLength;
+static uint8_t busWaiting;
+
+/******************************************************************************
+ * Driver state shared with the interrupt handlers is changed inside          *
+ * CRITICAL_BLOCK, which runs its body with interrupts disabled and puts them *
+ * back as they were (irqDisable() and irqRestore() of the backend). The body *
+ * must not leave the block with return or break.                             *
+ ******************************************************************************/
+#define CRITICAL_BLOCK for (mcp2515IrqState irq_ = irqDisable(), once_ = 1; once_; irqRestore(irq_), once_ = 0)
+
+/******************************************************************************
+ * Synchronous transactions (sendData() and everything built on it) and the   *
+ * asynchronous engine share one SPI port. spiBegin() waits, with the         *
+ * caller's interrupt state untouched so the SPI interrupt can finish its     *
+ * work, until the engine is idle, and returns with interrupts disabled. The  *
+ * SPI_BLOCK statement wraps a transaction between spiBegin() and restoring   *
+ * the interrupt state, in the same way as CRITICAL_BLOCK.                    *
+ *                                                                            *
+ * Calling it with interrupts disabled while an asynchronous transaction is   *
+ * still in flight would wait forever, so don't.                              *
+ ******************************************************************************/
+static mcp2515IrqState spiBegin(void) {
+    for (;;) {
+        // The SPI interrupt stays on exactly while the engine has a transaction
+        while (spiInterruptArmed()) {;}
+
+        mcp2515IrqState state = irqDisable();
+
+        if (!spiCurrent) {
+            return state;
+        }
+        irqRestore(state);
+    }
+}
+
+#define SPI_BLOCK for (mcp2515IrqState irq_ = spiBegin(), once_ = 1; once_; irqRestore(irq_), once_ = 0)
+
+/******************************************************************************
+ * Per-controller state, one entry per MCP2515 on the bus, indexed by device  *
+ * number.                                                                    *
+ *                                                                            *
+ * "rxRing" is the receive ring buffer. The INT handler is the only writer of *
+ * "rxHead" and canRead() is the only writer of "rxTail", so neither side     *
+ * ever has to lock the other out. Both indices run freely and are only       *
+ * masked when a slot is accessed; their difference is the number of frames   *
+ * waiting to be read.                                                        *
+ *                                                                            *
+ * "txSlots", "txPriority", "txOrder" and "txCount" make up the transmit      *
+ * queue, and "txActive" tracks the transmit buffers in flight (see           *
+ * canWrite() and serviceController() below). "filterHandlers" holds the      *
+ * receive handlers installed with setFilterHandler(), and "overflow" the lost *
+ * frame counters.                                                            *
+ *                                                                            *
+ * With CAN_FRAME_POOL, "rxRing" and "txSlots" hold the numbers of the pool   *
+ * slots the frames are in instead of the frames (see ringSlot() and          *
+ * QUEUED_FRAME()).                                                           *
+ *                                                                            *
+ * With CAN_TIMESTAMPS, "rxTime" holds the timestamp of each ring buffer      *
+ * slot, and "edgeTime" is the time the INT line was last seen to fall,       *
+ * valid while "edgePending" is set. With MCP2515_PROFILE, "profileEdge" is   *
+ * the Timer1 count when the INT line was last seen to fall, valid while      *
+ * "profileEdgePending" is set.                                               *
+ *                                                                            *
+ * With CAN_ERROR_MONITOR, "errors" holds the error counters, and with        *
+ * CAN_BUSOFF_RESTARTS "busOffStreak" counts the bus-offs since the driver    *
+ * last got a frame onto the bus, and "restartMode" is the mode a restart out *
+ * of bus-off goes back to, with RESTART_PENDING set while it is under way.   *
+ ******************************************************************************/
+typedef struct {
+#if CAN_FRAME_POOL
+    uint8_t          rxRing[CAN_RX_BUFFER_SIZE];
+#else
+    canFrame         rxRing[CAN_RX_BUFFER_SIZE];
+#endif
+    volatile uint8_t rxHead;
+    volatile uint8_t rxTail;
+#if CAN_FRAME_POOL
+    uint8_t          txSlots[CAN_TX_QUEUE_SIZE];
+#else
+    canFrame         txSlots[CAN_TX_QUEUE_SIZE];
+#endif
+    uint8_t          txPriority[CAN_TX_QUEUE_SIZE];
+    uint8_t          txOrder[CAN_TX_QUEUE_SIZE];
+    uint8_t          txCount;
+    volatile uint8_t txActive;
+    canFilterHandler filterHandlers[8];
+    canOverflowCounters overflow;
+#if CAN_TIMESTAMPS
+    uint32_t         rxTime[CAN_RX_BUFFER_SIZE];
+    uint32_t         edgeTime;
+    uint8_t          edgePending;
+#endif
+#if MCP2515_PROFILE
+    uint16_t         profileEdge;
+    uint8_t          profileEdgePending;
+#endif
+#if CAN_ERROR_MONITOR
+    canErrorCounters errors;
+#endif
+#if CAN_BUSOFF_RESTARTS
+    uint8_t          busOffStreak;
+    uint8_t          restartMode;
+#endif
+#if CAN_SLEEP
+    uint8_t          wakeMode;
+    volatile uint8_t asleep;
+#endif
+} controllerState;
+
+static controllerState controllers[MCP2515_DEVICE_COUNT];
+
+#if CAN_FRAME_POOL
+/******************************************************************************
+ * Shared frame pool (CAN_FRAME_POOL). "poolFree" is a stack of slot numbers: *
+ * the entries from position "poolUsed" up are the free slots, one for every  *
+ * slot the pool has left. Every entry holds its slot number XORed with its   *
+ * own position, so the all-zero array the C startup code leaves behind       *
+ * already lists every slot as free and nothing has to fill it in first. A    *
+ * slot is taken or given back in a handful of instructions with interrupts   *
+ * disabled, from the INT handler and the main context alike; the AVR has no  *
+ * atomic read-modify-write to do it without. "poolTaken" has one bit per     *
+ * slot, set while the slot is out of the pool, so a slot that is given back  *
+ * twice is caught before it can go on the stack a second time.               *
+ ******************************************************************************/
+static canFrame canFramePool[CAN_FRAME_POOL];
+static uint8_t  poolFree[CAN_FRAME_POOL];
+static uint8_t  poolTaken[(CAN_FRAME_POOL + 7) / 8];
+static uint8_t  poolUsed;
+
+#define QUEUED_FRAME(controller, slot) (&canFramePool[(controller)->txSlots[slot]])
+
+// Pool slot taken and given back with interrupts already disabled, as in the INT handler
+static uint8_t takeSlot(void) {
+    uint8_t slot;
+
+    if (poolUsed == CAN_FRAME_POOL) {
+        return CAN_NO_SLOT;
+    }
+    slot = poolFree[poolUsed] ^ poolUsed;
+    poolUsed++;
+    poolTaken[slot >> 3] |= 1 << (slot & 7);
+
+    return slot;
+}
+
+// Returns 0, and leaves the pool as it was, for a slot that is not taken
+static uint8_t returnSlot(uint8_t slot) {
+    if (!(poolTaken[slot >> 3] & (1 << (slot & 7)))) {
+        return 0;
+    }
+    poolTaken[slot >> 3] &= ~(1 << (slot & 7));
+    poolUsed--;
+    poolFree[poolUsed] = slot ^ poolUsed;
+
+    return 1;
+}
+
+/******************************************************************************
+ * Takes a slot out of the frame pool and returns its number, or CAN_NO_SLOT  *
+ * if every slot is in use. The frame in it (canSlotFrame()) is left as the   *
+ * previous owner had it.                                                     *
+ ******************************************************************************/
+uint8_t canAllocSlot(void) {
+    uint8_t slot;
+
+    CRITICAL_BLOCK {
+        slot = takeSlot();
+    }
+
+    return slot;
+}
+
+/******************************************************************************
+ * Gives a slot taken with canAllocSlot() or canReadSlot() back to the pool.  *
+ * Returns 0, and leaves the pool as it was, for a slot number past the end   *
+ * of the pool or a slot that is not taken (already freed, or queued with     *
+ * canWriteSlot() and since sent), so a stray or second call can neither      *
+ * overrun the free list nor hand one slot out twice.                         *
+ ******************************************************************************/
+uint8_t canFreeSlot(uint8_t slot) {
+    uint8_t freed = 0;
+
+    CRITICAL_BLOCK {
+        if (slot < CAN_FRAME_POOL) {
+            freed = returnSlot(slot);
+        }
+    }
+
+    return freed;
+}
+
+// The frame in pool slot "slot"
+canFrame *canSlotFrame(uint8_t slot) {
+    return &canFramePool[slot];
+}
+#else
+#define QUEUED_FRAME(controller, slot) (&(controller)->txSlots[slot])
+#endif
+
+#if CAN_TIMESTAMPS
+/******************************************************************************
+ * Timestamp clock. Timer1 counts F_CPU/8 and "timerHigh" adds                *
+ * CAN_TIMER_OVERFLOW_US microseconds on every overflow, so the time is       *
+ * "timerHigh" plus the shifted count. timerStamp() takes a count read with   *
+ * interrupts disabled and makes up for an overflow that is still pending: a  *
+ * small count with TOV1 set was read after the wrap the overflow interrupt   *
+ * has not accounted for yet.                                                 *
+ ******************************************************************************/
+static volatile uint32_t timerHigh;
+
+MCP2515_TIMER_ISR {
+    PROF_ISR_BEGIN();
+
+    timerHigh += CAN_TIMER_OVERFLOW_US;
+
+    PROF_ISR_END();
+}
+
+static uint32_t timerStamp(uint16_t count) {
+    uint32_t high = timerHigh;
+
+    if (timerOverflowPending() && count < 0x8000) {
+        high += CAN_TIMER_OVERFLOW_US;
+    }
+
+    return high + (count >> CAN_TIMER_SHIFT);
+}
+
+/******************************************************************************
+ * Returns the current time in microseconds. It wraps around after about 71   *
+ * minutes, so compare timestamps by subtracting them.                        *
+ ******************************************************************************/
+uint32_t canTimestamp(void) {
+    uint32_t now;
+
+    CRITICAL_BLOCK {
+        now = timerStamp(timerCount());
+    }
+
+    return now;
+}
+
+/******************************************************************************
+ * Records when the INT line of "device" fell, unless an earlier edge is      *
+ * still waiting to be used. Called from the INT handlers with interrupts     *
+ * disabled. For the device wired to ICP1 the time comes from the input       *
+ * capture: its age is worked out against the running count, which stays      *
+ * correct across an overflow.                                                *
+ ******************************************************************************/
+static void stampEdge(uint8_t device) {
+    controllerState *controller = &controllers[device];
+
+    if (controller->edgePending) {
+#ifdef CAN_TIMESTAMP_CAPTURE_DEVICE
+        if (device == CAN_TIMESTAMP_CAPTURE_DEVICE) {
+            timerCaptureClear();
+        }
+#endif
+        return;
+    }
+
+    uint16_t count = timerCount();
+    uint32_t now   = timerStamp(count);
+
+#ifdef CAN_TIMESTAMP_CAPTURE_DEVICE
+    if (device == CAN_TIMESTAMP_CAPTURE_DEVICE && timerCapturePending()) {
+        now -= (uint16_t)(count - timerCapture()) >> CAN_TIMER_SHIFT;
+        timerCaptureClear();
+    }
+#endif
+
+    controller->edgeTime    = now;
+    controller->edgePending = 1;
+
+    return;
+}
+
+/******************************************************************************
+ * Time to stamp the next frame taken from "device" with: the INT edge that   *
+ * announced it if that has not been used yet, otherwise (a frame that        *
+ * arrived while INT was still LOW) the current time.                         *
+ ******************************************************************************/
+static uint32_t receiveTime(uint8_t device) {
+    controllerState *controller = &controllers[device];
+
+    if (controller->edgePending) {
+        controller->edgePending = 0;
+    } else {
+        controller->edgeTime = timerStamp(timerCount());
+    }
+
+    return controller->edgeTime;
+}
+
+/******************************************************************************
+ * Timestamp of the frame a filter handler of "device" has just been given,   *
+ * for handlers that want it.                                                 *
+ ******************************************************************************/
+uint32_t canHandlerTimestamp(uint8_t device) {
+    return controllers[device].edgeTime;
+}
+#endif
+
 /****************************************************************************** 
  * When the MCP2515 receives a valid CAN message, it generates an interrupt   *
- * on the INT pin (which is an active LOW.) The MCP2515 INT pin is the D2 pin *
- * on the Arduino, so to check the state of the D2 pin on the PIN register,   *
- * we shift 0x1 two bits to the left. Again, since INT is an active LOW, if   *
- * D2 is LOW, that signals that the interrupt has been generated and that     *
- * there is a valid CAN message to be read.                                   *
+ * on the INT pin (which is an active LOW.) The INT pin of device 0 is the D2 *
+ * pin on the Arduino, so to check the state of the D2 pin on the PIN         *
+ * register, we shift 0x1 two bits to the left (interruptBit() looks the pin  *
+ * up for the other devices at compile time.) Again, since INT is an active   *
+ * LOW, if the pin is LOW, that signals that the interrupt has been generated *
+ * and that there is a valid CAN message to be read.                          *
  ******************************************************************************/
-uint8_t messageReceived(void) {
-    return!(PIND & (1<<INTERRUPT_LOW));
+uint8_t messageReceived(uint8_t device) {
+    return interruptPinLow(device);
 }
 
 /******************************************************************************
@@ -32,13 +360,13 @@ uint8_t messageReceived(void) {
  * into the Master's register. In summary, on each clock pulse, a bit is      *
  * exchanged in each direction between the Master and the Slave. We then wait *
  * until the SPIF bit is set in the SPSR register (SPI Status Register) to    *
- * indicate that the 8-bit transfer of data is complete.                      *
+ * indicate that the 8-bit transfer of data is complete. spiTransfer() of the *
+ * ATmega328 backend does this (see mcp2515hal.h).                            *
  ******************************************************************************/
 uint8_t sendData(uint8_t data) {
-    SPDR = data;
-    while (!(SPSR & (1<<SPIF))) {;}
+    PROF_COUNT(spiBytes);
 
-    return SPDR;
+    return spiTransfer(data);
 }
 
 /******************************************************************************
@@ -47,15 +375,23 @@ uint8_t sendData(uint8_t data) {
  * memory address to read from. Next, send the data that you want to write to *
  * the specified memory address. Lastly, set the "Chip Select" pin HIGH,      *
  * disabling the Slave.                                                       *
+ *                                                                            *
+ * Every transaction runs inside an SPI_BLOCK (see below): it waits for the   *
+ * asynchronous SPI engine to go idle and then keeps interrupts disabled. The *
+ * INT handlers talk to the MCP2515s as well, and they must never pull a     *
+ * "Chip Select" LOW in the middle of a transaction started from the main     *
+ * loop.                                                                      *
  ******************************************************************************/
-void writeToRegister(uint8_t address, uint8_t data) {
-    PORTB &= ~(1<<CHIP_SELECT);
+void writeToRegister(uint8_t device, uint8_t address, uint8_t data) {
+    SPI_BLOCK {
+        chipSelect(device);
 
-    sendData(SPI_WRITE);
-    sendData(address);
-    sendData(data);
+        sendData(SPI_WRITE);
+        sendData(address);
+        sendData(data);
 
-    PORTB |= (1<<CHIP_SELECT);
+        chipDeselect(device);
+    }
 
     return;
 }
@@ -67,19 +403,66 @@ void writeToRegister(uint8_t address, uint8_t data) {
  * the return data from the SPDR should be the data read from the memory      *
  * address. Lastly, set the "Chip Select" pin HIGH, disabling the Slave.      *
  ******************************************************************************/
-uint8_t readRegister(uint8_t address) {
-    PORTB &= ~(1<<CHIP_SELECT);
+uint8_t readRegister(uint8_t device, uint8_t address) {
+    uint8_t data;
 
-    sendData(SPI_READ);
-    sendData(address);
+    SPI_BLOCK {
+        chipSelect(device);
 
-    uint8_t data = sendData(FILLER);
+        sendData(SPI_READ);
+        sendData(address);
 
-    PORTB |= (1<<CHIP_SELECT);
+        data = sendData(FILLER);
+
+        chipDeselect(device);
+    }
 
     return data;
 }
 
+/******************************************************************************
+ * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
+ * to the Master. Next, send the "SPI_WRITE" instruction. Next, send the      *
+ * memory address of the first register to write to. Next, send the "length"  *
+ * bytes of "data"; the MCP2515 advances its address pointer after every      *
+ * byte, so they land in consecutive registers. Lastly, set the "Chip Select" *
+ * pin HIGH, disabling the Slave.                                             *
+ ******************************************************************************/
+void writeRegisters(uint8_t device, uint8_t address, const uint8_t *data, uint8_t length) {
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_WRITE);
+        sendData(address);
+        spiBurst(data, 0, length);
+
+        chipDeselect(device);
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
+ * to the Master. Next, send the "SPI_READ" instruction. Next, send the       *
+ * memory address of the first register to read from. Next, send "length"     *
+ * filler bytes; each one clocks the next consecutive register back into      *
+ * "data". Lastly, set the "Chip Select" pin HIGH, disabling the Slave.       *
+ ******************************************************************************/
+void readRegisters(uint8_t device, uint8_t address, uint8_t *data, uint8_t length) {
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_READ);
+        sendData(address);
+        spiBurst(0, data, length);
+
+        chipDeselect(device);
+    }
+
+    return;
+}
+
 /******************************************************************************
  * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
  * to the Master. Next, send the "SPI_BIT_MODIFY" instruction. Next, send the *
@@ -98,16 +481,17 @@ uint8_t readRegister(uint8_t address) {
  *   -------------------------                                                *
  * NEW VALUE: 0 0 1 0 0 0 0 1                                                 *
  ******************************************************************************/
-void bitModify(uint8_t address, uint8_t mask, uint8_t data) {
-    PORTB &= ~(1<<CHIP_SELECT);
+void bitModify(uint8_t device, uint8_t address, uint8_t mask, uint8_t data) {
+    SPI_BLOCK {
+        chipSelect(device);
 
-    sendData(SPI_BIT_MODIFY);
-    sendData(address);
-    sendData(mask);
-    sendData(data);  
-                    
+        sendData(SPI_BIT_MODIFY);
+        sendData(address);
+        sendData(mask);
+        sendData(data);
 
-    PORTB |= (1<<CHIP_SELECT);
+        chipDeselect(device);
+    }
 
     return;
 }
@@ -120,13 +504,17 @@ void bitModify(uint8_t address, uint8_t mask, uint8_t data) {
  * to the SPDR will be the data returned from the instruction sent earlier.   *
  * Lastly, set the "Chip Select" pin HIGH, disabling the Slave.               *
  ******************************************************************************/
-uint8_t readStatus(uint8_t readType) {
-    PORTB &= ~(1<<CHIP_SELECT);
+uint8_t readStatus(uint8_t device, uint8_t readType) {
+    uint8_t data;
+
+    SPI_BLOCK {
+        chipSelect(device);
 
-    sendData(readType);
-    uint8_t data = sendData(FILLER);
+        sendData(readType);
+        data = sendData(FILLER);
 
-    PORTB |= (1<<CHIP_SELECT);
+        chipDeselect(device);
+    }
 
     return data;
 }
@@ -138,66 +526,1786 @@ uint8_t readStatus(uint8_t readType) {
  * registers are in their default state prior to configuration and operations.*
  * Performing a Reset also puts the chip into Configuration Mode.             *
  ******************************************************************************/
-void resetController(void) {
-    PORTB &= ~(1<<CHIP_SELECT);
+void resetController(uint8_t device) {
+    SPI_BLOCK {
+        chipSelect(device);
 
-    sendData(SPI_RESET);
+        sendData(SPI_RESET);
 
-    PORTB |=  (1<<CHIP_SELECT);
+        chipDeselect(device);
+    }
 
     return;
 }
 
 /******************************************************************************
+ * Waits for CANSTAT of "device" to show operation mode "mode" (see           *
+ * CAN_MODE_TIMEOUT_US). Returns 1 once it does and 0 if it never did.        *
  ******************************************************************************/
-uint8_t initController(void) {
-    // Pull "Chip Select" pin HIGH (disabling Slave)
-    // Configure "Chip Select" pin as an OUTPUT
-    PORTB |= (1<<CHIP_SELECT);
-    DDRB  |= (1<<CHIP_SELECT);
-
-    // Pull "Serial Clock" pin LOW 
-    // Pull "MOSI" (Master Out Slave In) pin LOW 
-    // Pull "MISO" (Master In Slave Out) pin LOW
-    PORTB &= ~((1<<SERIAL_CLK) | (1<<MOSI) | (1<<MISO));
-    
-    // Configure "Serial Clock" pin as an OUTPUT
-    // Configure "MOSI" pin as an OUTPUT
-    // Configure "MISO" pin as in INPUT
-    DDRB  |= ((1<<SERIAL_CLK) | (1<<MOSI));
-    DDRB  &= ~(1<<MISO);
+static uint8_t waitForMode(uint8_t device, uint8_t mode) {
+    for (uint16_t waited = 0; ; waited += CAN_MODE_POLL_US) {
+        if ((readRegister(device, CANSTAT) & OPMOD_MASK) == mode) {
+            return 1;
+        }
+        if (waited >= CAN_MODE_TIMEOUT_US) {
+            return 0;
+        }
+        delayUs(CAN_MODE_POLL_US);
+    }
+}
 
-    // Configure "Interrupt" pin as an INPUT
-    // Configure "Interrupt" pin HIGH
-    DDRD  &= ~(1<<INTERRUPT_LOW);
-    PORTD |=  (1<<INTERRUPT_LOW);
+/******************************************************************************
+ * Requests operation mode "mode" of "device": MODE_NORMAL, MODE_SLEEP,       *
+ * MODE_LOOPBACK, MODE_LISTEN or MODE_CONFIG (mcp2515registers.h).            *
+ * initController() leaves a device in Configuration mode, the only one in    *
+ * which the bit timing, filters and masks can be written, so                 *
+ * setAcceptanceFilters() comes first and setMode(device, MODE_NORMAL) last.  *
+ *                                                                            *
+ * Listen-only mode receives every valid frame without ever acknowledging one *
+ * or sending anything, so a device can sniff a fully loaded bus without      *
+ * touching it. Loopback mode sends the transmit buffers straight into the    *
+ * device's own receive buffers, which runs the whole transmit queue, SPI and *
+ * INT handler path without a bus.                                            *
+ *                                                                            *
+ * CANSTAT and CANCTRL are neighbours, so one READ tells whether the device   *
+ * is already in the mode asked for, and that is all such a request costs.    *
+ * Returns 1 once CANSTAT shows the new mode and 0 if it did not within       *
+ * CAN_MODE_TIMEOUT_US (the request stays in place, so the change may still   *
+ * happen later).                                                             *
+ ******************************************************************************/
+uint8_t setMode(uint8_t device, uint8_t mode) {
+    uint8_t regs[2];
 
-    // Enable SPI
-    // Data order: MSB first
-    // Set Arduino to Controller Mode
-    // Configure serial clock speed
-    SPCR = (1<<SPE) | (0<<DORD) | (1<<MSTR) | (0<<SPR1) | (1<<SPR0);
-    // Baseline/default Status register
-    SPSR = 0;
+    mode &= REQOP_MASK;
+    readRegisters(device, CANSTAT, regs, sizeof(regs));
+    if ((regs[0] & OPMOD_MASK) == mode && (regs[1] & REQOP_MASK) == mode) {
+        return 1;
+    }
 
-    // Perform a reset on MCP2515 controller
-    resetController();
+    bitModify(device, CANCTRL, REQOP_MASK, mode);
 
-    // Give controller time for reset to complete
-    _delay_us(10);
+    return waitForMode(device, mode);
+}
+
+// Current operation mode of "device", one of the MODE_* values
+uint8_t readMode(uint8_t device) {
+    return readRegister(device, CANSTAT) & OPMOD_MASK;
+}
+
+/******************************************************************************
+ * Turns One-shot mode (OSM in CANCTRL) of "device" on or off. Each frame     *
+ * then gets a single attempt: one that loses arbitration or meets an error   *
+ * frame is dropped instead of being sent again later, which suits frames     *
+ * that are worse late than never. The MCP2515 clears TXREQ of a dropped      *
+ * frame without raising TXnIF, so the INT handler recognises its buffer from *
+ * READ STATUS as neither waiting nor done and refills it at its next pass,   *
+ * see serviceController().                                                   *
+ ******************************************************************************/
+void setOneShot(uint8_t device, uint8_t enabled) {
+    bitModify(device, CANCTRL, (1<<OSM), enabled ? (1<<OSM) : 0);
+
+    return;
+}
+
+#if CAN_SLEEP
+/******************************************************************************
+ * Puts "device" into Sleep mode and the ATmega328 into power-down until bus  *
+ * activity wakes the device again (WAKIF), then returns 1. Returns 0         *
+ * straight away, with the device left in its mode, if it did not get to      *
+ * sleep within CAN_MODE_TIMEOUT_US, which it does not while transmissions    *
+ * are pending, so the transmit queue should have run dry first.              *
+ *                                                                            *
+ * INT0 and INT1 only wake the CPU from power-down on a low level, so the     *
+ * device's INT pin is switched to that while the CPU sleeps. The MCP2515     *
+ * wakes into Listen-only mode, in which it already receives but neither      *
+ * acknowledges nor sends, and the INT handler that wakes the CPU puts it     *
+ * back into the mode it went to sleep from in its first pass, so frames are  *
+ * received and acknowledged again while the application is still on its way  *
+ * back from here. The frame that woke the MCP2515 is lost to it, as it is to *
+ * any sleeping CAN node; how soon the CPU itself runs again is the start-up  *
+ * time its fuses (SUT, CKSEL) set.                                           *
+ *                                                                            *
+ * Timers stop in power-down, so the cyclic messages and ISO-TP timeouts      *
+ * pause, and so does the timestamp clock. A wake-up of the CPU by anything   *
+ * else (another device, the application's own interrupts) sends it back to   *
+ * sleep. Interrupts are enabled while the CPU sleeps, since the wake-up      *
+ * comes through the INT handler, and are left as the caller had them on      *
+ * return.                                                                    *
+ ******************************************************************************/
+uint8_t canSleep(uint8_t device) {
+    controllerState *controller = &controllers[device];
+    uint8_t mode = readMode(device);
+
+    controller->wakeMode = mode;
+    controller->asleep   = 1;
+    if (!setMode(device, MODE_SLEEP)) {
+        controller->asleep = 0;
+        bitModify(device, CANCTRL, REQOP_MASK, mode);
+        return 0;
+    }
+
+    mcp2515IrqState irq = irqDisable();
+
+    interruptWakeLevel(device, 1);
+    while (controller->asleep) {
+        // The SPI clock stops too, so a transaction still being clocked out
+        // by the SPI interrupt is let finish first
+        if (!spiCurrent) {
+            cpuSleep();
+        }
+        irqEnable();
+        irqDisable();
+    }
+    interruptWakeLevel(device, 0);
+    irqRestore(irq);
+
+    return 1;
+}
+#endif
+
+/******************************************************************************
+ * Pulls the Chip Select line of an asynchronous transaction LOW and sends    *
+ * its opcode. From here on the SPI Transfer Complete interrupt clocks out    *
+ * the rest of it.                                                            *
+ ******************************************************************************/
+static void spiStart(spiTransaction *transaction) {
+    spiPosition = 0;
+
+    spiChipSelectLow(&transaction->cs);
+
+    PROF_COUNT(spiBytes);
+
+    spiInterruptEnable();
+    spiPut(transaction->opcode);
+
+    return;
+}
+
+/******************************************************************************
+ * Queues an asynchronous SPI transaction and returns straight away. A        *
+ * transaction is the "opcode" byte, then the "address" byte if               *
+ * SPI_ASYNC_ADDRESS is set in "flags", then "length" data bytes taken from   *
+ * "tx" (filler bytes if "tx" is NULL) while the bytes clocked back are       *
+ * stored in "rx" (unless it is NULL). "cs" selects the Chip Select pin, in   *
+ * the form the backend gives spiChipSelect; a zeroed "cs" means MCP2515      *
+ * device 0. When the last byte is done, Chip Select goes HIGH again and      *
+ * "complete" (if not NULL) is called from the SPI interrupt.                 *
+ *                                                                            *
+ * The descriptor and its buffers belong to the engine until "complete" runs. *
+ * Global interrupts must be enabled for the engine to make progress.         *
+ ******************************************************************************/
+void spiSubmit(spiTransaction *transaction) {
+    transaction->next = 0;
+
+    CRITICAL_BLOCK {
+        if (spiCurrent) {
+            spiLast->next = transaction;
+        } else {
+            spiCurrent = transaction;
+            spiStart(transaction);
+        }
+        spiLast = transaction;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Returns 1 while the asynchronous SPI engine still has transactions to      *
+ * clock out.                                                                 *
+ ******************************************************************************/
+uint8_t spiBusy(void) {
+    return spiCurrent != 0;
+}
+
+static void serviceBus(void);
+
+/******************************************************************************
+ * The SPI Transfer Complete interrupt fires after every byte of an           *
+ * asynchronous transaction. It stores the byte that came back, then either   *
+ * sends the next one or, at the end of the transaction, raises Chip Select,  *
+ * starts the next queued transaction and calls the completion callback. The  *
+ * main loop keeps running between bytes instead of spinning on SPIF.         *
+ *                                                                            *
+ * Once the queue is empty the SPI interrupt is switched off again, and any   *
+ * INT line that had to wait for the bus is serviced.                         *
+ ******************************************************************************/
+MCP2515_SPI_ISR {
+    PROF_ISR_BEGIN();
+
+    spiTransaction *transaction = spiCurrent;
+    uint8_t header = (transaction->flags & SPI_ASYNC_ADDRESS) ? 2 : 1;
+    uint8_t data   = spiGet();
+    uint8_t index  = spiPosition - header;
+
+    if (spiPosition >= header && transaction->rx) {
+        transaction->rx[index] = data;
+    }
+
+    spiPosition++;
+
+    if (spiPosition < header + transaction->length) {
+        index = spiPosition - header;
+
+        if (spiPosition < header) {
+            spiPut(transaction->address);
+        } else {
+            spiPut(transaction->tx ? transaction->tx[index] : FILLER);
+        }
+        PROF_COUNT(spiBytes);
+        PROF_ISR_END();
+        return;
+    }
+
+    spiChipSelectHigh(&transaction->cs);
+
+    spiCurrent = transaction->next;
+
+    if (spiCurrent) {
+        spiStart(spiCurrent);
+    } else {
+        spiInterruptDisable();
+    }
+
+    if (transaction->complete) {
+        transaction->complete(transaction);
+    }
+
+    if (!spiCurrent && busLength) {
+        serviceBus();
+    }
+
+    PROF_ISR_END();
+}
+
+/******************************************************************************
+ * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
+ * to the Master. Next, send the "SPI_READ_RX" instruction pointed at the     *
+ * SIDH register of the requested receive buffer (0 or 1). The MCP2515 then   *
+ * streams SIDH, SIDL, EID8, EID0, DLC and the data bytes back one after      *
+ * another. canFrame has the same layout, so every byte goes straight into    *
+ * place and the whole frame comes out of a single transaction. Lastly, set   *
+ * the "Chip Select" pin HIGH; raising it after a READ RX BUFFER instruction  *
+ * clears the buffer's RXnIF flag, so no separate "bitModify" is needed to    *
+ * acknowledge the frame.                                                     *
+ *                                                                            *
+ * The only byte touched on the way is DLC: its reserved bits are cleared, a  *
+ * DLC above 8 is capped, and the SRR bit of a standard remote frame is       *
+ * copied into its RTR bit (see canFrame). Only the data bytes the frame      *
+ * carries are clocked out, unless the SPI backend has MCP2515_SPI_DMA: all   *
+ * eight then come in the same burst as the rest (see mcp2515hal.h).          *
+ ******************************************************************************/
+void readFrame(uint8_t device, uint8_t buffer, canFrame *frame) {
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_READ_RX_SIDH(buffer));
+
+#if MCP2515_SPI_DMA
+        // The whole buffer in one burst, data bytes past the DLC included
+        spiBurst(0, (uint8_t *)frame, sizeof(canFrame));
+
+        uint8_t dlc = frame->dlc;
+#else
+        frame->sidh = sendData(FILLER);
+        frame->sidl = sendData(FILLER);
+        frame->eid8 = sendData(FILLER);
+        frame->eid0 = sendData(FILLER);
+
+        uint8_t dlc = sendData(FILLER);
+#endif
+        uint8_t rtr = (frame->sidl & (1<<IDE)) ? (dlc & (1<<RTR))
+                                                : ((frame->sidl >> SRR) & 1) << RTR;
+
+        dlc &= DLC_MASK;
+        if (dlc > 8) {
+            dlc = 8;
+        }
+        frame->dlc = dlc | rtr;
+
+#if !MCP2515_SPI_DMA
+        // Remote frames carry no data, whatever their DLC says
+        if (!rtr) {
+            spiBurst(0, frame->data, dlc);
+        }
+#endif
+
+        chipDeselect(device);
+    }
 
-    // Load Configuration registers
-    PORTB &= ~(1<<CHIP_SELECT);
-    sendData(SPI_WRITE);
-    sendData(CNF3);
-    sendData((1<<PHSEG21));
-    
+    return;
+}
+
+#if !FRAME_HOOKS
+/******************************************************************************
+ * Throws away the frame in a receive buffer without reading it. Sending only *
+ * the "SPI_READ_RX" instruction and raising "Chip Select" again clears RXnIF *
+ * just like a full readFrame() does, for the cost of a single byte.          *
+ ******************************************************************************/
+static void releaseReceiveBuffer(uint8_t device, uint8_t buffer) {
+    chipSelect(device);
+
+    sendData(SPI_READ_RX_DATA(buffer));
+
+    chipDeselect(device);
+
+    return;
+}
+#endif
+
+#if CAN_FRAME_POOL
+/******************************************************************************
+ * Non-blocking read from the receive ring buffer of "device", as             *
+ * canReadTimestamped(), but the frame stays in the pool slot the INT handler *
+ * read it into: the slot number goes into "slot" and the slot belongs to the *
+ * caller from then on. It is given back with canFreeSlot(), or handed on     *
+ * with canWriteSlot(), so a frame can go from the MCP2515 to a transmit      *
+ * queue without being copied.                                                *
+ ******************************************************************************/
+uint8_t canReadSlot(uint8_t device, uint8_t *slot, uint32_t *timestamp) {
+    controllerState *controller = &controllers[device];
+    uint8_t tail = controller->rxTail;
+
+    if (tail == controller->rxHead) {
+        return 0;
+    }
+
+    COMPILER_BARRIER();
+    *slot = controller->rxRing[tail & (CAN_RX_BUFFER_SIZE - 1)];
+#if CAN_TIMESTAMPS
+    if (timestamp) {
+        *timestamp = controller->rxTime[tail & (CAN_RX_BUFFER_SIZE - 1)];
+    }
+#else
+    if (timestamp) {
+        *timestamp = 0;
+    }
+#endif
+    COMPILER_BARRIER();
+
+    controller->rxTail = tail + 1;
+
+    return 1;
+}
+#endif
+
+/******************************************************************************
+ * Non-blocking read from the receive ring buffer of "device". If a frame is  *
+ * waiting, it is copied into "frame", its timestamp (see CAN_TIMESTAMPS in   *
+ * mcp2515config.h) into "timestamp" unless that is NULL, and 1 is returned.  *
+ * If the buffer is empty, 0 is returned straight away. No SPI traffic        *
+ * happens here; the INT handler has already pulled the frame off the         *
+ * MCP2515.                                                                   *
+ ******************************************************************************/
+uint8_t canReadTimestamped(uint8_t device, canFrame *frame, uint32_t *timestamp) {
+#if CAN_FRAME_POOL
+    uint8_t slot;
+
+    if (!canReadSlot(device, &slot, timestamp)) {
+        return 0;
+    }
+    *frame = canFramePool[slot];
+    canFreeSlot(slot);
+
+    return 1;
+#else
+    controllerState *controller = &controllers[device];
+    uint8_t tail = controller->rxTail;
+
+    if (tail == controller->rxHead) {
+        return 0;
+    }
+
+    COMPILER_BARRIER();
+    *frame = controller->rxRing[tail & (CAN_RX_BUFFER_SIZE - 1)];
+#if CAN_TIMESTAMPS
+    if (timestamp) {
+        *timestamp = controller->rxTime[tail & (CAN_RX_BUFFER_SIZE - 1)];
+    }
+#else
+    if (timestamp) {
+        *timestamp = 0;
+    }
+#endif
+    COMPILER_BARRIER();
+
+    controller->rxTail = tail + 1;
+
+    return 1;
+#endif
+}
+
+/******************************************************************************
+ * Non-blocking read from the receive ring buffer of "device", as             *
+ * canReadTimestamped() without the timestamp.                                *
+ ******************************************************************************/
+uint8_t canRead(uint8_t device, canFrame *frame) {
+    return canReadTimestamped(device, frame, 0);
+}
 
+/******************************************************************************
+ * Converts an identifier (with its CAN_EXTENDED_FLAG bit) into the SIDH,     *
+ * SIDL, EID8 and EID0 register layout shared by the transmit buffers, the    *
+ * acceptance filters and the acceptance masks. The EXIDE bit is set in SIDL  *
+ * for extended identifiers.                                                  *
+ ******************************************************************************/
+static void packIdentifier(uint32_t id, uint8_t *regs) {
+    canPackedId packed = canPackId(id);
+
+    memcpy(regs, &packed, sizeof(packed));
+
+    return;
+}
+
+/******************************************************************************
+ * Clocks a frame out as it sits in memory: the four identifier bytes, DLC    *
+ * and, unless it is a remote frame, the data bytes. This is the tail of      *
+ * every LOAD TX BUFFER and WRITE instruction that fills a transmit buffer.   *
+ ******************************************************************************/
+static void streamFrame(const canFrame *frame) {
+    spiBurst((const uint8_t *)frame, 0, 5 + canGetLength(frame));
+
+    return;
+}
+
+/******************************************************************************
+ * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
+ * to the Master. Next, send the "SPI_LOAD_TX" instruction pointed at the     *
+ * SIDH register of the requested transmit buffer (0, 1 or 2). The            *
+ * identifier, DLC and data bytes are then streamed into TXBnSIDH..TXBnD7 in  *
+ * one go, as the MCP2515 advances its address pointer after every byte.      *
+ * Lastly, set the "Chip Select" pin HIGH. The frame is not sent until        *
+ * requestToSend() is called for the buffer.                                  *
+ ******************************************************************************/
+void loadTxBuffer(uint8_t device, uint8_t buffer, const canFrame *frame) {
+    SPI_BLOCK {
+        chipSelect(device);
 
+        sendData(SPI_LOAD_TX_SIDH(buffer));
+        streamFrame(frame);
 
-    return SPDR;
+        chipDeselect(device);
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
+ * to the Master. Next, send the "SPI_RTS" instruction with the lower three   *
+ * bits set for each transmit buffer that should start transmitting (bit 0    *
+ * for TXB0, bit 1 for TXB1, bit 2 for TXB2). Lastly, set the "Chip Select"   *
+ * pin HIGH. This one-byte instruction sets TXREQ without a read-modify-write *
+ * of TXBnCTRL. Buffers outside MCP2515_RESERVED_TX_BUFFERS are marked in     *
+ * "txActive", so the INT handler services their TXnIF flags whoever loaded   *
+ * them.                                                                      *
+ ******************************************************************************/
+void requestToSend(uint8_t device, uint8_t buffers) {
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_RTS | (buffers & 0x07));
+        PROF_ADD(framesTx, (buffers & 1) + ((buffers >> 1) & 1) + ((buffers >> 2) & 1));
+
+        chipDeselect(device);
+        controllers[device].txActive |= buffers & 0x07 & ~MCP2515_RESERVED_TX_BUFFERS;
+    }
+
+    return;
 }
 
-int main() {
-    return 0;
+/******************************************************************************
+ * Returns the first transmit buffer of "device" that is free, or 3 if none   *
+ * is. A buffer is free when its TXREQ bit is clear (it is not waiting to     *
+ * transmit) and its TXnIF flag is clear (the INT handler is not about to     *
+ * refill it from the transmit queue). Both bits of all three buffers come    *
+ * back from a single READ STATUS instruction, so this costs two bytes.       *
+ ******************************************************************************/
+static uint8_t findFreeTxBuffer(uint8_t device) {
+    uint8_t status = readStatus(device, SPI_READ_STATUS);
+
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        if (!(status & (3<<(STATUS_TX0REQ + 2 * buffer))) && !(MCP2515_RESERVED_TX_BUFFERS & (1<<buffer))) {
+            return buffer;
+        }
+    }
+
+    return 3;
+}
+
+/******************************************************************************
+ * Sends a frame straight through the first free transmit buffer of "device", *
+ * bypassing the transmit queue. Returns 1 when the frame has been handed to  *
+ * the MCP2515 and 0 when all three buffers are busy.                         *
+ ******************************************************************************/
+uint8_t sendFrame(uint8_t device, const canFrame *frame) {
+    uint8_t sent = 0;
+
+    SPI_BLOCK {
+        uint8_t buffer = findFreeTxBuffer(device);
+
+        if (buffer < 3) {
+            loadTxBuffer(device, buffer, frame);
+            requestToSend(device, 1<<buffer);
+            sent = 1;
+        }
+    }
+
+    return sent;
+}
+
+#if MCP2515_RESERVED_TX_BUFFERS
+/******************************************************************************
+ * Loads a frame into transmit buffer "buffer" of "device", one of the        *
+ * reserved buffers in MCP2515_TXRTS_BUFFERS or CAN_CYCLIC_BUFFERS, with      *
+ * priority "priority", without sending it. canTrigger() or requestToSend()   *
+ * sends it afterwards, as many times as wanted, since the frame stays in the *
+ * buffer. Returns 0 if the buffer is not reserved, or if it is still waiting *
+ * to transmit and so cannot be written.                                      *
+ ******************************************************************************/
+uint8_t canPreload(uint8_t device, uint8_t buffer, const canFrame *frame, uint8_t priority) {
+    uint8_t loaded = 0;
+
+    if (buffer > 2 || !(MCP2515_RESERVED_TX_BUFFERS & (1<<buffer))) {
+        return 0;
+    }
+
+    SPI_BLOCK {
+        if (!(readStatus(device, SPI_READ_STATUS) & (1<<(STATUS_TX0REQ + 2 * buffer)))) {
+            chipSelect(device);
+
+            sendData(SPI_WRITE);
+            sendData(TXB0CTRL + (buffer << 4));
+            sendData(priority & ((1<<TXP1) | (1<<TXP0)));
+            streamFrame(frame);
+
+            chipDeselect(device);
+            loaded = 1;
+        }
+    }
+
+    return loaded;
+}
+
+/******************************************************************************
+ * First, set the "Chip Select" pin LOW so that the Slave is enabled relative *
+ * to the Master. Next, send the "SPI_LOAD_TX" instruction pointed at TXBnD0  *
+ * of reserved transmit buffer "buffer", which needs no address byte. Next,   *
+ * stream the first "length" data bytes into TXBnD0 onwards. Lastly, set the  *
+ * "Chip Select" pin HIGH. The identifier and DLC are left as canPreload()    *
+ * put them; the caller makes sure the buffer is not waiting to transmit.     *
+ ******************************************************************************/
+void loadTxData(uint8_t device, uint8_t buffer, const uint8_t *data, uint8_t length) {
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_LOAD_TX_DATA(buffer));
+        spiBurst(data, 0, length);
+
+        chipDeselect(device);
+    }
+
+    return;
+}
+#endif
+
+#if MCP2515_TXRTS_BUFFERS
+/******************************************************************************
+ * Sends the frame preloaded into transmit buffer "buffer" of "device" by     *
+ * pulsing its TXnRTS pin. This takes a few cycles and no SPI traffic at all, *
+ * so it can be called from any interrupt handler, even while the SPI bus is  *
+ * busy. A pulse while the buffer is still waiting to transmit has no further *
+ * effect.                                                                    *
+ ******************************************************************************/
+void canTrigger(uint8_t device, uint8_t buffer) {
+    txRtsPulse(device, buffer);
+    PROF_COUNT(framesTx);
+
+    return;
+}
+#endif
+
+#if MCP2515_RXBF_PINS
+/******************************************************************************
+ * Returns which receive buffers of "device" hold a frame (bit 0 for RXB0,    *
+ * bit 1 for RXB1), read from the RXnBF pins without any SPI traffic.         *
+ ******************************************************************************/
+uint8_t receiveBuffersFull(uint8_t device) {
+    return rxBufferPins(device);
+}
+#endif
+
+/******************************************************************************
+ * Loads a frame into a transmit buffer and starts it. TXBnCTRL sits right in *
+ * front of TXBnSIDH, so a single WRITE instruction puts the priority into    *
+ * its TXP bits and the frame into the buffer; when several buffers are       *
+ * pending the MCP2515 itself sends the highest priority one first. TXREQ is  *
+ * left clear by that write and set afterwards with REQUEST TO SEND, so the   *
+ * frame cannot go out half loaded.                                           *
+ ******************************************************************************/
+static void startTransmit(uint8_t device, uint8_t buffer, const canFrame *frame, uint8_t priority) {
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_WRITE);
+        sendData(TXB0CTRL + (buffer << 4));
+        sendData(priority & ((1<<TXP1) | (1<<TXP0)));
+        streamFrame(frame);
+
+        chipDeselect(device);
+    }
+
+    requestToSend(device, 1<<buffer);
+
+    return;
+}
+
+#if CAN_ISOTP_CHANNELS
+/******************************************************************************
+ * Loads a frame into transmit buffer "buffer" of "device" and starts it,     *
+ * like startTransmit(), but gathers it from two places: the identifier, the  *
+ * DLC and the first "headLength" data bytes come from "head", and the next   *
+ * "length" data bytes straight from "data". Whatever the DLC of "head"       *
+ * leaves over is filled with "padding". A transport layer can so put its     *
+ * protocol bytes in front of a piece of the caller's buffer without copying  *
+ * it into a frame first. The buffer has to be free; this is called from      *
+ * interrupt handlers only, with the SPI bus idle.                            *
+ ******************************************************************************/
+void transmitSegment(uint8_t device, uint8_t buffer, uint8_t priority, const canFrame *head,
+                     uint8_t headLength, const uint8_t *data, uint8_t length, uint8_t padding) {
+    const uint8_t *bytes = (const uint8_t *)head;
+    uint8_t total = canGetLength(head);
+
+    SPI_BLOCK {
+        chipSelect(device);
+
+        sendData(SPI_WRITE);
+        sendData(TXB0CTRL + (buffer << 4));
+        sendData(priority & ((1<<TXP1) | (1<<TXP0)));
+        for (uint8_t i = 0; i < 5 + headLength; i++) {
+            sendData(bytes[i]);
+        }
+        for (uint8_t i = 0; i < length; i++) {
+            sendData(data[i]);
+        }
+        for (uint8_t i = headLength + length; i < total; i++) {
+            sendData(padding);
+        }
+
+        chipDeselect(device);
+    }
+
+    requestToSend(device, 1<<buffer);
+
+    return;
+}
+#endif
+
+/******************************************************************************
+ * Transmit queue. Frames that cannot go straight into a transmit buffer wait *
+ * in the queue of their device until the INT handler sees a TXnIF flag and   *
+ * moves the highest priority frame into the buffer that just emptied.        *
+ *                                                                            *
+ * "txOrder" is a permutation of the slot numbers: its first "txCount"        *
+ * entries are the queued slots sorted by priority (oldest first within a     *
+ * priority), and the remaining entries are the free slots. Queueing and      *
+ * dequeueing only shuffle these one-byte indices, never the frames           *
+ * themselves. The queue is only touched with interrupts disabled.            *
+ *                                                                            *
+ * Called from the INT handler once the TXnIF flag of "buffer" has been       *
+ * cleared: if the transmit queue is not empty, the frame at its head is      *
+ * moved into the buffer. With CAN_ISOTP_CHANNELS the ISO-TP transport is     *
+ * told about the buffer afterwards, and may refill it itself if the queue    *
+ * left it free.                                                              *
+ ******************************************************************************/
+static void serviceTxBuffer(uint8_t device, uint8_t buffer) {
+    controllerState *controller = &controllers[device];
+
+    controller->txActive &= ~(1<<buffer);
+
+    if (controller->txCount) {
+        uint8_t slot = controller->txOrder[0];
+
+        controller->txCount--;
+        for (uint8_t i = 0; i < controller->txCount; i++) {
+            controller->txOrder[i] = controller->txOrder[i + 1];
+        }
+        controller->txOrder[controller->txCount] = slot;
+
+        startTransmit(device, buffer, QUEUED_FRAME(controller, slot), controller->txPriority[slot]);
+#if CAN_FRAME_POOL
+        returnSlot(controller->txSlots[slot]);
+#endif
+    }
+
+#if CAN_ISOTP_CHANNELS
+    isotpTransmitted(device, buffer, ~controller->txActive & 0x07 & ~MCP2515_RESERVED_TX_BUFFERS);
+#endif
+
+    return;
+}
+
+/******************************************************************************
+ * Takes a free transmit queue slot of "controller" and sorts it in behind    *
+ * every queued frame of at least "priority", ahead of the lower ones. The    *
+ * queue must not be full; the caller puts the frame into the slot returned.  *
+ ******************************************************************************/
+static uint8_t queueEntry(controllerState *controller, uint8_t priority) {
+    uint8_t slot = controller->txOrder[controller->txCount];
+    uint8_t i    = controller->txCount;
+
+    // Shift every lower priority entry back by one
+    while (i && controller->txPriority[controller->txOrder[i - 1]] < priority) {
+        controller->txOrder[i] = controller->txOrder[i - 1];
+        i--;
+    }
+
+    controller->txOrder[i]       = slot;
+    controller->txPriority[slot] = priority;
+    controller->txCount++;
+
+    return slot;
+}
+
+/******************************************************************************
+ * Queues a frame for transmission on "device" with a priority from           *
+ * CAN_PRIORITY_LOWEST (0) to CAN_PRIORITY_HIGHEST (3). If a transmit buffer  *
+ * is free the frame goes out immediately; otherwise it waits in the transmit *
+ * queue ahead of every frame with a lower priority. Returns 1 on success and *
+ * 0 when the queue is full.                                                  *
+ ******************************************************************************/
+uint8_t canWrite(uint8_t device, const canFrame *frame, uint8_t priority) {
+    controllerState *controller = &controllers[device];
+    uint8_t queued = 1;
+
+    SPI_BLOCK {
+        uint8_t buffer = findFreeTxBuffer(device);
+
+        if (buffer < 3) {
+            startTransmit(device, buffer, frame, priority);
+        } else if (controller->txCount == CAN_TX_QUEUE_SIZE) {
+            queued = 0;
+        } else {
+#if CAN_FRAME_POOL
+            uint8_t slot = takeSlot();
+
+            if (slot == CAN_NO_SLOT) {
+                queued = 0;
+            } else {
+                canFramePool[slot] = *frame;
+                controller->txSlots[queueEntry(controller, priority)] = slot;
+            }
+#else
+            controller->txSlots[queueEntry(controller, priority)] = *frame;
+#endif
+        }
+    }
+
+    return queued;
+}
+
+#if CAN_FRAME_POOL
+/******************************************************************************
+ * Queues the frame in pool slot "slot" for transmission on "device", as      *
+ * canWrite(), without copying it: the slot goes into the transmit queue as   *
+ * it is and back to the pool once the frame is in a transmit buffer. Returns *
+ * 0 when the queue is full, and the slot then stays with the caller.         *
+ ******************************************************************************/
+uint8_t canWriteSlot(uint8_t device, uint8_t slot, uint8_t priority) {
+    controllerState *controller = &controllers[device];
+    uint8_t queued = 1;
+
+    SPI_BLOCK {
+        uint8_t buffer = findFreeTxBuffer(device);
+
+        if (buffer < 3) {
+            startTransmit(device, buffer, &canFramePool[slot], priority);
+            returnSlot(slot);
+        } else if (controller->txCount == CAN_TX_QUEUE_SIZE) {
+            queued = 0;
+        } else {
+            controller->txSlots[queueEntry(controller, priority)] = slot;
+        }
+    }
+
+    return queued;
+}
+#endif
+
+/******************************************************************************
+ * Installs "handler" for frames that device "device" accepts through         *
+ * acceptance filter "filter", or restores the ring buffer for that filter    *
+ * when "handler" is NULL. The filter number is the one reported by RX        *
+ * STATUS: 0-5 for RXF0-RXF5, and 6 or 7 when a frame that matched RXF0 or    *
+ * RXF1 rolled over into RXB1. Handlers run inside the INT handler, so they   *
+ * must be short; the frame they are given is only valid until they return.   *
+ ******************************************************************************/
+void setFilterHandler(uint8_t device, uint8_t filter, canFilterHandler handler) {
+    CRITICAL_BLOCK {
+        controllers[device].filterHandlers[filter & RX_STATUS_FILTER_MASK] = handler;
+    }
+
+    return;
+}
+
+#if MCP2515_PROFILE
+volatile canProfile mcp2515Profile;
+
+/******************************************************************************
+ * Latency measurement. profileEdge() notes the Timer1 count when the INT     *
+ * line of "device" is first seen LOW (or, for CAN_TIMESTAMP_CAPTURE_DEVICE,  *
+ * the count latched by ICP1 at the edge itself), and profileFrameStored()    *
+ * turns it into a latency once the first frame announced by that edge is     *
+ * stored.                                                                    *
+ ******************************************************************************/
+static void profileEdge(uint8_t device) {
+    controllerState *controller = &controllers[device];
+
+    if (controller->profileEdgePending) {
+        return;
+    }
+
+    controller->profileEdge        = timerCount();
+    controller->profileEdgePending = 1;
+
+#ifdef CAN_TIMESTAMP_CAPTURE_DEVICE
+    if (device == CAN_TIMESTAMP_CAPTURE_DEVICE && timerCapturePending()) {
+        controller->profileEdge = timerCapture();
+    }
+#endif
+
+    return;
+}
+
+static void profileFrameStored(uint8_t device) {
+    controllerState *controller = &controllers[device];
+
+    if (controller->profileEdgePending) {
+        uint16_t latency = timerCount() - controller->profileEdge;
+
+        if (latency > mcp2515Profile.latencyMax) {
+            mcp2515Profile.latencyMax = latency;
+        }
+        controller->profileEdgePending = 0;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Copies the performance counters (see mcp2515prof.h) into "profile" and, if *
+ * "clear" is set, starts them again from zero.                               *
+ ******************************************************************************/
+void readProfile(canProfile *profile, uint8_t clear) {
+    CRITICAL_BLOCK {
+        memcpy(profile, (const canProfile *)&mcp2515Profile, sizeof(canProfile));
+        if (clear) {
+            memset((canProfile *)&mcp2515Profile, 0, sizeof(canProfile));
+        }
+    }
+
+    return;
+}
+#endif
+
+/******************************************************************************
+ * Adds one to a lost frame counter, stopping at its maximum.                 *
+ ******************************************************************************/
+static void countOverflow(uint16_t *counter) {
+    PROF_COUNT(framesDropped);
+
+    if (*counter != 0xFFFF) {
+        (*counter)++;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Copies the lost frame counters of "device" into "counters" and, if "clear" *
+ * is set, starts them again from zero.                                       *
+ ******************************************************************************/
+void readOverflowCounters(uint8_t device, canOverflowCounters *counters, uint8_t clear) {
+    CRITICAL_BLOCK {
+        *counters = controllers[device].overflow;
+        if (clear) {
+            memset(&controllers[device].overflow, 0, sizeof(canOverflowCounters));
+        }
+    }
+
+    return;
+}
+
+#if CAN_ERROR_MONITOR
+// Adds one to an error counter, stopping at its maximum
+static void countError(uint16_t *counter) {
+    if (*counter != 0xFFFF) {
+        (*counter)++;
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Copies the error counters of "device" into "counters" and, if "clear" is   *
+ * set, starts the peaks, transition counts and histograms again from zero    *
+ * (the state and the error counters as last seen stay).                      *
+ ******************************************************************************/
+void readErrorCounters(uint8_t device, canErrorCounters *counters, uint8_t clear) {
+    CRITICAL_BLOCK {
+        canErrorCounters *errors = &controllers[device].errors;
+
+        *counters = *errors;
+        if (clear) {
+            memset(errors, 0, sizeof(canErrorCounters));
+            errors->state = counters->state;
+            errors->tec   = counters->tec;
+            errors->rec   = counters->rec;
+        }
+    }
+
+    return;
+}
+#endif
+
+#if FRAME_HOOKS
+/******************************************************************************
+ * Offers a frame taken off "device" to the bus monitor (CAN_MONITOR_IDS),    *
+ * then to the ISO-TP channels (CAN_ISOTP_CHANNELS) and then to the gateway   *
+ * (CAN_GATEWAY). Returns 1 if the frame is to be delivered as usual and 0 if *
+ * one of them consumed it.                                                   *
+ ******************************************************************************/
+static uint8_t offerFrame(uint8_t device, canFrame *frame) {
+#if CAN_MONITOR_IDS
+    if (monitorReceived(device, frame)) {
+        return 0;
+    }
+#endif
+#if CAN_ISOTP_CHANNELS
+    if (isotpReceived(device, frame)) {
+        return 0;
+    }
+#endif
+#if CAN_GATEWAY
+    return gatewayForward(device, frame);
+#else
+    return 1;
+#endif
+}
+#endif
+
+/******************************************************************************
+ * Storage for the frame going into position "head" of the receive ring of    *
+ * "controller", which has room for it: the ring slot, or with CAN_FRAME_POOL *
+ * a pool slot put into it. Returns 0 if the pool has run dry.                *
+ ******************************************************************************/
+static canFrame *ringSlot(controllerState *controller, uint8_t head) {
+#if CAN_FRAME_POOL
+    uint8_t slot = takeSlot();
+
+    if (slot == CAN_NO_SLOT) {
+        return 0;
+    }
+    controller->rxRing[head & (CAN_RX_BUFFER_SIZE - 1)] = slot;
+
+    return &canFramePool[slot];
+#else
+    return &controller->rxRing[head & (CAN_RX_BUFFER_SIZE - 1)];
+#endif
+}
+
+/******************************************************************************
+ * Moves one received frame out of "device". "rxStatus" is the RX STATUS      *
+ * response: its top two bits say which receive buffer holds a frame (RXB0 is *
+ * served first when both do) and its low three bits say which filter         *
+ * accepted it, which selects the handler straight away without reading       *
+ * CANINTF or RXBnCTRL. A frame without a handler is read directly into the   *
+ * next ring buffer slot. With the bus monitor, ISO-TP or the gateway built   *
+ * in, every frame is passed to offerFrame() before it is delivered, and only *
+ * delivered if none of them consumes it.                                     *
+ ******************************************************************************/
+static void dispatchFrame(uint8_t device, uint8_t rxStatus) {
+    controllerState *controller = &controllers[device];
+    uint8_t buffer = (rxStatus & (1<<RX_STATUS_RXB0)) ? 0 : 1;
+    canFilterHandler handler = controller->filterHandlers[rxStatus & RX_STATUS_FILTER_MASK];
+
+    if (handler) {
+        canFrame frame;
+
+#if CAN_TIMESTAMPS
+        receiveTime(device);
+#endif
+        readFrame(device, buffer, &frame);
+        PROF_COUNT(framesRx);
+#if MCP2515_PROFILE
+        profileFrameStored(device);
+#endif
+#if FRAME_HOOKS
+        if (!offerFrame(device, &frame)) {
+            return;
+        }
+#endif
+        handler(device, &frame);
+    } else {
+        uint8_t   head = controller->rxHead;
+        canFrame *slot = 0;
+
+        if ((uint8_t)(head - controller->rxTail) != CAN_RX_BUFFER_SIZE) {
+            slot = ringSlot(controller, head);
+        }
+
+        if (slot) {
+
+#if CAN_TIMESTAMPS
+            controller->rxTime[head & (CAN_RX_BUFFER_SIZE - 1)] = receiveTime(device);
+#endif
+            readFrame(device, buffer, slot);
+            PROF_COUNT(framesRx);
+#if MCP2515_PROFILE
+            profileFrameStored(device);
+#endif
+#if FRAME_HOOKS
+            // Offered from the slot itself; it is only published if it stays
+            if (!offerFrame(device, slot)) {
+#if CAN_FRAME_POOL
+                returnSlot(controller->rxRing[head & (CAN_RX_BUFFER_SIZE - 1)]);
+#endif
+                return;
+            }
+#endif
+            COMPILER_BARRIER();
+            controller->rxHead = head + 1;
+        } else {
+#if FRAME_HOOKS
+            // No slot left, but the frame may still be forwarded or taken in
+            canFrame frame;
+
+#if CAN_TIMESTAMPS
+            receiveTime(device);
+#endif
+            readFrame(device, buffer, &frame);
+            PROF_COUNT(framesRx);
+            if (offerFrame(device, &frame)) {
+                countOverflow(&controller->overflow.ringOverrun);
+            }
+#else
+            releaseReceiveBuffer(device, buffer);
+            PROF_COUNT(framesRx);
+            countOverflow(&controller->overflow.ringOverrun);
+#endif
+        }
+    }
+
+    return;
+}
+
+#if CAN_BUSOFF_RESTARTS
+// Set in "restartMode" while a restart waits for finishRestart()
+#define RESTART_PENDING 0x01
+
+/******************************************************************************
+ * Restarts "device" out of bus-off: Configuration mode clears TEC and REC,   *
+ * and going straight back to the mode it was in lets the MCP2515 rejoin      *
+ * after 11 recessive bits instead of 128 times that. A mode change waits for *
+ * pending transmissions, so they are aborted (ABAT) on the way in; off the   *
+ * bus the change is then immediate. This only requests Configuration mode    *
+ * and notes the mode to go back to in "restartMode": the INT handler runs    *
+ * with interrupts off, so rather than wait for CANSTAT here the same pass    *
+ * finishes the restart with finishRestart() once the error flags are served. *
+ ******************************************************************************/
+static void restartController(uint8_t device) {
+    uint8_t mode = readRegister(device, CANCTRL) & REQOP_MASK;
+
+    bitModify(device, CANCTRL, REQOP_MASK | (1<<ABAT), MODE_CONFIG | (1<<ABAT));
+    controllers[device].restartMode = mode | RESTART_PENDING;
+
+    return;
+}
+
+/******************************************************************************
+ * Second half of restartController(): one READ of CANSTAT, then back to the  *
+ * mode "device" was in. If CANSTAT shows Configuration mode the restart      *
+ * counts and the buffers the driver had waiting are requested again, with    *
+ * their priorities unchanged; if it does not, nothing waits for it and the   *
+ * MCP2515 is left to its own recovery.                                       *
+ ******************************************************************************/
+static void finishRestart(uint8_t device) {
+    controllerState *controller = &controllers[device];
+    uint8_t restarted = (readRegister(device, CANSTAT) & OPMOD_MASK) == MODE_CONFIG;
+
+    bitModify(device, CANCTRL, REQOP_MASK | (1<<ABAT), controller->restartMode & REQOP_MASK);
+    controller->restartMode = 0;
+
+    if (!restarted) {
+        return;
+    }
+
+    if (controller->txActive) {
+        requestToSend(device, controller->txActive);
+    }
+    countError(&controller->errors.restarts);
+
+    return;
+}
+
+/******************************************************************************
+ * Recovery policy for a device that has just gone bus-off. The first         *
+ * CAN_BUSOFF_RESTARTS bus-offs in a row are cut short at once; after that    *
+ * only those whose number past CAN_BUSOFF_RESTARTS is a power of two are, so *
+ * the gaps double and the MCP2515's own recovery runs in between. After 255  *
+ * bus-offs without a frame getting through, only the MCP2515's own recovery  *
+ * is left.                                                                   *
+ ******************************************************************************/
+static void recoverBusOff(uint8_t device) {
+    controllerState *controller = &controllers[device];
+
+    if (controller->busOffStreak == 0xFF) {
+        return;
+    }
+
+    uint8_t streak = ++controller->busOffStreak;
+
+    if (streak > CAN_BUSOFF_RESTARTS) {
+        uint8_t late = streak - CAN_BUSOFF_RESTARTS;
+
+        if (late & (late - 1)) {
+            return;
+        }
+    }
+
+    restartController(device);
+
+    return;
+}
+#endif
+
+#if CAN_ERROR_MONITOR
+// Error state that the EFLG bits "eflg" stand for
+static uint8_t errorState(uint8_t eflg) {
+    if (eflg & (1<<TXBO)) {
+        return CAN_ERROR_BUS_OFF;
+    }
+    if (eflg & ((1<<TXEP) | (1<<RXEP))) {
+        return CAN_ERROR_PASSIVE;
+    }
+    if (eflg & (1<<EWARN)) {
+        return CAN_ERROR_WARNING;
+    }
+
+    return CAN_ERROR_ACTIVE;
+}
+
+/******************************************************************************
+ * Samples TEC and REC of "device" (neighbours, so one READ fetches both)     *
+ * into the error counters and follows the state "eflg" reports. With         *
+ * CAN_BUSOFF_RESTARTS, a change into bus-off runs the recovery policy.       *
+ ******************************************************************************/
+static void trackErrors(uint8_t device, uint8_t eflg) {
+    canErrorCounters *errors = &controllers[device].errors;
+    uint8_t counts[2];
+    uint8_t state = errorState(eflg);
+
+    readRegisters(device, TEC, counts, sizeof(counts));
+
+    errors->tec = counts[0];
+    errors->rec = counts[1];
+    if (counts[0] > errors->tecPeak) {
+        errors->tecPeak = counts[0];
+    }
+    if (counts[1] > errors->recPeak) {
+        errors->recPeak = counts[1];
+    }
+    countError(&errors->tecHistogram[counts[0] >> 5]);
+    countError(&errors->recHistogram[counts[1] >> 5]);
+
+    if (state != errors->state) {
+        errors->state = state;
+        countError(&errors->entered[state]);
+#if CAN_BUSOFF_RESTARTS
+        if (state == CAN_ERROR_BUS_OFF) {
+            recoverBusOff(device);
+        }
+#endif
+    }
+
+    return;
+}
+
+#define ERROR_FLAGS ((1<<MERRF) | (1<<ERRIF))
+#else
+#define ERROR_FLAGS (1<<ERRIF)
+#endif
+
+#if CAN_SLEEP
+#define WAKE_FLAG (1<<WAKIF)
+#else
+#define WAKE_FLAG 0
+#endif
+
+/******************************************************************************
+ * Serves the error interrupt. CANINTF and EFLG are neighbours, so one READ   *
+ * instruction fetches both. A receive buffer overflow is counted and its     *
+ * RXnOVR bit cleared, then ERRIF is cleared. With CAN_ERROR_MONITOR the      *
+ * message error flag MERRF is served too, and the error counters are only    *
+ * sampled once the flags are clear, so a change the sampling itself causes   *
+ * (a restart out of bus-off) raises ERRIF again and is seen on the next      *
+ * pass. With CAN_SLEEP the wake-up flag WAKIF is served here as well, see    *
+ * canSleep().                                                                *
+ ******************************************************************************/
+static void serviceErrorFlags(uint8_t device) {
+    controllerState *controller = &controllers[device];
+    uint8_t flags[2];
+
+    readRegisters(device, CANINTF, flags, sizeof(flags));
+
+#if CAN_SLEEP
+    // Woken into Listen-only mode: back to acknowledging frames first
+    if (flags[0] & (1<<WAKIF)) {
+        bitModify(device, CANCTRL, REQOP_MASK, controller->wakeMode);
+        controller->asleep = 0;
+    }
+#endif
+
+    if (!(flags[0] & (ERROR_FLAGS | WAKE_FLAG))) {
+        return;
+    }
+
+    if (flags[1] & (1<<RX0OVR)) {
+        countOverflow(&controller->overflow.rxOverflow[0]);
+    }
+    if (flags[1] & (1<<RX1OVR)) {
+        countOverflow(&controller->overflow.rxOverflow[1]);
+    }
+    if (flags[1] & ((1<<RX1OVR) | (1<<RX0OVR))) {
+        bitModify(device, EFLG, (1<<RX1OVR) | (1<<RX0OVR), 0);
+    }
+
+    bitModify(device, CANINTF, flags[0] & (ERROR_FLAGS | WAKE_FLAG), 0);
+
+#if CAN_ERROR_MONITOR
+    if (flags[0] & ERROR_FLAGS) {
+        trackErrors(device, flags[1]);
+    }
+#endif
+
+    return;
+}
+
+/******************************************************************************
+ * The MCP2515 pulls its INT pin LOW as soon as a receive buffer fills or a   *
+ * transmit buffer empties. This routine serves one device and loops until no *
+ * flag is left set, which releases the INT pin again. If something new       *
+ * happens while it is still running, the loop simply picks it up.            *
+ *                                                                            *
+ * Each pass starts with a 2-byte RX STATUS transaction, which is all it      *
+ * takes to find and dispatch a received frame (with MCP2515_RXBF_PINS it is  *
+ * skipped when the RXnBF pins show both receive buffers empty). The TXnIF    *
+ * flags are only fetched, with READ STATUS, while at least one transmit      *
+ * buffer started by the driver has not been serviced yet; all of the flags   *
+ * found set are cleared with one BIT MODIFY before the emptied buffers are   *
+ * refilled. A buffer of the driver's with neither TXnIF nor TXREQ set was    *
+ * dropped (One-shot mode) and is refilled in the same way.                   *
+ *                                                                            *
+ * When the ring buffer is full the frame is dropped (and counted), but the   *
+ * receive buffer is still released so the MCP2515 can keep receiving. Any    *
+ * other flag (the error interrupt, which reports receive buffer overflows    *
+ * and error state changes, with CAN_ERROR_MONITOR message errors and with    *
+ * CAN_SLEEP the wake-up) keeps INT LOW after the loop; only then is CANINTF  *
+ * read.                                                                      *
+ ******************************************************************************/
+static void serviceController(uint8_t device) {
+    controllerState *controller = &controllers[device];
+
+    for (;;) {
+#if MCP2515_RXBF_PINS
+        uint8_t rxStatus = rxBufferPins(device) ? readStatus(device, SPI_RX_STATUS) : 0;
+#else
+        uint8_t rxStatus = readStatus(device, SPI_RX_STATUS);
+#endif
+        uint8_t busy     = rxStatus & ((1<<RX_STATUS_RXB1) | (1<<RX_STATUS_RXB0));
+
+        if (busy) {
+            dispatchFrame(device, rxStatus);
+        }
+
+        if (controller->txActive) {
+            uint8_t status = readStatus(device, SPI_READ_STATUS);
+            uint8_t done   = 0;
+            uint8_t ended  = 0;
+
+            for (uint8_t buffer = 0; buffer < 3; buffer++) {
+                if (status & (1<<(STATUS_TX0IF + 2 * buffer))) {
+                    done |= (1<<buffer);
+                } else if (!(status & (1<<(STATUS_TX0REQ + 2 * buffer)))) {
+                    ended |= (1<<buffer);
+                }
+            }
+            // Reserved buffers belong to canTrigger() and the cyclic messages
+            done  &= controller->txActive;
+            ended &= controller->txActive;
+
+            if (done) {
+                bitModify(device, CANINTF, done << TX0IF, 0);
+#if CAN_BUSOFF_RESTARTS
+                controller->busOffStreak = 0;
+#endif
+            }
+
+            // Dropped in One-shot mode: free again, but without TXnIF to clear
+            done |= ended;
+
+            if (done) {
+                for (uint8_t buffer = 0; buffer < 3; buffer++) {
+                    if (done & (1<<buffer)) {
+                        serviceTxBuffer(device, buffer);
+                    }
+                }
+                busy = 1;
+            }
+        }
+
+        if (!busy) {
+            break;
+        }
+    }
+
+    // INT still LOW with no receive or transmit work left: the error flag
+    // (or the wake-up flag)
+    if (messageReceived(device)) {
+        serviceErrorFlags(device);
+    }
+
+#if CAN_BUSOFF_RESTARTS
+    if (controller->restartMode) {
+        finishRestart(device);
+    }
+#endif
+
+    return;
+}
+
+/******************************************************************************
+ * Bus scheduler. Every MCP2515 raises an INT line of its own, but they all   *
+ * share one SPI port. "busQueue" lists the devices waiting to be served in   *
+ * the order their INT lines were seen to fall, and "busWaiting" has bit n    *
+ * set while device n is on the list. The device at the head of the list is   *
+ * served until all of its flags are clear, so its traffic goes out back to   *
+ * back instead of interleaving Chip Select with the other devices, and only  *
+ * then does the scheduler move on.                                           *
+ *                                                                            *
+ * INT lines that fall while a device is being served are picked up by        *
+ * polling the pins before the next device is chosen (several at once are     *
+ * queued in device order), instead of waiting for their own interrupt to     *
+ * fire afterwards. When that interrupt does fire the pin is already HIGH     *
+ * again and the scheduler returns without touching the bus.                  *
+ *                                                                            *
+ * All of this runs from interrupt handlers, which never nest, so it needs no *
+ * locking.                                                                   *
+ ******************************************************************************/
+static void busRequest(uint8_t device) {
+#if CAN_TIMESTAMPS
+    stampEdge(device);
+#endif
+#if MCP2515_PROFILE
+    profileEdge(device);
+#endif
+
+    if (!(busWaiting & (1<<device))) {
+        busWaiting |= (1<<device);
+        busQueue[busLength++] = device;
+    }
+
+    return;
+}
+
+static void busPoll(void) {
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        if (messageReceived(device)) {
+            busRequest(device);
+        }
+    }
+
+    return;
+}
+
+static void serviceBus(void) {
+    while (busLength) {
+        uint8_t device = busQueue[0];
+
+        if (messageReceived(device)) {
+            serviceController(device);
+        }
+#if CAN_TIMESTAMPS
+        // An edge that only announced transmit flags stamps nothing
+        controllers[device].edgePending = 0;
+#endif
+#if MCP2515_PROFILE
+        controllers[device].profileEdgePending = 0;
+#endif
+
+        busLength--;
+#if MCP2515_DEVICE_COUNT > 1
+        for (uint8_t i = 0; i < busLength; i++) {
+            busQueue[i] = busQueue[i + 1];
+        }
+#endif
+        busWaiting &= ~(1<<device);
+
+        busPoll();
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Called by the INT line interrupts once the devices that need attention     *
+ * have been queued. If the asynchronous SPI engine owns the bus right now,   *
+ * the SPI interrupt runs the scheduler as soon as its queue runs dry.        *
+ ******************************************************************************/
+static void busInterrupt(void) {
+    if (!spiCurrent) {
+        serviceBus();
+    }
+
+    return;
+}
+
+#ifdef MCP2515_INT0_ISR
+// Falling edge on PD2 with the ATmega328 backend
+MCP2515_INT0_ISR {
+    PROF_ISR_BEGIN();
+
+    busRequest(MCP2515_INT0_DEVICE);
+    busInterrupt();
+
+    PROF_ISR_END();
+}
+#endif
+
+#ifdef MCP2515_INT1_ISR
+// Falling edge on PD3 with the ATmega328 backend
+MCP2515_INT1_ISR {
+    PROF_ISR_BEGIN();
+
+    busRequest(MCP2515_INT1_DEVICE);
+    busInterrupt();
+
+    PROF_ISR_END();
+}
+#endif
+
+#ifdef MCP2515_SHARED_ISR
+// Any edge on the other PORTD pins with the ATmega328 backend; only devices
+// whose INT is LOW are queued
+MCP2515_SHARED_ISR {
+    PROF_ISR_BEGIN();
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        if (interruptShared(device) && messageReceived(device)) {
+            busRequest(device);
+        }
+    }
+    busInterrupt();
+
+    PROF_ISR_END();
+}
+#endif
+
+/******************************************************************************
+ * Counts how many distinct values the identifiers take once "mask" is        *
+ * applied. Every distinct value needs an acceptance filter of its own.       *
+ ******************************************************************************/
+static uint8_t countFilterGroups(const uint32_t *ids, uint8_t count, uint32_t mask) {
+    uint8_t groups = 0;
+
+    for (uint8_t i = 0; i < count; i++) {
+        uint8_t j = 0;
+
+        while (j < i && ((ids[i] ^ ids[j]) & mask)) {
+            j++;
+        }
+        if (j == i) {
+            groups++;
+        }
+    }
+
+    return groups;
+}
+
+/******************************************************************************
+ * Works out the acceptance mask for one receive buffer. Starting from an     *
+ * exact match on every identifier bit, the mask gives up one bit at a time,  *
+ * each time dropping the bit whose removal merges the most identifiers,      *
+ * until the remaining distinct values fit into the buffer's "filters"        *
+ * acceptance filters. Keeping as many mask bits as possible keeps the number *
+ * of unwanted identifiers that slip through as low as possible.              *
+ ******************************************************************************/
+static uint32_t chooseFilterMask(const uint32_t *ids, uint8_t count, uint8_t filters, uint32_t mask) {
+    while (countFilterGroups(ids, count, mask) > filters) {
+        uint32_t bestBit    = 0;
+        uint8_t  bestGroups = 0xFF;
+
+        for (uint32_t bit = 1; bit & CAN_EXTENDED_MASK; bit <<= 1) {
+            if (mask & bit) {
+                uint8_t groups = countFilterGroups(ids, count, mask & ~bit);
+
+                if (groups < bestGroups) {
+                    bestGroups = groups;
+                    bestBit    = bit;
+                }
+            }
+        }
+
+        mask &= ~bestBit;
+    }
+
+    return mask;
+}
+
+/******************************************************************************
+ * Programs the mask and acceptance filters of one receive buffer for a list  *
+ * of identifiers that are all of the same type. "flag" is CAN_EXTENDED_FLAG  *
+ * for extended identifiers and 0 for standard ones. Filters that are not     *
+ * needed repeat the first one, so they never open up anything extra.         *
+ *                                                                            *
+ * For standard identifiers the EID bits of the mask are left clear; the      *
+ * MCP2515 would otherwise compare them against the first two data bytes.     *
+ ******************************************************************************/
+static void programReceiveFilters(uint8_t device, const uint8_t *filterAddresses, uint8_t filters,
+                                  uint8_t maskAddress, const uint32_t *ids, uint8_t count,
+                                  uint32_t flag) {
+    uint32_t fullMask = flag ? CAN_EXTENDED_MASK : CAN_STANDARD_MASK;
+    uint32_t mask     = chooseFilterMask(ids, count, filters, fullMask);
+    uint8_t  regs[4];
+    uint8_t  used     = 0;
+
+    packIdentifier(mask | flag, regs);
+    regs[1] &= ~(1<<EXIDE);
+    writeRegisters(device, maskAddress, regs, 4);
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (countFilterGroups(ids, i + 1, mask) > used) {
+            packIdentifier((ids[i] & mask) | flag, regs);
+            writeRegisters(device, filterAddresses[used++], regs, 4);
+        }
+    }
+
+    packIdentifier((ids[0] & mask) | flag, regs);
+    while (used < filters) {
+        writeRegisters(device, filterAddresses[used++], regs, 4);
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Configures the MCP2515 acceptance masks and filters so that only the       *
+ * listed identifiers (plus as few others as possible) ever reach a receive   *
+ * buffer. Extended identifiers are marked with CAN_EXTENDED_FLAG. With an    *
+ * empty list every frame is accepted.                                        *
+ *                                                                            *
+ * RXB0 has one mask (RXM0) and two filters (RXF0-RXF1); RXB1 has one mask    *
+ * (RXM1) and four filters (RXF2-RXF5). A mask can only serve one frame type  *
+ * without also matching data bytes, so when the list mixes standard and      *
+ * extended identifiers each type gets a receive buffer of its own, with the  *
+ * larger group in RXB1. When the list holds a single type, the identifiers   *
+ * are first grouped as if there were six filters under one mask; two of      *
+ * those groups go to RXB0 and the rest to RXB1, and each buffer then gets a  *
+ * mask of its own.                                                           *
+ *                                                                            *
+ * Returns 1 on success and 0 if the list holds more than CAN_FILTER_MAX_IDS  *
+ * identifiers. Filters can only be changed in Configuration Mode, which      *
+ * initController() leaves the MCP2515 in.                                    *
+ ******************************************************************************/
+uint8_t setAcceptanceFilters(uint8_t device, const uint32_t *ids, uint8_t count) {
+    static const uint8_t rxb0Filters[2] = { RXF0SIDH, RXF1SIDH };
+    static const uint8_t rxb1Filters[4] = { RXF2SIDH, RXF3SIDH, RXF4SIDH, RXF5SIDH };
+    uint32_t values[CAN_FILTER_MAX_IDS];
+    uint8_t  split = 0;
+
+    if (count > CAN_FILTER_MAX_IDS) {
+        return 0;
+    }
+
+    if (count == 0) {
+        static const uint8_t zero[4] = { 0, 0, 0, 0 };
+
+        writeRegisters(device, RXM0SIDH, zero, 4);
+        writeRegisters(device, RXM1SIDH, zero, 4);
+        // A zero mask still only passes the frame type of each filter's
+        // EXIDE bit, so RXM = 11 turns the filters off altogether
+        bitModify(device, RXB0CTRL, (1<<RXM1) | (1<<RXM0), (1<<RXM1) | (1<<RXM0));
+        bitModify(device, RXB1CTRL, (1<<RXM1) | (1<<RXM0), (1<<RXM1) | (1<<RXM0));
+
+        return 1;
+    }
+
+    // Standard identifiers first, then extended ones
+    for (uint8_t i = 0; i < count; i++) {
+        if (!(ids[i] & CAN_EXTENDED_FLAG)) {
+            values[split++] = ids[i] & CAN_STANDARD_MASK;
+        }
+    }
+    for (uint8_t i = 0, j = split; i < count; i++) {
+        if (ids[i] & CAN_EXTENDED_FLAG) {
+            values[j++] = ids[i] & CAN_EXTENDED_MASK;
+        }
+    }
+
+    if (split == 0 || split == count) {
+        // A single type: move the first two six-filter groups to the front
+        uint32_t flag = split ? 0 : CAN_EXTENDED_FLAG;
+        uint32_t mask = chooseFilterMask(values, count, 6,
+                                         flag ? CAN_EXTENDED_MASK : CAN_STANDARD_MASK);
+        uint32_t key0 = values[0] & mask;
+        uint32_t key1 = key0;
+
+        split = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            uint32_t key = values[i] & mask;
+
+            if (key != key0 && key1 == key0) {
+                key1 = key;
+            }
+            if (key == key0 || key == key1) {
+                uint32_t value = values[i];
+
+                values[i]       = values[split];
+                values[split++] = value;
+            }
+        }
+
+        programReceiveFilters(device, rxb0Filters, 2, RXM0SIDH, values, split, flag);
+
+        // Everything fitted into RXB0: let RXB1 repeat the same set
+        if (split == count) {
+            programReceiveFilters(device, rxb1Filters, 4, RXM1SIDH, values, split, flag);
+        } else {
+            programReceiveFilters(device, rxb1Filters, 4, RXM1SIDH, values + split, count - split, flag);
+        }
+    } else if (split < count - split) {
+        programReceiveFilters(device, rxb0Filters, 2, RXM0SIDH, values, split, 0);
+        programReceiveFilters(device, rxb1Filters, 4, RXM1SIDH, values + split, count - split,
+                              CAN_EXTENDED_FLAG);
+    } else {
+        programReceiveFilters(device, rxb0Filters, 2, RXM0SIDH, values + split, count - split,
+                              CAN_EXTENDED_FLAG);
+        programReceiveFilters(device, rxb1Filters, 4, RXM1SIDH, values, split, 0);
+    }
+
+    bitModify(device, RXB0CTRL, (1<<RXM1) | (1<<RXM0), 0);
+    bitModify(device, RXB1CTRL, (1<<RXM1) | (1<<RXM0), 0);
+
+    return 1;
+}
+
+/******************************************************************************
+ * Changes the SPI clock to fosc/"divider" at run time, for example to start  *
+ * at a slow, safe rate and speed up once the wiring has been checked. Valid  *
+ * dividers are 2, 4, 8, 16, 32, 64 and 128; SPI2X in SPSR is set for 2, 8    *
+ * and 32. Returns 0 and leaves the clock alone for any other value.          *
+ ******************************************************************************/
+uint8_t setSpiClockDivider(uint8_t divider) {
+    uint8_t changed;
+
+    SPI_BLOCK {
+        changed = spiSetDivider(divider);
+    }
+
+    return changed;
+}
+
+/******************************************************************************
+ ******************************************************************************/
+uint8_t initController(uint8_t device) {
+    // Pull "Chip Select" pin HIGH (disabling Slave)
+    // Configure "Chip Select" pin as an OUTPUT
+    chipSelectInit(device);
+
+    // Configure "Interrupt" pin as an INPUT
+    // Configure "Interrupt" pin HIGH
+    interruptPinInit(device);
+
+    // Set the SPI pins up and enable SPI (see spiPortInit())
+    spiPortInit();
+
+    // Perform a reset on MCP2515 controller
+    resetController(device);
+
+    // Give controller time for reset to complete
+    delayUs(10);
+
+    // Load Configuration registers (see mcp2515timing.h)
+    // Raise INT when either receive buffer fills
+    // Raise INT when a transmit buffer empties (except reserved buffers)
+    // Raise INT on errors, which include receive buffer overflows
+    // Raise INT on every message error too, with CAN_ERROR_MONITOR
+    // Raise INT on wake-up, past the wake-up filter, with CAN_SLEEP
+    // CNF3, CNF2, CNF1 and CANINTE sit at consecutive addresses, so one
+    // write instruction fills all four
+    const uint8_t config[4] = {
+        MCP2515_CNF3_VALUE | (CAN_SLEEP ? (1<<WAKFIL) : 0),
+        MCP2515_CNF2_VALUE,
+        MCP2515_CNF1_VALUE,
+        (((1<<TX2IE) | (1<<TX1IE) | (1<<TX0IE)) & ~(MCP2515_RESERVED_TX_BUFFERS<<TX0IE)) |
+        (CAN_ERROR_MONITOR ? (1<<MERRE) : 0) | (CAN_SLEEP ? (1<<WAKIE) : 0) |
+        (1<<ERRIE) | (1<<RX1IE) | (1<<RX0IE)
+    };
+    writeRegisters(device, CNF3, config, sizeof(config));
+
+#if MCP2515_RX_ROLLOVER
+    // Let RXB0 roll over into RXB1 when it is still full
+    writeToRegister(device, RXB0CTRL, (1<<BUKT));
+#endif
+
+#if MCP2515_RXBF_PINS || MCP2515_TXRTS_BUFFERS
+    // RXnBF: buffer full interrupt outputs (if MCP2515_RXBF_PINS)
+    // TXnRTS: request-to-send inputs for MCP2515_TXRTS_BUFFERS
+    // BFPCTRL and TXRTSCTRL are neighbours, so one write sets both
+    const uint8_t pins[2] = {
+        MCP2515_RXBF_PINS ? ((1<<B1BFE) | (1<<B0BFE) | (1<<B1BFM) | (1<<B0BFM)) : 0,
+        MCP2515_TXRTS_BUFFERS
+    };
+    writeRegisters(device, BFPCTRL, pins, sizeof(pins));
+#endif
+
+#if MCP2515_TXRTS_BUFFERS
+    txRtsInit(device);
+#endif
+
+    controllerState *controller = &controllers[device];
+
+    CRITICAL_BLOCK {
+#if CAN_FRAME_POOL
+        // Frames still queued or unread from before go back to the pool
+        for (uint8_t i = 0; i < controller->txCount; i++) {
+            returnSlot(controller->txSlots[controller->txOrder[i]]);
+        }
+        for (uint8_t tail = controller->rxTail; tail != controller->rxHead; tail++) {
+            returnSlot(controller->rxRing[tail & (CAN_RX_BUFFER_SIZE - 1)]);
+        }
+#endif
+
+        // Every transmit queue slot starts out free, the ring empty and
+        // no transmit buffer in flight: the reset emptied them all
+        for (uint8_t slot = 0; slot < CAN_TX_QUEUE_SIZE; slot++) {
+            controller->txOrder[slot] = slot;
+        }
+        controller->txCount  = 0;
+        controller->rxHead   = 0;
+        controller->rxTail   = 0;
+        controller->txActive = 0;
+    }
+
+#if CAN_TIMESTAMPS || MCP2515_PROFILE
+    // Start the timestamp or profiling clock (see timerInit())
+    timerInit();
+#endif
+
+    // Watch the "Interrupt" pin: falling edge on INT0/INT1, else PCINT2
+    // Clear any edge latched before the handler was ready
+    // (global interrupts are left to the application's sei())
+    interruptEnable(device);
+
+    return spiGet();
 }
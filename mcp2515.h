@@ -1,6 +1,13 @@
 #ifndef _MCP2515_H_
 #define _MCP2515_H_
 
+#include <stdint.h>
+#include <string.h>
+#include "mcp2515config.h"
+#include "mcp2515registers.h"
+#include "mcp2515hal.h"
+#include "mcp2515prof.h"
+
 /******************************************************************************
  * SPI Commands                                                               *
  ******************************************************************************/
@@ -8,11 +15,293 @@
 #define SPI_READ        0x03
 #define SPI_READ_RX     0x90
 #define SPI_WRITE       0x02
-#define SPI_WRITE_RX    0x40
+#define SPI_LOAD_TX     0x40
+#define SPI_WRITE_RX    SPI_LOAD_TX
 #define SPI_RTS         0x80
 #define SPI_READ_STATUS 0xA0
 #define SPI_RX_STATUS   0xB0
 #define SPI_BIT_MODIFY  0x05
 
+// READ RX BUFFER variants: start at RXBnSIDH or at RXBnD0 of buffer "n"
+#define SPI_READ_RX_SIDH(n) (SPI_READ_RX | ((n) << 2))
+#define SPI_READ_RX_DATA(n) (SPI_READ_RX | ((n) << 2) | 0x02)
+
+// LOAD TX BUFFER variants: start at TXBnSIDH or at TXBnD0 of buffer "n"
+#define SPI_LOAD_TX_SIDH(n) (SPI_LOAD_TX | ((n) << 1))
+#define SPI_LOAD_TX_DATA(n) (SPI_LOAD_TX | ((n) << 1) | 0x01)
+
+// REQUEST TO SEND for transmit buffer "n"
+#define SPI_RTS_TXB(n)      (SPI_RTS | (1 << (n)))
+
+/******************************************************************************
+ * READ STATUS Response Bits                                                  *
+ ******************************************************************************/
+#define STATUS_RX0IF  0
+#define STATUS_RX1IF  1
+#define STATUS_TX0REQ 2
+#define STATUS_TX0IF  3
+#define STATUS_TX1REQ 4
+#define STATUS_TX1IF  5
+#define STATUS_TX2REQ 6
+#define STATUS_TX2IF  7
+
+// Every READ STATUS bit that reflects a CANINTF flag
+#define STATUS_INTERRUPT_MASK ((1<<STATUS_RX0IF) | (1<<STATUS_RX1IF) | \
+                               (1<<STATUS_TX0IF) | (1<<STATUS_TX1IF) | \
+                               (1<<STATUS_TX2IF))
+
+/******************************************************************************
+ * RX STATUS Response Bits                                                    *
+ ******************************************************************************/
+#define RX_STATUS_RXB1        7
+#define RX_STATUS_RXB0        6
+#define RX_STATUS_EXTENDED    4
+#define RX_STATUS_REMOTE      3
+#define RX_STATUS_FILTER_MASK 0x07
+
+/******************************************************************************
+ * CAN Frames                                                                 *
+ *                                                                            *
+ * A canFrame is laid out byte for byte like the SIDH, SIDL, EID8, EID0, DLC  *
+ * and D0..D7 registers of a receive or transmit buffer (RXBnSIDH.. and       *
+ * TXBnSIDH.. in mcp2515registers.h). READ RX BUFFER streams a frame straight *
+ * into a ring buffer slot and LOAD TX BUFFER streams it straight back out,   *
+ * so a frame is never repacked on its way through the driver and a received  *
+ * frame can be forwarded as it is.                                           *
+ *                                                                            *
+ * Identifiers are handed to and from the accessors below right-aligned (11   *
+ * bits for a standard frame, 29 bits for an extended frame), with the frame  *
+ * type carried in the top bits, so a single 32-bit compare tells two         *
+ * identifiers apart.                                                         *
+ *                                                                            *
+ * For remote frames the driver keeps the RTR bit in DLC set, whatever the    *
+ * frame type; the receive path copies the SRR bit of a standard frame into   *
+ * it.                                                                        *
+ ******************************************************************************/
+#define CAN_EXTENDED_FLAG 0x80000000UL
+#define CAN_RTR_FLAG      0x40000000UL
+#define CAN_STANDARD_MASK 0x000007FFUL
+#define CAN_EXTENDED_MASK 0x1FFFFFFFUL
+
+// Transmit priorities, written into the TXP bits of TXBnCTRL
+#define CAN_PRIORITY_LOWEST  0
+#define CAN_PRIORITY_LOW     1
+#define CAN_PRIORITY_HIGH    2
+#define CAN_PRIORITY_HIGHEST 3
+
+typedef struct __attribute__((packed)) {
+    uint8_t sidh;
+    uint8_t sidl;
+    uint8_t eid8;
+    uint8_t eid0;
+    uint8_t dlc;
+    uint8_t data[8];
+} canFrame;
+
+/******************************************************************************
+ * Packed identifiers. A canPackedId holds SIDH, SIDL, EID8 and EID0 exactly  *
+ * as they sit in memory (SIDH in the low byte on the little-endian AVR),     *
+ * with the bits that do not belong to the identifier cleared. Two frames     *
+ * carry the same identifier and frame type exactly when their packed         *
+ * identifiers are equal, so a frame can be matched against a constant from   *
+ * canPackId() without decoding it first.                                     *
+ ******************************************************************************/
+typedef uint32_t canPackedId;
+
+#define CAN_INLINE static inline __attribute__((always_inline))
+
+// Packs an identifier (with its CAN_EXTENDED_FLAG bit) into the buffer register layout
+CAN_INLINE canPackedId canPackId(uint32_t id) {
+    uint32_t extended = -(id >> 31);
+    uint32_t sid      = (id >> (extended & 18)) & CAN_STANDARD_MASK;
+    uint32_t eid      = id & extended & 0x3FFFFUL;
+
+    return (sid >> 3) |
+           (((sid << 5) & 0xE0) | (extended & (1<<EXIDE)) | (eid >> 16)) << 8 |
+           ((eid & 0xFF00) << 8) |
+           ((eid & 0x00FF) << 24);
+}
+
+// The packed identifier of a frame; EID8/EID0 only count for extended frames
+CAN_INLINE canPackedId canFramePackedId(const canFrame *frame) {
+    canPackedId packed;
+    uint32_t    extended = -(uint32_t)((frame->sidl >> IDE) & 1);
+
+    memcpy(&packed, frame, sizeof(packed));
+
+    return packed & (0x0000E8FFUL | (extended & 0xFFFF0300UL));
+}
+
+// Right-aligned identifier with CAN_EXTENDED_FLAG and CAN_RTR_FLAG folded in
+CAN_INLINE uint32_t canGetId(const canFrame *frame) {
+    uint32_t extended = -(uint32_t)((frame->sidl >> IDE) & 1);
+    uint32_t sid      = ((uint32_t)frame->sidh << 3) | (frame->sidl >> 5);
+    uint32_t eid      = (sid << 18) | ((uint32_t)(frame->sidl & 0x03) << 16) |
+                        ((uint32_t)frame->eid8 << 8) | frame->eid0;
+    uint32_t rtr      = (uint32_t)((frame->dlc >> RTR) & 1) << 30;
+
+    return (sid & ~extended) | ((eid | CAN_EXTENDED_FLAG) & extended) | rtr;
+}
+
+// Sets identifier, frame type and (from CAN_RTR_FLAG) the RTR bit of a frame
+CAN_INLINE void canSetId(canFrame *frame, uint32_t id) {
+    canPackedId packed = canPackId(id);
+
+    memcpy(frame, &packed, sizeof(packed));
+    frame->dlc = (frame->dlc & DLC_MASK) | (uint8_t)(((id >> 30) & 1) << RTR);
+}
+
+// Number of data bytes the frame carries (0 for a remote frame)
+CAN_INLINE uint8_t canGetLength(const canFrame *frame) {
+    uint8_t dlc = frame->dlc & DLC_MASK;
+
+    dlc = (dlc > 8) ? 8 : dlc;
+
+    return dlc & (uint8_t)(((frame->dlc >> RTR) & 1) - 1);
+}
+
+// Sets the data length code (0-8) and keeps the RTR bit
+CAN_INLINE void canSetLength(canFrame *frame, uint8_t length) {
+    frame->dlc = (frame->dlc & (1<<RTR)) | (length & DLC_MASK);
+}
+
+/******************************************************************************
+ * Lost frame counters (see readOverflowCounters()). "rxOverflow" counts the  *
+ * RX0OVR/RX1OVR events of the MCP2515, i.e. frames that found the receive    *
+ * buffer still full, which points at the INT handler or the SPI bus being    *
+ * too slow. "ringOverrun" counts frames that were taken off the MCP2515 but  *
+ * dropped because the ring buffer was full, which points at the application  *
+ * not calling canRead() often enough. The counters stop at their maximum     *
+ * instead of wrapping.                                                       *
+ ******************************************************************************/
+typedef struct {
+    uint16_t rxOverflow[2];
+    uint16_t ringOverrun;
+} canOverflowCounters;
+
+/******************************************************************************
+ * Error states (see readErrorCounters()), as EFLG reports them: warning once *
+ * TEC or REC reaches 96, error-passive once either reaches 128 and bus-off   *
+ * once TEC passes 255.                                                       *
+ ******************************************************************************/
+#define CAN_ERROR_ACTIVE  0
+#define CAN_ERROR_WARNING 1
+#define CAN_ERROR_PASSIVE 2
+#define CAN_ERROR_BUS_OFF 3
+
+// Error counter histogram bins, each 32 counts wide
+#define CAN_ERROR_BINS 8
+
+/******************************************************************************
+ * Error counters (CAN_ERROR_MONITOR). "state", "tec" and "rec" are the error *
+ * state and the error counters as last seen, "tecPeak" and "recPeak" the     *
+ * highest counts seen. "entered" counts the changes into each state          *
+ * (entered[CAN_ERROR_ACTIVE] being recoveries) and "restarts" the bus-offs   *
+ * the recovery policy cut short. The histograms get one sample of each error *
+ * counter per error interrupt and per message error, bin n holding the       *
+ * samples from 32 * n to 32 * n + 31. The counters stop at their maximum     *
+ * instead of wrapping.                                                       *
+ ******************************************************************************/
+typedef struct {
+    uint8_t  state;
+    uint8_t  tec;
+    uint8_t  rec;
+    uint8_t  tecPeak;
+    uint8_t  recPeak;
+    uint16_t entered[4];
+    uint16_t restarts;
+    uint16_t tecHistogram[CAN_ERROR_BINS];
+    uint16_t recHistogram[CAN_ERROR_BINS];
+} canErrorCounters;
+
+#if CAN_FRAME_POOL
+// No pool slot (canAllocSlot() with the pool empty)
+#define CAN_NO_SLOT 0xFF
+#endif
+
+// Receive handler installed per acceptance filter with setFilterHandler()
+typedef void (*canFilterHandler)(uint8_t device, const canFrame *frame);
+
+/******************************************************************************
+ * Asynchronous SPI transactions (see spiSubmit())                            *
+ ******************************************************************************/
+#define SPI_ASYNC_ADDRESS 0x01
+
+typedef struct spiTransaction {
+    spiChipSelect     cs;
+    uint8_t           opcode;
+    uint8_t           address;
+    uint8_t           flags;
+    const uint8_t    *tx;
+    uint8_t          *rx;
+    uint8_t           length;
+    void            (*complete)(struct spiTransaction *transaction);
+    struct spiTransaction *next;
+} spiTransaction;
+
+/******************************************************************************
+ * Driver API                                                                 *
+ ******************************************************************************/
+uint8_t messageReceived(uint8_t device);
+uint8_t sendData(uint8_t data);
+void    writeToRegister(uint8_t device, uint8_t address, uint8_t data);
+uint8_t readRegister(uint8_t device, uint8_t address);
+void    writeRegisters(uint8_t device, uint8_t address, const uint8_t *data, uint8_t length);
+void    readRegisters(uint8_t device, uint8_t address, uint8_t *data, uint8_t length);
+void    bitModify(uint8_t device, uint8_t address, uint8_t mask, uint8_t data);
+uint8_t readStatus(uint8_t device, uint8_t readType);
+void    resetController(uint8_t device);
+uint8_t initController(uint8_t device);
+uint8_t setMode(uint8_t device, uint8_t mode);
+uint8_t readMode(uint8_t device);
+void    setOneShot(uint8_t device, uint8_t enabled);
+#if CAN_SLEEP
+uint8_t canSleep(uint8_t device);
+#endif
+uint8_t setSpiClockDivider(uint8_t divider);
+void    spiSubmit(spiTransaction *transaction);
+uint8_t spiBusy(void);
+void    readFrame(uint8_t device, uint8_t buffer, canFrame *frame);
+uint8_t canRead(uint8_t device, canFrame *frame);
+uint8_t canReadTimestamped(uint8_t device, canFrame *frame, uint32_t *timestamp);
+void    loadTxBuffer(uint8_t device, uint8_t buffer, const canFrame *frame);
+void    requestToSend(uint8_t device, uint8_t buffers);
+uint8_t sendFrame(uint8_t device, const canFrame *frame);
+uint8_t canWrite(uint8_t device, const canFrame *frame, uint8_t priority);
+#if CAN_FRAME_POOL
+uint8_t   canAllocSlot(void);
+uint8_t   canFreeSlot(uint8_t slot);
+canFrame *canSlotFrame(uint8_t slot);
+uint8_t   canReadSlot(uint8_t device, uint8_t *slot, uint32_t *timestamp);
+uint8_t   canWriteSlot(uint8_t device, uint8_t slot, uint8_t priority);
+#endif
+#if MCP2515_RESERVED_TX_BUFFERS
+uint8_t canPreload(uint8_t device, uint8_t buffer, const canFrame *frame, uint8_t priority);
+void    loadTxData(uint8_t device, uint8_t buffer, const uint8_t *data, uint8_t length);
+#endif
+#if CAN_ISOTP_CHANNELS
+void    transmitSegment(uint8_t device, uint8_t buffer, uint8_t priority, const canFrame *head,
+                        uint8_t headLength, const uint8_t *data, uint8_t length, uint8_t padding);
+#endif
+#if MCP2515_TXRTS_BUFFERS
+void    canTrigger(uint8_t device, uint8_t buffer);
+#endif
+#if MCP2515_RXBF_PINS
+uint8_t receiveBuffersFull(uint8_t device);
+#endif
+uint8_t setAcceptanceFilters(uint8_t device, const uint32_t *ids, uint8_t count);
+void    setFilterHandler(uint8_t device, uint8_t filter, canFilterHandler handler);
+void    readOverflowCounters(uint8_t device, canOverflowCounters *counters, uint8_t clear);
+#if CAN_ERROR_MONITOR
+void    readErrorCounters(uint8_t device, canErrorCounters *counters, uint8_t clear);
+#endif
+#if MCP2515_PROFILE
+void    readProfile(canProfile *profile, uint8_t clear);
+#endif
+#if CAN_TIMESTAMPS
+uint32_t canTimestamp(void);
+uint32_t canHandlerTimestamp(uint8_t device);
+#endif
+
 
 #endif
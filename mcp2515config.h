@@ -0,0 +1,474 @@
+#ifndef _MCP2515CONFIG_H_
+#define _MCP2515CONFIG_H_
+
+/******************************************************************************
+ * Compile-time configuration for the MCP2515 driver. Every option can be     *
+ * overridden from the compiler command line (e.g. -DCAN_RX_BUFFER_SIZE=32)   *
+ * without editing this file.                                                 *
+ ******************************************************************************/
+
+/******************************************************************************
+ * Pin mapping. Each MCP2515 on the SPI bus is numbered from 0 and has its    *
+ * own Chip Select pin (any port) and INT pin (any PORTD pin). Everything is  *
+ * resolved at compile time by mcp2515pins.h, so selecting a device is a      *
+ * single cbi/sbi instruction. Device 0 defaults to the Arduino Uno wiring:   *
+ * CS on D10 (PB2) and INT on D2 (PD2, the INT0 pin).                         *
+ *                                                                            *
+ * INT pins on PD2 and PD3 use INT0 and INT1; any other PORTD pin uses the    *
+ * pin change interrupt PCINT2. The driver defines the handlers for the ones  *
+ * it needs, so the application must not define them as well.                *
+ ******************************************************************************/
+#ifndef MCP2515_DEVICE_COUNT
+#define MCP2515_DEVICE_COUNT 1
+#endif
+
+#if (MCP2515_DEVICE_COUNT < 1) || (MCP2515_DEVICE_COUNT > 3)
+#error "MCP2515_DEVICE_COUNT must be 1, 2 or 3"
+#endif
+
+#ifndef MCP2515_DEV0_CS_PORT
+#define MCP2515_DEV0_CS_PORT PORTB
+#define MCP2515_DEV0_CS_DDR  DDRB
+#define MCP2515_DEV0_CS_BIT  2
+#endif
+
+#ifndef MCP2515_DEV0_INT_BIT
+#define MCP2515_DEV0_INT_BIT 2
+#endif
+
+#if (MCP2515_DEVICE_COUNT > 1) && !defined(MCP2515_DEV1_CS_PORT)
+#define MCP2515_DEV1_CS_PORT PORTB
+#define MCP2515_DEV1_CS_DDR  DDRB
+#define MCP2515_DEV1_CS_BIT  1
+#endif
+
+#if (MCP2515_DEVICE_COUNT > 1) && !defined(MCP2515_DEV1_INT_BIT)
+#define MCP2515_DEV1_INT_BIT 3
+#endif
+
+#if (MCP2515_DEVICE_COUNT > 2) && !defined(MCP2515_DEV2_CS_PORT)
+#define MCP2515_DEV2_CS_PORT PORTB
+#define MCP2515_DEV2_CS_DDR  DDRB
+#define MCP2515_DEV2_CS_BIT  0
+#endif
+
+#if (MCP2515_DEVICE_COUNT > 2) && !defined(MCP2515_DEV2_INT_BIT)
+#define MCP2515_DEV2_INT_BIT 4
+#endif
+
+/******************************************************************************
+ * Buffer full and request-to-send pins. With MCP2515_RXBF_PINS set to 1,     *
+ * RX0BF and RX1BF of every device are set up as buffer full interrupt        *
+ * outputs, so the driver (and receiveBuffersFull()) can tell from a GPIO     *
+ * read whether a receive buffer holds a frame and skips the RX STATUS        *
+ * instruction when neither does. Both pins of a device go to one AVR port:   *
+ * MCP2515_DEVn_RXBF_PIN is its PIN register and                              *
+ * MCP2515_DEVn_RX0BF_BIT/RX1BF_BIT the bits.                                 *
+ *                                                                            *
+ * MCP2515_TXRTS_BUFFERS is a bitmask of transmit buffers (bit n for TXBn)    *
+ * whose TXnRTS pin starts a transmission. Those buffers are taken out of the *
+ * driver's transmit queue: canPreload() fills one and canTrigger() pulses    *
+ * its pin, which sends the frame without any SPI traffic, as often as        *
+ * needed. The TXnRTS pins of a device share one AVR port too:                *
+ * MCP2515_DEVn_TXRTS_PORT/TXRTS_DDR and MCP2515_DEVn_TX0RTS_BIT..TX2RTS_BIT. *
+ *                                                                            *
+ * Device 0 defaults to RX0BF/RX1BF on A0/A1 (PC0/PC1) and TX0RTS..TX2RTS on  *
+ * A2..A4 (PC2..PC4); the other devices have no defaults.                     *
+ ******************************************************************************/
+#ifndef MCP2515_RXBF_PINS
+#define MCP2515_RXBF_PINS 0
+#endif
+
+#ifndef MCP2515_TXRTS_BUFFERS
+#define MCP2515_TXRTS_BUFFERS 0
+#endif
+
+#if (MCP2515_TXRTS_BUFFERS < 0) || (MCP2515_TXRTS_BUFFERS > 7)
+#error "MCP2515_TXRTS_BUFFERS is a bitmask of TXB0-TXB2"
+#endif
+
+#if MCP2515_RXBF_PINS && !defined(MCP2515_DEV0_RXBF_PIN)
+#define MCP2515_DEV0_RXBF_PIN   PINC
+#define MCP2515_DEV0_RX0BF_BIT  0
+#define MCP2515_DEV0_RX1BF_BIT  1
+#endif
+
+#if MCP2515_TXRTS_BUFFERS && !defined(MCP2515_DEV0_TXRTS_PORT)
+#define MCP2515_DEV0_TXRTS_PORT PORTC
+#define MCP2515_DEV0_TXRTS_DDR  DDRC
+#define MCP2515_DEV0_TX0RTS_BIT 2
+#define MCP2515_DEV0_TX1RTS_BIT 3
+#define MCP2515_DEV0_TX2RTS_BIT 4
+#endif
+
+#if MCP2515_RXBF_PINS && (((MCP2515_DEVICE_COUNT > 1) && !defined(MCP2515_DEV1_RXBF_PIN)) || \
+                          ((MCP2515_DEVICE_COUNT > 2) && !defined(MCP2515_DEV2_RXBF_PIN)))
+#error "MCP2515_RXBF_PINS needs MCP2515_DEVn_RXBF_PIN and RXnBF bits for every device"
+#endif
+
+#if MCP2515_TXRTS_BUFFERS && (((MCP2515_DEVICE_COUNT > 1) && !defined(MCP2515_DEV1_TXRTS_PORT)) || \
+                              ((MCP2515_DEVICE_COUNT > 2) && !defined(MCP2515_DEV2_TXRTS_PORT)))
+#error "MCP2515_TXRTS_BUFFERS needs MCP2515_DEVn_TXRTS_PORT/DDR and TXnRTS bits for every device"
+#endif
+
+/******************************************************************************
+ * Cyclic messages (cancyclic.c). CAN_CYCLIC_BUFFERS is a bitmask of transmit *
+ * buffers (bit n for TXBn, on every device) that are pinned to cyclic        *
+ * messages and, like the TXnRTS buffers, kept out of the driver's transmit   *
+ * queue. CAN_CYCLIC_MAX is the number of cyclic messages that can run at     *
+ * once, and CAN_CYCLIC_TICK_US the Timer2 tick that their periods are        *
+ * counted in.                                                                *
+ ******************************************************************************/
+#ifndef CAN_CYCLIC_BUFFERS
+#define CAN_CYCLIC_BUFFERS 0
+#endif
+
+#ifndef CAN_CYCLIC_MAX
+#define CAN_CYCLIC_MAX 3
+#endif
+
+#ifndef CAN_CYCLIC_TICK_US
+#define CAN_CYCLIC_TICK_US 1000UL
+#endif
+
+#if (CAN_CYCLIC_BUFFERS < 0) || (CAN_CYCLIC_BUFFERS > 7)
+#error "CAN_CYCLIC_BUFFERS is a bitmask of TXB0-TXB2"
+#endif
+
+#if CAN_CYCLIC_BUFFERS & MCP2515_TXRTS_BUFFERS
+#error "A transmit buffer cannot be both a TXnRTS and a cyclic buffer"
+#endif
+
+// Transmit buffers the driver's own transmit queue never uses
+#define MCP2515_RESERVED_TX_BUFFERS (MCP2515_TXRTS_BUFFERS | CAN_CYCLIC_BUFFERS)
+
+#if MCP2515_RESERVED_TX_BUFFERS == 7
+#error "At least one transmit buffer has to be left for the transmit queue"
+#endif
+
+/******************************************************************************
+ * Gateway (cangateway.c). With CAN_GATEWAY set to 1 every received frame is  *
+ * looked up in the routing table that tools/cangwgen.py generates into       *
+ * cangatewayroutes.h ("make GATEWAY_ROUTES=file" does both) and forwarded    *
+ * from inside the INT handler. Routes with a rate limit need CAN_TIMESTAMPS. *
+ * CAN_GATEWAY_ROUTES_HEADER, if defined, names the generated header to       *
+ * include instead (the sim tests build their own).                           *
+ ******************************************************************************/
+#ifndef CAN_GATEWAY
+#define CAN_GATEWAY 0
+#endif
+
+/******************************************************************************
+ * ISO-TP transport (canisotp.c, ISO 15765-2 with normal addressing).         *
+ * CAN_ISOTP_CHANNELS is the number of channels, each a pair of transmit and  *
+ * receive identifiers on one device; left at 0 the transport is not built.   *
+ * Its frames go through the same transmit buffers as the transmit queue, and *
+ * Timer0 ticks every CAN_ISOTP_TICK_US while a transfer runs, to time STmin  *
+ * and the CAN_ISOTP_TIMEOUT_MS flow control timeouts (N_Bs and N_Cr). Frames *
+ * are padded to eight bytes with CAN_ISOTP_PADDING.                          *
+ ******************************************************************************/
+#ifndef CAN_ISOTP_CHANNELS
+#define CAN_ISOTP_CHANNELS 0
+#endif
+
+#ifndef CAN_ISOTP_TICK_US
+#define CAN_ISOTP_TICK_US 100UL
+#endif
+
+#ifndef CAN_ISOTP_TIMEOUT_MS
+#define CAN_ISOTP_TIMEOUT_MS 1000UL
+#endif
+
+#ifndef CAN_ISOTP_PADDING
+#define CAN_ISOTP_PADDING 0xCC
+#endif
+
+#if CAN_ISOTP_TIMEOUT_MS * 1000UL / CAN_ISOTP_TICK_US > 65535UL
+#error "CAN_ISOTP_TIMEOUT_MS is too many CAN_ISOTP_TICK_US ticks"
+#endif
+
+/******************************************************************************
+ * Bus monitor (canmonitor.c). CAN_MONITOR_IDS is the number of identifiers   *
+ * the monitor keeps statistics for, a power of two, at 24 bytes of SRAM      *
+ * each; left at 0 the monitor is not built. It needs CAN_TIMESTAMPS, and     *
+ * writes its snapshots to the UART at CAN_MONITOR_BAUD (8N1), which has to   *
+ * come within 2% of a divider of F_CPU / 8; the default of 250000 is exact   *
+ * at 8 and 16 MHz.                                                           *
+ ******************************************************************************/
+#ifndef CAN_MONITOR_IDS
+#define CAN_MONITOR_IDS 0
+#endif
+
+#ifndef CAN_MONITOR_BAUD
+#define CAN_MONITOR_BAUD 250000UL
+#endif
+
+#if CAN_MONITOR_IDS & (CAN_MONITOR_IDS - 1)
+#error "CAN_MONITOR_IDS must be a power of two"
+#endif
+
+#if CAN_MONITOR_IDS > 128
+#error "CAN_MONITOR_IDS must be 128 or less"
+#endif
+
+/******************************************************************************
+ * Frame logger (canlog.c). CAN_LOG_BUFFER is the size of each of the two     *
+ * UART transmit buffers the logger alternates between, in bytes (22, room    *
+ * for the longest record, to 255); left at 0 the logger is not built. It     *
+ * needs CAN_TIMESTAMPS and sends at CAN_LOG_BAUD (8N1, within 2% of a        *
+ * divider of F_CPU / 8; the default of 1000000 is exact at 8 and 16 MHz).    *
+ * The logger and the bus monitor both take the UART, so only one of them can *
+ * be built in.                                                               *
+ ******************************************************************************/
+#ifndef CAN_LOG_BUFFER
+#define CAN_LOG_BUFFER 0
+#endif
+
+#ifndef CAN_LOG_BAUD
+#define CAN_LOG_BAUD 1000000UL
+#endif
+
+#if CAN_LOG_BUFFER && (CAN_LOG_BUFFER < 22 || CAN_LOG_BUFFER > 255)
+#error "CAN_LOG_BUFFER must be between 22 and 255"
+#endif
+
+#if CAN_LOG_BUFFER && CAN_MONITOR_IDS
+#error "The frame logger and the bus monitor cannot share the UART"
+#endif
+
+/******************************************************************************
+ * Receive buffer rollover. With MCP2515_RX_ROLLOVER set to 1 (the default)   *
+ * initController() sets BUKT in RXB0CTRL, so a frame that arrives while RXB0 *
+ * is still full goes into RXB1 instead of being lost. Frames that are lost   *
+ * anyway are counted (see readOverflowCounters()).                           *
+ ******************************************************************************/
+#ifndef MCP2515_RX_ROLLOVER
+#define MCP2515_RX_ROLLOVER 1
+#endif
+
+/******************************************************************************
+ * Mode changes (see setMode()). The MCP2515 only changes its operation mode  *
+ * between frames and, on the way out of Normal mode, once its pending        *
+ * transmissions are done, so setMode() polls CANSTAT until the new mode      *
+ * shows: first straight after the request, which is where most changes are   *
+ * already seen, then every CAN_MODE_POLL_US, giving up after                 *
+ * CAN_MODE_TIMEOUT_US. The default covers a frame of the longest kind with   *
+ * stuff bits at 125 kbit/s.                                                  *
+ ******************************************************************************/
+#ifndef CAN_MODE_TIMEOUT_US
+#define CAN_MODE_TIMEOUT_US 2000U
+#endif
+
+#ifndef CAN_MODE_POLL_US
+#define CAN_MODE_POLL_US 10U
+#endif
+
+#if CAN_MODE_TIMEOUT_US > 65535U - CAN_MODE_POLL_US
+#error "CAN_MODE_TIMEOUT_US plus CAN_MODE_POLL_US must stay below 65536"
+#endif
+
+/******************************************************************************
+ * Error state monitoring. With CAN_ERROR_MONITOR set to 1 the INT handler    *
+ * follows every device through the error-active, warning, error-passive and  *
+ * bus-off states as ERRIF reports them, counts the transitions and samples   *
+ * TEC and REC into histograms, also on every message error (MERRF), all read *
+ * back with readErrorCounters().                                             *
+ *                                                                            *
+ * CAN_BUSOFF_RESTARTS is the bus-off recovery policy and needs               *
+ * CAN_ERROR_MONITOR. Left at 0 every bus-off waits for the MCP2515 to rejoin *
+ * by itself after 128 times 11 recessive bits. Otherwise the INT handler     *
+ * restarts the controller the moment it goes bus-off (Configuration mode and *
+ * back, which clears TEC and REC) for the first CAN_BUSOFF_RESTARTS bus-offs *
+ * in a row, and then backs off: only the next, 2nd, 4th, 8th and so on are   *
+ * cut short, and the ones in between take the standard recovery, so a node   *
+ * that is itself at fault does not keep disrupting the bus. A frame the      *
+ * driver gets onto the bus starts the count again.                           *
+ ******************************************************************************/
+#ifndef CAN_ERROR_MONITOR
+#define CAN_ERROR_MONITOR 0
+#endif
+
+#ifndef CAN_BUSOFF_RESTARTS
+#define CAN_BUSOFF_RESTARTS 0
+#endif
+
+#if CAN_BUSOFF_RESTARTS && !CAN_ERROR_MONITOR
+#error "CAN_BUSOFF_RESTARTS needs CAN_ERROR_MONITOR"
+#endif
+
+#if CAN_BUSOFF_RESTARTS > 254
+#error "CAN_BUSOFF_RESTARTS must be between 0 and 254"
+#endif
+
+/******************************************************************************
+ * Sleep (canSleep()). CAN_SLEEP set to 1 turns on the wake-up filter (WAKFIL *
+ * in CNF3), which keeps glitches on the bus from waking a sleeping MCP2515,  *
+ * and the wake-up interrupt, which the INT handler answers by putting the    *
+ * device straight back into the mode it went to sleep from. Left at 0 there  *
+ * is no canSleep().                                                          *
+ ******************************************************************************/
+#ifndef CAN_SLEEP
+#define CAN_SLEEP 0
+#endif
+
+/******************************************************************************
+ * Performance counters (mcp2515prof.h). MCP2515_PROFILE set to 1, as "make   *
+ * mcp2515-prof" does, counts SPI traffic, interrupt time, frames and drops,  *
+ * and measures the worst INT-to-buffer latency, all read back with           *
+ * readProfile(). Timer1 runs freely at F_CPU for the measurements unless     *
+ * CAN_TIMESTAMPS already uses it. Left at 0 the instrumentation compiles to  *
+ * nothing.                                                                   *
+ ******************************************************************************/
+#ifndef MCP2515_PROFILE
+#define MCP2515_PROFILE 0
+#endif
+
+/******************************************************************************
+ * Number of frames held by each device's receive ring buffer, which its INT *
+ * handler fills. It has to be a power of two no larger than 128 so that the  *
+ * free-running 8-bit head/tail indices wrap correctly.                       *
+ ******************************************************************************/
+#ifndef CAN_RX_BUFFER_SIZE
+#define CAN_RX_BUFFER_SIZE 16
+#endif
+
+#if (CAN_RX_BUFFER_SIZE & (CAN_RX_BUFFER_SIZE - 1)) || (CAN_RX_BUFFER_SIZE > 128)
+#error "CAN_RX_BUFFER_SIZE must be a power of two no larger than 128"
+#endif
+
+/******************************************************************************
+ * Number of frames the software transmit queue can hold on top of the three  *
+ * hardware transmit buffers.                                                 *
+ ******************************************************************************/
+#ifndef CAN_TX_QUEUE_SIZE
+#define CAN_TX_QUEUE_SIZE 8
+#endif
+
+#if (CAN_TX_QUEUE_SIZE < 1) || (CAN_TX_QUEUE_SIZE > 64)
+#error "CAN_TX_QUEUE_SIZE must be between 1 and 64"
+#endif
+
+/******************************************************************************
+ * Shared frame pool. With CAN_FRAME_POOL set to a number of frames (1 to     *
+ * 254), the receive rings and transmit queues of every device hold one-byte  *
+ * slot numbers, and the frames themselves live in one pool of that many      *
+ * slots, taken and given back in constant time (see canAllocSlot()).         *
+ * CAN_RX_BUFFER_SIZE and CAN_TX_QUEUE_SIZE then only cap how many frames     *
+ * each ring or queue holds, so a busy device uses the room an idle one       *
+ * leaves. Three devices with the default sizes keep 936 bytes of frames      *
+ * without the pool; a pool of 32 takes 416 bytes plus 104 for the slot       *
+ * numbers. A received frame that finds the pool empty counts as a ring       *
+ * overrun. Left at 0, every ring and queue keeps frames of its own.          *
+ ******************************************************************************/
+#ifndef CAN_FRAME_POOL
+#define CAN_FRAME_POOL 0
+#endif
+
+#if CAN_FRAME_POOL > 254
+#error "CAN_FRAME_POOL must be 254 or less"
+#endif
+
+/******************************************************************************
+ * Largest identifier list setAcceptanceFilters() accepts. The list is copied *
+ * onto the stack (four bytes per identifier) while the masks are worked out. *
+ ******************************************************************************/
+#ifndef CAN_FILTER_MAX_IDS
+#define CAN_FILTER_MAX_IDS 32
+#endif
+
+/******************************************************************************
+ * Receive timestamps. With CAN_TIMESTAMPS set to 1 the driver takes over     *
+ * Timer1 (prescaler 8, free running, overflow interrupt) as a 32-bit         *
+ * microsecond clock, and every frame in a receive ring buffer is stamped     *
+ * with the time its device's INT line fell; canReadTimestamped() returns it. *
+ * The clock is a snapshot taken as the INT handler starts, a few             *
+ * microseconds after the edge.                                               *
+ *                                                                            *
+ * For an exact stamp, also wire the INT line of one device to ICP1 (PB0, D8) *
+ * and set CAN_TIMESTAMP_CAPTURE_DEVICE to its device number: Timer1 then     *
+ * latches the falling edge in hardware. PB0 is the default Chip Select of    *
+ * device 2, so move that one elsewhere first.                                *
+ *                                                                            *
+ * The timer belongs to the hardware backend (see mcp2515hal.h); the          *
+ * ATmega328 one needs F_CPU to be 8 or 16 MHz, which turns timer ticks into  *
+ * microseconds with a shift.                                                 *
+ ******************************************************************************/
+#ifndef CAN_TIMESTAMPS
+#define CAN_TIMESTAMPS 0
+#endif
+
+#if defined(CAN_TIMESTAMP_CAPTURE_DEVICE) && !CAN_TIMESTAMPS
+#error "CAN_TIMESTAMP_CAPTURE_DEVICE needs CAN_TIMESTAMPS"
+#endif
+
+/******************************************************************************
+ * SPI clock divider (fosc/N) used by initController(). Valid values are 2,   *
+ * 4, 8, 16, 32, 64 and 128; 2, 8 and 32 use the SPI2X double-speed bit. The  *
+ * MCP2515 accepts up to 10 MHz, so fosc/2 (8 MHz on a 16 MHz Uno) is fine on *
+ * boards with clean wiring. The default of 16 keeps the original 1 MHz       *
+ * clock.                                                                     *
+ ******************************************************************************/
+#ifndef MCP2515_SPI_CLOCK_DIV
+#define MCP2515_SPI_CLOCK_DIV 16
+#endif
+
+#if   MCP2515_SPI_CLOCK_DIV == 2
+#define MCP2515_SPI_SPR 0
+#define MCP2515_SPI_2X  1
+#elif MCP2515_SPI_CLOCK_DIV == 4
+#define MCP2515_SPI_SPR 0
+#define MCP2515_SPI_2X  0
+#elif MCP2515_SPI_CLOCK_DIV == 8
+#define MCP2515_SPI_SPR 1
+#define MCP2515_SPI_2X  1
+#elif MCP2515_SPI_CLOCK_DIV == 16
+#define MCP2515_SPI_SPR 1
+#define MCP2515_SPI_2X  0
+#elif MCP2515_SPI_CLOCK_DIV == 32
+#define MCP2515_SPI_SPR 2
+#define MCP2515_SPI_2X  1
+#elif MCP2515_SPI_CLOCK_DIV == 64
+#define MCP2515_SPI_SPR 2
+#define MCP2515_SPI_2X  0
+#elif MCP2515_SPI_CLOCK_DIV == 128
+#define MCP2515_SPI_SPR 3
+#define MCP2515_SPI_2X  0
+#else
+#error "MCP2515_SPI_CLOCK_DIV must be 2, 4, 8, 16, 32, 64 or 128"
+#endif
+
+#if defined(F_CPU) && (F_CPU / MCP2515_SPI_CLOCK_DIV) > 10000000UL
+#error "MCP2515_SPI_CLOCK_DIV gives an SPI clock above the MCP2515's 10 MHz limit"
+#endif
+
+/******************************************************************************
+ * SPI and GPIO backend (see mcp2515hal.h). Left undefined, the driver uses   *
+ * the ATmega328 one in mcp2515pins.h; otherwise it names the header of       *
+ * another one, quoted, e.g. -DMCP2515_HAL_HEADER='"myboardpins.h"'. A        *
+ * backend that runs spiBurst() on a DMA channel defines MCP2515_SPI_DMA to   *
+ * 1, and readFrame() then takes every frame in one burst.                    *
+ ******************************************************************************/
+
+/******************************************************************************
+ * Frequency of the crystal on the MCP2515 (8, 16 and 20 MHz boards are       *
+ * common) and the CAN bitrate to run at. mcp2515timing.h turns these into    *
+ * the CNF1/CNF2/CNF3 values at compile time.                                 *
+ ******************************************************************************/
+#ifndef MCP2515_OSC_HZ
+#define MCP2515_OSC_HZ 16000000UL
+#endif
+
+#ifndef CAN_BITRATE
+#define CAN_BITRATE 500000UL
+#endif
+
+/******************************************************************************
+ * Synchronisation jump width in time quanta (1-4). It is capped at the       *
+ * length of phase segment 2.                                                 *
+ ******************************************************************************/
+#ifndef MCP2515_SJW
+#define MCP2515_SJW 1
+#endif
+
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef _MCP2515HAL_H_
+#define _MCP2515HAL_H_
+
+#include <stdint.h>
+#include "mcp2515config.h"
+
+/******************************************************************************
+ * Hardware backend of the driver. Every register access of mcp2515.c goes    *
+ * through the always inlined functions and macros below, so the backend is   *
+ * picked at compile time: mcp2515pins.h (the ATmega328) unless               *
+ * MCP2515_HAL_HEADER names another header.                                   *
+ *                                                                            *
+ *   spiPortInit()                 sets the SPI pins up and enables the port  *
+ *   spiSetDivider(divider)        fosc/divider; 0 if it cannot be made       *
+ *   spiTransfer(data)             one byte each way                          *
+ *   spiBurst(tx, rx, length)      "length" bytes; tx NULL sends FILLER       *
+ *                                 bytes, rx NULL drops what comes back       *
+ *   spiPut(data), spiGet()        one byte of the asynchronous engine        *
+ *   spiInterruptEnable/Disable()  its transfer complete interrupt,           *
+ *   spiInterruptArmed()           MCP2515_SPI_ISR, and whether it is on      *
+ *   spiChipSelectLow/High(cs)     Chip Select of a spiChipSelect             *
+ *   chipSelect(device)            Chip Select LOW                            *
+ *   chipDeselect(device)          Chip Select HIGH                           *
+ *   chipSelectInit(device)        Chip Select as an OUTPUT, HIGH             *
+ *   interruptPinInit(device)      INT as an INPUT, pulled up                 *
+ *   interruptPinLow(device)       nonzero while INT is LOW                   *
+ *   interruptEnable(device)       arms the interrupt watching INT            *
+ *   irqDisable(), irqRestore(s)   critical section, in a mcp2515IrqState     *
+ *   irqEnable()                   interrupts on                              *
+ *   delayUs(us)                   busy wait                                  *
+ *                                                                            *
+ * plus the handlers MCP2515_INT0_ISR, MCP2515_INT1_ISR and                   *
+ * MCP2515_SHARED_ISR (with interruptShared()) for the INT lines the backend  *
+ * wires, txRtsInit() and txRtsPulse() with MCP2515_TXRTS_BUFFERS,            *
+ * rxBufferPins() with MCP2515_RXBF_PINS, interruptWakeLevel() and cpuSleep() *
+ * with CAN_SLEEP, and the timer of CAN_TIMESTAMPS and MCP2515_PROFILE:       *
+ * timerInit(), timerCount(), timerOverflowPending(), the timerCapture()      *
+ * calls, MCP2515_TIMER_ISR and CAN_TIMER_SHIFT and CAN_TIMER_OVERFLOW_US     *
+ * (see mcp2515pins.h).                                                       *
+ *                                                                            *
+ * spiBurst() returns once the whole transfer is through; it may run on a DMA *
+ * channel, and a backend that does sets MCP2515_SPI_DMA to 1. readFrame()    *
+ * then takes a frame, DLC and all eight data bytes, in a single burst rather *
+ * than stopping at its DLC, which costs a few more bytes on the wire but one *
+ * DMA job instead of thirteen transfers. sim/dmapins.h is such a backend for *
+ * the host simulation, run by the "dma" sim test.                            *
+ *                                                                            *
+ * The optional layers that drive AVR peripherals of their own (the cyclic    *
+ * timer, the UART of the frame logger and the bus monitor) are still         *
+ * ATmega328 code.                                                            *
+ ******************************************************************************/
+#ifdef MCP2515_HAL_HEADER
+#include MCP2515_HAL_HEADER
+#else
+#include "mcp2515pins.h"
+#endif
+
+#ifndef MCP2515_SPI_DMA
+#error "The hardware backend must define MCP2515_SPI_DMA"
+#endif
+
+
+#endif
@@ -0,0 +1,552 @@
+#ifndef _MCP2515PINS_H_
+#define _MCP2515PINS_H_
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/delay.h>
+#include <stdint.h>
+#include "mcp2515config.h"
+#include "mcp2515prof.h"
+
+/******************************************************************************
+ * Hardware SPI pins of the ATmega328 (PORTB). SS (PB2) has to stay an output *
+ * for the SPI to remain in Master mode, even if no MCP2515 uses it as its    *
+ * Chip Select.                                                               *
+ ******************************************************************************/
+#define SPI_SS_BIT   2
+#define SPI_MOSI_BIT 3
+#define SPI_MISO_BIT 4
+#define SPI_SCK_BIT  5
+
+// Timer1 input capture pin ICP1 (PB0), used by CAN_TIMESTAMP_CAPTURE_DEVICE
+#define TIMER_ICP1_BIT 0
+
+/******************************************************************************
+ * SPI data register. Every byte the driver clocks goes through SPI_PUT() and *
+ * every byte it takes back comes from SPI_GET(). The host simulation (sim/)  *
+ * defines both in its <avr/io.h>, since a simulated SPDR could not tell a    *
+ * write from a read.                                                         *
+ ******************************************************************************/
+#ifndef SPI_PUT
+#define SPI_PUT(data) (SPDR = (data))
+#define SPI_GET()     (SPDR)
+#endif
+
+/******************************************************************************
+ * Chip Select and INT pin helpers. "device" is a device number from          *
+ * mcp2515config.h. The helpers are always inlined, and with a constant       *
+ * device number (or a single device) the compiler folds the comparisons away *
+ * and each call becomes a single cbi/sbi or sbis instruction on the          *
+ * configured pin.                                                            *
+ ******************************************************************************/
+#define MCP2515_ALWAYS_INLINE static inline __attribute__((always_inline))
+
+MCP2515_ALWAYS_INLINE void chipSelect(uint8_t device) {
+    PROF_COUNT(csTransactions);
+
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        MCP2515_DEV2_CS_PORT &= ~(1<<MCP2515_DEV2_CS_BIT);
+        return;
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        MCP2515_DEV1_CS_PORT &= ~(1<<MCP2515_DEV1_CS_BIT);
+        return;
+    }
+#endif
+    (void)device;
+    MCP2515_DEV0_CS_PORT &= ~(1<<MCP2515_DEV0_CS_BIT);
+}
+
+MCP2515_ALWAYS_INLINE void chipDeselect(uint8_t device) {
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        MCP2515_DEV2_CS_PORT |= (1<<MCP2515_DEV2_CS_BIT);
+        return;
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        MCP2515_DEV1_CS_PORT |= (1<<MCP2515_DEV1_CS_BIT);
+        return;
+    }
+#endif
+    (void)device;
+    MCP2515_DEV0_CS_PORT |= (1<<MCP2515_DEV0_CS_BIT);
+}
+
+// Configures the Chip Select pin as an OUTPUT, pulled HIGH (deselected)
+MCP2515_ALWAYS_INLINE void chipSelectInit(uint8_t device) {
+    chipDeselect(device);
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        MCP2515_DEV2_CS_DDR |= (1<<MCP2515_DEV2_CS_BIT);
+        return;
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        MCP2515_DEV1_CS_DDR |= (1<<MCP2515_DEV1_CS_BIT);
+        return;
+    }
+#endif
+    MCP2515_DEV0_CS_DDR |= (1<<MCP2515_DEV0_CS_BIT);
+}
+
+// PORTD bit of the device's (active LOW) INT pin
+MCP2515_ALWAYS_INLINE uint8_t interruptBit(uint8_t device) {
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        return MCP2515_DEV2_INT_BIT;
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        return MCP2515_DEV1_INT_BIT;
+    }
+#endif
+    (void)device;
+    return MCP2515_DEV0_INT_BIT;
+}
+
+// Configures the device's INT pin as an INPUT, with its pull-up on
+MCP2515_ALWAYS_INLINE void interruptPinInit(uint8_t device) {
+    DDRD  &= ~(1<<interruptBit(device));
+    PORTD |=  (1<<interruptBit(device));
+}
+
+// Nonzero while the device's (active LOW) INT pin is LOW
+MCP2515_ALWAYS_INLINE uint8_t interruptPinLow(uint8_t device) {
+    return !(PIND & (1<<interruptBit(device)));
+}
+
+/******************************************************************************
+ * SPI port, the SPI half of the backend contract in mcp2515hal.h.            *
+ * spiTransfer() clocks one byte out and returns the byte clocked in;         *
+ * spiBurst() clocks "length" bytes, from "tx" or FILLER bytes (0xFF) if it   *
+ * is NULL, into "rx" unless that is NULL, and returns once the last one is   *
+ * through. The ATmega328 has no DMA, so spiBurst() is a loop of              *
+ * spiTransfer() and MCP2515_SPI_DMA is 0: readFrame() then reads a frame     *
+ * byte by byte and stops at its DLC. A backend that includes this one with   *
+ * MCP2515_SPI_DMA already defined brings its own spiBurst() instead (see     *
+ * sim/dmapins.h).                                                            *
+ ******************************************************************************/
+// Sets the SPI pins up and enables the SPI as Master at MCP2515_SPI_CLOCK_DIV
+MCP2515_ALWAYS_INLINE void spiPortInit(void) {
+    // Keep SS an OUTPUT, so the SPI stays in Master mode
+    DDRB  |= (1<<SPI_SS_BIT);
+
+    // Pull "Serial Clock" pin LOW 
+    // Pull "MOSI" (Master Out Slave In) pin LOW 
+    // Pull "MISO" (Master In Slave Out) pin LOW
+    PORTB &= ~((1<<SPI_SCK_BIT) | (1<<SPI_MOSI_BIT) | (1<<SPI_MISO_BIT));
+    
+    // Configure "Serial Clock" pin as an OUTPUT
+    // Configure "MOSI" pin as an OUTPUT
+    // Configure "MISO" pin as in INPUT
+    DDRB  |= ((1<<SPI_SCK_BIT) | (1<<SPI_MOSI_BIT));
+    DDRB  &= ~(1<<SPI_MISO_BIT);
+
+    // Enable SPI
+    // Data order: MSB first
+    // Set Arduino to Controller Mode
+    // Configure serial clock speed (MCP2515_SPI_CLOCK_DIV)
+    SPCR = (1<<SPE) | (0<<DORD) | (1<<MSTR) | (MCP2515_SPI_SPR<<SPR0);
+    // Double the clock for the fosc/2, fosc/8 and fosc/32 settings
+    SPSR = (MCP2515_SPI_2X<<SPI2X);
+}
+
+// Sets the SPI clock to fosc/"divider" (2 to 128); returns 0 for any other divider
+MCP2515_ALWAYS_INLINE uint8_t spiSetDivider(uint8_t divider) {
+    uint8_t spr, doubleSpeed;
+
+    switch (divider) {
+        case 2:   spr = 0; doubleSpeed = 1; break;
+        case 4:   spr = 0; doubleSpeed = 0; break;
+        case 8:   spr = 1; doubleSpeed = 1; break;
+        case 16:  spr = 1; doubleSpeed = 0; break;
+        case 32:  spr = 2; doubleSpeed = 1; break;
+        case 64:  spr = 2; doubleSpeed = 0; break;
+        case 128: spr = 3; doubleSpeed = 0; break;
+        default:  return 0;
+    }
+
+    SPCR = (SPCR & ~((1<<SPR1) | (1<<SPR0))) | (spr<<SPR0);
+    SPSR = (doubleSpeed<<SPI2X);
+
+    return 1;
+}
+
+// Exchanges one byte through SPDR, waiting for SPIF in SPSR
+MCP2515_ALWAYS_INLINE uint8_t spiTransfer(uint8_t data) {
+    SPI_PUT(data);
+    while (!(SPSR & (1<<SPIF))) {;}
+
+    return SPI_GET();
+}
+
+#ifndef MCP2515_SPI_DMA
+#define MCP2515_SPI_DMA 0
+
+MCP2515_ALWAYS_INLINE void spiBurst(const uint8_t *tx, uint8_t *rx, uint8_t length) {
+    PROF_ADD(spiBytes, length);
+
+    for (uint8_t i = 0; i < length; i++) {
+        uint8_t data = spiTransfer(tx ? tx[i] : 0xFF);
+
+        if (rx) {
+            rx[i] = data;
+        }
+    }
+}
+#endif
+
+/******************************************************************************
+ * Asynchronous SPI engine. spiPut() starts a byte and returns at once,       *
+ * spiGet() takes the byte that came back once it is through; the SPI         *
+ * Transfer Complete interrupt (MCP2515_SPI_ISR) says when, while             *
+ * spiInterruptEnable() has it on. An asynchronous transaction names its Chip *
+ * Select with a spiChipSelect: the PORT register and bit mask of any pin, or *
+ * a NULL "port" for MCP2515 device 0, which is what a zeroed transaction     *
+ * gets.                                                                      *
+ ******************************************************************************/
+#define MCP2515_SPI_ISR ISR(SPI_STC_vect)
+
+typedef struct {
+    volatile uint8_t *port;
+    uint8_t           mask;
+} spiChipSelect;
+
+MCP2515_ALWAYS_INLINE void spiPut(uint8_t data) {
+    SPI_PUT(data);
+}
+
+MCP2515_ALWAYS_INLINE uint8_t spiGet(void) {
+    return SPI_GET();
+}
+
+MCP2515_ALWAYS_INLINE void spiInterruptEnable(void) {
+    SPCR |= (1<<SPIE);
+}
+
+MCP2515_ALWAYS_INLINE void spiInterruptDisable(void) {
+    SPCR &= ~(1<<SPIE);
+}
+
+// Nonzero while the SPI Transfer Complete interrupt is on
+MCP2515_ALWAYS_INLINE uint8_t spiInterruptArmed(void) {
+    return SPCR & (1<<SPIE);
+}
+
+MCP2515_ALWAYS_INLINE void spiChipSelectLow(const spiChipSelect *cs) {
+    if (cs->port) {
+        *cs->port &= ~cs->mask;
+        PROF_COUNT(csTransactions);
+    } else {
+        chipSelect(0);
+    }
+}
+
+MCP2515_ALWAYS_INLINE void spiChipSelectHigh(const spiChipSelect *cs) {
+    if (cs->port) {
+        *cs->port |= cs->mask;
+    } else {
+        chipDeselect(0);
+    }
+}
+
+#if MCP2515_RXBF_PINS
+// Bit n set while RXnBF of the device is LOW, i.e. receive buffer n is full
+MCP2515_ALWAYS_INLINE uint8_t rxBufferPins(uint8_t device) {
+    uint8_t pins;
+
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        pins = ~MCP2515_DEV2_RXBF_PIN;
+        return ((pins >> MCP2515_DEV2_RX0BF_BIT) & 1) | (((pins >> MCP2515_DEV2_RX1BF_BIT) & 1) << 1);
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        pins = ~MCP2515_DEV1_RXBF_PIN;
+        return ((pins >> MCP2515_DEV1_RX0BF_BIT) & 1) | (((pins >> MCP2515_DEV1_RX1BF_BIT) & 1) << 1);
+    }
+#endif
+    (void)device;
+    pins = ~MCP2515_DEV0_RXBF_PIN;
+    return ((pins >> MCP2515_DEV0_RX0BF_BIT) & 1) | (((pins >> MCP2515_DEV0_RX1BF_BIT) & 1) << 1);
+}
+#endif
+
+#if MCP2515_TXRTS_BUFFERS
+// Bit of the AVR pin driving TXnRTS of transmit buffer "buffer" (0-2)
+#define MCP2515_TXRTS_BIT(n, buffer) ((buffer) == 0 ? MCP2515_DEV##n##_TX0RTS_BIT : \
+                                      (buffer) == 1 ? MCP2515_DEV##n##_TX1RTS_BIT : \
+                                                      MCP2515_DEV##n##_TX2RTS_BIT)
+
+// Mask of the AVR pins driving the TXnRTS pins in MCP2515_TXRTS_BUFFERS
+#define MCP2515_TXRTS_MASK(n) ((((MCP2515_TXRTS_BUFFERS >> 0) & 1) << MCP2515_DEV##n##_TX0RTS_BIT) | \
+                               (((MCP2515_TXRTS_BUFFERS >> 1) & 1) << MCP2515_DEV##n##_TX1RTS_BIT) | \
+                               (((MCP2515_TXRTS_BUFFERS >> 2) & 1) << MCP2515_DEV##n##_TX2RTS_BIT))
+
+// Configures the TXnRTS driving pins as OUTPUTs, idling HIGH
+MCP2515_ALWAYS_INLINE void txRtsInit(uint8_t device) {
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        MCP2515_DEV2_TXRTS_PORT |= MCP2515_TXRTS_MASK(2);
+        MCP2515_DEV2_TXRTS_DDR  |= MCP2515_TXRTS_MASK(2);
+        return;
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        MCP2515_DEV1_TXRTS_PORT |= MCP2515_TXRTS_MASK(1);
+        MCP2515_DEV1_TXRTS_DDR  |= MCP2515_TXRTS_MASK(1);
+        return;
+    }
+#endif
+    (void)device;
+    MCP2515_DEV0_TXRTS_PORT |= MCP2515_TXRTS_MASK(0);
+    MCP2515_DEV0_TXRTS_DDR  |= MCP2515_TXRTS_MASK(0);
+}
+
+// Pulls TXnRTS LOW for a moment; the falling edge starts the transmission
+MCP2515_ALWAYS_INLINE void txRtsPulse(uint8_t device, uint8_t buffer) {
+#if MCP2515_DEVICE_COUNT > 2
+    if (device == 2) {
+        MCP2515_DEV2_TXRTS_PORT &= ~(1<<MCP2515_TXRTS_BIT(2, buffer));
+        __asm__ __volatile__ ("nop");
+        MCP2515_DEV2_TXRTS_PORT |= (1<<MCP2515_TXRTS_BIT(2, buffer));
+        return;
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 1
+    if (device == 1) {
+        MCP2515_DEV1_TXRTS_PORT &= ~(1<<MCP2515_TXRTS_BIT(1, buffer));
+        __asm__ __volatile__ ("nop");
+        MCP2515_DEV1_TXRTS_PORT |= (1<<MCP2515_TXRTS_BIT(1, buffer));
+        return;
+    }
+#endif
+    (void)device;
+    MCP2515_DEV0_TXRTS_PORT &= ~(1<<MCP2515_TXRTS_BIT(0, buffer));
+    __asm__ __volatile__ ("nop");
+    MCP2515_DEV0_TXRTS_PORT |= (1<<MCP2515_TXRTS_BIT(0, buffer));
+}
+#endif
+
+/******************************************************************************
+ * INT line routing. PD2 and PD3 have external interrupts of their own (INT0  *
+ * and INT1); every other PORTD pin is served by the pin change interrupt     *
+ * PCINT2, which the whole port shares. MCP2515_INT0_DEVICE and               *
+ * MCP2515_INT1_DEVICE name the device wired to each external interrupt (they *
+ * stay undefined when no device is), and MCP2515_PCINT_MASK collects the     *
+ * PORTD bits that need the pin change interrupt.                             *
+ ******************************************************************************/
+#define MCP2515_PCINT_BIT(bit) ((((bit) == 2) || ((bit) == 3)) ? 0 : (1 << (bit)))
+
+#if MCP2515_DEV0_INT_BIT == 2
+#define MCP2515_INT0_DEVICE 0
+#elif (MCP2515_DEVICE_COUNT > 1) && (MCP2515_DEV1_INT_BIT == 2)
+#define MCP2515_INT0_DEVICE 1
+#elif (MCP2515_DEVICE_COUNT > 2) && (MCP2515_DEV2_INT_BIT == 2)
+#define MCP2515_INT0_DEVICE 2
+#endif
+
+#if MCP2515_DEV0_INT_BIT == 3
+#define MCP2515_INT1_DEVICE 0
+#elif (MCP2515_DEVICE_COUNT > 1) && (MCP2515_DEV1_INT_BIT == 3)
+#define MCP2515_INT1_DEVICE 1
+#elif (MCP2515_DEVICE_COUNT > 2) && (MCP2515_DEV2_INT_BIT == 3)
+#define MCP2515_INT1_DEVICE 2
+#endif
+
+#if MCP2515_DEVICE_COUNT > 2
+#define MCP2515_PCINT_MASK (MCP2515_PCINT_BIT(MCP2515_DEV0_INT_BIT) | \
+                            MCP2515_PCINT_BIT(MCP2515_DEV1_INT_BIT) | \
+                            MCP2515_PCINT_BIT(MCP2515_DEV2_INT_BIT))
+#elif MCP2515_DEVICE_COUNT > 1
+#define MCP2515_PCINT_MASK (MCP2515_PCINT_BIT(MCP2515_DEV0_INT_BIT) | \
+                            MCP2515_PCINT_BIT(MCP2515_DEV1_INT_BIT))
+#else
+#define MCP2515_PCINT_MASK MCP2515_PCINT_BIT(MCP2515_DEV0_INT_BIT)
+#endif
+
+#if (MCP2515_DEVICE_COUNT > 1) && (MCP2515_DEV0_INT_BIT == MCP2515_DEV1_INT_BIT)
+#error "Devices 0 and 1 cannot share an INT pin"
+#endif
+
+#if (MCP2515_DEVICE_COUNT > 2) && ((MCP2515_DEV2_INT_BIT == MCP2515_DEV0_INT_BIT) || \
+                                   (MCP2515_DEV2_INT_BIT == MCP2515_DEV1_INT_BIT))
+#error "Device 2 cannot share an INT pin with device 0 or 1"
+#endif
+
+/******************************************************************************
+ * INT line vectors. MCP2515_INT0_ISR and MCP2515_INT1_ISR serve the one      *
+ * device wired to each (MCP2515_INT0_DEVICE, MCP2515_INT1_DEVICE);           *
+ * MCP2515_SHARED_ISR serves every device for which interruptShared() is      *
+ * nonzero, and has to look at their INT pins to find the ones that are LOW.  *
+ * A backend defines the ones it uses.                                        *
+ ******************************************************************************/
+#ifdef MCP2515_INT0_DEVICE
+#define MCP2515_INT0_ISR ISR(INT0_vect)
+#endif
+
+#ifdef MCP2515_INT1_DEVICE
+#define MCP2515_INT1_ISR ISR(INT1_vect)
+#endif
+
+#if MCP2515_PCINT_MASK
+#define MCP2515_SHARED_ISR ISR(PCINT2_vect)
+#endif
+
+// Nonzero if the device's INT pin is served by MCP2515_SHARED_ISR
+MCP2515_ALWAYS_INLINE uint8_t interruptShared(uint8_t device) {
+    return MCP2515_PCINT_BIT(interruptBit(device)) != 0;
+}
+
+// Arms the interrupt that watches the device's INT pin (falling edge on INT0/INT1)
+MCP2515_ALWAYS_INLINE void interruptEnable(uint8_t device) {
+    uint8_t bit = interruptBit(device);
+
+    if (bit == 2) {
+        EICRA = (EICRA & ~((1<<ISC01) | (1<<ISC00))) | (1<<ISC01);
+        EIFR  = (1<<INTF0);
+        EIMSK |= (1<<INT0);
+    } else if (bit == 3) {
+        EICRA = (EICRA & ~((1<<ISC11) | (1<<ISC10))) | (1<<ISC11);
+        EIFR  = (1<<INTF1);
+        EIMSK |= (1<<INT1);
+    } else {
+        PCMSK2 |= (1<<bit);
+        PCIFR   = (1<<PCIF2);
+        PCICR  |= (1<<PCIE2);
+    }
+}
+
+// Switches INT0/INT1 between falling edge and low level, the only one of the
+// two that wakes the ATmega328 from power-down (pin changes always do)
+MCP2515_ALWAYS_INLINE void interruptWakeLevel(uint8_t device, uint8_t level) {
+    uint8_t bit  = interruptBit(device);
+    uint8_t edge = (bit == 2) ? (1<<ISC01) : (bit == 3) ? (1<<ISC11) : 0;
+
+    if (level) {
+        EICRA &= ~edge;
+    } else {
+        EICRA |= edge;
+    }
+}
+
+/******************************************************************************
+ * Critical sections. irqDisable() turns interrupts off and returns the state *
+ * they were in, irqRestore() puts it back; stores made in between are done   *
+ * before interrupts can come back on. irqEnable() turns them on.             *
+ ******************************************************************************/
+typedef uint8_t mcp2515IrqState;
+
+MCP2515_ALWAYS_INLINE mcp2515IrqState irqDisable(void) {
+    mcp2515IrqState sreg = SREG;
+
+    cli();
+
+    return sreg;
+}
+
+MCP2515_ALWAYS_INLINE void irqRestore(mcp2515IrqState sreg) {
+    __asm__ __volatile__ ("" ::: "memory");
+    SREG = sreg;
+}
+
+MCP2515_ALWAYS_INLINE void irqEnable(void) {
+    sei();
+}
+
+// Busy wait of a constant number of microseconds
+#define delayUs(us) _delay_us(us)
+
+/******************************************************************************
+ * Sleep. cpuSleep() is called with interrupts disabled and powers the CPU    *
+ * down until an interrupt wakes it, enabling interrupts in the same step so  *
+ * none that comes in between is missed; it returns with interrupts enabled   *
+ * and the wake-up interrupt served.                                          *
+ ******************************************************************************/
+MCP2515_ALWAYS_INLINE void cpuSleep(void) {
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
+/******************************************************************************
+ * Timer1, the clock of CAN_TIMESTAMPS and MCP2515_PROFILE. timerInit() runs  *
+ * it freely, at F_CPU/8 with CAN_TIMESTAMPS (its overflow interrupt,         *
+ * MCP2515_TIMER_ISR, on, and ICP1 latching falling edges for                 *
+ * CAN_TIMESTAMP_CAPTURE_DEVICE) and at F_CPU otherwise. timerCount() is the  *
+ * running 16-bit count, which shifted right by CAN_TIMER_SHIFT gives         *
+ * microseconds and wraps every CAN_TIMER_OVERFLOW_US of them;                *
+ * timerOverflowPending() is nonzero while a wrap has not been served yet.    *
+ * timerCapture() is the count ICP1 latched, valid while                      *
+ * timerCapturePending() is nonzero, and timerCaptureClear() lets it latch    *
+ * the next edge.                                                             *
+ ******************************************************************************/
+#if CAN_TIMESTAMPS
+#if   !defined(F_CPU)
+#error "CAN_TIMESTAMPS needs F_CPU"
+#elif F_CPU == 16000000UL
+#define CAN_TIMER_SHIFT       1
+#define CAN_TIMER_OVERFLOW_US 32768UL
+#elif F_CPU == 8000000UL
+#define CAN_TIMER_SHIFT       0
+#define CAN_TIMER_OVERFLOW_US 65536UL
+#else
+#error "CAN_TIMESTAMPS needs F_CPU to be 8 or 16 MHz"
+#endif
+#endif
+
+#define MCP2515_TIMER_ISR ISR(TIMER1_OVF_vect)
+
+MCP2515_ALWAYS_INLINE void timerInit(void) {
+#if CAN_TIMESTAMPS
+    // Run Timer1 freely at F_CPU/8 as the timestamp clock
+    // Latch falling edges on ICP1 for the capture device
+    // Count overflows into the upper timestamp bits
+    TCCR1A  = 0;
+    TCCR1B  = (0<<ICES1) | (1<<CS11);
+    TIMSK1 |= (1<<TOIE1);
+#ifdef CAN_TIMESTAMP_CAPTURE_DEVICE
+    DDRB   &= ~(1<<TIMER_ICP1_BIT);
+    TIFR1   = (1<<ICF1);
+#endif
+#else
+    // Run Timer1 freely at F_CPU to time the driver
+    TCCR1A = 0;
+    TCCR1B = (1<<CS10);
+#endif
+}
+
+MCP2515_ALWAYS_INLINE uint16_t timerCount(void) {
+    return TCNT1;
+}
+
+MCP2515_ALWAYS_INLINE uint8_t timerOverflowPending(void) {
+    return TIFR1 & (1<<TOV1);
+}
+
+MCP2515_ALWAYS_INLINE uint8_t timerCapturePending(void) {
+    return TIFR1 & (1<<ICF1);
+}
+
+MCP2515_ALWAYS_INLINE uint16_t timerCapture(void) {
+    return ICR1;
+}
+
+MCP2515_ALWAYS_INLINE void timerCaptureClear(void) {
+    TIFR1 = (1<<ICF1);
+}
+
+
+#endif
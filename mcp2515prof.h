@@ -0,0 +1,84 @@
+#ifndef _MCP2515PROF_H_
+#define _MCP2515PROF_H_
+
+#include <stdint.h>
+#include "mcp2515config.h"
+
+/******************************************************************************
+ * Driver performance counters, compiled in with MCP2515_PROFILE (make        *
+ * mcp2515-prof). Durations are Timer1 ticks of MCP2515_PROF_TICK_CYCLES CPU  *
+ * cycles each: Timer1 runs at F_CPU while profiling, or at F_CPU/8 when      *
+ * CAN_TIMESTAMPS owns it.                                                    *
+ *                                                                            *
+ *   spiBytes       bytes clocked over SPI, synchronous and asynchronous      *
+ *   csTransactions times a Chip Select was pulled LOW                        *
+ *   isrEntries     driver interrupt handlers run                             *
+ *   isrTicks       total time spent in them                                  *
+ *   isrTicksMax    longest single run                                        *
+ *   framesRx       frames taken off the MCP2515s                             *
+ *   framesTx       transmissions requested (REQUEST TO SEND, TXnRTS)         *
+ *   framesDropped  frames lost in the MCP2515 or at a full ring buffer       *
+ *   latencyMax     worst time from an INT line falling to its frame          *
+ *                  sitting in the ring buffer (or handed to its handler)     *
+ *                                                                            *
+ * The latency is measured from the moment the INT handler runs, or from the  *
+ * ICP1 capture for CAN_TIMESTAMP_CAPTURE_DEVICE, which also covers the       *
+ * interrupt response time. Every counter stops at its maximum instead of     *
+ * wrapping.                                                                  *
+ ******************************************************************************/
+typedef struct {
+    uint32_t spiBytes;
+    uint32_t csTransactions;
+    uint32_t isrEntries;
+    uint32_t isrTicks;
+    uint16_t isrTicksMax;
+    uint16_t latencyMax;
+    uint32_t framesRx;
+    uint32_t framesTx;
+    uint32_t framesDropped;
+} canProfile;
+
+#if MCP2515_PROFILE
+
+#if CAN_TIMESTAMPS
+#define MCP2515_PROF_TICK_CYCLES 8
+#else
+#define MCP2515_PROF_TICK_CYCLES 1
+#endif
+
+extern volatile canProfile mcp2515Profile;
+
+/******************************************************************************
+ * Instrumentation hooks used inside the driver. Without MCP2515_PROFILE they *
+ * expand to nothing, so the instrumented code compiles exactly as it would   *
+ * without them.                                                              *
+ ******************************************************************************/
+#define PROF_ADD(field, count) do {                                                \
+        uint32_t profValue_ = mcp2515Profile.field + (count);                      \
+        mcp2515Profile.field = (profValue_ < mcp2515Profile.field) ? 0xFFFFFFFFUL  \
+                                                                   : profValue_;   \
+    } while (0)
+
+#define PROF_COUNT(field) PROF_ADD(field, 1)
+
+#define PROF_ISR_BEGIN() uint16_t profStart_ = timerCount(); PROF_COUNT(isrEntries)
+
+#define PROF_ISR_END() do {                                                        \
+        uint16_t profTicks_ = timerCount() - profStart_;                           \
+        PROF_ADD(isrTicks, profTicks_);                                            \
+        if (profTicks_ > mcp2515Profile.isrTicksMax) {                             \
+            mcp2515Profile.isrTicksMax = profTicks_;                               \
+        }                                                                          \
+    } while (0)
+
+#else
+
+#define PROF_ADD(field, count)
+#define PROF_COUNT(field)
+#define PROF_ISR_BEGIN()
+#define PROF_ISR_END()
+
+#endif
+
+
+#endif
@@ -1,6 +1,36 @@
 #ifndef REGISTERS_H
 #define REGISTERS_H
 
+#define CANCTRL  0x0F   // CAN CONTROL REGISTER (ALSO AT 0x1F, 0x2F ... 0x7F)
+// CANCTRL BITS
+#define REQOP2   7      // REQUEST OPERATION MODE BIT 2
+#define REQOP1   6      // REQUEST OPERATION MODE BIT 1
+#define REQOP0   5      // REQUEST OPERATION MODE BIT 0
+#define ABAT     4      // ABORT ALL PENDING TRANSMISSIONS BIT
+#define OSM      3      // ONE-SHOT MODE BIT
+#define CLKEN    2      // CLKOUT PIN ENABLE BIT
+#define CLKPRE1  1      // CLKOUT PIN PRESCALER BIT 1
+#define CLKPRE0  0      // CLKOUT PIN PRESCALER BIT 0
+#define REQOP_MASK 0xE0 // REQUEST OPERATION MODE BITS
+
+#define CANSTAT  0x0E   // CAN STATUS REGISTER (ALSO AT 0x1E, 0x2E ... 0x7E)
+// CANSTAT BITS
+#define OPMOD2   7      // OPERATION MODE BIT 2
+#define OPMOD1   6      // OPERATION MODE BIT 1
+#define OPMOD0   5      // OPERATION MODE BIT 0
+#define ICOD2    3      // INTERRUPT FLAG CODE BIT 2
+#define ICOD1    2      // INTERRUPT FLAG CODE BIT 1
+#define ICOD0    1      // INTERRUPT FLAG CODE BIT 0
+#define OPMOD_MASK 0xE0 // OPERATION MODE BITS
+#define ICOD_MASK  0x0E // INTERRUPT FLAG CODE BITS
+
+// OPERATION MODES (REQOP IN CANCTRL, OPMOD IN CANSTAT)
+#define MODE_NORMAL   0x00 // NORMAL OPERATION MODE
+#define MODE_SLEEP    0x20 // SLEEP MODE
+#define MODE_LOOPBACK 0x40 // LOOPBACK MODE
+#define MODE_LISTEN   0x60 // LISTEN-ONLY MODE
+#define MODE_CONFIG   0x80 // CONFIGURATION MODE
+
 #define TXRTSCTRL 0x0D  // TXnRTS PIN CONTROL AND STATUS REGISTER
 // TXRTSCTRL BITS
 #define B2RTS    5      // TRANSMIT BUFFER 2 REQUEST-TO-SEND STATE
@@ -9,6 +39,24 @@
 #define B2RTSM   2      // TRANSMIT BUFFER 2 REQUEST TRANSMISSION
 #define B1RTSM   1      // TRANSMIT BUFFER 1 REQUEST TRANSMISSION
 #define B0TRSM   0      // TRANSMIT BUFFER 0 REQUEST TRANSMISSION
+#define B0RTSM   B0TRSM // TRANSMIT BUFFER 0 REQUEST TRANSMISSION
+
+#define BFPCTRL  0x0C   // RXnBF PIN CONTROL AND STATUS REGISTER
+// BFPCTRL BITS
+#define B1BFS    5      // RX1BF PIN STATE BIT (DIGITAL OUTPUT MODE ONLY)
+#define B0BFS    4      // RX0BF PIN STATE BIT (DIGITAL OUTPUT MODE ONLY)
+#define B1BFE    3      // RX1BF PIN FUNCTION ENABLE BIT
+#define B0BFE    2      // RX0BF PIN FUNCTION ENABLE BIT
+#define B1BFM    1      // RX1BF PIN OPERATION MODE BIT
+#define B0BFM    0      // RX0BF PIN OPERATION MODE BIT
+
+// TXBnCTRL BITS
+#define ABTF     6      // MESSAGE ABORTED FLAG BIT
+#define MLOA     5      // MESSAGE LOST ARBITRATION BIT
+#define TXERR    4      // TRANSMISSION ERROR DETECTED BIT
+#define TXREQ    3      // MESSAGE TRANSMIT REQUEST BIT
+#define TXP1     1      // TRANSMIT BUFFER PRIORITY BIT 1
+#define TXP0     0      // TRANSMIT BUFFER PRIORITY BIT 0
 
 // TRANSMIT BUFFER 0 REGISTER MEMORY ADDRESSES
 #define TXB0CTRL 0x30   // TRANSMIT BUFFER 0 CONTROL REGISTER
@@ -58,6 +106,16 @@
 #define TXB2D6   0x5C   // TRANSMIT BUFFER 2 DATA BYTE 6
 #define TXB2D7   0x5D   // TRANSMIT BUFFER 2 DATA BYTE 7
 
+// RXB0CTRL/RXB1CTRL BITS
+#define RXM1     6      // RECEIVE BUFFER OPERATING MODE BIT 1
+#define RXM0     5      // RECEIVE BUFFER OPERATING MODE BIT 0
+#define RXRTR    3      // RECEIVED REMOTE TRANSFER REQUEST BIT
+#define BUKT     2      // ROLLOVER ENABLE BIT (RXB0CTRL ONLY)
+#define BUKT1    1      // READ-ONLY COPY OF BUKT (RXB0CTRL ONLY)
+#define FILHIT2  2      // FILTER HIT BIT 2 (RXB1CTRL ONLY)
+#define FILHIT1  1      // FILTER HIT BIT 1 (RXB1CTRL ONLY)
+#define FILHIT0  0      // FILTER HIT BIT 0
+
 // RECEIVE BUFFER 0 REGISTER MEMORY ADDRESSES
 #define RXB0CTRL 0x60   // RECEIVE BUFFER 0 CONTROL
 #define RXB0SIDH 0x61   // RECEIVE BUFFER 0 STANDARD IDENTIFIER HIGH
@@ -90,6 +148,47 @@
 #define RXB1D6   0x7C   // RECEIVE BUFFER 1 DATA BYTE 6
 #define RXB1D7   0x7D   // RECEIVE BUFFER 1 DATA BYTE 7
 
+// ACCEPTANCE FILTER REGISTER MEMORY ADDRESSES
+// (EACH FILTER IS SIDH, SIDL, EID8, EID0 AT CONSECUTIVE ADDRESSES)
+#define RXF0SIDH 0x00   // FILTER 0 STANDARD IDENTIFIER HIGH
+#define RXF0SIDL 0x01   // FILTER 0 STANDARD IDENTIFIER LOW
+#define RXF0EID8 0x02   // FILTER 0 EXTENDED IDENTIFIER HIGH
+#define RXF0EID0 0x03   // FILTER 0 EXTENDED IDENTIFIER LOW
+#define RXF1SIDH 0x04   // FILTER 1 STANDARD IDENTIFIER HIGH
+#define RXF1SIDL 0x05   // FILTER 1 STANDARD IDENTIFIER LOW
+#define RXF1EID8 0x06   // FILTER 1 EXTENDED IDENTIFIER HIGH
+#define RXF1EID0 0x07   // FILTER 1 EXTENDED IDENTIFIER LOW
+#define RXF2SIDH 0x08   // FILTER 2 STANDARD IDENTIFIER HIGH
+#define RXF2SIDL 0x09   // FILTER 2 STANDARD IDENTIFIER LOW
+#define RXF2EID8 0x0A   // FILTER 2 EXTENDED IDENTIFIER HIGH
+#define RXF2EID0 0x0B   // FILTER 2 EXTENDED IDENTIFIER LOW
+#define RXF3SIDH 0x10   // FILTER 3 STANDARD IDENTIFIER HIGH
+#define RXF3SIDL 0x11   // FILTER 3 STANDARD IDENTIFIER LOW
+#define RXF3EID8 0x12   // FILTER 3 EXTENDED IDENTIFIER HIGH
+#define RXF3EID0 0x13   // FILTER 3 EXTENDED IDENTIFIER LOW
+#define RXF4SIDH 0x14   // FILTER 4 STANDARD IDENTIFIER HIGH
+#define RXF4SIDL 0x15   // FILTER 4 STANDARD IDENTIFIER LOW
+#define RXF4EID8 0x16   // FILTER 4 EXTENDED IDENTIFIER HIGH
+#define RXF4EID0 0x17   // FILTER 4 EXTENDED IDENTIFIER LOW
+#define RXF5SIDH 0x18   // FILTER 5 STANDARD IDENTIFIER HIGH
+#define RXF5SIDL 0x19   // FILTER 5 STANDARD IDENTIFIER LOW
+#define RXF5EID8 0x1A   // FILTER 5 EXTENDED IDENTIFIER HIGH
+#define RXF5EID0 0x1B   // FILTER 5 EXTENDED IDENTIFIER LOW
+
+// ACCEPTANCE MASK REGISTER MEMORY ADDRESSES
+#define RXM0SIDH 0x20   // MASK 0 STANDARD IDENTIFIER HIGH
+#define RXM0SIDL 0x21   // MASK 0 STANDARD IDENTIFIER LOW
+#define RXM0EID8 0x22   // MASK 0 EXTENDED IDENTIFIER HIGH
+#define RXM0EID0 0x23   // MASK 0 EXTENDED IDENTIFIER LOW
+#define RXM1SIDH 0x24   // MASK 1 STANDARD IDENTIFIER HIGH
+#define RXM1SIDL 0x25   // MASK 1 STANDARD IDENTIFIER LOW
+#define RXM1EID8 0x26   // MASK 1 EXTENDED IDENTIFIER HIGH
+#define RXM1EID0 0x27   // MASK 1 EXTENDED IDENTIFIER LOW
+
+// ERROR COUNTER REGISTER MEMORY ADDRESSES
+#define TEC      0x1C   // TRANSMIT ERROR COUNTER
+#define REC      0x1D   // RECEIVE ERROR COUNTER
+
 // CONFIGURATION BUFFER 1 REGISTER MEMORY ADDRESSES/BITS
 #define CNF1     0x2A   // CONFIGURATION BUFFER 1
 #define SJW1     7      // SYNC JUMP WIDTH LENGTH BIT 1
@@ -120,6 +219,48 @@
 #define PHSEG21  1      // PS2 LENGTH BIT 1
 #define PHSEG20  0      // PS2 LENGTH BIT 0
 
+// CAN INTERRUPT ENABLE REGISTER MEMORY ADDRESS/BITS
+#define CANINTE  0x2B   // CAN INTERRUPT ENABLE REGISTER
+#define MERRE    7      // MESSAGE ERROR INTERRUPT ENABLE BIT
+#define WAKIE    6      // WAKE-UP INTERRUPT ENABLE BIT
+#define ERRIE    5      // ERROR INTERRUPT ENABLE BIT
+#define TX2IE    4      // TRANSMIT BUFFER 2 EMPTY INTERRUPT ENABLE BIT
+#define TX1IE    3      // TRANSMIT BUFFER 1 EMPTY INTERRUPT ENABLE BIT
+#define TX0IE    2      // TRANSMIT BUFFER 0 EMPTY INTERRUPT ENABLE BIT
+#define RX1IE    1      // RECEIVE BUFFER 1 FULL INTERRUPT ENABLE BIT
+#define RX0IE    0      // RECEIVE BUFFER 0 FULL INTERRUPT ENABLE BIT
+
+// CAN INTERRUPT FLAG REGISTER MEMORY ADDRESS/BITS
+#define CANINTF  0x2C   // CAN INTERRUPT FLAG REGISTER
+#define MERRF    7      // MESSAGE ERROR INTERRUPT FLAG BIT
+#define WAKIF    6      // WAKE-UP INTERRUPT FLAG BIT
+#define ERRIF    5      // ERROR INTERRUPT FLAG BIT
+#define TX2IF    4      // TRANSMIT BUFFER 2 EMPTY INTERRUPT FLAG BIT
+#define TX1IF    3      // TRANSMIT BUFFER 1 EMPTY INTERRUPT FLAG BIT
+#define TX0IF    2      // TRANSMIT BUFFER 0 EMPTY INTERRUPT FLAG BIT
+#define RX1IF    1      // RECEIVE BUFFER 1 FULL INTERRUPT FLAG BIT
+#define RX0IF    0      // RECEIVE BUFFER 0 FULL INTERRUPT FLAG BIT
+
+// ERROR FLAG REGISTER MEMORY ADDRESS/BITS
+#define EFLG     0x2D   // ERROR FLAG REGISTER
+#define RX1OVR   7      // RECEIVE BUFFER 1 OVERFLOW FLAG BIT
+#define RX0OVR   6      // RECEIVE BUFFER 0 OVERFLOW FLAG BIT
+#define TXBO     5      // BUS-OFF ERROR FLAG BIT
+#define TXEP     4      // TRANSMIT ERROR-PASSIVE FLAG BIT
+#define RXEP     3      // RECEIVE ERROR-PASSIVE FLAG BIT
+#define TXWAR    2      // TRANSMIT ERROR WARNING FLAG BIT
+#define RXWAR    1      // RECEIVE ERROR WARNING FLAG BIT
+#define EWARN    0      // ERROR WARNING FLAG BIT
+
+// TXBnSIDL/RXBnSIDL BITS
+#define SRR      4      // STANDARD FRAME REMOTE TRANSMIT REQUEST BIT (RX ONLY)
+#define IDE      3      // EXTENDED IDENTIFIER FLAG BIT
+#define EXIDE    3      // EXTENDED IDENTIFIER ENABLE BIT (TX)
+
+// TXBnDLC/RXBnDLC BITS
+#define RTR      6      // EXTENDED FRAME REMOTE TRANSMISSION REQUEST BIT
+#define DLC_MASK 0x0F   // DATA LENGTH CODE BITS
+
 
 
 
@@ -0,0 +1,88 @@
+#ifndef _MCP2515TIMING_H_
+#define _MCP2515TIMING_H_
+
+#include "mcp2515config.h"
+#include "mcp2515registers.h"
+
+/******************************************************************************
+ * Compile-time bit-timing calculator. From MCP2515_OSC_HZ and CAN_BITRATE it *
+ * picks the number of time quanta (TQ) per bit and the baud rate prescaler,  *
+ * then splits the bit into the propagation segment and the two phase         *
+ * segments with the sample point as close to 87.5% as the crystal allows.    *
+ *                                                                            *
+ *   one bit = SYNC (1 TQ) + PRSEG + PHSEG1 + PHSEG2                          *
+ *   TQ      = 2 * BRP / fosc                                                 *
+ *   sample  = (1 + PRSEG + PHSEG1) / bit length                              *
+ *                                                                            *
+ * Everything here is evaluated by the preprocessor, so an oscillator/bitrate *
+ * pair that cannot be reached is reported with #error rather than at run     *
+ * time.                                                                      *
+ ******************************************************************************/
+
+/******************************************************************************
+ * A bit can be 8 to 25 TQ long, but with PRSEG and PHSEG1 limited to 8 TQ    *
+ * each, a sample point near 87.5% is only possible up to 20 TQ. The          *
+ * candidate lengths are tried in order of how close they get to 87.5% (16 TQ *
+ * is exact), and the first one that divides the oscillator evenly with a     *
+ * prescaler of 64 or less wins.                                              *
+ ******************************************************************************/
+#define MCP2515_TQ_FITS(n) (((MCP2515_OSC_HZ / 2) % (CAN_BITRATE * (n)) == 0) && \
+                            ((MCP2515_OSC_HZ / 2) / (CAN_BITRATE * (n)) <= 64))
+
+#if   MCP2515_TQ_FITS(16)
+#define MCP2515_TQ 16
+#elif MCP2515_TQ_FITS(17)
+#define MCP2515_TQ 17
+#elif MCP2515_TQ_FITS(15)
+#define MCP2515_TQ 15
+#elif MCP2515_TQ_FITS(18)
+#define MCP2515_TQ 18
+#elif MCP2515_TQ_FITS(14)
+#define MCP2515_TQ 14
+#elif MCP2515_TQ_FITS(19)
+#define MCP2515_TQ 19
+#elif MCP2515_TQ_FITS(20)
+#define MCP2515_TQ 20
+#elif MCP2515_TQ_FITS(13)
+#define MCP2515_TQ 13
+#elif MCP2515_TQ_FITS(12)
+#define MCP2515_TQ 12
+#elif MCP2515_TQ_FITS(11)
+#define MCP2515_TQ 11
+#elif MCP2515_TQ_FITS(10)
+#define MCP2515_TQ 10
+#elif MCP2515_TQ_FITS(9)
+#define MCP2515_TQ 9
+#elif MCP2515_TQ_FITS(8)
+#define MCP2515_TQ 8
+#else
+#error "CAN_BITRATE cannot be derived from MCP2515_OSC_HZ"
+#endif
+
+// Segment lengths in TQ
+#define MCP2515_BRP    ((MCP2515_OSC_HZ / 2) / (CAN_BITRATE * MCP2515_TQ))
+#define MCP2515_PHSEG2 ((MCP2515_TQ + 4) / 8 < 2 ? 2 : (MCP2515_TQ + 4) / 8)
+#define MCP2515_PHSEG1 ((MCP2515_TQ - MCP2515_PHSEG2) / 2)
+#define MCP2515_PRSEG  (MCP2515_TQ - 1 - MCP2515_PHSEG2 - MCP2515_PHSEG1)
+#define MCP2515_SJW_TQ (MCP2515_SJW > MCP2515_PHSEG2 ? MCP2515_PHSEG2 : MCP2515_SJW)
+
+// Resulting sample point, in tenths of a percent
+#define MCP2515_SAMPLE_POINT ((1000 * (MCP2515_TQ - MCP2515_PHSEG2)) / MCP2515_TQ)
+
+#if (MCP2515_SJW < 1) || (MCP2515_SJW > 4)
+#error "MCP2515_SJW must be between 1 and 4"
+#endif
+
+#if (MCP2515_PRSEG < 1) || (MCP2515_PRSEG > 8) || (MCP2515_PHSEG1 > 8) || \
+    (MCP2515_PHSEG1 < MCP2515_PHSEG2)
+#error "Bit timing calculation produced out-of-range segments"
+#endif
+
+// Register values, one field per configuration register
+#define MCP2515_CNF1_VALUE (((MCP2515_SJW_TQ - 1) << SJW0) | (MCP2515_BRP - 1))
+#define MCP2515_CNF2_VALUE ((1<<BTLMODE) | ((MCP2515_PHSEG1 - 1) << PHSEG10) | \
+                            (MCP2515_PRSEG - 1))
+#define MCP2515_CNF3_VALUE ((MCP2515_PHSEG2 - 1) << PHSEG20)
+
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef _SIM_AVR_INTERRUPT_H_
+#define _SIM_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+/******************************************************************************
+ * Host stand-in for <avr/interrupt.h>. An interrupt handler is a plain       *
+ * function that the simulation calls when its flag is set and the I bit of   *
+ * SREG allows it (see mcp2515sim.c); sei() and cli() flip that bit.          *
+ ******************************************************************************/
+#define ISR(vector, ...) void vector(void); void vector(void)
+
+#define sei() (SREG |= (1<<SREG_I))
+#define cli() (SREG &= ~(1<<SREG_I))
+
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef _SIM_AVR_IO_H_
+#define _SIM_AVR_IO_H_
+
+#include <stdint.h>
+
+/******************************************************************************
+ * Host stand-in for <avr/io.h> (see mcp2515sim.h). Every I/O register is an  *
+ * access through simRegister(), which lets the simulation catch up with the  *
+ * time the access takes, follow the Chip Select and TXnRTS pins, drive the   *
+ * INT and RXnBF pins and run any interrupt that is due, exactly between two  *
+ * accesses as on the real chip.                                              *
+ *                                                                            *
+ * The interrupt flag registers (EIFR, PCIFR, TIFR0, TIFR1, TIFR2) read back  *
+ * the pending flags; writing ones clears them, but writing back a value      *
+ * equal to the one just read goes unnoticed.                                 *
+ ******************************************************************************/
+enum {
+    SIM_PINB, SIM_DDRB, SIM_PORTB,
+    SIM_PINC, SIM_DDRC, SIM_PORTC,
+    SIM_PIND, SIM_DDRD, SIM_PORTD,
+    SIM_SPCR, SIM_SPSR, SIM_SPDR,
+    SIM_SREG, SIM_MCUCR, SIM_SMCR, SIM_PRR, SIM_GPIOR0,
+    SIM_EICRA, SIM_EIMSK, SIM_EIFR,
+    SIM_PCICR, SIM_PCIFR, SIM_PCMSK0, SIM_PCMSK1, SIM_PCMSK2,
+    SIM_TCCR0A, SIM_TCCR0B, SIM_TCNT0, SIM_OCR0A, SIM_TIMSK0, SIM_TIFR0,
+    SIM_TCCR1A, SIM_TCCR1B, SIM_TCCR1C, SIM_TIMSK1, SIM_TIFR1,
+    SIM_TCCR2A, SIM_TCCR2B, SIM_TCNT2, SIM_OCR2A, SIM_TIMSK2, SIM_TIFR2,
+    SIM_UCSR0A, SIM_UCSR0B, SIM_UCSR0C, SIM_UDR0,
+    SIM_REGISTER_COUNT
+};
+
+enum {
+    SIM_TCNT1, SIM_ICR1, SIM_OCR1A, SIM_OCR1B, SIM_UBRR0,
+    SIM_REGISTER16_COUNT
+};
+
+volatile uint8_t  *simRegister(uint8_t index);
+volatile uint16_t *simRegister16(uint8_t index);
+void               simSpiPut(uint8_t data);
+uint8_t            simSpiGet(void);
+void               simUartPut(uint8_t data);
+
+#define SPI_PUT(data)  simSpiPut(data)
+#define SPI_GET()      simSpiGet()
+#define UART_PUT(data) simUartPut(data)
+
+#define PINB   (*simRegister(SIM_PINB))
+#define DDRB   (*simRegister(SIM_DDRB))
+#define PORTB  (*simRegister(SIM_PORTB))
+#define PINC   (*simRegister(SIM_PINC))
+#define DDRC   (*simRegister(SIM_DDRC))
+#define PORTC  (*simRegister(SIM_PORTC))
+#define PIND   (*simRegister(SIM_PIND))
+#define DDRD   (*simRegister(SIM_DDRD))
+#define PORTD  (*simRegister(SIM_PORTD))
+#define SPCR   (*simRegister(SIM_SPCR))
+#define SPSR   (*simRegister(SIM_SPSR))
+#define SPDR   (*simRegister(SIM_SPDR))
+#define SREG   (*simRegister(SIM_SREG))
+#define MCUCR  (*simRegister(SIM_MCUCR))
+#define SMCR   (*simRegister(SIM_SMCR))
+#define PRR    (*simRegister(SIM_PRR))
+#define GPIOR0 (*simRegister(SIM_GPIOR0))
+#define EICRA  (*simRegister(SIM_EICRA))
+#define EIMSK  (*simRegister(SIM_EIMSK))
+#define EIFR   (*simRegister(SIM_EIFR))
+#define PCICR  (*simRegister(SIM_PCICR))
+#define PCIFR  (*simRegister(SIM_PCIFR))
+#define PCMSK0 (*simRegister(SIM_PCMSK0))
+#define PCMSK1 (*simRegister(SIM_PCMSK1))
+#define PCMSK2 (*simRegister(SIM_PCMSK2))
+#define TCCR0A (*simRegister(SIM_TCCR0A))
+#define TCCR0B (*simRegister(SIM_TCCR0B))
+#define TCNT0  (*simRegister(SIM_TCNT0))
+#define OCR0A  (*simRegister(SIM_OCR0A))
+#define TIMSK0 (*simRegister(SIM_TIMSK0))
+#define TIFR0  (*simRegister(SIM_TIFR0))
+#define TCCR1A (*simRegister(SIM_TCCR1A))
+#define TCCR1B (*simRegister(SIM_TCCR1B))
+#define TCCR1C (*simRegister(SIM_TCCR1C))
+#define TIMSK1 (*simRegister(SIM_TIMSK1))
+#define TIFR1  (*simRegister(SIM_TIFR1))
+#define TCCR2A (*simRegister(SIM_TCCR2A))
+#define TCCR2B (*simRegister(SIM_TCCR2B))
+#define TCNT2  (*simRegister(SIM_TCNT2))
+#define OCR2A  (*simRegister(SIM_OCR2A))
+#define TIMSK2 (*simRegister(SIM_TIMSK2))
+#define TIFR2  (*simRegister(SIM_TIFR2))
+#define UCSR0A (*simRegister(SIM_UCSR0A))
+#define UCSR0B (*simRegister(SIM_UCSR0B))
+#define UCSR0C (*simRegister(SIM_UCSR0C))
+#define UDR0   (*simRegister(SIM_UDR0))
+#define TCNT1  (*simRegister16(SIM_TCNT1))
+#define ICR1   (*simRegister16(SIM_ICR1))
+#define OCR1A  (*simRegister16(SIM_OCR1A))
+#define OCR1B  (*simRegister16(SIM_OCR1B))
+#define UBRR0  (*simRegister16(SIM_UBRR0))
+
+/******************************************************************************
+ * Register bits (ATmega328 datasheet)                                        *
+ ******************************************************************************/
+#define SPIE   7
+#define SPE    6
+#define DORD   5
+#define MSTR   4
+#define CPOL   3
+#define CPHA   2
+#define SPR1   1
+#define SPR0   0
+#define SPIF   7
+#define WCOL   6
+#define SPI2X  0
+
+#define SREG_I 7
+
+#define ISC11  3
+#define ISC10  2
+#define ISC01  1
+#define ISC00  0
+#define INT1   1
+#define INT0   0
+#define INTF1  1
+#define INTF0  0
+#define PCIE2  2
+#define PCIE1  1
+#define PCIE0  0
+#define PCIF2  2
+#define PCIF1  1
+#define PCIF0  0
+
+#define WGM01  1
+#define WGM00  0
+#define CS02   2
+#define CS01   1
+#define CS00   0
+#define OCIE0A 1
+#define OCF0A  1
+
+#define ICNC1  7
+#define ICES1  6
+#define WGM13  4
+#define WGM12  3
+#define CS12   2
+#define CS11   1
+#define CS10   0
+#define ICIE1  5
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1  0
+#define ICF1   5
+#define OCF1B  2
+#define OCF1A  1
+#define TOV1   0
+
+#define WGM21  1
+#define WGM20  0
+#define CS22   2
+#define CS21   1
+#define CS20   0
+#define OCIE2A 1
+#define OCF2A  1
+
+#define RXC0   7
+#define TXC0   6
+#define UDRE0  5
+#define U2X0   1
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0  4
+#define TXEN0  3
+#define UCSZ01 2
+#define UCSZ00 1
+
+#define SM2    3
+#define SM1    2
+#define SM0    1
+#define SE     0
+
+#define PRSPI  2
+
+
+#endif
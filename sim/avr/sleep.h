@@ -0,0 +1,23 @@
+#ifndef _SIM_AVR_SLEEP_H_
+#define _SIM_AVR_SLEEP_H_
+
+#include <avr/io.h>
+
+/******************************************************************************
+ * Host stand-in for <avr/sleep.h>. sleep_cpu() with SE set lets simulated    *
+ * time pass until an interrupt has been taken, as the CPU would sleep until  *
+ * one wakes it; the sleep mode itself is not modelled, so the timers keep    *
+ * running.                                                                   *
+ ******************************************************************************/
+#define SLEEP_MODE_IDLE     0
+#define SLEEP_MODE_PWR_DOWN (1<<SM1)
+
+void simSleep(void);
+
+#define set_sleep_mode(mode) (SMCR = (SMCR & ~((1<<SM2) | (1<<SM1) | (1<<SM0))) | (mode))
+#define sleep_enable()       (SMCR |= (1<<SE))
+#define sleep_disable()      (SMCR &= ~(1<<SE))
+#define sleep_cpu()          simSleep()
+
+
+#endif
@@ -0,0 +1,402 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "mcp2515.h"
+#include "mcp2515sim.h"
+
+/******************************************************************************
+ * Driver benchmark. Replays bus traces (candump -l logs) against the         *
+ * simulated MCP2515 (mcp2515sim.h) at 125 kbit/s to 1 Mbit/s and reports,    *
+ * for every receive and transmit strategy the driver offers, the frames per  *
+ * second that got through, the SPI bytes each frame cost, the share of       *
+ * frames lost and the share of CPU time spent in interrupt handlers.         *
+ *                                                                            *
+ *   bench [-f] [-b bitrate] trace...                                         *
+ *                                                                            *
+ * Receive strategies: "ring" (INT handler into the ring buffer, canRead() in *
+ * the main loop), "handler" (a filter handler for every filter) and "poll"   *
+ * (no interrupts, the main loop polls INT and reads frames itself). The      *
+ * receiving MCP2515 is set up with setAcceptanceFilters() for the            *
+ * identifiers in the trace (or to accept everything when there are more than *
+ * CAN_FILTER_MAX_IDS). Transmit strategies: "sendFrame" and "canWrite", with *
+ * the trace as the schedule of frames to send. With -f the recorded timing   *
+ * is ignored and the frames follow each other as fast as the bus (for        *
+ * receiving) or the driver (for transmitting) allows, which measures the     *
+ * ceiling instead of the load. A frame to transmit is lost when the driver   *
+ * still refuses it once the next one is due; with -f it is retried until it  *
+ * goes. "loopback" sends the trace with canWrite() in Loopback mode and      *
+ * reads it back with canRead(), the driver's whole transmit and receive path *
+ * without a bus, which is how an MCP2515 can be benchmarked on its own.      *
+ *                                                                            *
+ * The compile time options (MCP2515_RXBF_PINS, MCP2515_RX_ROLLOVER,          *
+ * MCP2515_SPI_CLOCK_DIV, ...) are set by building with different flags, see  *
+ * "make bench".                                                              *
+ ******************************************************************************/
+#define BENCH_MAX_FRAMES  200000
+#define BENCH_LOOP_CYCLES 200      // Application work between two driver calls
+#define BENCH_SETTLE_US   20000    // Time allowed after the last frame
+
+#define BENCH_RX_RING      0
+#define BENCH_RX_HANDLER   1
+#define BENCH_RX_POLL      2
+#define BENCH_TX_SENDFRAME 3
+#define BENCH_TX_CANWRITE  4
+#define BENCH_LOOPBACK     5
+
+static const char *strategyNames[] = {"ring", "handler", "poll", "sendFrame", "canWrite", "loopback"};
+
+typedef struct {
+    uint32_t frames;
+    uint32_t lost;
+    uint32_t spiBytes;
+    uint64_t elapsed;
+    uint64_t isrCycles;
+} benchResult;
+
+static simFrame *trace;
+static uint32_t  traceLength;
+static simFrame *schedule;
+static uint32_t  traceIds[CAN_FILTER_MAX_IDS + 1];
+static uint8_t   traceIdCount;
+
+static uint32_t  handled;
+static uint64_t  lastFrame;
+
+/******************************************************************************
+ * Trace loading                                                              *
+ ******************************************************************************/
+static uint8_t hexDigit(char c) {
+    return (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+// One "(seconds) interface id#data" line; returns 1 if it held a frame
+static uint8_t parseLine(const char *line, double *seconds, simFrame *frame) {
+    char identifier[16];
+    char payload[32] = "";
+
+    if (sscanf(line, " (%lf) %*s %15[0-9A-Fa-f]#%31s", seconds, identifier, payload) < 2) {
+        return 0;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->id       = strtoul(identifier, 0, 16);
+    frame->extended = strlen(identifier) > 3;
+
+    if (payload[0] == 'R' || payload[0] == 'r') {
+        frame->remote = 1;
+        frame->length = payload[1] ? hexDigit(payload[1]) & 0x0F : 0;
+        return 1;
+    }
+
+    for (uint8_t i = 0; i < 8 && payload[2 * i] && payload[2 * i + 1]; i++) {
+        frame->data[i] = (hexDigit(payload[2 * i]) << 4) | hexDigit(payload[2 * i + 1]);
+        frame->length  = i + 1;
+    }
+
+    return 1;
+}
+
+static uint8_t loadTrace(const char *path) {
+    FILE  *file = fopen(path, "r");
+    char   line[256];
+    double first = -1;
+
+    if (!file) {
+        perror(path);
+        return 0;
+    }
+
+    traceLength  = 0;
+    traceIdCount = 0;
+    while (fgets(line, sizeof(line), file) && traceLength < BENCH_MAX_FRAMES) {
+        double   seconds;
+        simFrame frame;
+
+        if (line[0] == '#' || !parseLine(line, &seconds, &frame)) {
+            continue;
+        }
+        if (first < 0) {
+            first = seconds;
+        }
+        // Microseconds from the first frame for now, CPU cycles once replayed
+        frame.time = (uint64_t)((seconds - first) * 1e6 + 0.5);
+        trace[traceLength++] = frame;
+
+        // Distinct identifiers, for the acceptance filters
+        uint32_t id = frame.id | (frame.extended ? CAN_EXTENDED_FLAG : 0);
+        uint8_t  known = 0;
+
+        while (known < traceIdCount && traceIds[known] != id) {
+            known++;
+        }
+        if (known == traceIdCount && traceIdCount <= CAN_FILTER_MAX_IDS) {
+            traceIds[traceIdCount++] = id;
+        }
+    }
+
+    fclose(file);
+
+    return traceLength != 0;
+}
+
+/******************************************************************************
+ * Strategies                                                                 *
+ ******************************************************************************/
+static void countFrame(uint8_t device, const canFrame *frame) {
+    (void)device;
+    (void)frame;
+
+    handled++;
+    lastFrame = simNow();
+
+    return;
+}
+
+static void countTransmitted(uint8_t device, const simFrame *frame) {
+    (void)device;
+    (void)frame;
+
+    handled++;
+    lastFrame = simNow();
+
+    return;
+}
+
+static void toCanFrame(const simFrame *from, canFrame *to) {
+    memset(to, 0, sizeof(*to));
+    canSetId(to, from->id | (from->extended ? CAN_EXTENDED_FLAG : 0) | (from->remote ? CAN_RTR_FLAG : 0));
+    canSetLength(to, from->length);
+    memcpy(to->data, from->data, sizeof(to->data));
+
+    return;
+}
+
+// Frames the polling main loop takes off the MCP2515 without any interrupt
+static void pollOnce(void) {
+    canFrame frame;
+
+    if (!messageReceived(0)) {
+        return;
+    }
+
+    uint8_t status = readStatus(0, SPI_RX_STATUS);
+
+    if (status & ((1<<RX_STATUS_RXB1) | (1<<RX_STATUS_RXB0))) {
+        readFrame(0, (status & (1<<RX_STATUS_RXB0)) ? 0 : 1, &frame);
+        countFrame(0, &frame);
+    } else {
+        bitModify(0, EFLG, (1<<RX1OVR) | (1<<RX0OVR), 0);
+        bitModify(0, CANINTF, (uint8_t)~((1<<RX1IF) | (1<<RX0IF)), 0);
+    }
+
+    return;
+}
+
+static void runReceive(uint8_t strategy, benchResult *result) {
+    canFrame frame;
+    uint64_t deadline = schedule[traceLength - 1].time + SIM_US(1000000) + traceLength * SIM_US(2000);
+
+    if (strategy == BENCH_RX_HANDLER) {
+        for (uint8_t filter = 0; filter < 8; filter++) {
+            setFilterHandler(0, filter, countFrame);
+        }
+    }
+    if (strategy != BENCH_RX_POLL) {
+        sei();
+    }
+
+    simReceive(0, schedule, traceLength);
+
+    uint64_t settled = 0;
+
+    while (simNow() < deadline) {
+        if (strategy == BENCH_RX_POLL) {
+            pollOnce();
+        } else {
+            while (canRead(0, &frame)) {
+                countFrame(0, &frame);
+            }
+        }
+        simRun(BENCH_LOOP_CYCLES);
+
+        if (!simBusIdle(0)) {
+            settled = 0;
+        } else if (!settled) {
+            settled = simNow() + SIM_US(BENCH_SETTLE_US);
+        } else if (simNow() > settled) {
+            break;
+        }
+    }
+
+    result->frames = handled;
+    result->lost   = traceLength - handled;
+
+    return;
+}
+
+static void runTransmit(uint8_t strategy, uint8_t flood, benchResult *result) {
+    canFrame frame;
+    uint32_t next     = 0;
+    uint32_t lost     = 0;
+    uint64_t deadline = schedule[traceLength - 1].time + SIM_US(1000000) + traceLength * SIM_US(2000);
+
+    simTransmitted = countTransmitted;
+    sei();
+
+    while (simNow() < deadline && (next < traceLength || handled + lost < traceLength)) {
+        if (next < traceLength && schedule[next].time <= simNow()) {
+            uint8_t accepted;
+
+            toCanFrame(&schedule[next], &frame);
+            accepted = (strategy == BENCH_TX_SENDFRAME) ? sendFrame(0, &frame)
+                                                         : canWrite(0, &frame, CAN_PRIORITY_LOW);
+            if (accepted) {
+                next++;
+            } else if (!flood && next + 1 < traceLength && schedule[next + 1].time <= simNow()) {
+                next++;
+                lost++;
+            }
+        }
+        simRun(BENCH_LOOP_CYCLES);
+    }
+
+    result->frames = handled;
+    result->lost   = traceLength - handled;
+
+    return;
+}
+
+// The transmit schedule again, each frame coming back through the ring buffer
+static void runLoopback(uint8_t flood, benchResult *result) {
+    canFrame frame;
+    uint32_t next     = 0;
+    uint32_t lost     = 0;
+    uint64_t deadline = schedule[traceLength - 1].time + SIM_US(1000000) + traceLength * SIM_US(2000);
+
+    sei();
+
+    while (simNow() < deadline && (next < traceLength || handled + lost < traceLength)) {
+        if (next < traceLength && schedule[next].time <= simNow()) {
+            toCanFrame(&schedule[next], &frame);
+            if (canWrite(0, &frame, CAN_PRIORITY_LOW)) {
+                next++;
+            } else if (!flood && next + 1 < traceLength && schedule[next + 1].time <= simNow()) {
+                next++;
+                lost++;
+            }
+        }
+        while (canRead(0, &frame)) {
+            countFrame(0, &frame);
+        }
+        simRun(BENCH_LOOP_CYCLES);
+    }
+
+    result->frames = handled;
+    result->lost   = traceLength - handled;
+
+    return;
+}
+
+/******************************************************************************
+ * One run: a fresh simulation and driver, one strategy, one bitrate. Runs    *
+ * in a child process, as the driver keeps its state in static variables.     *
+ ******************************************************************************/
+static void runOnce(const char *name, uint32_t bitrate, uint8_t strategy, uint8_t flood) {
+    benchResult result;
+
+    simInit();
+    simBitrate(0, bitrate);
+    initController(0);
+    if (!setAcceptanceFilters(0, traceIds, traceIdCount)) {
+        setAcceptanceFilters(0, 0, 0);
+    }
+    setMode(0, strategy == BENCH_LOOPBACK ? MODE_LOOPBACK : MODE_NORMAL);
+
+    uint64_t base     = simNow();
+    uint32_t spiStart = simSpiBytes();
+
+    for (uint32_t i = 0; i < traceLength; i++) {
+        schedule[i]      = trace[i];
+        schedule[i].time = base + (flood ? 0 : SIM_US(trace[i].time));
+    }
+
+    handled   = 0;
+    lastFrame = base;
+
+    if (strategy == BENCH_LOOPBACK) {
+        runLoopback(flood, &result);
+    } else if (strategy >= BENCH_TX_SENDFRAME) {
+        runTransmit(strategy, flood, &result);
+    } else {
+        runReceive(strategy, &result);
+    }
+
+    result.spiBytes  = simSpiBytes() - spiStart;
+    result.elapsed   = lastFrame - base;
+    result.isrCycles = simIsrCycles();
+
+    double seconds = (double)result.elapsed / F_CPU;
+
+    printf("%-20s %8lu %-10s %7lu %10.1f %10.2f %7.2f %6.1f\n",
+           name, (unsigned long)bitrate, strategyNames[strategy], (unsigned long)result.frames,
+           seconds > 0 ? result.frames / seconds : 0.0,
+           result.frames ? (double)result.spiBytes / result.frames : 0.0,
+           100.0 * result.lost / traceLength,
+           result.elapsed ? 100.0 * result.isrCycles / result.elapsed : 0.0);
+
+    return;
+}
+
+int main(int argc, char **argv) {
+    uint32_t rates[4] = {125000, 250000, 500000, 1000000};
+    uint8_t  rateCount = 4;
+    uint8_t  flood   = 0;
+    int      option;
+
+    while ((option = getopt(argc, argv, "fb:")) != -1) {
+        if (option == 'f') {
+            flood = 1;
+        } else if (option == 'b') {
+            rates[0]  = strtoul(optarg, 0, 10);
+            rateCount = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-f] [-b bitrate] trace...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    trace    = malloc(BENCH_MAX_FRAMES * sizeof(simFrame));
+    schedule = malloc(BENCH_MAX_FRAMES * sizeof(simFrame));
+
+    printf("# F_CPU %lu, SPI fosc/%d, RXBF pins %d, rollover %d, ring %d, %s timing\n",
+           (unsigned long)F_CPU, MCP2515_SPI_CLOCK_DIV, MCP2515_RXBF_PINS, MCP2515_RX_ROLLOVER,
+           CAN_RX_BUFFER_SIZE, flood ? "back-to-back" : "recorded");
+    printf("%-20s %8s %-10s %7s %10s %10s %7s %6s\n",
+           "trace", "bitrate", "strategy", "frames", "frames/s", "spi/frame", "lost%", "isr%");
+
+    for (int i = optind; i < argc; i++) {
+        const char *name = strrchr(argv[i], '/') ? strrchr(argv[i], '/') + 1 : argv[i];
+
+        if (!loadTrace(argv[i])) {
+            continue;
+        }
+
+        for (uint8_t rate = 0; rate < rateCount; rate++) {
+            for (uint8_t strategy = 0; strategy <= BENCH_LOOPBACK; strategy++) {
+                fflush(stdout);
+                if (fork() == 0) {
+                    runOnce(name, rates[rate], strategy, flood);
+                    fflush(stdout);
+                    _exit(0);
+                }
+                wait(0);
+            }
+        }
+    }
+
+    return 0;
+}
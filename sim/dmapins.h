@@ -0,0 +1,27 @@
+#ifndef _SIM_DMAPINS_H_
+#define _SIM_DMAPINS_H_
+
+#include <stdint.h>
+
+/******************************************************************************
+ * Host backend with a DMA channel, for MCP2515_HAL_HEADER='"dmapins.h"'. It  *
+ * is the ATmega328 backend of mcp2515pins.h with spiBurst() handed to the    *
+ * simulation's DMA channel, simSpiDma(): one access starts the job, which    *
+ * clocks every byte back to back and returns once the last one is through.   *
+ * MCP2515_SPI_DMA is 1, so this is the backend that builds and runs the      *
+ * single-burst readFrame() (see the "dma" sim test).                         *
+ ******************************************************************************/
+#define MCP2515_SPI_DMA 1
+
+void simSpiDma(const uint8_t *tx, uint8_t *rx, uint8_t length);
+
+#include "mcp2515pins.h"
+
+MCP2515_ALWAYS_INLINE void spiBurst(const uint8_t *tx, uint8_t *rx, uint8_t length) {
+    PROF_ADD(spiBytes, length);
+
+    simSpiDma(tx, rx, length);
+}
+
+
+#endif
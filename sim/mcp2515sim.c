@@ -0,0 +1,1487 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcp2515sim.h"
+#include "mcp2515.h"
+#include "mcp2515config.h"
+#include "mcp2515registers.h"
+#include "mcp2515pins.h"
+
+#define SIM_BUS_IDLE        0
+#define SIM_BUS_RECEIVING   1
+#define SIM_BUS_TRANSMITTING 2
+
+/******************************************************************************
+ * Interrupt vectors. The driver only defines the ones its configuration      *
+ * needs, so they are weak references here and an interrupt without a handler *
+ * stops the simulation.                                                      *
+ ******************************************************************************/
+#define SIM_VECTOR(name) void name(void) __attribute__((weak))
+
+SIM_VECTOR(INT0_vect);
+SIM_VECTOR(INT1_vect);
+SIM_VECTOR(PCINT2_vect);
+SIM_VECTOR(TIMER2_COMPA_vect);
+SIM_VECTOR(TIMER1_OVF_vect);
+SIM_VECTOR(TIMER0_COMPA_vect);
+SIM_VECTOR(SPI_STC_vect);
+SIM_VECTOR(USART_UDRE_vect);
+
+/******************************************************************************
+ * One simulated MCP2515. "cs", "rts" and "rxbf" point at the AVR port        *
+ * registers its pins are wired to (from mcp2515config.h), "selected" and     *
+ * "rtsLevels" are the pin levels seen at the last access, and "opcode",      *
+ * "position", "address" and "mask" track the SPI instruction in progress.    *
+ *                                                                            *
+ * On the bus side, "busState" says whether a frame is on the wire (and which *
+ * way), "busFree" is when the wire goes idle and "wire" is the frame on it.  *
+ * "txRequested" is when TXREQ of each transmit buffer was set, and           *
+ * "rxFilter" the RX STATUS filter code of each receive buffer. "txErrors" is *
+ * the transmit error count (TEC only shows up to 255 of it), "failures" the  *
+ * number of transmissions still to fail (see simTransmitErrors()) and        *
+ * "busOffUntil" when a device in bus-off rejoins by itself.                  *
+ ******************************************************************************/
+typedef struct {
+    uint8_t           regs[128];
+    volatile uint8_t *cs;
+    uint8_t           csMask;
+    volatile uint8_t *rts;
+    uint8_t           rtsMask[3];
+    volatile uint8_t *rxbf;
+    uint8_t           rxbfMask[2];
+    uint8_t           intBit;
+    uint8_t           intLow;
+    uint8_t           selected;
+    uint8_t           rtsLevels;
+    uint8_t           opcode;
+    uint8_t           position;
+    uint8_t           address;
+    uint8_t           mask;
+    uint8_t           rxFilter[2];
+    uint32_t          bitrate;
+    const simFrame   *incoming;
+    uint32_t          incomingCount;
+    uint32_t          incomingNext;
+    uint8_t           busState;
+    uint64_t          busFree;
+    simFrame          wire;
+    uint8_t           wireBuffer;
+    uint64_t          txRequested[3];
+    uint16_t          txErrors;
+    uint32_t          failures;
+    uint64_t          busOffUntil;
+    simCounters       counters;
+} simChip;
+
+static simChip chips[MCP2515_DEVICE_COUNT];
+
+/******************************************************************************
+ * AVR state. "registers" holds the I/O registers as the driver last wrote    *
+ * them, "flags" the interrupt flag registers as the simulation keeps them    *
+ * and "flagsShown" what they read back as at the last access (a difference   *
+ * is a write that clears flags).                                             *
+ ******************************************************************************/
+static uint8_t  registers[SIM_REGISTER_COUNT];
+static uint16_t registers16[SIM_REGISTER16_COUNT];
+static uint8_t  flags[SIM_REGISTER_COUNT];
+static uint8_t  flagsShown[SIM_REGISTER_COUNT];
+static uint8_t  quiet;
+static uint8_t  inInterrupt;
+static uint64_t now;
+static uint64_t isrCycles;
+
+static uint8_t  spiActive;
+static uint8_t  spiFlag;
+static uint8_t  spiData;
+static uint64_t spiDone;
+static uint32_t spiBytes;
+
+static uint8_t  timer1Clock;
+static uint64_t timer1Base;
+static uint64_t timer1Next;
+static uint8_t  timer0Setup[3];
+static uint64_t timer0Base;
+static uint64_t timer0Next;
+static uint8_t  timer2Setup[3];
+static uint64_t timer2Base;
+static uint64_t timer2Next;
+
+static uint64_t uartEmpty;
+static uint64_t uartDone;
+
+void (*simTransmitted)(uint8_t device, const simFrame *frame);
+void (*simUartTransmitted)(uint8_t data);
+
+static void simUpdate(void);
+
+/******************************************************************************
+ * CAN bit timing                                                             *
+ ******************************************************************************/
+static uint16_t crcBits(uint16_t crc, uint32_t value, uint8_t count) {
+    while (count--) {
+        uint8_t bit = ((value >> count) & 1) ^ ((crc >> 14) & 1);
+
+        crc = (crc << 1) & 0x7FFF;
+        if (bit) {
+            crc ^= 0x4599;
+        }
+    }
+
+    return crc;
+}
+
+/******************************************************************************
+ * Bits a frame occupies on the wire: SOF up to the CRC with its stuff bits,  *
+ * then the CRC delimiter, ACK, end of frame and intermission.                *
+ ******************************************************************************/
+static uint32_t frameBits(const simFrame *frame) {
+    uint8_t  bits[160];
+    uint8_t  count  = 0;
+    uint8_t  length = frame->remote ? 0 : (frame->length > 8 ? 8 : frame->length);
+    uint16_t crc    = 0;
+
+#define SIM_PUSH(value, n) do {                                      \
+        for (int8_t i_ = (n) - 1; i_ >= 0; i_--) {                   \
+            bits[count++] = ((value) >> i_) & 1;                     \
+        }                                                            \
+        crc = crcBits(crc, (value), (n));                            \
+    } while (0)
+
+    SIM_PUSH(0, 1);
+    if (frame->extended) {
+        SIM_PUSH(frame->id >> 18, 11);
+        SIM_PUSH(3, 2);
+        SIM_PUSH(frame->id & 0x3FFFF, 18);
+        SIM_PUSH(frame->remote ? 1 : 0, 1);
+        SIM_PUSH(0, 2);
+    } else {
+        SIM_PUSH(frame->id & CAN_STANDARD_MASK, 11);
+        SIM_PUSH(frame->remote ? 1 : 0, 1);
+        SIM_PUSH(0, 2);
+    }
+    SIM_PUSH(frame->length & 0x0F, 4);
+    for (uint8_t i = 0; i < length; i++) {
+        SIM_PUSH(frame->data[i], 8);
+    }
+#undef SIM_PUSH
+
+    for (int8_t i = 14; i >= 0; i--) {
+        bits[count++] = (crc >> i) & 1;
+    }
+
+    uint32_t total = count;
+    uint8_t  last  = bits[0];
+    uint8_t  run   = 1;
+
+    for (uint8_t i = 1; i < count; i++) {
+        if (bits[i] == last) {
+            run++;
+        } else {
+            last = bits[i];
+            run  = 1;
+        }
+        // After five equal bits a stuff bit of the opposite level starts a new run
+        if (run == 5) {
+            total++;
+            last = !last;
+            run  = 1;
+        }
+    }
+
+    return total + 1 + 2 + 7 + 3;
+}
+
+// CPU cycles "bits" bit times on the bus of "chip" take
+static uint64_t bitCycles(const simChip *chip, uint64_t bits) {
+    if (chip->bitrate) {
+        return bits * F_CPU / chip->bitrate;
+    }
+
+    uint8_t  cnf1   = chip->regs[CNF1];
+    uint8_t  cnf2   = chip->regs[CNF2];
+    uint8_t  cnf3   = chip->regs[CNF3];
+    uint8_t  phseg1 = ((cnf2 >> PHSEG10) & 0x07) + 1;
+    uint8_t  phseg2 = (cnf2 & (1<<BTLMODE)) ? (cnf3 & 0x07) + 1 : (phseg1 > 2 ? phseg1 : 2);
+    uint64_t tq     = 1 + ((cnf2 & 0x07) + 1) + phseg1 + phseg2;
+
+    return bits * tq * 2 * ((cnf1 & 0x3F) + 1) * F_CPU / MCP2515_OSC_HZ;
+}
+
+// CPU cycles a frame occupies the bus of "chip" for
+static uint64_t frameCycles(const simChip *chip, const simFrame *frame) {
+    return bitCycles(chip, frameBits(frame));
+}
+
+/******************************************************************************
+ * MCP2515 register file                                                      *
+ ******************************************************************************/
+static uint8_t chipMode(const simChip *chip) {
+    return chip->regs[CANSTAT] & OPMOD_MASK;
+}
+
+static void chipReset(simChip *chip) {
+    memset(chip->regs, 0, sizeof(chip->regs));
+    chip->regs[CANSTAT] = MODE_CONFIG;
+    chip->regs[CANCTRL] = MODE_CONFIG | (1<<CLKEN) | (1<<CLKPRE1) | (1<<CLKPRE0);
+
+    return;
+}
+
+// ICOD bits of CANSTAT: the highest priority interrupt that is enabled and set
+static uint8_t chipInterruptCode(const simChip *chip) {
+    static const uint8_t order[7][2] = {
+        {ERRIF, 1}, {WAKIF, 2}, {TX0IF, 3}, {TX1IF, 4}, {TX2IF, 5}, {RX0IF, 6}, {RX1IF, 7}
+    };
+    uint8_t pending = chip->regs[CANINTF] & chip->regs[CANINTE];
+
+    for (uint8_t i = 0; i < 7; i++) {
+        if (pending & (1<<order[i][0])) {
+            return order[i][1];
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t chipRead(const simChip *chip, uint8_t address) {
+    address &= 0x7F;
+
+    if ((address & 0x0F) == CANSTAT) {
+        return (chip->regs[CANSTAT] & OPMOD_MASK) | (chipInterruptCode(chip) << ICOD0);
+    }
+    if ((address & 0x0F) == CANCTRL) {
+        return chip->regs[CANCTRL];
+    }
+
+    return chip->regs[address];
+}
+
+/******************************************************************************
+ * Sets TEC, REC and the error bits of EFLG from the error counts, as the     *
+ * MCP2515 does: warning at 96, error-passive at 128, bus-off once the        *
+ * transmit error count passes 255. A change of the error bits raises ERRIF.  *
+ ******************************************************************************/
+static void chipErrorFlags(simChip *chip) {
+    uint8_t rec   = chip->regs[REC];
+    uint8_t flags = 0;
+
+    if (chip->txErrors >= 96) {
+        flags |= (1<<TXWAR) | (1<<EWARN);
+    }
+    if (rec >= 96) {
+        flags |= (1<<RXWAR) | (1<<EWARN);
+    }
+    if (chip->txErrors >= 128) {
+        flags |= (1<<TXEP);
+    }
+    if (rec >= 128) {
+        flags |= (1<<RXEP);
+    }
+    if (chip->txErrors > 255) {
+        flags |= (1<<TXBO);
+    }
+
+    chip->regs[TEC] = chip->txErrors > 255 ? 255 : chip->txErrors;
+    if (flags != (chip->regs[EFLG] & 0x3F)) {
+        chip->regs[EFLG]     = (chip->regs[EFLG] & 0xC0) | flags;
+        chip->regs[CANINTF] |= (1<<ERRIF);
+    }
+
+    return;
+}
+
+static uint8_t chipBusOff(const simChip *chip) {
+    return chip->txErrors > 255;
+}
+
+static void chipRequest(simChip *chip, uint8_t buffer) {
+    uint8_t *control = &chip->regs[TXB0CTRL + 16 * buffer];
+
+    if (!(*control & (1<<TXREQ))) {
+        *control |= (1<<TXREQ);
+        *control &= ~((1<<ABTF) | (1<<MLOA) | (1<<TXERR));
+        chip->txRequested[buffer] = now;
+    }
+
+    return;
+}
+
+// Drops every pending transmission that has not reached the wire yet
+static void chipAbort(simChip *chip) {
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        uint8_t *control = &chip->regs[TXB0CTRL + 16 * buffer];
+        uint8_t  onWire  = chip->busState == SIM_BUS_TRANSMITTING && chip->wireBuffer == buffer;
+
+        if ((*control & (1<<TXREQ)) && !onWire) {
+            *control = (*control & ~(1<<TXREQ)) | (1<<ABTF);
+        }
+    }
+
+    return;
+}
+
+static void chipWrite(simChip *chip, uint8_t address, uint8_t value) {
+    address &= 0x7F;
+
+    if ((address & 0x0F) == CANSTAT) {
+        return;
+    }
+
+    if ((address & 0x0F) == CANCTRL) {
+        chip->regs[CANCTRL] = value;
+        chip->regs[CANSTAT] = (value & REQOP_MASK) | (chip->regs[CANSTAT] & ~OPMOD_MASK);
+        if (value & (1<<ABAT)) {
+            chipAbort(chip);
+        }
+        // Configuration mode clears the error counters, bus-off included
+        if (chipMode(chip) == MODE_CONFIG) {
+            chip->txErrors   = 0;
+            chip->regs[REC]  = 0;
+            chipErrorFlags(chip);
+        }
+        return;
+    }
+
+    switch (address) {
+    case TXB0CTRL:
+    case TXB1CTRL:
+    case TXB2CTRL: {
+        uint8_t buffer = (address - TXB0CTRL) >> 4;
+
+        chip->regs[address] = (chip->regs[address] & ~((1<<TXP1) | (1<<TXP0))) |
+                              (value & ((1<<TXP1) | (1<<TXP0)));
+        if (value & (1<<TXREQ)) {
+            chipRequest(chip, buffer);
+        } else if (!(chip->busState == SIM_BUS_TRANSMITTING && chip->wireBuffer == buffer)) {
+            chip->regs[address] &= ~(1<<TXREQ);
+        }
+        break;
+    }
+    case RXB0CTRL:
+        value &= (1<<RXM1) | (1<<RXM0) | (1<<BUKT);
+        chip->regs[address] = (chip->regs[address] & ((1<<RXRTR) | (1<<FILHIT0))) | value |
+                              ((value & (1<<BUKT)) ? (1<<BUKT1) : 0);
+        break;
+    case RXB1CTRL:
+        chip->regs[address] = (chip->regs[address] & ~((1<<RXM1) | (1<<RXM0))) |
+                              (value & ((1<<RXM1) | (1<<RXM0)));
+        break;
+    case EFLG:
+        chip->regs[address] &= value | ~((1<<RX1OVR) | (1<<RX0OVR));
+        break;
+    case TXRTSCTRL:
+        chip->regs[address] = (chip->regs[address] & 0x38) | (value & 0x07);
+        break;
+    case TEC:
+    case REC:
+        break;
+    default:
+        chip->regs[address] = value;
+        break;
+    }
+
+    return;
+}
+
+// BIT MODIFY only works on some registers and writes all bits on the others
+static void chipModify(simChip *chip, uint8_t address, uint8_t mask, uint8_t data) {
+    uint8_t low = address & 0x0F;
+
+    if (!(low == CANCTRL || address == BFPCTRL || address == TXRTSCTRL ||
+          (address >= CNF3 && address <= EFLG) ||
+          address == TXB0CTRL || address == TXB1CTRL || address == TXB2CTRL ||
+          address == RXB0CTRL || address == RXB1CTRL)) {
+        mask = 0xFF;
+    }
+
+    chipWrite(chip, address, (chipRead(chip, address) & ~mask) | (data & mask));
+
+    return;
+}
+
+static uint8_t chipStatus(const simChip *chip) {
+    uint8_t f = chip->regs[CANINTF];
+
+    return (((f >> RX0IF) & 1) << STATUS_RX0IF) |
+           (((f >> RX1IF) & 1) << STATUS_RX1IF) |
+           (((chip->regs[TXB0CTRL] >> TXREQ) & 1) << STATUS_TX0REQ) |
+           (((f >> TX0IF) & 1) << STATUS_TX0IF) |
+           (((chip->regs[TXB1CTRL] >> TXREQ) & 1) << STATUS_TX1REQ) |
+           (((f >> TX1IF) & 1) << STATUS_TX1IF) |
+           (((chip->regs[TXB2CTRL] >> TXREQ) & 1) << STATUS_TX2REQ) |
+           (((f >> TX2IF) & 1) << STATUS_TX2IF);
+}
+
+static uint8_t chipRxStatus(const simChip *chip) {
+    uint8_t full   = chip->regs[CANINTF] & ((1<<RX1IF) | (1<<RX0IF));
+    uint8_t buffer = (full & (1<<RX0IF)) ? 0 : 1;
+    uint8_t base   = RXB0SIDH + 16 * buffer;
+    uint8_t status = full << RX_STATUS_RXB0;
+
+    if (!full) {
+        return 0;
+    }
+
+    if (chip->regs[base + 1] & (1<<IDE)) {
+        status |= (1<<RX_STATUS_EXTENDED);
+        if (chip->regs[base + 4] & (1<<RTR)) {
+            status |= (1<<RX_STATUS_REMOTE);
+        }
+    } else if (chip->regs[base + 1] & (1<<SRR)) {
+        status |= (1<<RX_STATUS_REMOTE);
+    }
+
+    return status | chip->rxFilter[buffer];
+}
+
+/******************************************************************************
+ * One byte of an SPI instruction: "in" is what the AVR sent, the return      *
+ * value what the MCP2515 shifts back at the same time.                       *
+ ******************************************************************************/
+static uint8_t chipByte(simChip *chip, uint8_t in) {
+    uint8_t position = chip->position++;
+    uint8_t opcode   = chip->opcode;
+
+    if (position == 0) {
+        chip->opcode = in;
+
+        if (in == SPI_RESET) {
+            chipReset(chip);
+        } else if ((in & 0xF9) == SPI_READ_RX) {
+            chip->address = RXB0SIDH + 16 * ((in >> 2) & 1) + ((in & 0x02) ? 5 : 0);
+        } else if ((in & 0xF8) == SPI_LOAD_TX && (in & 0x07) < 6) {
+            chip->address = TXB0SIDH + 16 * ((in >> 1) & 3) + ((in & 0x01) ? 5 : 0);
+        } else if ((in & 0xF8) == SPI_RTS) {
+            for (uint8_t buffer = 0; buffer < 3; buffer++) {
+                if (in & (1<<buffer)) {
+                    chipRequest(chip, buffer);
+                }
+            }
+        }
+        return 0xFF;
+    }
+
+    if (opcode == SPI_READ) {
+        if (position == 1) {
+            chip->address = in;
+            return 0xFF;
+        }
+        return chipRead(chip, chip->address++);
+    }
+
+    if (opcode == SPI_WRITE) {
+        if (position == 1) {
+            chip->address = in;
+        } else {
+            chipWrite(chip, chip->address++, in);
+        }
+        return 0xFF;
+    }
+
+    if (opcode == SPI_BIT_MODIFY) {
+        if (position == 1) {
+            chip->address = in;
+        } else if (position == 2) {
+            chip->mask = in;
+        } else if (position == 3) {
+            chipModify(chip, chip->address, chip->mask, in);
+        }
+        return 0xFF;
+    }
+
+    if (opcode == SPI_READ_STATUS) {
+        return chipStatus(chip);
+    }
+
+    if (opcode == SPI_RX_STATUS) {
+        return chipRxStatus(chip);
+    }
+
+    if ((opcode & 0xF9) == SPI_READ_RX) {
+        return chip->regs[chip->address++ & 0x7F];
+    }
+
+    if ((opcode & 0xF8) == SPI_LOAD_TX && (opcode & 0x07) < 6) {
+        chip->regs[chip->address++ & 0x7F] = in;
+    }
+
+    return 0xFF;
+}
+
+// Chip Select went HIGH: raising it after READ RX BUFFER clears RXnIF
+static void chipRelease(simChip *chip) {
+    if (chip->position && (chip->opcode & 0xF9) == SPI_READ_RX) {
+        chip->regs[CANINTF] &= ~(1 << ((chip->opcode >> 2) & 1));
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * MCP2515 bus side                                                           *
+ ******************************************************************************/
+static uint8_t filterMatch(const simChip *chip, uint8_t filter, uint8_t mask, const simFrame *frame) {
+    const uint8_t *f = &chip->regs[filter];
+    const uint8_t *m = &chip->regs[mask];
+    uint32_t fsid = ((uint32_t)f[0] << 3) | (f[1] >> 5);
+    uint32_t msid = ((uint32_t)m[0] << 3) | (m[1] >> 5);
+    uint32_t feid = ((uint32_t)(f[1] & 0x03) << 16) | ((uint32_t)f[2] << 8) | f[3];
+    uint32_t meid = ((uint32_t)(m[1] & 0x03) << 16) | ((uint32_t)m[2] << 8) | m[3];
+
+    if (((f[1] >> EXIDE) & 1) != frame->extended) {
+        return 0;
+    }
+
+    if (frame->extended) {
+        return !(((frame->id >> 18) ^ fsid) & msid) && !(((frame->id & 0x3FFFF) ^ feid) & meid);
+    }
+
+    // Standard frames match EID8 and EID0 against the first two data bytes
+    uint8_t d0 = frame->length > 0 ? frame->data[0] : 0;
+    uint8_t d1 = frame->length > 1 ? frame->data[1] : 0;
+
+    return !((frame->id ^ fsid) & msid) && !((d0 ^ f[2]) & m[2]) && !((d1 ^ f[3]) & m[3]);
+}
+
+static void chipStore(simChip *chip, uint8_t buffer, uint8_t filter, const simFrame *frame) {
+    uint8_t *r      = &chip->regs[RXB0SIDH + 16 * buffer];
+    uint8_t *ctrl   = &chip->regs[RXB0CTRL + 16 * buffer];
+    uint8_t  length = frame->remote ? 0 : (frame->length > 8 ? 8 : frame->length);
+
+    if (frame->extended) {
+        uint32_t sid = frame->id >> 18;
+
+        r[0] = sid >> 3;
+        r[1] = ((sid << 5) & 0xE0) | (1<<IDE) | ((frame->id >> 16) & 0x03);
+        r[2] = frame->id >> 8;
+        r[3] = frame->id;
+        r[4] = (frame->remote ? (1<<RTR) : 0) | (frame->length & DLC_MASK);
+    } else {
+        r[0] = frame->id >> 3;
+        r[1] = ((frame->id << 5) & 0xE0) | (frame->remote ? (1<<SRR) : 0);
+        r[2] = 0;
+        r[3] = 0;
+        r[4] = frame->length & DLC_MASK;
+    }
+    memcpy(&r[5], frame->data, length);
+
+    if (buffer == 0) {
+        *ctrl = (*ctrl & ~((1<<RXRTR) | (1<<FILHIT0))) | (frame->remote ? (1<<RXRTR) : 0) | (filter & 1);
+        chip->rxFilter[0] = filter;
+    } else {
+        uint8_t hit = filter > 5 ? filter - 6 : filter;
+
+        *ctrl = (*ctrl & ((1<<RXM1) | (1<<RXM0))) | (frame->remote ? (1<<RXRTR) : 0) | hit;
+        chip->rxFilter[1] = filter;
+    }
+
+    chip->regs[CANINTF] |= (1 << buffer);
+    chip->counters.framesReceived++;
+
+    return;
+}
+
+static void chipOverflow(simChip *chip, uint8_t buffer) {
+    chip->regs[EFLG]    |= buffer ? (1<<RX1OVR) : (1<<RX0OVR);
+    chip->regs[CANINTF] |= (1<<ERRIF);
+    chip->counters.framesOverflowed++;
+
+    return;
+}
+
+/******************************************************************************
+ * Acceptance: RXB0 first through filters 0 and 1 (rolling over into RXB1     *
+ * with BUKT set), then RXB1 through filters 2 to 5. RXM set to 11 in         *
+ * RXBnCTRL takes every frame.                                                *
+ ******************************************************************************/
+static void chipAccept(simChip *chip, const simFrame *frame) {
+    int8_t hit = -1;
+
+    if (((chip->regs[RXB0CTRL] >> RXM0) & 3) == 3) {
+        hit = 0;
+    } else if (filterMatch(chip, RXF0SIDH, RXM0SIDH, frame)) {
+        hit = 0;
+    } else if (filterMatch(chip, RXF1SIDH, RXM0SIDH, frame)) {
+        hit = 1;
+    }
+
+    if (hit >= 0) {
+        if (!(chip->regs[CANINTF] & (1<<RX0IF))) {
+            chipStore(chip, 0, hit, frame);
+        } else if (!(chip->regs[RXB0CTRL] & (1<<BUKT))) {
+            chipOverflow(chip, 0);
+        } else if (!(chip->regs[CANINTF] & (1<<RX1IF))) {
+            chipStore(chip, 1, hit + 6, frame);
+        } else {
+            chipOverflow(chip, 1);
+        }
+        return;
+    }
+
+    static const uint8_t filters[4] = {RXF2SIDH, RXF3SIDH, RXF4SIDH, RXF5SIDH};
+
+    if (((chip->regs[RXB1CTRL] >> RXM0) & 3) == 3) {
+        hit = 2;
+    } else {
+        for (uint8_t i = 0; i < 4 && hit < 0; i++) {
+            if (filterMatch(chip, filters[i], RXM1SIDH, frame)) {
+                hit = i + 2;
+            }
+        }
+    }
+
+    if (hit < 0) {
+        chip->counters.framesFiltered++;
+    } else if (!(chip->regs[CANINTF] & (1<<RX1IF))) {
+        chipStore(chip, 1, hit, frame);
+    } else {
+        chipOverflow(chip, 1);
+    }
+
+    return;
+}
+
+static void chipTakeFrame(const simChip *chip, uint8_t buffer, simFrame *frame) {
+    const uint8_t *r   = &chip->regs[TXB0SIDH + 16 * buffer];
+    uint32_t       sid = ((uint32_t)r[0] << 3) | (r[1] >> 5);
+
+    frame->extended = (r[1] >> EXIDE) & 1;
+    frame->id       = frame->extended ? (sid << 18) | ((uint32_t)(r[1] & 0x03) << 16) |
+                                        ((uint32_t)r[2] << 8) | r[3]
+                                      : sid;
+    frame->remote   = (r[4] >> RTR) & 1;
+    frame->length   = r[4] & DLC_MASK;
+    frame->time     = now;
+    memcpy(frame->data, &r[5], 8);
+
+    return;
+}
+
+static void chipFrameDone(simChip *chip) {
+    uint8_t mode = chipMode(chip);
+
+    if (chip->busState == SIM_BUS_TRANSMITTING && chip->failures) {
+        uint8_t buffer = chip->wireBuffer;
+
+        // An error frame instead: TXREQ stays set and the frame goes again,
+        // except in One-shot mode, where the frame is dropped without TXnIF
+        chip->failures--;
+        chip->regs[TXB0CTRL + 16 * buffer] |= (1<<TXERR);
+        if (chip->regs[CANCTRL] & (1<<OSM)) {
+            chip->regs[TXB0CTRL + 16 * buffer] &= ~(1<<TXREQ);
+        }
+        chip->regs[CANINTF] |= (1<<MERRF);
+        chip->txErrors      += 8;
+        chip->txRequested[buffer] = now;
+        if (chipBusOff(chip)) {
+            chip->busOffUntil = now + bitCycles(chip, 128 * 11);
+        }
+        chipErrorFlags(chip);
+    } else if (chip->busState == SIM_BUS_TRANSMITTING) {
+        uint8_t buffer = chip->wireBuffer;
+
+        if (chip->txErrors) {
+            chip->txErrors--;
+            chipErrorFlags(chip);
+        }
+        chip->regs[TXB0CTRL + 16 * buffer] &= ~(1<<TXREQ);
+        chip->regs[CANINTF] |= (1 << (TX0IF + buffer));
+        chip->counters.framesTransmitted++;
+
+        if (mode == MODE_LOOPBACK) {
+            chipAccept(chip, &chip->wire);
+        } else if (simTransmitted) {
+            simTransmitted(chip - chips, &chip->wire);
+        }
+    } else if (mode == MODE_NORMAL || mode == MODE_LISTEN) {
+        // Every valid frame gets its ACK, whatever the filters make of it,
+        // except in Listen-only mode
+        if (mode == MODE_NORMAL) {
+            chip->counters.framesAcknowledged++;
+        }
+        chipAccept(chip, &chip->wire);
+    } else {
+        // Bus activity wakes a sleeping MCP2515 into Listen-only mode
+        if (mode == MODE_SLEEP) {
+            chip->regs[CANINTF]     |= (1<<WAKIF);
+            chip->regs[CANSTAT]  = MODE_LISTEN | (chip->regs[CANSTAT] & ~OPMOD_MASK);
+        }
+        chip->counters.framesMissed++;
+    }
+
+    chip->busState = SIM_BUS_IDLE;
+
+    return;
+}
+
+/******************************************************************************
+ * Picks the next frame for the wire of an idle "chip": the earliest of the   *
+ * next incoming frame and the transmit buffers waiting with TXREQ (highest   *
+ * TXP first, then the highest buffer number, as the MCP2515 does). A tie is  *
+ * won by the lower identifier, as in arbitration. Returns 0 with "start"     *
+ * untouched when there is nothing to send or receive.                        *
+ ******************************************************************************/
+static uint8_t chipNextFrame(const simChip *chip, uint64_t *start, int8_t *buffer) {
+    uint8_t  found = 0;
+    int8_t   tx    = -1;
+    uint64_t txAt  = 0;
+
+    if ((chipMode(chip) == MODE_NORMAL || chipMode(chip) == MODE_LOOPBACK) && !chipBusOff(chip)) {
+        for (int8_t i = 2; i >= 0; i--) {
+            uint8_t control = chip->regs[TXB0CTRL + 16 * i];
+
+            if ((control & (1<<TXREQ)) &&
+                (tx < 0 || (control & 3) > (chip->regs[TXB0CTRL + 16 * tx] & 3))) {
+                tx = i;
+            }
+        }
+        if (tx >= 0) {
+            txAt  = chip->txRequested[tx] > chip->busFree ? chip->txRequested[tx] : chip->busFree;
+            found = 1;
+        }
+    }
+
+    if (chip->incomingNext < chip->incomingCount) {
+        const simFrame *frame = &chip->incoming[chip->incomingNext];
+        uint64_t        rxAt  = frame->time > chip->busFree ? frame->time : chip->busFree;
+
+        if (!found || rxAt < txAt) {
+            *start  = rxAt;
+            *buffer = -1;
+            return 1;
+        }
+        if (rxAt == txAt) {
+            simFrame own;
+
+            chipTakeFrame(chip, tx, &own);
+            uint32_t rxKey = frame->extended ? frame->id : (frame->id << 18);
+            uint32_t txKey = own.extended ? own.id : (own.id << 18);
+
+            if (rxKey < txKey || (rxKey == txKey && !frame->extended)) {
+                *start  = rxAt;
+                *buffer = -1;
+                return 1;
+            }
+        }
+    }
+
+    if (found) {
+        *start  = txAt;
+        *buffer = tx;
+    }
+
+    return found;
+}
+
+static void chipBus(simChip *chip) {
+    // Bus-off ends by itself after 128 times 11 recessive bits in Normal mode
+    if (chipBusOff(chip) && now >= chip->busOffUntil && chipMode(chip) == MODE_NORMAL) {
+        chip->txErrors  = 0;
+        chip->regs[REC] = 0;
+        chipErrorFlags(chip);
+    }
+
+    for (;;) {
+        if (chip->busState != SIM_BUS_IDLE) {
+            if (chip->busFree > now) {
+                return;
+            }
+            chipFrameDone(chip);
+            continue;
+        }
+
+        uint64_t start;
+        int8_t   buffer;
+
+        if (!chipNextFrame(chip, &start, &buffer) || start > now) {
+            return;
+        }
+
+        if (buffer < 0) {
+            chip->wire     = chip->incoming[chip->incomingNext++];
+            chip->busState = SIM_BUS_RECEIVING;
+        } else {
+            chipTakeFrame(chip, buffer, &chip->wire);
+            chip->wireBuffer = buffer;
+            chip->busState   = SIM_BUS_TRANSMITTING;
+        }
+        chip->busFree = start + frameCycles(chip, &chip->wire);
+    }
+}
+
+/******************************************************************************
+ * AVR side                                                                   *
+ ******************************************************************************/
+static void setFlag(uint8_t reg, uint8_t bit) {
+    flags[reg]      |= (1<<bit);
+    registers[reg]   = flags[reg];
+    flagsShown[reg]  = flags[reg];
+
+    return;
+}
+
+static uint8_t takeFlag(uint8_t reg, uint8_t bit) {
+    if (!(flags[reg] & (1<<bit))) {
+        return 0;
+    }
+
+    flags[reg]      &= ~(1<<bit);
+    registers[reg]   = flags[reg];
+    flagsShown[reg]  = flags[reg];
+
+    return 1;
+}
+
+static uint16_t timer1Prescaler(uint8_t clock) {
+    static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+    return prescalers[clock & 0x07];
+}
+
+static uint16_t timer0Prescaler(uint8_t clock) {
+    static const uint16_t prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+
+    return prescalers[clock & 0x07];
+}
+
+static uint16_t timer2Prescaler(uint8_t clock) {
+    static const uint16_t prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+
+    return prescalers[clock & 0x07];
+}
+
+static uint16_t timer1Count(void) {
+    uint16_t prescaler = timer1Prescaler(timer1Clock);
+
+    return prescaler ? (uint16_t)((now - timer1Base) / prescaler) : registers16[SIM_TCNT1];
+}
+
+// Picks up what the driver wrote since the last access
+static void simLatch(void) {
+    static const uint8_t flagRegisters[5] = {SIM_EIFR, SIM_PCIFR, SIM_TIFR0, SIM_TIFR1, SIM_TIFR2};
+
+    for (uint8_t i = 0; i < 5; i++) {
+        uint8_t reg = flagRegisters[i];
+
+        if (registers[reg] != flagsShown[reg]) {
+            flags[reg]     &= ~registers[reg];
+            registers[reg]  = flags[reg];
+            flagsShown[reg] = flags[reg];
+        }
+    }
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        simChip *chip     = &chips[device];
+        uint8_t  selected = !(*chip->cs & chip->csMask);
+
+        if (selected != chip->selected) {
+            if (selected) {
+                chip->position = 0;
+            } else {
+                chipRelease(chip);
+            }
+            chip->selected = selected;
+        }
+
+        if (chip->rts) {
+            for (uint8_t buffer = 0; buffer < 3; buffer++) {
+                uint8_t level = (*chip->rts & chip->rtsMask[buffer]) || !chip->rtsMask[buffer];
+                uint8_t was   = (chip->rtsLevels >> buffer) & 1;
+
+                if (chip->rtsMask[buffer] && was && !level &&
+                    (chip->regs[TXRTSCTRL] & (1 << buffer))) {
+                    chipRequest(chip, buffer);
+                }
+                chip->rtsLevels = (chip->rtsLevels & ~(1<<buffer)) | (level << buffer);
+            }
+            // Pin states read back through B0RTS..B2RTS
+            chip->regs[TXRTSCTRL] = (chip->regs[TXRTSCTRL] & 0x07) | (chip->rtsLevels << B0RTS);
+        }
+    }
+
+    if ((registers[SIM_TCCR1B] & 0x07) != timer1Clock) {
+        uint16_t count = timer1Count();
+
+        timer1Clock = registers[SIM_TCCR1B] & 0x07;
+        timer1Base  = now - (uint64_t)count * timer1Prescaler(timer1Clock);
+        timer1Next  = timer1Prescaler(timer1Clock) ? timer1Base + 65536ULL * timer1Prescaler(timer1Clock) : 0;
+    }
+
+    if (registers[SIM_TCCR0A] != timer0Setup[0] || registers[SIM_TCCR0B] != timer0Setup[1] ||
+        registers[SIM_OCR0A] != timer0Setup[2]) {
+        uint16_t prescaler = timer0Prescaler(registers[SIM_TCCR0B]);
+
+        timer0Setup[0] = registers[SIM_TCCR0A];
+        timer0Setup[1] = registers[SIM_TCCR0B];
+        timer0Setup[2] = registers[SIM_OCR0A];
+        timer0Base     = now;
+        timer0Next     = prescaler ? now + (uint64_t)(registers[SIM_OCR0A] + 1) * prescaler : 0;
+    }
+
+    if (registers[SIM_TCCR2A] != timer2Setup[0] || registers[SIM_TCCR2B] != timer2Setup[1] ||
+        registers[SIM_OCR2A] != timer2Setup[2]) {
+        uint16_t prescaler = timer2Prescaler(registers[SIM_TCCR2B]);
+
+        timer2Setup[0] = registers[SIM_TCCR2A];
+        timer2Setup[1] = registers[SIM_TCCR2B];
+        timer2Setup[2] = registers[SIM_OCR2A];
+        timer2Base     = now;
+        timer2Next     = prescaler ? now + (uint64_t)(registers[SIM_OCR2A] + 1) * prescaler : 0;
+    }
+
+    return;
+}
+
+// Lets everything that was due by "now" happen
+static void simEvents(void) {
+    if (spiActive && spiDone <= now) {
+        spiActive = 0;
+        spiFlag   = 1;
+    }
+
+    while (timer1Next && timer1Next <= now) {
+        setFlag(SIM_TIFR1, TOV1);
+        timer1Next += 65536ULL * timer1Prescaler(timer1Clock);
+    }
+
+    while (timer0Next && timer0Next <= now) {
+        setFlag(SIM_TIFR0, OCF0A);
+        timer0Next += (uint64_t)(registers[SIM_OCR0A] + 1) * timer0Prescaler(registers[SIM_TCCR0B]);
+    }
+
+    while (timer2Next && timer2Next <= now) {
+        setFlag(SIM_TIFR2, OCF2A);
+        timer2Next += (uint64_t)(registers[SIM_OCR2A] + 1) * timer2Prescaler(registers[SIM_TCCR2B]);
+    }
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        chipBus(&chips[device]);
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Drives the INT and RXnBF pins and latches the interrupt flags their edges  *
+ * set. INT0 and INT1 are taken to trigger on the falling edge, which is how  *
+ * the driver sets them up.                                                   *
+ ******************************************************************************/
+static void simPins(void) {
+    uint8_t pind = 0xFF;
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        simChip *chip   = &chips[device];
+        uint8_t  intLow = (chip->regs[CANINTF] & chip->regs[CANINTE]) != 0;
+
+        if (intLow) {
+            pind &= ~(1 << chip->intBit);
+        }
+
+        // A falling edge sets INTFn; with ISCn1:0 at 0 the LOW level itself
+        // is the request, for as long as it lasts
+        if (chip->intBit == 2 || chip->intBit == 3) {
+            uint8_t flag  = (chip->intBit == 2) ? INTF0 : INTF1;
+            uint8_t sense = (chip->intBit == 2) ? ((1<<ISC01) | (1<<ISC00)) : ((1<<ISC11) | (1<<ISC10));
+            uint8_t level = !(registers[SIM_EICRA] & sense);
+
+            if (intLow && (level || !chip->intLow)) {
+                setFlag(SIM_EIFR, flag);
+            } else if (level) {
+                takeFlag(SIM_EIFR, flag);
+            }
+        }
+
+        if (intLow && !chip->intLow) {
+#ifdef CAN_TIMESTAMP_CAPTURE_DEVICE
+            if (device == CAN_TIMESTAMP_CAPTURE_DEVICE) {
+                registers16[SIM_ICR1] = timer1Count();
+                setFlag(SIM_TIFR1, ICF1);
+            }
+#endif
+        }
+
+        if (intLow != chip->intLow && (registers[SIM_PCMSK2] & (1 << chip->intBit)) &&
+            chip->intBit != 2 && chip->intBit != 3) {
+            setFlag(SIM_PCIFR, PCIF2);
+        }
+        chip->intLow = intLow;
+
+        if (chip->rxbf) {
+            uint8_t bfp = chip->regs[BFPCTRL];
+
+            for (uint8_t buffer = 0; buffer < 2; buffer++) {
+                uint8_t enabled = bfp & (1 << (B0BFE + buffer));
+                uint8_t low     = (bfp & (1 << (B0BFM + buffer))) ?
+                                  (chip->regs[CANINTF] & (1 << buffer)) != 0 :
+                                  !(bfp & (1 << (B0BFS + buffer)));
+
+                if (enabled && low) {
+                    *chip->rxbf &= ~chip->rxbfMask[buffer];
+                } else {
+                    *chip->rxbf |= chip->rxbfMask[buffer];
+                }
+            }
+        }
+    }
+
+    registers[SIM_PIND] = pind;
+
+    return;
+}
+
+typedef void (*simVector)(void);
+
+// The data register empty interrupt is enabled and UDR0 can take a byte; it stays pending while so
+static uint8_t uartPending(void) {
+    return (registers[SIM_UCSR0B] & ((1<<UDRIE0) | (1<<TXEN0))) == ((1<<UDRIE0) | (1<<TXEN0)) &&
+           uartEmpty <= now;
+}
+
+static simVector simHandler(simVector vector, const char *name) {
+    if (!vector) {
+        fprintf(stderr, "sim: %s enabled without a handler\n", name);
+        abort();
+    }
+
+    return vector;
+}
+
+// Takes the flag of the highest priority interrupt that may run now
+static simVector simPending(void) {
+    if ((registers[SIM_EIMSK] & (1<<INT0)) && takeFlag(SIM_EIFR, INTF0)) {
+        return simHandler(INT0_vect, "INT0_vect");
+    }
+    if ((registers[SIM_EIMSK] & (1<<INT1)) && takeFlag(SIM_EIFR, INTF1)) {
+        return simHandler(INT1_vect, "INT1_vect");
+    }
+    if ((registers[SIM_PCICR] & (1<<PCIE2)) && takeFlag(SIM_PCIFR, PCIF2)) {
+        return simHandler(PCINT2_vect, "PCINT2_vect");
+    }
+    if ((registers[SIM_TIMSK2] & (1<<OCIE2A)) && takeFlag(SIM_TIFR2, OCF2A)) {
+        return simHandler(TIMER2_COMPA_vect, "TIMER2_COMPA_vect");
+    }
+    if ((registers[SIM_TIMSK1] & (1<<TOIE1)) && takeFlag(SIM_TIFR1, TOV1)) {
+        return simHandler(TIMER1_OVF_vect, "TIMER1_OVF_vect");
+    }
+    if ((registers[SIM_TIMSK0] & (1<<OCIE0A)) && takeFlag(SIM_TIFR0, OCF0A)) {
+        return simHandler(TIMER0_COMPA_vect, "TIMER0_COMPA_vect");
+    }
+    if ((registers[SIM_SPCR] & (1<<SPIE)) && spiFlag) {
+        spiFlag = 0;
+        return simHandler(SPI_STC_vect, "SPI_STC_vect");
+    }
+    if (uartPending()) {
+        return simHandler(USART_UDRE_vect, "USART_UDRE_vect");
+    }
+
+    return 0;
+}
+
+/******************************************************************************
+ * Brings the simulation up to "now" and, unless an interrupt handler is      *
+ * running or the I bit is clear, runs every interrupt that is due, highest   *
+ * priority first. reti sets the I bit again, so the next one follows         *
+ * straight after.                                                            *
+ ******************************************************************************/
+static void simUpdate(void) {
+    for (;;) {
+        simLatch();
+        simEvents();
+        simPins();
+
+        if (inInterrupt || !(registers[SIM_SREG] & (1<<SREG_I))) {
+            return;
+        }
+
+        uint8_t   any    = flags[SIM_EIFR] | flags[SIM_PCIFR] | flags[SIM_TIFR0] | flags[SIM_TIFR1] |
+                           flags[SIM_TIFR2] | spiFlag | uartPending();
+        simVector vector = any ? simPending() : 0;
+
+        if (!vector) {
+            return;
+        }
+
+        uint64_t start = now;
+
+        inInterrupt = 1;
+        registers[SIM_SREG] &= ~(1<<SREG_I);
+        now += SIM_ISR_CYCLES;
+        vector();
+        registers[SIM_SREG] |= (1<<SREG_I);
+        inInterrupt = 0;
+        isrCycles += now - start;
+    }
+}
+
+static uint64_t simNextEvent(void) {
+    uint64_t next = UINT64_MAX;
+
+    if (spiActive && spiDone < next) {
+        next = spiDone;
+    }
+    if (timer1Next && timer1Next < next) {
+        next = timer1Next;
+    }
+    if (timer0Next && timer0Next < next) {
+        next = timer0Next;
+    }
+    if (timer2Next && timer2Next < next) {
+        next = timer2Next;
+    }
+    if ((registers[SIM_UCSR0B] & (1<<UDRIE0)) && uartEmpty > now && uartEmpty < next) {
+        next = uartEmpty;
+    }
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        simChip *chip = &chips[device];
+        uint64_t start;
+        int8_t   buffer;
+
+        if (chipBusOff(chip) && chip->busOffUntil > now && chip->busOffUntil < next) {
+            next = chip->busOffUntil;
+        }
+        if (chip->busState != SIM_BUS_IDLE) {
+            start = chip->busFree;
+        } else if (!chipNextFrame(chip, &start, &buffer)) {
+            continue;
+        }
+        if (start < next) {
+            next = start;
+        }
+    }
+
+    return next;
+}
+
+// Lets time pass up to "target", with interrupts running as they fall due
+static void simAdvance(uint64_t target) {
+    while (now < target) {
+        uint64_t next = simNextEvent();
+
+        now = (next > now && next < target) ? next : target;
+        simUpdate();
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Register access (see avr/io.h)                                             *
+ ******************************************************************************/
+volatile uint8_t *simRegister(uint8_t index) {
+    if (quiet) {
+        return &registers[index];
+    }
+
+    now += SIM_ACCESS_CYCLES;
+    simUpdate();
+
+    if (index == SIM_SPSR) {
+        // A polled transfer: the CPU spins until SPIF is set
+        if (spiActive && !(registers[SIM_SPCR] & (1<<SPIE))) {
+            simAdvance(spiDone);
+        }
+        registers[SIM_SPSR] = (registers[SIM_SPSR] & (1<<SPI2X)) | (spiFlag << SPIF);
+    } else if (index == SIM_UCSR0A) {
+        // A polled transmitter: the CPU spins until UDRE0 is set
+        if (uartEmpty > now && !(registers[SIM_UCSR0B] & (1<<UDRIE0))) {
+            simAdvance(uartEmpty);
+        }
+        registers[SIM_UCSR0A] = (registers[SIM_UCSR0A] & (1<<U2X0)) | ((uartEmpty <= now) << UDRE0) |
+                                ((uartDone <= now) << TXC0);
+    } else if (index == SIM_TCNT0 && timer0Next) {
+        uint64_t prescaler = timer0Prescaler(registers[SIM_TCCR0B]);
+
+        registers[SIM_TCNT0] = ((now - timer0Base) / prescaler) % (registers[SIM_OCR0A] + 1);
+    } else if (index == SIM_TCNT2 && timer2Next) {
+        uint64_t prescaler = timer2Prescaler(registers[SIM_TCCR2B]);
+
+        registers[SIM_TCNT2] = ((now - timer2Base) / prescaler) % (registers[SIM_OCR2A] + 1);
+    }
+
+    return &registers[index];
+}
+
+volatile uint16_t *simRegister16(uint8_t index) {
+    if (quiet) {
+        return &registers16[index];
+    }
+
+    now += SIM_ACCESS_CYCLES;
+    simUpdate();
+
+    if (index == SIM_TCNT1) {
+        registers16[SIM_TCNT1] = timer1Count();
+    }
+
+    return &registers16[index];
+}
+
+// Clocks one byte through the selected chips, with no CPU access cost
+static void spiClock(uint8_t data) {
+    static const uint8_t dividers[4] = {4, 16, 64, 128};
+    uint8_t divider;
+    uint8_t in = 0xFF;
+
+    divider = dividers[registers[SIM_SPCR] & 0x03];
+    if (registers[SIM_SPSR] & (1<<SPI2X)) {
+        divider /= 2;
+    }
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        if (chips[device].selected) {
+            in &= chipByte(&chips[device], data);
+        }
+    }
+
+    spiData   = in;
+    spiActive = 1;
+    spiDone   = now + 8 * divider;
+    spiBytes++;
+
+    return;
+}
+
+void simSpiPut(uint8_t data) {
+    now += SIM_ACCESS_CYCLES;
+    simUpdate();
+
+    spiClock(data);
+    spiFlag = 0;
+
+    return;
+}
+
+/******************************************************************************
+ * A byte written to UDR0 moves into the transmit shift register as soon as   *
+ * the byte before it is out, and takes 10 bit times of the rate UBRR0 and    *
+ * U2X0 set (8N1). It is handed to "simUartTransmitted" straight away.        *
+ ******************************************************************************/
+void simUartPut(uint8_t data) {
+    now += SIM_ACCESS_CYCLES;
+    simUpdate();
+
+    if (!(registers[SIM_UCSR0B] & (1<<TXEN0))) {
+        return;
+    }
+
+    uint64_t bit = (uint64_t)((registers[SIM_UCSR0A] & (1<<U2X0)) ? 8 : 16) * (registers16[SIM_UBRR0] + 1);
+
+    uartEmpty = uartDone > now ? uartDone : now;
+    uartDone  = uartEmpty + 10 * bit;
+    if (simUartTransmitted) {
+        simUartTransmitted(data);
+    }
+
+    return;
+}
+
+uint8_t simSpiGet(void) {
+    now += SIM_ACCESS_CYCLES;
+    simUpdate();
+
+    spiFlag = 0;
+
+    return spiData;
+}
+
+/******************************************************************************
+ * DMA channel of the host backend in sim/dmapins.h. The CPU starts the job   *
+ * with one access; the channel then clocks "length" bytes through the SPI    *
+ * back to back, from "tx" (filler bytes if NULL) into "rx" (unless NULL),    *
+ * each one written as soon as the byte before it is in, and the job returns  *
+ * once the last one is.                                                      *
+ ******************************************************************************/
+void simSpiDma(const uint8_t *tx, uint8_t *rx, uint8_t length) {
+    now += SIM_ACCESS_CYCLES;
+    simUpdate();
+
+    for (uint8_t i = 0; i < length; i++) {
+        spiClock(tx ? tx[i] : 0xFF);
+        simAdvance(spiDone);
+        if (rx) {
+            rx[i] = spiData;
+        }
+    }
+    spiFlag = 0;
+
+    return;
+}
+
+void simDelayUs(double us) {
+    simAdvance(now + (uint64_t)(us * (F_CPU / 1000000.0)));
+
+    return;
+}
+
+void simSleep(void) {
+    uint64_t taken = isrCycles;
+
+    if (!(registers[SIM_SMCR] & (1<<SE))) {
+        return;
+    }
+
+    while (isrCycles == taken) {
+        uint64_t next = simNextEvent();
+
+        if (next == UINT64_MAX) {
+            fprintf(stderr, "sim: asleep with nothing left to wake the CPU\n");
+            abort();
+        }
+        now = next > now ? next : now + 1;
+        simUpdate();
+    }
+
+    return;
+}
+
+/******************************************************************************
+ * Simulation API                                                             *
+ ******************************************************************************/
+void simInit(void) {
+    memset(chips, 0, sizeof(chips));
+    memset(registers, 0, sizeof(registers));
+    memset(registers16, 0, sizeof(registers16));
+    memset(flags, 0, sizeof(flags));
+    memset(flagsShown, 0, sizeof(flagsShown));
+    now = isrCycles = 0;
+    spiActive = spiFlag = 0;
+    spiBytes  = 0;
+    uartEmpty = uartDone = 0;
+    timer1Clock = 0;
+    timer1Next  = timer0Next = timer2Next = 0;
+    memset(timer0Setup, 0, sizeof(timer0Setup));
+    memset(timer2Setup, 0, sizeof(timer2Setup));
+
+    registers[SIM_PINB] = registers[SIM_PINC] = registers[SIM_PIND] = 0xFF;
+    registers[SIM_PORTB] = registers[SIM_PORTC] = registers[SIM_PORTD] = 0xFF;
+
+    // Wire the chips up the way mcp2515config.h says
+    quiet = 1;
+    chips[0].cs     = &MCP2515_DEV0_CS_PORT;
+    chips[0].csMask = 1 << MCP2515_DEV0_CS_BIT;
+    chips[0].intBit = MCP2515_DEV0_INT_BIT;
+#if MCP2515_DEVICE_COUNT > 1
+    chips[1].cs     = &MCP2515_DEV1_CS_PORT;
+    chips[1].csMask = 1 << MCP2515_DEV1_CS_BIT;
+    chips[1].intBit = MCP2515_DEV1_INT_BIT;
+#endif
+#if MCP2515_DEVICE_COUNT > 2
+    chips[2].cs     = &MCP2515_DEV2_CS_PORT;
+    chips[2].csMask = 1 << MCP2515_DEV2_CS_BIT;
+    chips[2].intBit = MCP2515_DEV2_INT_BIT;
+#endif
+#if MCP2515_RXBF_PINS
+    chips[0].rxbf        = &MCP2515_DEV0_RXBF_PIN;
+    chips[0].rxbfMask[0] = 1 << MCP2515_DEV0_RX0BF_BIT;
+    chips[0].rxbfMask[1] = 1 << MCP2515_DEV0_RX1BF_BIT;
+#if MCP2515_DEVICE_COUNT > 1
+    chips[1].rxbf        = &MCP2515_DEV1_RXBF_PIN;
+    chips[1].rxbfMask[0] = 1 << MCP2515_DEV1_RX0BF_BIT;
+    chips[1].rxbfMask[1] = 1 << MCP2515_DEV1_RX1BF_BIT;
+#endif
+#if MCP2515_DEVICE_COUNT > 2
+    chips[2].rxbf        = &MCP2515_DEV2_RXBF_PIN;
+    chips[2].rxbfMask[0] = 1 << MCP2515_DEV2_RX0BF_BIT;
+    chips[2].rxbfMask[1] = 1 << MCP2515_DEV2_RX1BF_BIT;
+#endif
+#endif
+#if MCP2515_TXRTS_BUFFERS
+#define SIM_RTS_MASK(n, buffer) (((MCP2515_TXRTS_BUFFERS >> (buffer)) & 1) << MCP2515_TXRTS_BIT(n, buffer))
+    chips[0].rts = &MCP2515_DEV0_TXRTS_PORT;
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        chips[0].rtsMask[buffer] = SIM_RTS_MASK(0, buffer);
+    }
+#if MCP2515_DEVICE_COUNT > 1
+    chips[1].rts = &MCP2515_DEV1_TXRTS_PORT;
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        chips[1].rtsMask[buffer] = SIM_RTS_MASK(1, buffer);
+    }
+#endif
+#if MCP2515_DEVICE_COUNT > 2
+    chips[2].rts = &MCP2515_DEV2_TXRTS_PORT;
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        chips[2].rtsMask[buffer] = SIM_RTS_MASK(2, buffer);
+    }
+#endif
+#undef SIM_RTS_MASK
+#endif
+    quiet = 0;
+
+    for (uint8_t device = 0; device < MCP2515_DEVICE_COUNT; device++) {
+        chipReset(&chips[device]);
+        chips[device].rtsLevels = 0x07;
+    }
+
+    return;
+}
+
+void simBitrate(uint8_t device, uint32_t bitrate) {
+    chips[device].bitrate = bitrate;
+
+    return;
+}
+
+void simReceive(uint8_t device, const simFrame *frames, uint32_t count) {
+    chips[device].incoming      = frames;
+    chips[device].incomingCount = count;
+    chips[device].incomingNext  = 0;
+
+    return;
+}
+
+// Frames the caller has put after the ones handed to simReceive() so far
+void simReceiveMore(uint8_t device, uint32_t count) {
+    chips[device].incomingCount += count;
+
+    return;
+}
+
+uint64_t simFrameCycles(uint8_t device, const simFrame *frame) {
+    return frameCycles(&chips[device], frame);
+}
+
+uint8_t simBusIdle(uint8_t device) {
+    const simChip *chip = &chips[device];
+    uint64_t start;
+    int8_t   buffer;
+
+    return chip->busState == SIM_BUS_IDLE && !chipNextFrame(chip, &start, &buffer);
+}
+
+void simRun(uint64_t cycles) {
+    simAdvance(now + cycles);
+
+    return;
+}
+
+uint64_t simNow(void) {
+    return now;
+}
+
+uint64_t simIsrCycles(void) {
+    return isrCycles;
+}
+
+uint32_t simSpiBytes(void) {
+    return spiBytes;
+}
+
+void simReadCounters(uint8_t device, simCounters *counters) {
+    *counters = chips[device].counters;
+
+    return;
+}
+
+uint8_t simChipRegister(uint8_t device, uint8_t address) {
+    return chipRead(&chips[device], address);
+}
+
+void simTransmitErrors(uint8_t device, uint32_t count) {
+    chips[device].failures = count;
+
+    return;
+}
@@ -0,0 +1,87 @@
+#ifndef _MCP2515SIM_H_
+#define _MCP2515SIM_H_
+
+#include <stdint.h>
+
+/******************************************************************************
+ * Host simulation of an ATmega328 with up to three MCP2515s on its SPI port. *
+ *                                                                            *
+ * The driver is compiled unchanged for the host with sim/ ahead on the       *
+ * include path, so <avr/io.h>, <avr/interrupt.h>, <avr/sleep.h>,             *
+ * <util/atomic.h> and <util/delay.h> come from here. Each I/O register       *
+ * access costs SIM_ACCESS_CYCLES, each SPI byte the time the configured      *
+ * clock divider gives it, and each interrupt SIM_ISR_CYCLES on top of the    *
+ * accesses it makes; the code between accesses is free, so the CPU time      *
+ * reported is a lower bound. The MCP2515 model follows the datasheet for the *
+ * SPI instructions, acceptance filters, rollover, buffer overflows,          *
+ * interrupt flags and the INT, RXnBF and TXnRTS pins, and puts frames on the *
+ * bus with their real bit timing, stuff bits included. Bus errors are only   *
+ * modelled on the transmit side: simTransmitErrors() makes the next          *
+ * transmissions of a device fail, which moves TEC, EFLG and MERRF/ERRIF      *
+ * through the error states up to bus-off. A device in bus-off rejoins after  *
+ * 128 times 11 recessive bits, or at once when it enters Configuration mode. *
+ * simSpiDma() is a DMA channel on the SPI, which no ATmega328 has, for the   *
+ * backend in sim/dmapins.h.                                                  *
+ *                                                                            *
+ * Frames reach a device from a list handed to simReceive(), each at its      *
+ * "time" (in CPU cycles, see SIM_US()) or as soon as the bus is free after   *
+ * it; simReceiveMore() extends the list by frames written after its end, so  *
+ * a simulated peer can answer from the "simTransmitted" hook, and            *
+ * simFrameCycles() gives the time a frame occupies the bus. The bitrate      *
+ * follows CNF1..CNF3 and MCP2515_OSC_HZ unless simBitrate() sets one. Frames *
+ * a device transmits are counted and passed to the "simTransmitted" hook,    *
+ * and bytes written to the UART go to the "simUartTransmitted" hook at its   *
+ * baud rate, from polled writes or the data register empty interrupt. The    *
+ * counters tell frames stored in a receive buffer from frames the filters    *
+ * rejected, frames lost to a full buffer and frames that arrived while the   *
+ * device was not listening (Configuration, Sleep or Loopback mode); one      *
+ * arriving in Sleep mode also wakes the device into Listen-only mode and     *
+ * sets WAKIF. framesAcknowledged counts the incoming frames the device       *
+ * acknowledged, which it does for every one in Normal mode, filtered or not, *
+ * and for none in Listen-only mode.                                          *
+ ******************************************************************************/
+#define SIM_ACCESS_CYCLES 2
+#define SIM_ISR_CYCLES    40
+
+#define SIM_US(us) ((uint64_t)(us) * (F_CPU / 1000000UL))
+
+typedef struct {
+    uint64_t time;
+    uint32_t id;
+    uint8_t  extended;
+    uint8_t  remote;
+    uint8_t  length;
+    uint8_t  data[8];
+} simFrame;
+
+typedef struct {
+    uint32_t framesReceived;
+    uint32_t framesFiltered;
+    uint32_t framesMissed;
+    uint32_t framesOverflowed;
+    uint32_t framesTransmitted;
+    uint32_t framesAcknowledged;
+} simCounters;
+
+/******************************************************************************
+ * Simulation API                                                             *
+ ******************************************************************************/
+void     simInit(void);
+void     simBitrate(uint8_t device, uint32_t bitrate);
+void     simReceive(uint8_t device, const simFrame *frames, uint32_t count);
+void     simReceiveMore(uint8_t device, uint32_t count);
+uint64_t simFrameCycles(uint8_t device, const simFrame *frame);
+uint8_t  simBusIdle(uint8_t device);
+void     simRun(uint64_t cycles);
+uint64_t simNow(void);
+uint64_t simIsrCycles(void);
+uint32_t simSpiBytes(void);
+void     simReadCounters(uint8_t device, simCounters *counters);
+uint8_t  simChipRegister(uint8_t device, uint8_t address);
+void     simTransmitErrors(uint8_t device, uint32_t count);
+
+extern void (*simTransmitted)(uint8_t device, const simFrame *frame);
+extern void (*simUartTransmitted)(uint8_t data);
+
+
+#endif
@@ -0,0 +1,139 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Bus-off test, built with CAN_ERROR_MONITOR and CAN_BUSOFF_RESTARTS at 2.   *
+ * simTransmitErrors() makes the transmissions of one frame fail, 32 of them  *
+ * to a bus-off. The error counters have to follow the states, and the time   *
+ * the frame takes to get through tells restarted bus-offs (none of the 128   *
+ * times 11 recessive bits of the MCP2515's own recovery) from the ones the   *
+ * backoff leaves to the MCP2515.                                             *
+ ******************************************************************************/
+#define TEST_BITRATE   500000UL
+#define TEST_BUSOFF    32        // Failed transmissions from error-active to bus-off
+#define TEST_RECOVERY  (128 * 11)
+
+static simFrame testFrame;
+static uint32_t transmitted;
+static uint64_t transmittedAt;
+
+static void countTransmitted(uint8_t device, const simFrame *frame) {
+    (void)device;
+
+    CHECK(frame->id == testFrame.id);
+    CHECK(memcmp(frame->data, testFrame.data, 8) == 0);
+    transmitted++;
+    transmittedAt = frame->time;
+
+    return;
+}
+
+/******************************************************************************
+ * Sends the test frame with "failures" failed transmissions ahead of it and  *
+ * checks the time it took against "recoveries" waits for the MCP2515's own   *
+ * recovery, with less than one more such wait allowed for the driver.        *
+ ******************************************************************************/
+static void sendThrough(uint32_t failures, uint32_t recoveries) {
+    canFrame frame;
+    uint64_t attempt  = simFrameCycles(0, &testFrame);
+    uint64_t recovery = (uint64_t)TEST_RECOVERY * F_CPU / TEST_BITRATE;
+    uint64_t limit    = simNow() + (failures + 1) * attempt + (recoveries + 2) * recovery;
+
+    memset(&frame, 0, sizeof(frame));
+    canSetId(&frame, testFrame.id);
+    canSetLength(&frame, 8);
+    memcpy(frame.data, testFrame.data, 8);
+
+    transmitted = 0;
+    simTransmitErrors(0, failures);
+
+    uint64_t start = simNow();
+
+    CHECK(canWrite(0, &frame, CAN_PRIORITY_LOW));
+    while (!transmitted && simNow() < limit) {
+        simRun(200);
+    }
+    simRun(SIM_US(1000));
+
+    // From the request to the start of the attempt that got through
+    uint64_t elapsed = transmittedAt - start;
+    uint64_t least   = failures * attempt + recoveries * recovery;
+
+    CHECK(transmitted == 1);
+    CHECK(elapsed >= least);
+    CHECK(elapsed < least + recovery);
+
+    return;
+}
+
+// Configuration mode and back clears TEC and REC
+static void clearErrors(void) {
+    setMode(0, MODE_CONFIG);
+    setMode(0, MODE_NORMAL);
+    simRun(SIM_US(1000));
+
+    return;
+}
+
+int main(void) {
+    canErrorCounters counters;
+
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    simTransmitted = countTransmitted;
+    sei();
+
+    testFrame.id     = 0x123;
+    testFrame.length = 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        testFrame.data[i] = 0x10 + i;
+    }
+
+    // Eight failures short of bus-off: warning and error-passive, then back
+    sendThrough(TEST_BUSOFF - 8, 0);
+    readErrorCounters(0, &counters, 1);
+    CHECK(counters.state == CAN_ERROR_PASSIVE);
+    CHECK(counters.entered[CAN_ERROR_WARNING] == 1);
+    CHECK(counters.entered[CAN_ERROR_PASSIVE] == 1);
+    CHECK(counters.entered[CAN_ERROR_BUS_OFF] == 0);
+    CHECK(counters.tecPeak == 8 * (TEST_BUSOFF - 8));
+    CHECK(counters.restarts == 0);
+
+    // One bus-off, restarted at once; the restart clears TEC
+    clearErrors();
+    sendThrough(TEST_BUSOFF + 8, 0);
+    readErrorCounters(0, &counters, 1);
+    CHECK(counters.entered[CAN_ERROR_BUS_OFF] == 1);
+    CHECK(counters.restarts == 1);
+    CHECK(counters.tecPeak == 255);
+    CHECK(counters.tec < 96);
+    CHECK(simChipRegister(0, TEC) < 96);
+    CHECK(readMode(0) == MODE_NORMAL);
+
+    // Ten bus-offs in a row: the 1st to 4th, 6th and 10th are restarted, the
+    // 5th and 7th to 9th wait for the MCP2515
+    clearErrors();
+    sendThrough(10 * TEST_BUSOFF, 4);
+    readErrorCounters(0, &counters, 1);
+    CHECK(counters.entered[CAN_ERROR_BUS_OFF] == 10);
+    CHECK(counters.restarts == 6);
+    CHECK(readMode(0) == MODE_NORMAL);
+
+    // The frame that got through started the count again
+    clearErrors();
+    sendThrough(TEST_BUSOFF, 0);
+    readErrorCounters(0, &counters, 1);
+    CHECK(counters.entered[CAN_ERROR_BUS_OFF] == 1);
+    CHECK(counters.restarts == 1);
+    CHECK(counters.state == CAN_ERROR_ACTIVE);
+
+    return simTestDone("busoff");
+}
@@ -0,0 +1,121 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "cancyclic.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Cyclic message test, built with CAN_CYCLIC_BUFFERS at TXB2. A message with *
+ * a 10 tick period runs while its data is left alone or changed in various   *
+ * places between two periods. Every frame has to go out 10 ms after the one  *
+ * before, give or take the SPI bytes ahead of its REQUEST TO SEND, with the  *
+ * data of the last cyclicUpdate(), and every period has to cost exactly its  *
+ * SPI bytes: the REQUEST TO SEND alone when nothing changed, plus a LOAD TX  *
+ * BUFFER up to the last changed byte or a WRITE of the changed run,          *
+ * whichever is shorter.                                                      *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_BUFFER  2
+#define TEST_PERIOD  10        // ticks of CAN_CYCLIC_TICK_US
+#define TEST_SLACK   (10 * 8 * MCP2515_SPI_CLOCK_DIV)    // 10 SPI bytes
+
+typedef struct {
+    uint8_t first;             // Changed bytes, 0 to 8 of them
+    uint8_t count;
+    uint8_t spiBytes;          // What the period costs
+} testCase;
+
+static const testCase cases[] = {
+    {0, 0, 1},                 // Unchanged: REQUEST TO SEND
+    {0, 1, 3},                 // Byte 0: LOAD TX BUFFER of 1 byte
+    {0, 8, 10},                // All eight: LOAD TX BUFFER of 8 bytes
+    {1, 2, 5},                 // Bytes 1-2: LOAD TX BUFFER of 3 bytes
+    {5, 1, 4},                 // Byte 5: WRITE of 1 byte
+    {7, 1, 4},                 // Byte 7
+    {2, 4, 7},                 // Bytes 2-5: WRITE of 4 bytes
+    {0, 0, 1},
+};
+
+#define TEST_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static uint8_t  data[8];
+static uint32_t transmitted;
+static uint64_t transmittedAt[TEST_CASES + 1];
+
+static void checkTransmitted(uint8_t device, const simFrame *frame) {
+    CHECK(device == 0);
+    CHECK(frame->id == 0x321);
+    CHECK(frame->length == 8);
+    CHECK(memcmp(frame->data, data, 8) == 0);
+
+    if (transmitted < TEST_CASES + 1) {
+        transmittedAt[transmitted] = frame->time;
+    }
+    transmitted++;
+
+    return;
+}
+
+int main(void) {
+    canFrame frame;
+
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    simTransmitted = checkTransmitted;
+    cyclicInit();
+    sei();
+
+    for (uint8_t i = 0; i < 8; i++) {
+        data[i] = 0x10 + i;
+    }
+    memset(&frame, 0, sizeof(frame));
+    canSetId(&frame, 0x321);
+    canSetLength(&frame, 8);
+    memcpy(frame.data, data, 8);
+
+    uint8_t message = cyclicStart(0, TEST_BUFFER, &frame, CAN_PRIORITY_LOW, TEST_PERIOD);
+
+    CHECK(message != CAN_CYCLIC_NONE);
+
+    // Halfway between two periods from here on
+    simRun(SIM_US(TEST_PERIOD * CAN_CYCLIC_TICK_US / 2));
+    CHECK(transmitted == 1);
+
+    for (uint8_t i = 0; i < TEST_CASES; i++) {
+        uint32_t spiStart = simSpiBytes();
+
+        for (uint8_t byte = cases[i].first; byte < cases[i].first + cases[i].count; byte++) {
+            data[byte] ^= 0x80 + i;
+        }
+        cyclicUpdate(message, data);
+
+        simRun(SIM_US(TEST_PERIOD * CAN_CYCLIC_TICK_US));
+        CHECK(transmitted == i + 2U);
+        CHECK(simSpiBytes() - spiStart == cases[i].spiBytes);
+    }
+
+    // Each frame a period after the one before, give or take the bytes written
+    // ahead of its REQUEST TO SEND; the first went out at cyclicStart()
+    for (uint8_t i = 2; i < TEST_CASES + 1; i++) {
+        uint64_t gap = transmittedAt[i] - transmittedAt[i - 1];
+
+        CHECK(gap + TEST_SLACK > SIM_US(TEST_PERIOD * CAN_CYCLIC_TICK_US));
+        CHECK(gap < SIM_US(TEST_PERIOD * CAN_CYCLIC_TICK_US) + TEST_SLACK);
+    }
+
+    // Stopped, it costs nothing and sends nothing more
+    uint32_t spiStart = simSpiBytes();
+
+    cyclicStop(message);
+    simRun(SIM_US(3 * TEST_PERIOD * CAN_CYCLIC_TICK_US));
+    CHECK(transmitted == TEST_CASES + 1);
+    CHECK(simSpiBytes() == spiStart);
+
+    return simTestDone("cyclic");
+}
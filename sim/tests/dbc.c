@@ -0,0 +1,172 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "candbc.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Signal decoder test, built against the candbc.h that tools/candbcgen.py    *
+ * generates from sim/tests/dbc.dbc. Its two messages hold little-endian      *
+ * (Intel) and big-endian (Motorola) signals that cross byte boundaries,      *
+ * signed ones of both orders and a 32-bit one. Encoding known values has to  *
+ * give the known frames below, into zeroed data and without touching the     *
+ * bits no signal covers; decoding the frames, as they come in through a      *
+ * filter set from dbcMessageIds[], has to give the values back, sign and     *
+ * scaled physical value included, and the _PACKED constants have to match    *
+ * canFramePackedId().                                                        *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+
+// Nibble 0xA, Cross12 0xBCD, Signed10 -300, Word32 0xDEADBEEF, Flag 1
+static const uint8_t intelFrame[8]      = {0xDA, 0xBC, 0xD4, 0xBE, 0xFB, 0xB6, 0x7A, 0x83};
+// Bits 59-62 are in no signal
+static const uint8_t intelFilled[8]     = {0xDA, 0xBC, 0xD4, 0xBE, 0xFB, 0xB6, 0x7A, 0xFF};
+// Mode 5, Cross16 0xA55A, SignedM -200, Long 0x123456, Last8 -3
+static const uint8_t motorolaFrame[8]   = {0xB4, 0xAB, 0x44, 0xE0, 0x12, 0x34, 0x56, 0xFD};
+// Bits 19-20 and 24-25 are in no signal
+static const uint8_t motorolaFilled[8]  = {0xB4, 0xAB, 0x5C, 0xE3, 0x12, 0x34, 0x56, 0xFD};
+
+static void encodeIntel(uint8_t *data) {
+    encodeIntelSignalsNibble(data, 0xA);
+    encodeIntelSignalsCross12(data, 0xBCD);
+    encodeIntelSignalsSigned10(data, -300);
+    encodeIntelSignalsWord32(data, 0xDEADBEEFUL);
+    encodeIntelSignalsFlag(data, 1);
+
+    return;
+}
+
+static void encodeMotorola(uint8_t *data) {
+    encodeMotorolaSignalsMode(data, 5);
+    encodeMotorolaSignalsCross16(data, 0xA55A);
+    encodeMotorolaSignalsSignedM(data, -200);
+    encodeMotorolaSignalsLong(data, 0x123456UL);
+    encodeMotorolaSignalsLast8(data, -3);
+
+    return;
+}
+
+static void checkIntel(const uint8_t *data) {
+    CHECK(decodeIntelSignalsNibble(data) == 0xA);
+    CHECK(decodeIntelSignalsCross12(data) == 0xBCD);
+    CHECK(decodeIntelSignalsSigned10(data) == -300);
+    CHECK(decodeIntelSignalsWord32(data) == 0xDEADBEEFUL);
+    CHECK(decodeIntelSignalsFlag(data) == 1);
+    CHECK(DBC_PHYSICAL(INTEL_SIGNALS_SIGNED10, decodeIntelSignalsSigned10(data)) == -160.0);
+
+    return;
+}
+
+static void checkMotorola(const uint8_t *data) {
+    CHECK(decodeMotorolaSignalsMode(data) == 5);
+    CHECK(decodeMotorolaSignalsCross16(data) == 0xA55A);
+    CHECK(decodeMotorolaSignalsSignedM(data) == -200);
+    CHECK(decodeMotorolaSignalsLong(data) == 0x123456UL);
+    CHECK(decodeMotorolaSignalsLast8(data) == -3);
+    CHECK(DBC_PHYSICAL(MOTOROLA_SIGNALS_CROSS16, decodeMotorolaSignalsCross16(data)) == 10582.5);
+    CHECK(DBC_PHYSICAL(MOTOROLA_SIGNALS_SIGNED_M, decodeMotorolaSignalsSignedM(data)) == -205);
+
+    return;
+}
+
+// Every value each signal can take at its edges, through encode and decode
+static void checkExtremes(void) {
+    uint8_t data[8];
+
+    memset(data, 0, sizeof(data));
+    encodeIntelSignalsSigned10(data, -512);
+    CHECK(decodeIntelSignalsSigned10(data) == -512);
+    encodeIntelSignalsSigned10(data, 511);
+    CHECK(decodeIntelSignalsSigned10(data) == 511);
+    encodeIntelSignalsWord32(data, 0xFFFFFFFFUL);
+    CHECK(decodeIntelSignalsWord32(data) == 0xFFFFFFFFUL);
+    CHECK(decodeIntelSignalsSigned10(data) == 511);
+    CHECK(decodeIntelSignalsFlag(data) == 0);
+
+    memset(data, 0, sizeof(data));
+    encodeMotorolaSignalsSignedM(data, -256);
+    CHECK(decodeMotorolaSignalsSignedM(data) == -256);
+    encodeMotorolaSignalsSignedM(data, 255);
+    CHECK(decodeMotorolaSignalsSignedM(data) == 255);
+    encodeMotorolaSignalsCross16(data, 0xFFFF);
+    CHECK(decodeMotorolaSignalsCross16(data) == 0xFFFF);
+    CHECK(decodeMotorolaSignalsMode(data) == 0);
+    CHECK(decodeMotorolaSignalsSignedM(data) == 255);
+    encodeMotorolaSignalsLast8(data, -128);
+    CHECK(decodeMotorolaSignalsLast8(data) == -128);
+
+    return;
+}
+
+static void checkEncoded(void) {
+    uint8_t data[8];
+
+    memset(data, 0, sizeof(data));
+    encodeIntel(data);
+    CHECK(memcmp(data, intelFrame, 8) == 0);
+    memset(data, 0xFF, sizeof(data));
+    encodeIntel(data);
+    CHECK(memcmp(data, intelFilled, 8) == 0);
+
+    memset(data, 0, sizeof(data));
+    encodeMotorola(data);
+    CHECK(memcmp(data, motorolaFrame, 8) == 0);
+    memset(data, 0xFF, sizeof(data));
+    encodeMotorola(data);
+    CHECK(memcmp(data, motorolaFilled, 8) == 0);
+
+    return;
+}
+
+int main(void) {
+    simFrame incoming[3];
+    canFrame frame;
+
+    checkEncoded();
+    checkIntel(intelFrame);
+    checkIntel(intelFilled);
+    checkMotorola(motorolaFrame);
+    checkMotorola(motorolaFilled);
+    checkExtremes();
+
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    CHECK(setAcceptanceFilters(0, dbcMessageIds, DBC_MESSAGE_COUNT));
+    setMode(0, MODE_NORMAL);
+    sei();
+
+    // Both messages and one the filters keep out
+    memset(incoming, 0, sizeof(incoming));
+    incoming[0].time   = simNow() + SIM_US(500);
+    incoming[0].id     = INTEL_SIGNALS_ID;
+    incoming[0].length = INTEL_SIGNALS_LENGTH;
+    memcpy(incoming[0].data, intelFrame, 8);
+    incoming[1].time   = simNow() + SIM_US(1000);
+    incoming[1].id     = 0x101;
+    incoming[1].length = 8;
+    incoming[2].time     = simNow() + SIM_US(1500);
+    incoming[2].id       = MOTOROLA_SIGNALS_ID & ~CAN_EXTENDED_FLAG;
+    incoming[2].extended = 1;
+    incoming[2].length   = MOTOROLA_SIGNALS_LENGTH;
+    memcpy(incoming[2].data, motorolaFrame, 8);
+    simReceive(0, incoming, 3);
+    simRun(SIM_US(3000));
+
+    CHECK(canRead(0, &frame));
+    CHECK(canGetId(&frame) == INTEL_SIGNALS_ID);
+    CHECK(canFramePackedId(&frame) == INTEL_SIGNALS_PACKED);
+    checkIntel(frame.data);
+
+    CHECK(canRead(0, &frame));
+    CHECK(canGetId(&frame) == MOTOROLA_SIGNALS_ID);
+    CHECK(canFramePackedId(&frame) == MOTOROLA_SIGNALS_PACKED);
+    checkMotorola(frame.data);
+
+    CHECK(!canRead(0, &frame));
+
+    return simTestDone("dbc");
+}
@@ -0,0 +1,104 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * DMA backend test, built with MCP2515_HAL_HEADER at sim/dmapins.h, so       *
+ * readFrame() takes every frame in one spiBurst() on the simulated DMA       *
+ * channel. Standard and extended frames of every DLC from 0 to 8, remote     *
+ * frames with a DLC and a DLC above 8 have to come out of canRead() as they  *
+ * went on the bus, with the DLC capped at 8, and every frame has to cost the *
+ * same SPI bytes, since all eight data bytes come in whatever the DLC.       *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_FRAMES  22
+
+static simFrame incoming[TEST_FRAMES];
+
+static void addFrame(uint8_t i, uint32_t id, uint8_t extended, uint8_t remote, uint8_t length) {
+    simFrame *frame = &incoming[i];
+
+    memset(frame, 0, sizeof(*frame));
+    frame->time     = SIM_US(1000UL * i);
+    frame->id       = id;
+    frame->extended = extended;
+    frame->remote   = remote;
+    frame->length   = length;
+    for (uint8_t byte = 0; byte < 8; byte++) {
+        frame->data[byte] = remote ? 0 : i * 0x10 + byte;
+    }
+
+    return;
+}
+
+static void buildTrace(void) {
+    uint8_t i = 0;
+
+    for (uint8_t length = 0; length <= 8; length++) {
+        addFrame(i++, 0x100 + length, 0, 0, length);
+        addFrame(i++, 0x18DA0000UL + length, 1, 0, length);
+    }
+    addFrame(i++, 0x7FF, 0, 1, 4);
+    addFrame(i++, 0x1FFFFFFFUL, 1, 1, 8);
+    addFrame(i++, 0x123, 0, 0, 15);
+    addFrame(i++, 0x00ABCDEFUL, 1, 0, 9);
+
+    return;
+}
+
+static void checkFrame(const canFrame *frame, const simFrame *sent) {
+    uint32_t id     = sent->id | (sent->extended ? CAN_EXTENDED_FLAG : 0) |
+                      (sent->remote ? CAN_RTR_FLAG : 0);
+    uint8_t  length = sent->remote ? 0 : (sent->length > 8 ? 8 : sent->length);
+
+    CHECK(canGetId(frame) == id);
+    CHECK(canGetLength(frame) == length);
+    CHECK(memcmp(frame->data, sent->data, length) == 0);
+
+    return;
+}
+
+int main(void) {
+    canFrame frame;
+
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    sei();
+
+    buildTrace();
+
+    uint64_t start = simNow() + SIM_US(500);
+
+    for (uint8_t i = 0; i < TEST_FRAMES; i++) {
+        incoming[i].time += start;
+    }
+
+    uint32_t cost = 0;
+
+    simReceive(0, incoming, TEST_FRAMES);
+    for (uint8_t i = 0; i < TEST_FRAMES; i++) {
+        uint32_t spiStart = simSpiBytes();
+
+        // Up to a little short of the next frame, whose INT is then still ahead
+        simRun(incoming[i].time + SIM_US(900) - simNow());
+
+        // The same for every frame, whatever its DLC
+        if (i == 0) {
+            cost = simSpiBytes() - spiStart;
+        }
+        CHECK(simSpiBytes() - spiStart == cost);
+
+        CHECK(canRead(0, &frame));
+        checkFrame(&frame, &incoming[i]);
+        CHECK(!canRead(0, &frame));
+    }
+
+    return simTestDone("dma");
+}
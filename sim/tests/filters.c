@@ -0,0 +1,267 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515registers.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Acceptance filter test. Lists of standard, extended and mixed identifiers, *
+ * with up to and well past six groups, go through setAcceptanceFilters().    *
+ * For each one RXM0, RXM1 and RXF0-RXF5 are read back from the MCP2515 and   *
+ * every listed identifier has to pass them. Then every standard identifier   *
+ * and, for extended lists, every single-bit neighbour of the listed ones and *
+ * a spread of others are put on the bus: what reaches the receive buffers    *
+ * has to be exactly what the registers let through, every listed identifier  *
+ * has to come out of canRead(), and the unwanted ones that get through have  *
+ * to stay within the bound of each list.                                     *
+ ******************************************************************************/
+#define TEST_BITRATE 1000000UL
+#define TEST_SPACING 100       // us between two frames
+#define TEST_SPREAD  256       // Extended identifiers that are not neighbours
+#define TEST_MAX_IDS 16
+#define TEST_FRAMES  (2048 + TEST_MAX_IDS * 30 + TEST_SPREAD)
+
+typedef struct {
+    const char *name;
+    uint8_t     count;
+    uint32_t    ids[TEST_MAX_IDS];
+    uint16_t    unwantedStandard;  // Most other standard identifiers let through
+    uint16_t    unwantedExtended;  // Most other extended ones, of those tried
+} testList;
+
+#define EXT(id) ((id) | CAN_EXTENDED_FLAG)
+
+// The bounds are what the greedy mask of chooseFilterMask() gets to today:
+// a list that fits the filters lets nothing else through, and one that does
+// not gives up as few mask bits as it can
+static const testList lists[] = {
+    {"three standard", 3, {0x100, 0x200, 0x7FF}, 0, 0},
+    {"six standard", 6, {0x010, 0x123, 0x234, 0x345, 0x456, 0x567}, 0, 0},
+    {"ten standard", 10, {0x101, 0x123, 0x245, 0x367, 0x489, 0x5AB, 0x6CD, 0x7EF, 0x010, 0x332}, 520, 0},
+    {"sixteen standard", 16, {0x300, 0x301, 0x302, 0x303, 0x304, 0x305, 0x306, 0x307,
+                              0x500, 0x508, 0x510, 0x518, 0x0F0, 0x1F0, 0x2F0, 0x3F0}, 8, 0},
+    {"four extended", 4, {EXT(0x18FEF100), EXT(0x18FEF200), EXT(0x0CF00400), EXT(0x1FFFFFFF)}, 0, 0},
+    {"twelve extended", 12, {EXT(0x18DA00F1), EXT(0x18DA01F1), EXT(0x18DA02F1), EXT(0x18DA03F1),
+                             EXT(0x18DAF100), EXT(0x18DAF101), EXT(0x18DAF102), EXT(0x18DAF103),
+                             EXT(0x0CF00400), EXT(0x0CF00300), EXT(0x18FEEE00), EXT(0x18FEF500)}, 0, 16},
+    {"mixed", 5, {0x100, EXT(0x18FEF100), 0x200, 0x7FF, EXT(0x0CF00400)}, 0, 0},
+    {"mixed, many groups", 12, {0x100, 0x211, 0x322, 0x433, 0x544, EXT(0x18FEF100), EXT(0x18FEF200),
+                                EXT(0x0CF00400), EXT(0x18DA00F1), EXT(0x18DAF100), EXT(0x1FFFFFFF),
+                                EXT(0x00000001)}, 1024, 144},
+};
+
+#define TEST_LISTS (sizeof(lists) / sizeof(lists[0]))
+
+typedef struct {
+    uint32_t mask[2];
+    uint32_t filter[6];
+    uint8_t  extended[6];
+    uint8_t  acceptAll[2];
+} testFilters;
+
+static simFrame frames[TEST_FRAMES];
+static uint8_t  seen[TEST_MAX_IDS];
+
+// 29-bit value of a mask or filter register set, SID in bits 18-28 as for extended frames
+static uint32_t readIdRegisters(uint8_t address, uint8_t *extended) {
+    uint8_t sidh = simChipRegister(0, address);
+    uint8_t sidl = simChipRegister(0, address + 1);
+    uint8_t eid8 = simChipRegister(0, address + 2);
+    uint8_t eid0 = simChipRegister(0, address + 3);
+
+    if (extended) {
+        *extended = (sidl >> EXIDE) & 1;
+    }
+
+    return ((uint32_t)sidh << 21) | ((uint32_t)(sidl >> 5) << 18) | ((uint32_t)(sidl & 0x03) << 16) |
+           ((uint32_t)eid8 << 8) | eid0;
+}
+
+static void readFilters(testFilters *filters) {
+    static const uint8_t addresses[6] = {RXF0SIDH, RXF1SIDH, RXF2SIDH, RXF3SIDH, RXF4SIDH, RXF5SIDH};
+
+    filters->mask[0] = readIdRegisters(RXM0SIDH, 0);
+    filters->mask[1] = readIdRegisters(RXM1SIDH, 0);
+    for (uint8_t i = 0; i < 6; i++) {
+        filters->filter[i] = readIdRegisters(addresses[i], &filters->extended[i]);
+    }
+    filters->acceptAll[0] = (simChipRegister(0, RXB0CTRL) & ((1<<RXM1) | (1<<RXM0))) == ((1<<RXM1) | (1<<RXM0));
+    filters->acceptAll[1] = (simChipRegister(0, RXB1CTRL) & ((1<<RXM1) | (1<<RXM0))) == ((1<<RXM1) | (1<<RXM0));
+
+    return;
+}
+
+// What the registers let through: RXF0-RXF1 under RXM0, RXF2-RXF5 under RXM1
+static uint8_t passes(const testFilters *filters, uint32_t id, uint8_t extended) {
+    uint32_t value = extended ? id : id << 18;
+
+    for (uint8_t i = 0; i < 6; i++) {
+        uint8_t  buffer = i >= 2;
+        uint32_t mask   = extended ? filters->mask[buffer] : filters->mask[buffer] & 0x1FFC0000UL;
+
+        if (filters->acceptAll[buffer]) {
+            return 1;
+        }
+        if (filters->extended[i] == extended && !((value ^ filters->filter[i]) & mask)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint8_t isListed(const testList *list, uint32_t id, uint8_t extended) {
+    for (uint8_t i = 0; i < list->count; i++) {
+        if (list->ids[i] == (id | (extended ? CAN_EXTENDED_FLAG : 0))) {
+            return i + 1;
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t addFrame(uint32_t count, uint32_t id, uint8_t extended) {
+    memset(&frames[count], 0, sizeof(frames[count]));
+    frames[count].id       = id;
+    frames[count].extended = extended;
+
+    return count + 1;
+}
+
+// Every standard identifier, and for an extended list its neighbours and a spread of others
+static uint32_t buildFrames(const testList *list) {
+    uint32_t count     = 0;
+    uint8_t  extended  = 0;
+    uint32_t generator = 12345;
+
+    for (uint32_t id = 0; id < 0x800; id++) {
+        count = addFrame(count, id, 0);
+    }
+    for (uint8_t i = 0; i < list->count; i++) {
+        if (list->ids[i] & CAN_EXTENDED_FLAG) {
+            uint32_t id = list->ids[i] & CAN_EXTENDED_MASK;
+
+            count    = addFrame(count, id, 1);
+            extended = 1;
+            for (uint8_t bit = 0; bit < 29; bit++) {
+                count = addFrame(count, id ^ (1UL << bit), 1);
+            }
+        }
+    }
+    if (extended) {
+        for (uint16_t i = 0; i < TEST_SPREAD; i++) {
+            generator = generator * 1103515245UL + 12345;
+            count     = addFrame(count, generator & CAN_EXTENDED_MASK, 1);
+        }
+    }
+
+    return count;
+}
+
+static void checkList(const testList *list) {
+    testFilters filters;
+    simCounters before;
+    simCounters after;
+    uint32_t    count;
+    uint32_t    expected         = 0;
+    uint32_t    unwantedStandard = 0;
+    uint32_t    unwantedExtended = 0;
+
+    initController(0);
+    CHECK(setAcceptanceFilters(0, list->ids, list->count));
+    readFilters(&filters);
+    setMode(0, MODE_NORMAL);
+
+    // Every listed identifier passes the registers
+    for (uint8_t i = 0; i < list->count; i++) {
+        uint8_t extended = (list->ids[i] & CAN_EXTENDED_FLAG) != 0;
+
+        CHECK(passes(&filters, list->ids[i] & CAN_EXTENDED_MASK, extended));
+    }
+
+    // A buffer with standard filters leaves the EID bits of its mask clear,
+    // which would otherwise be matched against the first two data bytes
+    for (uint8_t i = 0; i < 6; i++) {
+        if (!filters.extended[i]) {
+            CHECK(!(filters.mask[i >= 2] & 0x3FFFF));
+        }
+    }
+
+    count = buildFrames(list);
+    memset(seen, 0, sizeof(seen));
+
+    uint64_t start = simNow() + SIM_US(TEST_SPACING);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t pass   = passes(&filters, frames[i].id, frames[i].extended);
+        uint8_t listed = isListed(list, frames[i].id, frames[i].extended);
+
+        frames[i].time = start + SIM_US((uint64_t)TEST_SPACING * i);
+        expected += pass;
+        if (pass && !listed) {
+            if (frames[i].extended) {
+                unwantedExtended++;
+            } else {
+                unwantedStandard++;
+            }
+        }
+    }
+
+    simReadCounters(0, &before);
+    simReceive(0, frames, count);
+    while (simNow() < start + SIM_US((uint64_t)TEST_SPACING * (count + 10))) {
+        canFrame frame;
+
+        simRun(SIM_US(500));
+        while (canRead(0, &frame)) {
+            uint32_t id     = canGetId(&frame);
+            uint8_t  listed = isListed(list, id & CAN_EXTENDED_MASK, (id & CAN_EXTENDED_FLAG) != 0);
+
+            if (listed) {
+                seen[listed - 1] = 1;
+            }
+        }
+    }
+    simReadCounters(0, &after);
+
+    CHECK(after.framesReceived - before.framesReceived == expected);
+    CHECK(after.framesOverflowed == before.framesOverflowed);
+    for (uint8_t i = 0; i < list->count; i++) {
+        CHECK(seen[i]);
+    }
+    CHECK(unwantedStandard <= list->unwantedStandard);
+    CHECK(unwantedExtended <= list->unwantedExtended);
+
+    return;
+}
+
+int main(void) {
+    testFilters filters;
+
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    sei();
+
+    for (uint8_t i = 0; i < TEST_LISTS; i++) {
+        checkList(&lists[i]);
+    }
+
+    // An empty list turns the filters off: everything passes
+    initController(0);
+    CHECK(setAcceptanceFilters(0, 0, 0));
+    readFilters(&filters);
+    CHECK(filters.acceptAll[0] && filters.acceptAll[1]);
+
+    // And a list past CAN_FILTER_MAX_IDS is turned down
+    uint32_t many[CAN_FILTER_MAX_IDS + 1];
+
+    for (uint8_t i = 0; i <= CAN_FILTER_MAX_IDS; i++) {
+        many[i] = i;
+    }
+    CHECK(!setAcceptanceFilters(0, many, CAN_FILTER_MAX_IDS + 1));
+
+    return simTestDone("filters");
+}
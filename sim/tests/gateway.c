@@ -0,0 +1,226 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "cangateway.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Gateway test. Two devices at 500 kbit/s with the routes of                 *
+ * sim/tests/gateway.routes; device 0 receives a mix of forwarded, rewritten, *
+ * rate limited and unrouted frames, each carrying its index in the list in   *
+ * its first data byte. The copies device 1 puts on the bus and the frames    *
+ * delivered on device 0 are checked against the routes, and the forward      *
+ * latency (from the end of the received frame to the start of its copy) is   *
+ * reported.                                                                  *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_ROUTED  40        // 0C9, 3E9, 18FEF100 and 123 in turn, 1 ms apart
+#define TEST_LIMITED 20        // then 1F5, 3 ms apart
+#define TEST_FRAMES  (TEST_ROUTED + TEST_LIMITED)
+
+static simFrame incoming[TEST_FRAMES];
+static simFrame copies[TEST_FRAMES];
+static uint32_t copyCount;
+static canFrame local[TEST_FRAMES];
+static uint32_t localCount;
+static uint32_t strayCount;
+
+static void collectCopy(uint8_t device, const simFrame *frame) {
+    if (device == 1 && copyCount < TEST_FRAMES) {
+        copies[copyCount++] = *frame;
+    } else {
+        strayCount++;
+    }
+
+    return;
+}
+
+static void setFrame(simFrame *frame, uint64_t time, uint32_t id, uint8_t extended, uint8_t index) {
+    memset(frame, 0, sizeof(*frame));
+    frame->time     = time;
+    frame->id       = id;
+    frame->extended = extended;
+    frame->length   = 8;
+    frame->data[0]  = index;
+    for (uint8_t i = 1; i < 8; i++) {
+        frame->data[i] = index ^ (0x11 * i);
+    }
+
+    return;
+}
+
+static void buildList(uint64_t base) {
+    static const uint32_t ids[4] = {0x0C9, 0x3E9, 0x18FEF100, 0x123};
+
+    for (uint8_t i = 0; i < TEST_ROUTED; i++) {
+        setFrame(&incoming[i], base + SIM_US(1000UL * i), ids[i & 3], (i & 3) == 2, i);
+    }
+    for (uint8_t i = 0; i < TEST_LIMITED; i++) {
+        setFrame(&incoming[TEST_ROUTED + i], base + SIM_US(45000UL + 3000UL * i), 0x1F5, 0,
+                 TEST_ROUTED + i);
+    }
+
+    return;
+}
+
+// Identifier a data frame from the list should be rewritten to, or 0 if it is not forwarded
+static uint32_t expectedCopy(uint8_t index) {
+    static const uint32_t copyIds[4] = {0x0C9, 0x3EA, 0x18FEF101, 0};
+
+    if (index < TEST_ROUTED) {
+        return copyIds[index & 3];
+    }
+    // 3 ms apart against a 10 ms interval: every fourth copy goes
+    return ((index - TEST_ROUTED) % 4 == 0) ? 0x1F5 : 0;
+}
+
+static void checkCopies(void) {
+    uint32_t next = 0;
+
+    for (uint8_t index = 0; index < TEST_FRAMES; index++) {
+        uint32_t id = expectedCopy(index);
+
+        if (!id) {
+            continue;
+        }
+
+        const simFrame *copy = &copies[next++];
+
+        CHECK(next <= copyCount);
+        CHECK(copy->id == id);
+        CHECK(copy->extended == incoming[index].extended);
+        CHECK(copy->length == 8);
+        CHECK(memcmp(copy->data, incoming[index].data, 8) == 0);
+    }
+    CHECK(copyCount == next);
+    CHECK(strayCount == 0);
+
+    return;
+}
+
+// Only the unrouted frames and the 3E9 routed with CAN_ROUTE_LOCAL, identifier unchanged
+static void checkLocal(void) {
+    uint32_t next = 0;
+
+    for (uint8_t index = 0; index < TEST_ROUTED; index++) {
+        if ((index & 3) != 1 && (index & 3) != 3) {
+            continue;
+        }
+
+        const canFrame *frame = &local[next++];
+
+        CHECK(next <= localCount);
+        CHECK(canGetId(frame) == incoming[index].id);
+        CHECK(canGetLength(frame) == 8);
+        CHECK(memcmp(frame->data, incoming[index].data, 8) == 0);
+    }
+    CHECK(localCount == next);
+
+    return;
+}
+
+static void reportLatency(void) {
+    uint64_t worst = 0;
+    uint64_t total = 0;
+    uint64_t worstFrame = 1;
+
+    for (uint32_t i = 0; i < copyCount; i++) {
+        const simFrame *source  = &incoming[copies[i].data[0]];
+        uint64_t        end     = source->time + simFrameCycles(0, source);
+        uint64_t        latency = copies[i].time - end;
+
+        CHECK(copies[i].time > end);
+        if (latency > worst) {
+            worst      = latency;
+            worstFrame = simFrameCycles(0, source);
+        }
+        total += latency;
+    }
+
+    printf("gateway: forward latency at %lu bit/s, SPI fosc/%d: worst %.1f us (%.2f frame times), "
+           "mean %.1f us\n",
+           (unsigned long)TEST_BITRATE, MCP2515_SPI_CLOCK_DIV, worst * 1e6 / F_CPU,
+           (double)worst / worstFrame, copyCount ? total * 1e6 / F_CPU / copyCount : 0.0);
+
+    return;
+}
+
+// gatewayForward() called directly: its return value and the frame it hands back
+static void checkForward(void) {
+    canGatewayCounters counters;
+    canFrame frame;
+    canFrame before;
+
+    memset(&frame, 0, sizeof(frame));
+    canSetLength(&frame, 2);
+    frame.data[0] = 0xA5;
+
+    readGatewayCounters(&counters, 1);
+
+    canSetId(&frame, 0x0C9);
+    CHECK(gatewayForward(0, &frame) == 0);
+    CHECK(gatewayForward(1, &frame) == 0);
+
+    canSetId(&frame, 0x3E9);
+    before = frame;
+    CHECK(gatewayForward(0, &frame) == 1);
+    CHECK(memcmp(&frame, &before, sizeof(frame)) == 0);
+
+    // No route for this source device, or none at all
+    CHECK(gatewayForward(1, &frame) == 1);
+    canSetId(&frame, 0x123);
+    CHECK(gatewayForward(0, &frame) == 1);
+
+    readGatewayCounters(&counters, 0);
+    CHECK(counters.forwarded == 3);
+    CHECK(counters.limited == 0);
+    CHECK(counters.rejected == 0);
+
+    return;
+}
+
+int main(void) {
+    canGatewayCounters counters;
+    canFrame frame;
+
+    simInit();
+    for (uint8_t device = 0; device < 2; device++) {
+        simBitrate(device, TEST_BITRATE);
+        initController(device);
+        setAcceptanceFilters(device, 0, 0);
+        setMode(device, MODE_NORMAL);
+    }
+    simTransmitted = collectCopy;
+    sei();
+
+    buildList(simNow() + SIM_US(1000));
+    simReceive(0, incoming, TEST_FRAMES);
+
+    uint64_t end = incoming[TEST_FRAMES - 1].time + SIM_US(5000);
+
+    while (simNow() < end) {
+        while (localCount < TEST_FRAMES && canRead(0, &local[localCount])) {
+            localCount++;
+        }
+        while (canRead(1, &frame)) {
+            strayCount++;
+        }
+        simRun(200);
+    }
+
+    checkCopies();
+    checkLocal();
+
+    readGatewayCounters(&counters, 0);
+    CHECK(counters.forwarded == copyCount);
+    CHECK(counters.limited == TEST_LIMITED - TEST_LIMITED / 4);
+    CHECK(counters.rejected == 0);
+
+    reportLatency();
+    checkForward();
+
+    return simTestDone("gateway");
+}
@@ -0,0 +1,539 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "canisotp.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * ISO-TP test. Channel 0 of device 0 talks to a simulated peer, which sees   *
+ * the frames the device puts on the bus through the "simTransmitted" hook    *
+ * and answers PEER_DELAY_US after each one with frames added to the          *
+ * device's receive list.                                                     *
+ *                                                                            *
+ * Sending, the peer reassembles the message and checks sequence numbers,     *
+ * block sizes and STmin gaps, answering the first frame with a flow control  *
+ * frame as the test case asks (CTS, WAIT then CTS, OVERFLOW or nothing at    *
+ * all). Receiving, it sends single or first frames and a block of            *
+ * consecutive frames for every CTS the device sends back. Built with         *
+ * CAN_ISOTP_TIMEOUT_MS at 20, so the N_Bs and N_Cr timeouts are quick.       *
+ *                                                                            *
+ *   isotp [-b]                                                               *
+ *                                                                            *
+ * With -b it sends a 4095 byte message with BS 0 and STmin 0 at 125 kbit/s   *
+ * to 1 Mbit/s instead and reports the share of line rate it gets, see "make  *
+ * bench".                                                                    *
+ ******************************************************************************/
+#define TEST_TX_ID      0x7E0
+#define TEST_RX_ID      0x7E8
+#define TEST_BITRATE    500000UL
+#define TEST_BLOCK_SIZE 8       // What the device's flow control frames ask for
+#define TEST_LIMIT_US   2000000 // Longest a transfer may take
+
+#define PEER_DELAY_US   50
+#define PEER_WAIT_US    5000    // From FC WAIT to the CTS that follows
+#define PEER_FRAMES     2048
+
+// What the peer answers a first frame with
+#define PEER_CTS        0
+#define PEER_WAIT       1
+#define PEER_OVERFLOW   2
+#define PEER_SILENT     3
+
+// What the peer does as the sender when the device asks for consecutive frames
+#define PEER_SEND       0
+#define PEER_BAD_SEQUENCE 1
+#define PEER_STOP       2
+
+typedef struct {
+    // Receiving what the device sends
+    uint8_t  answer;
+    uint8_t  blockSize;
+    uint8_t  stmin;
+    uint8_t  message[ISOTP_MAX_LENGTH];
+    uint16_t length;
+    uint16_t offset;
+    uint8_t  sequence;
+    uint8_t  blockCount;
+    uint8_t  done;
+    uint32_t singles;
+    uint32_t firsts;
+    uint32_t consecutives;
+    uint32_t errors;
+    uint64_t firstTime;      // Start of the device's first frame, end of the peer's
+    uint64_t lastEnd;
+    uint64_t minGap;
+    uint64_t ctsTime;
+    uint64_t busy;
+
+    // Sending to the device
+    uint8_t        sending;
+    const uint8_t *txData;
+    uint16_t       txLength;
+    uint16_t       txOffset;
+    uint8_t        txSequence;
+    uint32_t       flowControls;
+    uint8_t        flow[8];
+} peerState;
+
+static peerState peer;
+static simFrame  peerFrames[PEER_FRAMES];
+static uint32_t  peerCount;
+static uint32_t  strayCount;
+
+static uint8_t   message[ISOTP_MAX_LENGTH];
+static uint8_t   received[ISOTP_MAX_LENGTH];
+
+/******************************************************************************
+ * Peer                                                                       *
+ ******************************************************************************/
+static void peerQueue(uint64_t time, const uint8_t *data, uint8_t count) {
+    simFrame *frame = &peerFrames[peerCount];
+
+    if (peerCount == PEER_FRAMES) {
+        peer.errors++;
+        return;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->time   = time;
+    frame->id     = TEST_RX_ID;
+    frame->length = 8;
+    memset(frame->data, 0xAA, 8);
+    memcpy(frame->data, data, count);
+    peerCount++;
+    simReceiveMore(0, 1);
+
+    return;
+}
+
+static void peerFlowControl(uint64_t time, uint8_t status) {
+    uint8_t data[3] = {0x30 | status, peer.blockSize, peer.stmin};
+
+    peerQueue(time, data, 3);
+    if (status == 0) {
+        peer.ctsTime = time;
+    }
+
+    return;
+}
+
+// Next block of consecutive frames to the device, "count" of them (0 for all)
+static void peerBlock(uint64_t time, uint8_t count) {
+    for (uint8_t sent = 0; peer.txOffset < peer.txLength && (!count || sent < count); sent++) {
+        uint8_t  data[8];
+        uint16_t left  = peer.txLength - peer.txOffset;
+        uint8_t  bytes = left > 7 ? 7 : left;
+
+        data[0] = 0x20 | peer.txSequence;
+        if (peer.sending == PEER_BAD_SEQUENCE && sent == 1) {
+            data[0] = 0x20 | ((peer.txSequence + 1) & 0x0F);
+        }
+        memcpy(data + 1, peer.txData + peer.txOffset, bytes);
+        peerQueue(time, data, 1 + bytes);
+        peer.txOffset  += bytes;
+        peer.txSequence = (peer.txSequence + 1) & 0x0F;
+    }
+
+    return;
+}
+
+// Starts sending "length" bytes at "data" to the device
+static void peerSend(const uint8_t *data, uint16_t length, uint8_t sending) {
+    uint8_t frame[8];
+
+    peer.sending  = sending;
+    peer.txData   = data;
+    peer.txLength = length;
+
+    if (length <= 7) {
+        frame[0] = length;
+        memcpy(frame + 1, data, length);
+        peerQueue(simNow(), frame, 1 + length);
+        return;
+    }
+
+    frame[0] = 0x10 | (length >> 8);
+    frame[1] = length;
+    memcpy(frame + 2, data, 6);
+    peerQueue(simNow(), frame, 8);
+    peer.firstTime  = simNow() + simFrameCycles(0, &peerFrames[peerCount - 1]);
+    peer.txOffset   = 6;
+    peer.txSequence = 1;
+
+    return;
+}
+
+static void peerFirstFrame(const simFrame *frame, uint64_t now) {
+    peer.firsts++;
+    peer.length   = ((frame->data[0] & 0x0F) << 8) | frame->data[1];
+    peer.offset   = 6;
+    peer.sequence = 1;
+    memcpy(peer.message, frame->data + 2, 6);
+    peer.firstTime = frame->time;
+
+    switch (peer.answer) {
+    case PEER_CTS:
+        peerFlowControl(now + SIM_US(PEER_DELAY_US), 0);
+        break;
+    case PEER_WAIT:
+        peerFlowControl(now + SIM_US(PEER_DELAY_US), 1);
+        peerFlowControl(now + SIM_US(PEER_WAIT_US), 0);
+        break;
+    case PEER_OVERFLOW:
+        peerFlowControl(now + SIM_US(PEER_DELAY_US), 2);
+        break;
+    }
+
+    return;
+}
+
+static void peerConsecutive(const simFrame *frame, uint64_t end) {
+    uint16_t left  = peer.length - peer.offset;
+    uint8_t  bytes = left > 7 ? 7 : left;
+
+    peer.consecutives++;
+    if (!peer.firsts || peer.done || (frame->data[0] & 0x0F) != peer.sequence ||
+        frame->time < peer.ctsTime || !peer.ctsTime) {
+        peer.errors++;
+        return;
+    }
+
+    // STmin counts from the end of one consecutive frame to the start of the next
+    if (peer.offset > 6 && frame->time - peer.lastEnd < peer.minGap) {
+        peer.minGap = frame->time - peer.lastEnd;
+    }
+    peer.lastEnd = end;
+
+    memcpy(peer.message + peer.offset, frame->data + 1, bytes);
+    for (uint8_t i = 1 + bytes; i < 8; i++) {
+        if (frame->data[i] != CAN_ISOTP_PADDING) {
+            peer.errors++;
+        }
+    }
+    peer.offset  += bytes;
+    peer.sequence = (peer.sequence + 1) & 0x0F;
+
+    if (peer.offset == peer.length) {
+        peer.done = 1;
+    } else if (peer.blockSize && ++peer.blockCount == peer.blockSize) {
+        peer.blockCount = 0;
+        peerFlowControl(end + SIM_US(PEER_DELAY_US), 0);
+    }
+
+    return;
+}
+
+// A flow control frame from the device, receiving from the peer
+static void peerFlow(const simFrame *frame, uint64_t end) {
+    peer.flowControls++;
+    memcpy(peer.flow, frame->data, 8);
+
+    if ((frame->data[0] & 0x0F) == 0 && peer.sending != PEER_STOP) {
+        peerBlock(end + SIM_US(PEER_DELAY_US), frame->data[1]);
+    }
+
+    return;
+}
+
+static void peerHears(uint8_t device, const simFrame *frame) {
+    uint64_t end = frame->time + simFrameCycles(device, frame);
+
+    if (device != 0 || frame->id != TEST_TX_ID || frame->extended || frame->length != 8) {
+        strayCount++;
+        return;
+    }
+    peer.busy += simFrameCycles(device, frame);
+
+    switch (frame->data[0] & 0xF0) {
+    case 0x00:
+        peer.singles++;
+        peer.length = frame->data[0] & 0x0F;
+        memcpy(peer.message, frame->data + 1, peer.length);
+        for (uint8_t i = 1 + peer.length; i < 8; i++) {
+            if (frame->data[i] != CAN_ISOTP_PADDING) {
+                peer.errors++;
+            }
+        }
+        peer.done = 1;
+        break;
+    case 0x10:
+        peerFirstFrame(frame, end);
+        break;
+    case 0x20:
+        peerConsecutive(frame, end);
+        break;
+    case 0x30:
+        peerFlow(frame, end);
+        break;
+    default:
+        peer.errors++;
+        break;
+    }
+
+    return;
+}
+
+// Forgets the last case; frames already queued still go
+static void peerReset(uint8_t answer, uint8_t blockSize, uint8_t stmin) {
+    memset(&peer, 0, sizeof(peer));
+    peer.answer    = answer;
+    peer.blockSize = blockSize;
+    peer.stmin     = stmin;
+    peer.minGap    = UINT64_MAX;
+
+    return;
+}
+
+/******************************************************************************
+ * Cases                                                                      *
+ ******************************************************************************/
+// Lets the frames still queued by either side go, then 1 ms of quiet bus
+static void settle(void) {
+    while (!simBusIdle(0)) {
+        simRun(200);
+    }
+    simRun(SIM_US(1000));
+
+    return;
+}
+
+static uint8_t waitSend(void) {
+    uint64_t limit = simNow() + SIM_US(TEST_LIMIT_US);
+
+    while (isotpSendStatus(0) == ISOTP_BUSY && simNow() < limit) {
+        simRun(200);
+    }
+
+    return isotpSendStatus(0);
+}
+
+static uint8_t waitReceive(uint16_t *length) {
+    uint64_t limit = simNow() + SIM_US(TEST_LIMIT_US);
+
+    while (isotpReceiveStatus(0, length) == ISOTP_BUSY && simNow() < limit) {
+        simRun(200);
+    }
+
+    return isotpReceiveStatus(0, length);
+}
+
+static void fillMessage(uint16_t length, uint8_t seed) {
+    for (uint16_t i = 0; i < length; i++) {
+        message[i] = (uint8_t)(i * 7 + seed);
+    }
+
+    return;
+}
+
+static void sendCase(uint16_t length, uint8_t blockSize, uint8_t stmin) {
+    uint16_t consecutives = length > 7 ? (length - 6 + 7 - 1) / 7 : 0;
+
+    peerReset(PEER_CTS, blockSize, stmin);
+    fillMessage(length, length);
+
+    CHECK(isotpSend(0, message, length));
+    CHECK(!isotpSend(0, message, length));
+    CHECK(waitSend() == ISOTP_DONE);
+
+    CHECK(peer.done);
+    CHECK(peer.errors == 0);
+    CHECK(peer.length == length);
+    CHECK(memcmp(peer.message, message, length) == 0);
+    CHECK(peer.singles == (length <= 7));
+    CHECK(peer.firsts == (length > 7));
+    CHECK(peer.consecutives == consecutives);
+    if (stmin && consecutives > 1) {
+        CHECK(peer.minGap >= SIM_US(1000UL * stmin));
+    }
+    settle();
+
+    return;
+}
+
+// FC WAIT first: nothing may follow the first frame until the CTS
+static void sendWaitCase(void) {
+    peerReset(PEER_WAIT, 0, 0);
+    fillMessage(50, 3);
+
+    CHECK(isotpSend(0, message, 50));
+    CHECK(waitSend() == ISOTP_DONE);
+    CHECK(peer.done);
+    CHECK(peer.errors == 0);
+    CHECK(memcmp(peer.message, message, 50) == 0);
+    CHECK(peer.lastEnd - peer.firstTime >= SIM_US(PEER_WAIT_US));
+    settle();
+
+    return;
+}
+
+static void sendRefusedCase(uint8_t answer, uint8_t status) {
+    peerReset(answer, 0, 0);
+    fillMessage(100, 9);
+
+    CHECK(isotpSend(0, message, 100));
+    CHECK(waitSend() == status);
+    CHECK(peer.firsts == 1);
+    CHECK(peer.consecutives == 0);
+    if (status == ISOTP_TIMEOUT) {
+        // N_Bs runs from loading the first frame, part way into a tick
+        uint64_t waited = simNow() - peer.firstTime;
+
+        CHECK(waited >= SIM_US(CAN_ISOTP_TIMEOUT_MS * 1000UL - CAN_ISOTP_TICK_US));
+        CHECK(waited <= SIM_US(CAN_ISOTP_TIMEOUT_MS * 1000UL + 500));
+    }
+    settle();
+
+    return;
+}
+
+static void receiveCase(uint16_t length) {
+    uint16_t got = 0;
+    uint16_t consecutives = length > 7 ? (length - 6 + 7 - 1) / 7 : 0;
+
+    peerReset(PEER_CTS, 0, 0);
+    fillMessage(length, length >> 1);
+    memset(received, 0, sizeof(received));
+
+    CHECK(isotpReceive(0, received, sizeof(received)));
+    CHECK(isotpReceiveStatus(0, 0) == ISOTP_BUSY);
+    peerSend(message, length, PEER_SEND);
+
+    CHECK(waitReceive(&got) == ISOTP_DONE);
+    CHECK(got == length);
+    CHECK(memcmp(received, message, length) == 0);
+    CHECK(peer.flowControls == (consecutives + TEST_BLOCK_SIZE - 1) / TEST_BLOCK_SIZE);
+    if (peer.flowControls) {
+        CHECK(peer.flow[0] == 0x30);
+        CHECK(peer.flow[1] == TEST_BLOCK_SIZE);
+        CHECK(peer.flow[2] == 0);
+        CHECK(peer.flow[3] == CAN_ISOTP_PADDING);
+    }
+    settle();
+
+    return;
+}
+
+static void receiveOverflowCase(void) {
+    fillMessage(300, 1);
+    peerReset(PEER_CTS, 0, 0);
+
+    CHECK(isotpReceive(0, received, 50));
+    peerSend(message, 300, PEER_SEND);
+    CHECK(waitReceive(0) == ISOTP_OVERFLOW);
+    settle();
+    CHECK(peer.flowControls == 1);
+    CHECK(peer.flow[0] == 0x32);
+
+    return;
+}
+
+static void receiveBrokenCase(uint8_t sending, uint8_t status) {
+    fillMessage(100, 5);
+    peerReset(PEER_CTS, 0, 0);
+
+    CHECK(isotpReceive(0, received, sizeof(received)));
+    peerSend(message, 100, sending);
+    CHECK(waitReceive(0) == status);
+    CHECK(peer.flowControls == 1);
+    if (status == ISOTP_TIMEOUT) {
+        // N_Cr runs from taking the first frame in and answering it
+        uint64_t waited = simNow() - peer.firstTime;
+
+        CHECK(waited >= SIM_US(CAN_ISOTP_TIMEOUT_MS * 1000UL - CAN_ISOTP_TICK_US));
+        CHECK(waited <= SIM_US(CAN_ISOTP_TIMEOUT_MS * 1000UL + 500));
+    }
+    settle();
+
+    return;
+}
+
+static void setup(uint32_t bitrate) {
+    simInit();
+    simBitrate(0, bitrate);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    isotpInit();
+    isotpSetup(0, 0, TEST_TX_ID, TEST_RX_ID, TEST_BLOCK_SIZE, 0);
+
+    peerCount  = 0;
+    strayCount = 0;
+    simReceive(0, peerFrames, 0);
+    simTransmitted = peerHears;
+    sei();
+
+    return;
+}
+
+/******************************************************************************
+ * Throughput: one 4095 byte message, from the start of the first frame to    *
+ * the end of the last consecutive frame, against the time its frames and the *
+ * peer's flow control frame occupy the bus.                                  *
+ ******************************************************************************/
+static void throughput(uint32_t bitrate) {
+    setup(bitrate);
+    settle();
+    sendCase(ISOTP_MAX_LENGTH, 0, 0);
+
+    uint64_t elapsed = peer.lastEnd - peer.firstTime;
+    simFrame flow    = peerFrames[0];
+    uint64_t busy    = peer.busy + simFrameCycles(0, &flow);
+
+    printf("%8lu %7u %7lu %10.2f %10.1f %7.1f\n",
+           (unsigned long)bitrate, ISOTP_MAX_LENGTH, (unsigned long)(1 + peer.consecutives),
+           elapsed * 1e3 / F_CPU, ISOTP_MAX_LENGTH * (double)F_CPU / elapsed,
+           100.0 * busy / elapsed);
+
+    return;
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        static const uint32_t rates[4] = {125000, 250000, 500000, 1000000};
+
+        printf("# ISO-TP, F_CPU %lu, SPI fosc/%d, BS 0, STmin 0\n",
+               (unsigned long)F_CPU, MCP2515_SPI_CLOCK_DIV);
+        printf("%8s %7s %7s %10s %10s %7s\n", "bitrate", "bytes", "frames", "ms", "bytes/s", "line%");
+        for (uint8_t rate = 0; rate < 4; rate++) {
+            throughput(rates[rate]);
+        }
+
+        return simTestDone("isotp throughput");
+    }
+
+    setup(TEST_BITRATE);
+    settle();
+
+    // Sending: SF, FF + CF with BS 0 and BS > 0, STmin, FC WAIT, FC OVERFLOW, N_Bs
+    sendCase(5, 0, 0);
+    sendCase(7, 0, 0);
+    sendCase(8, 0, 0);
+    sendCase(200, 0, 0);
+    sendCase(200, 4, 0);
+    sendCase(60, 0, 2);
+    sendCase(60, 3, 1);
+    sendCase(ISOTP_MAX_LENGTH, 0, 0);
+    sendWaitCase();
+    sendRefusedCase(PEER_OVERFLOW, ISOTP_OVERFLOW);
+    sendRefusedCase(PEER_SILENT, ISOTP_TIMEOUT);
+    sendCase(20, 0, 0);
+    CHECK(!isotpSend(0, message, 0));
+    CHECK(!isotpSend(0, message, ISOTP_MAX_LENGTH + 1));
+
+    // Receiving: SF, FF + CF with the device's flow control, overflow, sequence error, N_Cr
+    receiveCase(7);
+    receiveCase(13);
+    receiveCase(300);
+    receiveCase(ISOTP_MAX_LENGTH);
+    receiveOverflowCase();
+    receiveBrokenCase(PEER_BAD_SEQUENCE, ISOTP_ERROR);
+    receiveBrokenCase(PEER_STOP, ISOTP_TIMEOUT);
+    receiveCase(100);
+
+    CHECK(strayCount == 0);
+
+    return simTestDone("isotp");
+}
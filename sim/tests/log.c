@@ -0,0 +1,268 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "mcp2515.h"
+#include "canlog.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Frame logger test, built with two devices, CAN_LOG_BUFFER at 32 and        *
+ * CAN_TIMESTAMPS. The UART stream is captured through simUartTransmitted and *
+ * decoded by tools/canlogdecode.py, and the candump lines it gives are       *
+ * checked against the frames put on the bus: device, identifier, RTR and     *
+ * data (with 0x00 bytes for COBS to skip) exactly, and the time within a few *
+ * microseconds, over 1-, 2- and 3-byte deltas. A burst of frames on device 0 *
+ * that logPoll() is not called for then has to come out as the frames the    *
+ * ring kept plus one lost-frame record for the rest.                         *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_BURST   40
+#define TEST_FRAMES  (8 + TEST_BURST)
+#define TEST_SLACK   3         // us
+
+typedef struct {
+    uint8_t  device;
+    uint32_t us;               // Start on the bus, from the first frame
+    simFrame frame;
+} testFrame;
+
+static testFrame frames[TEST_FRAMES];
+static uint32_t  frameCount;
+static uint8_t   capture[8192];
+static uint32_t  captureLength;
+
+static void collectUart(uint8_t data) {
+    if (captureLength < sizeof(capture)) {
+        capture[captureLength++] = data;
+    }
+
+    return;
+}
+
+static void addFrame(uint8_t device, uint32_t us, uint32_t id, uint8_t extended, uint8_t remote,
+                     uint8_t length, const uint8_t *data) {
+    testFrame *frame = &frames[frameCount++];
+
+    memset(frame, 0, sizeof(*frame));
+    frame->device          = device;
+    frame->us              = us;
+    frame->frame.id        = id;
+    frame->frame.extended  = extended;
+    frame->frame.remote    = remote;
+    frame->frame.length    = length;
+    if (data) {
+        memcpy(frame->frame.data, data, length);
+    }
+
+    return;
+}
+
+static void buildTrace(void) {
+    static const uint8_t zeros[8]   = {0x11, 0x22, 0x00, 0x33, 0x00, 0x00, 0x44, 0x55};
+    static const uint8_t empty[3]   = {0x00, 0x00, 0x00};
+    static const uint8_t ones[8]    = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+
+    addFrame(0, 0,      0x123,      0, 0, 8, zeros);
+    addFrame(0, 1000,   0x18FEF100, 1, 0, 3, empty);
+    // 200 us apart: a 1-byte delta
+    addFrame(0, 1500,   0x000,      0, 0, 0, 0);
+    addFrame(0, 1700,   0x001,      0, 0, 0, 0);
+    addFrame(1, 3000,   0x7FF,      0, 1, 2, 0);
+    addFrame(1, 5000,   0x1FFFFFFF, 1, 0, 8, ones);
+    // 70 ms on: a 3-byte delta, and back to device 0
+    addFrame(0, 75000,  0x456,      0, 0, 1, zeros);
+    addFrame(1, 80000,  0x0AA,      0, 0, 2, zeros + 4);
+
+    for (uint8_t i = 0; i < TEST_BURST; i++) {
+        uint8_t data = i;
+
+        addFrame(0, 100000 + 300 * i, 0x200 + i, 0, 0, 1, &data);
+    }
+
+    return;
+}
+
+// The candump line canlogdecode.py should give for a frame, without its time
+static void candumpLine(const testFrame *frame, char *line) {
+    const simFrame *sim = &frame->frame;
+
+    line += sprintf(line, "can%u ", frame->device);
+    line += sprintf(line, sim->extended ? "%08X#" : "%03X#", (unsigned)sim->id);
+    if (sim->remote) {
+        sprintf(line, "R");
+    } else {
+        for (uint8_t i = 0; i < sim->length; i++) {
+            line += sprintf(line, "%02X", sim->data[i]);
+        }
+    }
+
+    return;
+}
+
+// Microseconds from the end of the first frame to the end of "frame", where its INT falls
+static double frameEnd(const testFrame *frame) {
+    return frame->us + simFrameCycles(frame->device, &frame->frame) * 1e6 / F_CPU -
+           simFrameCycles(frames[0].device, &frames[0].frame) * 1e6 / F_CPU;
+}
+
+// The frames ahead of the burst one by one, then what the ring kept of the burst, in order
+static void checkDecoded(FILE *decoded) {
+    char     line[128];
+    char     expectedLine[64];
+    uint32_t next  = 0;
+    uint32_t burst = 0;
+
+    while (fgets(line, sizeof(line), decoded)) {
+        unsigned seconds;
+        unsigned micros;
+        char     rest[64];
+
+        CHECK(sscanf(line, "(%u.%u) %63[^\n]", &seconds, &micros, rest) == 3);
+
+        for (;;) {
+            CHECK(next < frameCount);
+            if (next >= frameCount) {
+                return;
+            }
+            candumpLine(&frames[next], expectedLine);
+            if (next < TEST_FRAMES - TEST_BURST || strcmp(expectedLine, rest) == 0) {
+                break;
+            }
+            next++;
+        }
+
+        double time = seconds * 1e6 + micros;
+
+        CHECK(strcmp(expectedLine, rest) == 0);
+        CHECK(time > frameEnd(&frames[next]) - TEST_SLACK);
+        CHECK(time < frameEnd(&frames[next]) + TEST_SLACK);
+
+        burst += next >= TEST_FRAMES - TEST_BURST;
+        next++;
+    }
+
+    CHECK(next >= TEST_FRAMES - TEST_BURST);
+    CHECK(burst > 0 && burst < TEST_BURST);
+
+    return;
+}
+
+static void checkLost(FILE *errors, uint32_t logged) {
+    char     line[128];
+    unsigned device;
+    unsigned lost;
+    uint8_t  records = 0;
+
+    while (fgets(line, sizeof(line), errors)) {
+        CHECK(sscanf(line, "can%u: %u frames lost", &device, &lost) == 2);
+        CHECK(device == 0);
+        CHECK(lost + logged == TEST_BURST);
+        records++;
+    }
+    CHECK(records == 1);
+
+    return;
+}
+
+static uint32_t countBurst(FILE *decoded) {
+    char     line[128];
+    uint32_t count = 0;
+
+    while (fgets(line, sizeof(line), decoded)) {
+        count += strstr(line, "can0 2") != 0;
+    }
+
+    return count;
+}
+
+static void decode(void) {
+    char  captureName[] = "/tmp/canlogXXXXXX";
+    char  command[256];
+    int   file = mkstemp(captureName);
+    FILE *decoded;
+    FILE *errors;
+
+    CHECK(file >= 0);
+    CHECK(write(file, capture, captureLength) == (ssize_t)captureLength);
+    close(file);
+
+    snprintf(command, sizeof(command),
+             "python3 tools/canlogdecode.py %s %s.log 2> %s.err", captureName, captureName, captureName);
+    CHECK(system(command) == 0);
+
+    snprintf(command, sizeof(command), "%s.log", captureName);
+    decoded = fopen(command, "r");
+    CHECK(decoded != 0);
+    snprintf(command, sizeof(command), "%s.err", captureName);
+    errors = fopen(command, "r");
+    CHECK(errors != 0);
+
+    if (decoded && errors) {
+        checkDecoded(decoded);
+        rewind(decoded);
+        checkLost(errors, countBurst(decoded));
+    }
+    if (decoded) {
+        fclose(decoded);
+    }
+    if (errors) {
+        fclose(errors);
+    }
+
+    unlink(captureName);
+    snprintf(command, sizeof(command), "%s.log", captureName);
+    unlink(command);
+    snprintf(command, sizeof(command), "%s.err", captureName);
+    unlink(command);
+
+    return;
+}
+
+int main(void) {
+    simFrame incoming[2][TEST_FRAMES];
+    uint32_t incomingCount[2] = {0, 0};
+
+    simInit();
+    for (uint8_t device = 0; device < 2; device++) {
+        simBitrate(device, TEST_BITRATE);
+        initController(device);
+        setAcceptanceFilters(device, 0, 0);
+        setMode(device, MODE_NORMAL);
+    }
+    simUartTransmitted = collectUart;
+    sei();
+
+    logStart();
+    buildTrace();
+
+    uint64_t start = simNow() + SIM_US(1000);
+
+    for (uint32_t i = 0; i < frameCount; i++) {
+        simFrame *frame = &incoming[frames[i].device][incomingCount[frames[i].device]++];
+
+        *frame      = frames[i].frame;
+        frame->time = start + SIM_US(frames[i].us);
+    }
+    simReceive(0, incoming[0], incomingCount[0]);
+    simReceive(1, incoming[1], incomingCount[1]);
+
+    // Nothing polled while the burst is on the bus
+    uint64_t burst = start + SIM_US(frames[TEST_FRAMES - TEST_BURST].us);
+    uint64_t end   = start + SIM_US(frames[frameCount - 1].us + 50000);
+
+    while (simNow() < end) {
+        if (simNow() < burst - SIM_US(1000) || simNow() > burst + SIM_US(300UL * TEST_BURST)) {
+            logPoll(0);
+            logPoll(1);
+        }
+        simRun(200);
+    }
+
+    decode();
+
+    return simTestDone("log");
+}
@@ -0,0 +1,225 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515registers.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Operation mode test, built with CAN_ERROR_MONITOR so a failed frame raises *
+ * MERRF. In Listen-only mode frames have to come in without an ACK and a     *
+ * frame written has to wait in its buffer until Normal mode sends it. In     *
+ * Loopback mode every frame written has to come back through canRead() as it *
+ * went in, without reaching the bus. In One-shot mode frames that meet an    *
+ * error frame have to be dropped, their buffers refilled from the transmit   *
+ * queue, and afterwards the driver must not think any of them still in       *
+ * flight; without One-shot mode the same error only delays the frame.        *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_FRAMES  4
+
+static simFrame incoming[TEST_FRAMES];
+static uint32_t transmittedIds[16];
+static uint8_t  transmitted;
+
+static void countTransmitted(uint8_t device, const simFrame *frame) {
+    CHECK(device == 0);
+
+    if (transmitted < sizeof(transmittedIds) / sizeof(transmittedIds[0])) {
+        transmittedIds[transmitted] = frame->id;
+    }
+    transmitted++;
+
+    return;
+}
+
+static void writeFrame(uint32_t id, uint8_t length) {
+    canFrame frame;
+
+    memset(&frame, 0, sizeof(frame));
+    canSetId(&frame, id);
+    canSetLength(&frame, length);
+    for (uint8_t i = 0; i < 8; i++) {
+        frame.data[i] = (uint8_t)id + i;
+    }
+    CHECK(canWrite(0, &frame, CAN_PRIORITY_LOW));
+
+    return;
+}
+
+static void receiveFrames(uint8_t count) {
+    memset(incoming, 0, sizeof(incoming));
+    for (uint8_t i = 0; i < count; i++) {
+        incoming[i].time   = simNow() + SIM_US(500UL * (i + 1));
+        incoming[i].id     = 0x400 + i;
+        incoming[i].length = 2;
+    }
+    simReceive(0, incoming, count);
+
+    return;
+}
+
+// SPI bytes it takes to receive and read one frame, with nothing to send
+static uint32_t receiveCost(void) {
+    canFrame frame;
+    uint32_t spiStart = simSpiBytes();
+
+    receiveFrames(1);
+    simRun(SIM_US(1000));
+    CHECK(canRead(0, &frame));
+    CHECK(canGetId(&frame) == 0x400);
+    CHECK(!canRead(0, &frame));
+
+    return simSpiBytes() - spiStart;
+}
+
+static void checkListenOnly(void) {
+    simCounters before;
+    simCounters after;
+    canFrame    frame;
+
+    CHECK(setMode(0, MODE_LISTEN));
+    CHECK(readMode(0) == MODE_LISTEN);
+
+    simReadCounters(0, &before);
+    writeFrame(0x321, 8);
+    receiveFrames(TEST_FRAMES);
+    simRun(SIM_US(500UL * (TEST_FRAMES + 2)));
+    simReadCounters(0, &after);
+
+    // Everything received, nothing acknowledged and nothing sent
+    for (uint8_t i = 0; i < TEST_FRAMES; i++) {
+        CHECK(canRead(0, &frame));
+        CHECK(canGetId(&frame) == 0x400U + i);
+    }
+    CHECK(!canRead(0, &frame));
+    CHECK(after.framesReceived - before.framesReceived == TEST_FRAMES);
+    CHECK(after.framesAcknowledged == before.framesAcknowledged);
+    CHECK(after.framesTransmitted == before.framesTransmitted);
+    CHECK(transmitted == 0);
+
+    // Back in Normal mode the frame goes out, and frames get their ACK again
+    CHECK(setMode(0, MODE_NORMAL));
+    simRun(SIM_US(1000));
+    CHECK(transmitted == 1 && transmittedIds[0] == 0x321);
+    receiveCost();
+    simReadCounters(0, &after);
+    CHECK(after.framesAcknowledged == before.framesAcknowledged + 1);
+
+    return;
+}
+
+static void checkLoopback(void) {
+    static const uint32_t ids[3]     = {0x123, 0x18DAF100UL | CAN_EXTENDED_FLAG, 0x7FF | CAN_RTR_FLAG};
+    static const uint8_t  lengths[3] = {3, 8, 4};
+    simCounters before;
+    simCounters after;
+    canFrame    frame;
+
+    CHECK(setMode(0, MODE_LOOPBACK));
+    CHECK(readMode(0) == MODE_LOOPBACK);
+    simReadCounters(0, &before);
+    transmitted = 0;
+
+    for (uint8_t i = 0; i < 3; i++) {
+        uint8_t length = (ids[i] & CAN_RTR_FLAG) ? 0 : lengths[i];
+
+        writeFrame(ids[i], lengths[i]);
+        simRun(SIM_US(1000));
+
+        CHECK(canRead(0, &frame));
+        CHECK(canGetId(&frame) == ids[i]);
+        CHECK(canGetLength(&frame) == length);
+        for (uint8_t byte = 0; byte < length; byte++) {
+            CHECK(frame.data[byte] == (uint8_t)(ids[i] + byte));
+        }
+        CHECK(!canRead(0, &frame));
+    }
+
+    // Nothing reached the bus, and nothing from the bus got in
+    receiveFrames(1);
+    simRun(SIM_US(1000));
+    CHECK(!canRead(0, &frame));
+    simReadCounters(0, &after);
+    CHECK(after.framesTransmitted - before.framesTransmitted == 3);
+    CHECK(after.framesMissed - before.framesMissed == 1);
+    CHECK(transmitted == 0);
+
+    CHECK(setMode(0, MODE_NORMAL));
+
+    return;
+}
+
+static void checkOneShot(uint32_t cost) {
+    setOneShot(0, 1);
+    CHECK(simChipRegister(0, CANCTRL) & (1<<OSM));
+    transmitted = 0;
+
+    // Three frames in the transmit buffers and three in the queue, all in
+    // place before anything goes out. The first three attempts fail, each
+    // dropping its frame and refilling its buffer from the queue, so three
+    // frames go out once each, at least one of them from the queue
+    CHECK(setMode(0, MODE_LISTEN));
+    for (uint8_t i = 0; i < 6; i++) {
+        writeFrame(0x200 + i, 8);
+    }
+    simTransmitErrors(0, 3);
+    CHECK(setMode(0, MODE_NORMAL));
+    simRun(SIM_US(5000));
+
+    uint8_t fromQueue = 0;
+
+    CHECK(transmitted == 3);
+    for (uint8_t i = 0; i < 3; i++) {
+        CHECK(transmittedIds[i] >= 0x200 && transmittedIds[i] <= 0x205);
+        fromQueue |= transmittedIds[i] >= 0x203;
+        for (uint8_t j = 0; j < i; j++) {
+            CHECK(transmittedIds[i] != transmittedIds[j]);
+        }
+    }
+    CHECK(fromQueue);
+    for (uint8_t buffer = 0; buffer < 3; buffer++) {
+        CHECK(!(simChipRegister(0, TXB0CTRL + 16 * buffer) & (1<<TXREQ)));
+    }
+
+    // No buffer is still down as in flight: receiving costs what it did
+    CHECK(receiveCost() == cost);
+
+    // And all three buffers take frames again
+    for (uint8_t i = 0; i < 4; i++) {
+        writeFrame(0x210 + i, 8);
+    }
+    simRun(SIM_US(5000));
+    CHECK(transmitted == 7);
+    CHECK(receiveCost() == cost);
+
+    // Without One-shot mode the failed frame is sent again
+    setOneShot(0, 0);
+    CHECK(!(simChipRegister(0, CANCTRL) & (1<<OSM)));
+    simTransmitErrors(0, 1);
+    writeFrame(0x220, 8);
+    simRun(SIM_US(2000));
+    CHECK(transmitted == 8 && transmittedIds[7] == 0x220);
+
+    return;
+}
+
+int main(void) {
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    simTransmitted = countTransmitted;
+    sei();
+
+    checkListenOnly();
+
+    uint32_t cost = receiveCost();
+
+    checkLoopback();
+    checkOneShot(cost);
+
+    return simTestDone("modes");
+}
@@ -0,0 +1,274 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "canmonitor.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Bus monitor test, built with CAN_MONITOR_IDS at 8 and CAN_TIMESTAMPS. Ten  *
+ * 100 ms windows of a known trace go past the monitor and the S and I lines  *
+ * it writes to the UART are checked window by window: frame counts, both     *
+ * loads, the gap figures and the untracked count. 0x100, 0x104 and 18DA00F1  *
+ * share one hash, so 0x104 and 18DA00F1 sit behind 0x100 when it goes quiet  *
+ * and is freed. From the fourth window on four new identifiers show up in    *
+ * each, 24 in all, which only fit in the table if the entries of the quiet   *
+ * ones are given up.                                                         *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_PERIOD  100       // ms
+#define TEST_WINDOWS 10
+#define TEST_FRAMES  64
+#define TEST_IDS     8         // I lines in one window at most
+#define TEST_EXT     0x18DA00F1UL
+
+typedef struct {
+    uint32_t id;
+    uint8_t  extended;
+    uint16_t frames;
+    uint32_t gap;              // Every gap in the window, 0 for "-"
+} testIdLine;
+
+typedef struct {
+    uint32_t   frames;
+    uint32_t   bits;
+    uint32_t   stuffBits;
+    uint8_t    ids;
+    testIdLine id[TEST_IDS];
+} testWindow;
+
+static simFrame   incoming[TEST_FRAMES];
+static uint32_t   incomingCount;
+static testWindow expected[TEST_WINDOWS];
+static char       output[16384];
+static uint32_t   outputLength;
+
+static void collectUart(uint8_t data) {
+    if (outputLength < sizeof(output) - 1) {
+        output[outputLength++] = data;
+    }
+
+    return;
+}
+
+// Adds a frame "ms" into the trace and counts it in its window
+static void addFrame(uint32_t ms, uint32_t id, uint8_t extended, uint8_t length) {
+    simFrame   *frame   = &incoming[incomingCount++];
+    testWindow *window  = &expected[ms / TEST_PERIOD];
+    uint8_t     stuffed = (extended ? 54 : 34) + 8 * length;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->time     = SIM_US(1000UL * ms);
+    frame->id       = id;
+    frame->extended = extended;
+    frame->length   = length;
+
+    window->frames++;
+    window->bits      += stuffed + 13;
+    window->stuffBits += (stuffed - 1) >> 2;
+
+    return;
+}
+
+static void expectId(uint8_t window, uint32_t id, uint8_t extended, uint16_t frames, uint32_t gap) {
+    testIdLine *line = &expected[window].id[expected[window].ids++];
+
+    line->id       = id;
+    line->extended = extended;
+    line->frames   = frames;
+    line->gap      = gap;
+
+    return;
+}
+
+static int compareTimes(const void *a, const void *b) {
+    const simFrame *first  = a;
+    const simFrame *second = b;
+
+    return (first->time > second->time) - (first->time < second->time);
+}
+
+static void buildTrace(void) {
+    // Window 0: all three of one hash
+    for (uint8_t i = 0; i < 10; i++) {
+        addFrame(5 + 10 * i, 0x100, 0, 8);
+        if (i < 5) {
+            addFrame(7 + 20 * i, 0x104, 0, 0);
+            addFrame(9 + 20 * i, TEST_EXT, 1, 2);
+        }
+    }
+    expectId(0, 0x100, 0, 10, 10000);
+    expectId(0, 0x104, 0, 5, 20000);
+    expectId(0, TEST_EXT, 1, 5, 20000);
+
+    // Window 1: 0x100 quiet, so its entry goes with the next snapshot
+    addFrame(107, 0x104, 0, 0);
+    addFrame(109, TEST_EXT, 1, 2);
+    addFrame(127, 0x104, 0, 0);
+    expectId(1, 0x104, 0, 2, 20000);
+    expectId(1, TEST_EXT, 1, 1, 20000);
+
+    // Window 2: 0x104 still found past the freed entry, gap and all
+    addFrame(205, 0x104, 0, 0);
+    expectId(2, 0x104, 0, 1, 78000);
+
+    for (uint8_t window = 3; window < 9; window++) {
+        for (uint8_t i = 0; i < 4; i++) {
+            uint32_t id = 0x400 + 4 * window + i;
+
+            addFrame(TEST_PERIOD * window + 30 + 10 * i, id, 0, 4);
+            expectId(window, id, 0, 1, 0);
+        }
+    }
+
+    // Window 9: 0x100 back, with no gap from its frames of window 0
+    addFrame(905, 0x100, 0, 8);
+    addFrame(915, 0x100, 0, 8);
+    expectId(9, 0x100, 0, 2, 10000);
+
+    qsort(incoming, incomingCount, sizeof(incoming[0]), compareTimes);
+
+    return;
+}
+
+static uint32_t loadPermille(uint32_t bits) {
+    return (uint32_t)((uint64_t)bits * 1000000000ULL / ((uint64_t)TEST_BITRATE * TEST_PERIOD * 1000UL));
+}
+
+static uint8_t loadMatches(const char *field, uint32_t bits) {
+    uint32_t whole;
+    uint32_t tenth;
+
+    if (sscanf(field, "%u.%u", &whole, &tenth) != 2) {
+        return 0;
+    }
+
+    int32_t difference = (int32_t)(whole * 10 + tenth) - (int32_t)loadPermille(bits);
+
+    // The window runs a poll late at most
+    return difference >= -1 && difference <= 0;
+}
+
+static uint8_t gapMatches(uint32_t gap, uint32_t expected) {
+    return gap + 4 >= expected && gap <= expected + 4;
+}
+
+static void checkIdLine(const testWindow *window, const char *line, uint8_t *seen) {
+    char     idText[16];
+    char     gapText[3][16];
+    unsigned frames;
+
+    CHECK(sscanf(line, "I %15s %u %15s %15s %15s", idText, &frames, gapText[0], gapText[1],
+                 gapText[2]) == 5);
+
+    uint32_t id = strtoul(idText, 0, 16);
+
+    for (uint8_t i = 0; i < window->ids; i++) {
+        const testIdLine *expectedLine = &window->id[i];
+
+        if (expectedLine->id != id) {
+            continue;
+        }
+
+        CHECK(!seen[i]);
+        seen[i] = 1;
+        CHECK(strlen(idText) == (expectedLine->extended ? 8 : 3));
+        CHECK(frames == expectedLine->frames);
+        for (uint8_t gap = 0; gap < 3; gap++) {
+            if (expectedLine->gap) {
+                CHECK(gapMatches(strtoul(gapText[gap], 0, 10), expectedLine->gap));
+            } else {
+                CHECK(strcmp(gapText[gap], "-") == 0);
+            }
+        }
+        return;
+    }
+
+    // Not an identifier of this window
+    CHECK(0);
+
+    return;
+}
+
+static void checkOutput(void) {
+    uint8_t windows = 0;
+    uint8_t seen[TEST_IDS];
+    char   *line = strtok(output, "\n");
+
+    while (line) {
+        if (line[0] == 'S') {
+            CHECK(windows < TEST_WINDOWS);
+            if (windows) {
+                for (uint8_t i = 0; i < expected[windows - 1].ids; i++) {
+                    CHECK(seen[i]);
+                }
+            }
+
+            const testWindow *window = &expected[windows < TEST_WINDOWS ? windows : 0];
+            unsigned          ms;
+            unsigned          frames;
+            unsigned          untracked;
+            unsigned          lost;
+            char              load[16];
+            char              worst[16];
+
+            CHECK(sscanf(line, "S %u %u %15s %15s %u %u", &ms, &frames, load, worst, &untracked,
+                         &lost) == 6);
+            CHECK(ms == TEST_PERIOD);
+            CHECK(frames == window->frames);
+            CHECK(loadMatches(load, window->bits));
+            CHECK(loadMatches(worst, window->bits + window->stuffBits));
+            CHECK(untracked == 0);
+            CHECK(lost == 0);
+
+            memset(seen, 0, sizeof(seen));
+            windows++;
+        } else {
+            CHECK(line[0] == 'I' && windows);
+            checkIdLine(&expected[windows - 1], line, seen);
+        }
+        line = strtok(0, "\n");
+    }
+
+    CHECK(windows == TEST_WINDOWS);
+    for (uint8_t i = 0; i < expected[TEST_WINDOWS - 1].ids; i++) {
+        CHECK(seen[i]);
+    }
+
+    return;
+}
+
+int main(void) {
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    simUartTransmitted = collectUart;
+    sei();
+
+    buildTrace();
+
+    CHECK(monitorStart(0, TEST_PERIOD));
+
+    uint64_t start = simNow();
+
+    for (uint32_t i = 0; i < incomingCount; i++) {
+        incoming[i].time += start;
+    }
+    simReceive(0, incoming, incomingCount);
+
+    uint64_t end = start + SIM_US(1000UL * TEST_PERIOD * TEST_WINDOWS + 50000);
+
+    while (simNow() < end) {
+        monitorPoll();
+        simRun(200);
+    }
+
+    output[outputLength] = 0;
+    checkOutput();
+
+    return simTestDone("monitor");
+}
@@ -0,0 +1,204 @@
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Frame pool test, built with CAN_FRAME_POOL at 8. Frames that arrive with   *
+ * every slot taken have to count as ring overruns; frames read with          *
+ * canReadSlot() and sent on with canWriteSlot() have to come out unchanged   *
+ * and give their slots back once transmitted. canFreeSlot() has to turn down *
+ * slot numbers past the pool and a second free of a slot, with every slot    *
+ * already free or with others still taken, and initController() has to give  *
+ * back the slots of frames left unread or queued. After each case the pool   *
+ * has to hand out exactly its 8 slots again, so nothing leaked and nothing   *
+ * was freed twice.                                                           *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_POOL    8
+#define TEST_FRAMES  6
+
+static simFrame incoming[TEST_FRAMES];
+static uint32_t transmitted;
+static uint32_t stray;
+
+static void checkTransmitted(uint8_t device, const simFrame *frame) {
+    CHECK(device == 0);
+    CHECK(transmitted < TEST_FRAMES / 2);
+    if (transmitted < TEST_FRAMES / 2) {
+        const simFrame *sent = &incoming[TEST_FRAMES / 2 + transmitted];
+
+        CHECK(frame->id == sent->id + 0x100);
+        CHECK(frame->length == sent->length);
+        CHECK(memcmp(frame->data, sent->data, sent->length) == 0);
+    }
+    transmitted++;
+
+    return;
+}
+
+static void countStray(uint8_t device, const simFrame *frame) {
+    (void)device;
+    (void)frame;
+
+    stray++;
+
+    return;
+}
+
+// Takes every slot, checks they are the pool's 8 and that there is no 9th
+static void takeAll(uint8_t *slots) {
+    uint8_t taken = 0;
+
+    for (uint8_t i = 0; i < TEST_POOL; i++) {
+        slots[i] = canAllocSlot();
+        CHECK(slots[i] < TEST_POOL);
+        if (slots[i] < TEST_POOL) {
+            CHECK(!(taken & (1 << slots[i])));
+            taken |= 1 << slots[i];
+        }
+    }
+    CHECK(canAllocSlot() == CAN_NO_SLOT);
+
+    return;
+}
+
+static void freeAll(const uint8_t *slots) {
+    for (uint8_t i = 0; i < TEST_POOL; i++) {
+        CHECK(canFreeSlot(slots[i]));
+    }
+
+    return;
+}
+
+// The whole pool is free: every slot can be taken, and given back
+static void checkBalanced(void) {
+    uint8_t slots[TEST_POOL];
+
+    takeAll(slots);
+    freeAll(slots);
+
+    return;
+}
+
+static void receive(uint8_t first, uint8_t count) {
+    uint64_t start = simNow() + SIM_US(500);
+
+    for (uint8_t i = first; i < first + count; i++) {
+        memset(&incoming[i], 0, sizeof(incoming[i]));
+        incoming[i].time    = start + SIM_US(1000UL * (i - first));
+        incoming[i].id      = 0x300 + i;
+        incoming[i].length  = 1 + i;
+        for (uint8_t byte = 0; byte < incoming[i].length; byte++) {
+            incoming[i].data[byte] = i * 0x10 + byte;
+        }
+    }
+    simReceive(0, incoming + first, count);
+    simRun(SIM_US(1000UL * count + 2000));
+
+    return;
+}
+
+int main(void) {
+    canOverflowCounters overflow;
+    uint8_t  slots[TEST_POOL];
+    uint8_t  slot;
+    uint32_t timestamp;
+
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    simTransmitted = checkTransmitted;
+    sei();
+
+    checkBalanced();
+
+    // Stray and extra frees are turned down and leave the pool whole
+    CHECK(!canFreeSlot(TEST_POOL));
+    CHECK(!canFreeSlot(CAN_NO_SLOT));
+    CHECK(!canFreeSlot(0));
+    checkBalanced();
+
+    // Frames that find the pool empty are ring overruns
+    readOverflowCounters(0, &overflow, 1);
+    takeAll(slots);
+    receive(0, TEST_FRAMES / 2);
+    CHECK(!canReadSlot(0, &slot, &timestamp));
+    readOverflowCounters(0, &overflow, 1);
+    CHECK(overflow.ringOverrun == TEST_FRAMES / 2);
+    CHECK(overflow.rxOverflow[0] == 0 && overflow.rxOverflow[1] == 0);
+    freeAll(slots);
+    checkBalanced();
+
+    // Received into slots, sent on from them, and the slots come back
+    receive(TEST_FRAMES / 2, TEST_FRAMES / 2);
+    for (uint8_t i = TEST_FRAMES / 2; i < TEST_FRAMES; i++) {
+        CHECK(canReadSlot(0, &slot, &timestamp));
+        CHECK(slot < TEST_POOL);
+
+        canFrame *frame = canSlotFrame(slot);
+
+        CHECK(canGetId(frame) == incoming[i].id);
+        CHECK(canGetLength(frame) == incoming[i].length);
+        CHECK(memcmp(frame->data, incoming[i].data, incoming[i].length) == 0);
+
+        canSetId(frame, incoming[i].id + 0x100);
+        CHECK(canWriteSlot(0, slot, CAN_PRIORITY_LOW));
+    }
+    CHECK(!canReadSlot(0, &slot, &timestamp));
+    simRun(SIM_US(2000));
+    CHECK(transmitted == TEST_FRAMES / 2);
+    readOverflowCounters(0, &overflow, 1);
+    CHECK(overflow.ringOverrun == 0);
+    checkBalanced();
+
+    // One free more than was taken is turned down
+    slot = canAllocSlot();
+    CHECK(canFreeSlot(slot));
+    CHECK(!canFreeSlot(slot));
+    checkBalanced();
+
+    // So is a second free of a slot while another one is still taken
+    slot = canAllocSlot();
+
+    uint8_t other = canAllocSlot();
+
+    CHECK(canFreeSlot(slot));
+    CHECK(!canFreeSlot(slot));
+    CHECK(canFreeSlot(other));
+    checkBalanced();
+
+    // A re-init gives back the slots of unread and still queued frames
+    receive(0, TEST_FRAMES / 2);
+    simTransmitted = countStray;
+    for (uint8_t i = 0; i < TEST_FRAMES; i++) {
+        canFrame frame;
+
+        memset(&frame, 0, sizeof(frame));
+        canSetId(&frame, 0x500 + i);
+        CHECK(canWrite(0, &frame, CAN_PRIORITY_LOW));
+    }
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    CHECK(!canReadSlot(0, &slot, &timestamp));
+    checkBalanced();
+
+    // Nothing from before the re-init is still in flight
+    simRun(SIM_US(2000));
+    stray = 0;
+    slot  = canAllocSlot();
+    memset(canSlotFrame(slot), 0, sizeof(canFrame));
+    canSetId(canSlotFrame(slot), 0x600);
+    CHECK(canWriteSlot(0, slot, CAN_PRIORITY_LOW));
+    simRun(SIM_US(2000));
+    CHECK(stray == 1);
+    checkBalanced();
+
+    return simTestDone("pool");
+}
@@ -0,0 +1,36 @@
+#ifndef _SIMTEST_H_
+#define _SIMTEST_H_
+
+#include <stdio.h>
+
+/******************************************************************************
+ * Sim tests ("make simtest"). Each test is a program of its own, built with  *
+ * the driver options it covers against the simulated MCP2515s                *
+ * (mcp2515sim.h). CHECK() reports a failed condition and carries on;         *
+ * simTestDone() prints the summary line and gives the exit status.           *
+ ******************************************************************************/
+static unsigned simTestChecks;
+static unsigned simTestFailures;
+
+static void simTestFail(const char *file, int line, const char *condition) {
+    simTestFailures++;
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, condition);
+
+    return;
+}
+
+#define CHECK(condition) do {                                        \
+        simTestChecks++;                                             \
+        if (!(condition)) {                                          \
+            simTestFail(__FILE__, __LINE__, #condition);             \
+        }                                                            \
+    } while (0)
+
+static int simTestDone(const char *name) {
+    printf("%s: %u checks, %u failed\n", name, simTestChecks, simTestFailures);
+
+    return simTestFailures != 0;
+}
+
+
+#endif
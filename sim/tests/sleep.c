@@ -0,0 +1,87 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "mcp2515.h"
+#include "mcp2515sim.h"
+#include "simtest.h"
+
+/******************************************************************************
+ * Sleep test, built with CAN_SLEEP. canSleep() is called with the first of   *
+ * three frames due on the bus 10 ms later. That frame has to wake the        *
+ * MCP2515 and the CPU and be lost; canSleep() has to return straight after   *
+ * it, with the device back in the mode it went to sleep from and INT back on *
+ * the falling edge, so the next two frames come in through the ring buffer   *
+ * as usual. Called with interrupts disabled, it has to return with them      *
+ * still disabled.                                                            *
+ ******************************************************************************/
+#define TEST_BITRATE 500000UL
+#define TEST_WAKE_US 10000
+
+static simFrame frames[3];
+
+static void sleepCase(uint8_t mode, uint32_t firstId, uint8_t interrupts) {
+    simCounters before;
+    simCounters after;
+    canFrame    frame;
+    uint64_t    wake = simNow() + SIM_US(TEST_WAKE_US);
+
+    setMode(0, mode);
+    for (uint8_t i = 0; i < 3; i++) {
+        memset(&frames[i], 0, sizeof(frames[i]));
+        frames[i].time    = wake + SIM_US(1000UL * i);
+        frames[i].id      = firstId + i;
+        frames[i].length  = 2;
+        frames[i].data[0] = i;
+        frames[i].data[1] = 0x5A;
+    }
+    simReadCounters(0, &before);
+    simReceive(0, frames, 3);
+
+    if (!interrupts) {
+        cli();
+    }
+    CHECK(canSleep(0) == 1);
+    CHECK(!(SREG & (1<<SREG_I)) == !interrupts);
+    sei();
+
+    // Back once the wake-up frame is over and the INT handler has run
+    uint64_t woken = frames[0].time + simFrameCycles(0, &frames[0]);
+
+    CHECK(simNow() >= woken);
+    CHECK(simNow() < woken + SIM_US(500));
+    CHECK(readMode(0) == mode);
+    CHECK((EICRA & ((1<<ISC01) | (1<<ISC00))) == (1<<ISC01));
+
+    simRun(SIM_US(3000));
+    simReadCounters(0, &after);
+    CHECK(after.framesMissed - before.framesMissed == 1);
+    CHECK(after.framesReceived - before.framesReceived == 2);
+
+    for (uint8_t i = 1; i < 3; i++) {
+        CHECK(canRead(0, &frame));
+        CHECK(canGetId(&frame) == firstId + i);
+        CHECK(canGetLength(&frame) == 2);
+        CHECK(frame.data[0] == i);
+    }
+    CHECK(!canRead(0, &frame));
+
+    return;
+}
+
+int main(void) {
+    simInit();
+    simBitrate(0, TEST_BITRATE);
+    initController(0);
+    setAcceptanceFilters(0, 0, 0);
+    setMode(0, MODE_NORMAL);
+    sei();
+
+    sleepCase(MODE_NORMAL, 0x100, 1);
+    sleepCase(MODE_NORMAL, 0x200, 1);
+    sleepCase(MODE_LISTEN, 0x300, 1);
+    sleepCase(MODE_NORMAL, 0x400, 0);
+
+    return simTestDone("sleep");
+}
@@ -0,0 +1,31 @@
+#ifndef _SIM_UTIL_ATOMIC_H_
+#define _SIM_UTIL_ATOMIC_H_
+
+#include <avr/interrupt.h>
+
+/******************************************************************************
+ * Host stand-in for <util/atomic.h>, built the same way as avr-libc's: the   *
+ * I bit is cleared on entry and a cleanup handler restores it on every way   *
+ * out of the block.                                                          *
+ ******************************************************************************/
+static inline uint8_t simAtomicEnter(void) {
+    cli();
+    return 1;
+}
+
+static inline void simAtomicRestore(const uint8_t *sreg) {
+    SREG = *sreg;
+}
+
+static inline void simAtomicForceOn(const uint8_t *sreg) {
+    (void)sreg;
+    sei();
+}
+
+#define ATOMIC_BLOCK(type) for (type, simAtomicOnce_ = simAtomicEnter(); simAtomicOnce_; simAtomicOnce_ = 0)
+
+#define ATOMIC_RESTORESTATE uint8_t simAtomicSreg_ __attribute__((__cleanup__(simAtomicRestore))) = SREG
+#define ATOMIC_FORCEON      uint8_t simAtomicSreg_ __attribute__((__cleanup__(simAtomicForceOn))) = 0
+
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _SIM_UTIL_DELAY_H_
+#define _SIM_UTIL_DELAY_H_
+
+/******************************************************************************
+ * Host stand-in for <util/delay.h>: a busy wait lets simulated time pass.    *
+ ******************************************************************************/
+void simDelayUs(double us);
+
+#define _delay_us(us) simDelayUs(us)
+#define _delay_ms(ms) simDelayUs((ms) * 1000.0)
+
+
+#endif
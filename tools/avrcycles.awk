@@ -0,0 +1,77 @@
+# Static cycle counts from "avr-objdump -d" output, one line per function.
+#
+#   avr-objdump -d mcp2515.elf | awk -v functions="sendData canRead" -f tools/avrcycles.awk
+#
+# "cycles" adds up every instruction of the function once, at the ATmega328
+# (AVRe+) timings with branches and skips not taken, so it is the cost of
+# the straight-line path. "loops" counts the backward branches; their bodies
+# run once in "cycles" and have to be multiplied out by hand. Functions that
+# were inlined or dropped by --gc-sections are reported as "inlined".
+
+function hex(text,    value, i) {
+    value = 0
+    text  = tolower(text)
+    gsub(/[ :]/, "", text)
+    sub(/^0x/, "", text)
+    for (i = 1; i <= length(text); i++) {
+        value = value * 16 + index("0123456789abcdef", substr(text, i, 1)) - 1
+    }
+    return value
+}
+
+BEGIN {
+    # Everything not listed takes one cycle
+    split("adiw sbiw mul muls mulsu fmul fmuls fmulsu ld ldd st std lds sts " \
+          "push pop rjmp ijmp sbi cbi", two, " ")
+    split("rcall icall lpm elpm jmp", three, " ")
+    split("call ret reti", four, " ")
+    for (i in two)   cost[two[i]]   = 2
+    for (i in three) cost[three[i]] = 3
+    for (i in four)  cost[four[i]]  = 4
+
+    count = split(functions, wanted, " ")
+    printf "%-24s %6s %6s %7s %6s\n", "function", "insns", "bytes", "cycles", "loops"
+}
+
+# "00000080 <sendData>:" starts a function
+/^[0-9a-f]+ <[^>]+>:$/ {
+    name = $2
+    gsub(/[<>:]/, "", name)
+    sub(/\..*/, "", name)              # LTO clones: sendData.lto_priv.0
+    start[name] = hex($1)
+    next
+}
+
+# "  84:	07 fe       	sbrs	r0, 7"
+/^ +[0-9a-f]+:\t/ && name != "" {
+    n = split($0, column, "\t")
+    if (n < 3) {
+        next
+    }
+    op = column[3]
+    gsub(/ /, "", op)
+
+    insns[name]++
+    bytes[name]  += split(column[2], encoding, " ")
+    cycles[name] += (op in cost) ? cost[op] : 1
+
+    # Relative branches and jumps name their target after ";"
+    if ((op ~ /^br/ || op == "rjmp") && match($0, /; 0x[0-9a-f]+/)) {
+        target = hex(substr($0, RSTART + 2, RLENGTH - 2))
+        here   = hex(column[1])
+        if (target <= here && target >= start[name]) {
+            loops[name]++
+        }
+    }
+}
+
+END {
+    for (i = 1; i <= count; i++) {
+        f = wanted[i]
+        if (f in insns) {
+            printf "%-24s %6d %6d %7d %6d\n", f, insns[f], bytes[f], cycles[f], loops[f]
+        } else {
+            printf "%-24s %6s\n", f, "inlined"
+        }
+    }
+}
@@ -0,0 +1,272 @@
+#!/usr/bin/env python3
+"""Generates candbc.h, inline signal decoders and encoders, from a DBC file.
+
+    tools/candbcgen.py powertrain.dbc [message ...] > candbc.h
+
+Only the BO_ (message) and SG_ (signal) lines of the DBC are read:
+
+    BO_ 2364539904 EEC1: 8 Engine
+     SG_ EngineSpeed : 24|16@1+ (0.125,0) [0|8031.875] "rpm" Vector__XXX
+
+Naming messages on the command line generates only those, so an
+application gets decoders for just the messages it subscribes to, and
+dbcMessageIds[] lists them for setAcceptanceFilters().
+
+Every signal becomes a decode and an encode function with the start bit,
+length and byte order folded into constant shifts and masks, one term
+per data byte the signal touches, so the cost of a decode is known from
+the definition alone and nothing walks a table at run time. They work
+on the raw value, in the smallest integer type that holds it; FACTOR
+and OFFSET turn it into the physical value (DBC_PHYSICAL()). A filter
+handler picks its messages out by packed identifier:
+
+    if (canFramePackedId(frame) == EEC1_PACKED) {
+        engineSpeed = decodeEec1EngineSpeed(frame->data);
+    }
+"""
+
+import re
+import sys
+
+EXTENDED = 0x80000000
+EXIDE = 0x08
+
+MESSAGE = re.compile(r"BO_\s+(\d+)\s+(\w+)\s*:\s*(\d+)\s+\w+")
+SIGNAL = re.compile(r"SG_\s+(\w+)\s*(M|m\d+)?\s*:\s*(\d+)\|(\d+)@([01])([+-])\s*"
+                    r"\(([^,]+),([^)]+)\)\s*\[([^|]*)\|([^\]]*)\]\s*\"([^\"]*)\"")
+
+
+def pack(identifier):
+    if identifier & EXTENDED:
+        value = identifier & 0x1FFFFFFF
+        sid, eid = value >> 18, value & 0x3FFFF
+        sidl = ((sid & 0x07) << 5) | EXIDE | (eid >> 16)
+        return (sid >> 3) | (sidl << 8) | (((eid >> 8) & 0xFF) << 16) | ((eid & 0xFF) << 24)
+    return (identifier >> 3) | ((identifier & 0x07) << 13)
+
+
+def parse(path):
+    messages = []
+    with open(path) as file:
+        for number, line in enumerate(file, 1):
+            text = line.strip()
+            match = MESSAGE.match(text)
+            if match:
+                messages.append({
+                    "id": int(match.group(1)),
+                    "name": match.group(2),
+                    "length": int(match.group(3)),
+                    "signals": [],
+                })
+                continue
+            if not text.startswith("SG_"):
+                continue
+            match = SIGNAL.match(text)
+            if not match or not messages:
+                sys.exit("%s:%d: cannot read signal" % (path, number))
+            signal = {
+                "name": match.group(1),
+                "multiplex": match.group(2),
+                "start": int(match.group(3)),
+                "length": int(match.group(4)),
+                "motorola": match.group(5) == "0",
+                "signed": match.group(6) == "-",
+                "factor": match.group(7).strip(),
+                "offset": match.group(8).strip(),
+                "unit": match.group(11),
+            }
+            try:
+                signal["bits"] = bit_positions(signal, messages[-1]["length"])
+            except ValueError as error:
+                sys.exit("%s:%d: %s" % (path, number, error))
+            messages[-1]["signals"].append(signal)
+    return messages
+
+
+def bit_positions(signal, length):
+    """Data bit (byte * 8 + bit) of every signal bit, least significant first."""
+    if not 1 <= signal["length"] <= 32:
+        raise ValueError("signal %s is not 1 to 32 bits" % signal["name"])
+    bits = []
+    position = signal["start"]
+    for _ in range(signal["length"]):
+        bits.append(position)
+        if signal["motorola"]:
+            # Big-endian: from the most significant bit down, bit 7 of the next byte after bit 0
+            position = position + 15 if position % 8 == 0 else position - 1
+        else:
+            position += 1
+    if signal["motorola"]:
+        bits.reverse()
+    if max(bits) >= length * 8:
+        raise ValueError("signal %s does not fit %d data bytes" % (signal["name"], length))
+    return bits
+
+
+def chunks(bits):
+    """(byte, lowest bit in the byte, bit count, lowest value bit) per data byte."""
+    result = []
+    for value_bit, position in enumerate(bits):
+        byte, bit = divmod(position, 8)
+        if result and result[-1][0] == byte and result[-1][1] + result[-1][2] == bit:
+            result[-1][2] += 1
+        else:
+            result.append([byte, bit, 1, value_bit])
+    return result
+
+
+def raw_type(signal):
+    for width in (8, 16, 32):
+        if signal["length"] <= width:
+            return "%sint%d_t" % ("" if signal["signed"] else "u", width), width
+
+
+def camel(name):
+    parts = [p for p in re.split(r"_+", name) if p]
+    if len(parts) > 1 or name.isupper():
+        return "".join(p[0].upper() + p[1:].lower() for p in parts)
+    return name[0].upper() + name[1:]
+
+
+def macro(name):
+    return re.sub(r"(?<=[a-z0-9])(?=[A-Z])", "_", name).upper()
+
+
+def decoder(message, signal):
+    ctype, width = raw_type(signal)
+    utype = "uint%d_t" % width
+    name = camel(message["name"]) + camel(signal["name"])
+    terms = []
+    for byte, bit, count, value_bit in chunks(signal["bits"]):
+        term = "data[%d]" % byte
+        if bit:
+            term = "(%s >> %d)" % (term, bit)
+        if bit + count < 8:
+            term = "(%s & 0x%02X)" % (term, (1 << count) - 1)
+        if width > 8 and value_bit + count > 8:
+            term = "(%s)%s" % (utype, term)
+        if value_bit:
+            term = "(%s << %d)" % (term, value_bit)
+        terms.append(term)
+
+    lines = ["CAN_INLINE %s decode%s(const uint8_t *data) {" % (ctype, name)]
+    if signal["signed"] and signal["length"] < width:
+        head, tail = "    %s raw = " % utype, ";"
+    elif len(terms) > 1:
+        head, tail = "    return (%s)(" % ctype, ");"
+    else:
+        head, tail = "    return ", ";"
+    lines.append(head + (" |\n" + " " * len(head)).join(terms) + tail)
+    if signal["signed"] and signal["length"] < width:
+        sign = 1 << (signal["length"] - 1)
+        lines.append("")
+        lines.append("    // Sign extension")
+        lines.append("    return (%s)((raw ^ 0x%X) - 0x%X);" % (ctype, sign, sign))
+    lines.append("}")
+    return name, lines
+
+
+def encoder(message, signal):
+    ctype, width = raw_type(signal)
+    utype = "uint%d_t" % width
+    name = camel(message["name"]) + camel(signal["name"])
+    lines = ["CAN_INLINE void encode%s(uint8_t *data, %s value) {" % (name, ctype)]
+    if signal["signed"]:
+        lines.append("    %s raw = (%s)value;" % (utype, utype))
+        lines.append("")
+        source = "raw"
+    else:
+        source = "value"
+    for byte, bit, count, value_bit in chunks(signal["bits"]):
+        mask = ((1 << count) - 1) << bit
+        part = source
+        if value_bit:
+            part = "(%s >> %d)" % (part, value_bit)
+        part = "(uint8_t)%s" % part
+        if bit:
+            part = "(%s << %d)" % (part, bit)
+        if mask == 0xFF:
+            lines.append("    data[%d] = %s;" % (byte, part))
+        else:
+            lines.append("    data[%d] = (data[%d] & 0x%02X) | (%s & 0x%02X);" % (byte, byte, ~mask & 0xFF, part, mask))
+    lines.append("")
+    lines.append("    return;")
+    lines.append("}")
+    return lines
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: candbcgen.py file.dbc [message ...]")
+
+    messages = parse(sys.argv[1])
+    wanted = sys.argv[2:]
+    known = set(m["name"] for m in messages)
+    for name in wanted:
+        if name not in known:
+            sys.exit("%s: no message %s" % (sys.argv[1], name))
+    if wanted:
+        messages = [m for m in messages if m["name"] in wanted]
+
+    print("// Generated by tools/candbcgen.py from %s, do not edit" % sys.argv[1])
+    print("#ifndef _CANDBC_H_")
+    print("#define _CANDBC_H_")
+    print()
+    print("#include <stdint.h>")
+    print('#include "mcp2515.h"')
+    print()
+    print("// Physical value of a raw signal value, e.g. DBC_PHYSICAL(EEC1_ENGINE_SPEED, raw)")
+    print("#define DBC_PHYSICAL(signal, raw) ((raw) * signal##_FACTOR + signal##_OFFSET)")
+    print()
+    print("#define DBC_MESSAGE_COUNT %d" % len(messages))
+    print()
+    print("// Identifiers of the messages below, as setAcceptanceFilters() takes them")
+    print("static const uint32_t dbcMessageIds[%s] = {" % ("DBC_MESSAGE_COUNT" if messages else "1"))
+    for message in messages:
+        flag = " | CAN_EXTENDED_FLAG" if message["id"] & EXTENDED else ""
+        print("    0x%XUL%s,  // %s" % (message["id"] & 0x1FFFFFFF, flag, message["name"]))
+    if not messages:
+        print("    0")
+    print("};")
+
+    for message in messages:
+        prefix = macro(camel(message["name"]))
+        standard = not message["id"] & EXTENDED
+        print()
+        print("/" + "*" * 78)
+        title = " * %s, %s identifier 0x%X, %d bytes" % (
+            message["name"], "standard" if standard else "extended", message["id"] & 0x1FFFFFFF,
+            message["length"])
+        print(title.ljust(77) + " *")
+        print(" " + "*" * 78 + "/")
+        print("#define %s_ID     (0x%XUL%s)" % (prefix, message["id"] & 0x1FFFFFFF,
+                                                "" if standard else " | CAN_EXTENDED_FLAG"))
+        print("#define %s_PACKED 0x%08XUL" % (prefix, pack(message["id"])))
+        print("#define %s_LENGTH %d" % (prefix, message["length"]))
+        for signal in message["signals"]:
+            name, decode = decoder(message, signal)
+            signal_macro = prefix + "_" + macro(camel(signal["name"]))
+            print()
+            order = "big-endian (Motorola)" if signal["motorola"] else "little-endian (Intel)"
+            note = ""
+            if signal["multiplex"] == "M":
+                note = ", multiplexer"
+            elif signal["multiplex"]:
+                note = ", present when the multiplexer is %s" % signal["multiplex"][1:]
+            print("// %s: start bit %d, %d bit%s %s, %s%s%s" % (
+                signal["name"], signal["start"], signal["length"], "s" if signal["length"] > 1 else "", order,
+                "signed" if signal["signed"] else "unsigned",
+                ", " + signal["unit"] if signal["unit"] else "", note))
+            print("#define %s_FACTOR (%s)" % (signal_macro, signal["factor"]))
+            print("#define %s_OFFSET (%s)" % (signal_macro, signal["offset"]))
+            print()
+            print("\n".join(decode))
+            print()
+            print("\n".join(encoder(message, signal)))
+    print()
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
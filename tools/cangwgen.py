@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+"""Generates cangatewayroutes.h, the gateway routing table, from a route file.
+
+    tools/cangwgen.py gateway.routes > cangatewayroutes.h
+
+One route per line, "#" starts a comment:
+
+    source identifier destination [rewrite=identifier] [interval=ms]
+                                  [priority=0-3] [local]
+
+Identifiers are hexadecimal as candump prints them: up to three digits
+for a standard frame, eight for an extended one. The routes come out
+sorted by packed identifier (the SIDH..EID0 bytes read as a
+little-endian 32-bit word, see canPackId() in mcp2515.h), which is the
+order gatewayForward() searches them in.
+"""
+
+import sys
+
+EXIDE = 0x08
+
+
+def parse_identifier(text):
+    value = int(text, 16)
+    extended = len(text) > 3
+    limit = 0x1FFFFFFF if extended else 0x7FF
+    if value > limit:
+        raise ValueError("identifier %s out of range" % text)
+    return value, extended
+
+
+def pack(value, extended):
+    if extended:
+        sid, eid = value >> 18, value & 0x3FFFF
+        sidl = ((sid & 0x07) << 5) | EXIDE | (eid >> 16)
+        return (sid >> 3) | (sidl << 8) | (((eid >> 8) & 0xFF) << 16) | ((eid & 0xFF) << 24)
+    return (value >> 3) | ((value & 0x07) << 13)
+
+
+def parse(path):
+    routes = []
+    with open(path) as file:
+        for number, line in enumerate(file, 1):
+            fields = line.split("#", 1)[0].split()
+            if not fields:
+                continue
+            try:
+                if len(fields) < 3:
+                    raise ValueError("expected source, identifier and destination")
+                route = {
+                    "source": int(fields[0]),
+                    "id": parse_identifier(fields[1]),
+                    "destination": int(fields[2]),
+                    "rewrite": None,
+                    "interval": 0,
+                    "priority": 1,
+                    "local": False,
+                }
+                for option in fields[3:]:
+                    key, _, value = option.partition("=")
+                    if key == "rewrite":
+                        route["rewrite"] = parse_identifier(value)
+                    elif key == "interval":
+                        route["interval"] = int(value) * 1000
+                    elif key == "priority" and 0 <= int(value) <= 3:
+                        route["priority"] = int(value)
+                    elif key == "local" and not value:
+                        route["local"] = True
+                    else:
+                        raise ValueError("bad option %s" % option)
+                if not 0 <= route["source"] <= 2 or not 0 <= route["destination"] <= 2:
+                    raise ValueError("devices are numbered 0-2")
+            except ValueError as error:
+                sys.exit("%s:%d: %s" % (path, number, error))
+            routes.append(route)
+    if len(routes) > 255:
+        sys.exit("%s: at most 255 routes" % path)
+    return routes
+
+
+def name(identifier):
+    value, extended = identifier
+    return ("%08X" if extended else "%03X") % value
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit("usage: cangwgen.py routes")
+
+    routes = parse(sys.argv[1])
+    routes.sort(key=lambda r: (pack(*r["id"]), r["source"], r["destination"]))
+    slots = 0
+    devices = 1 + max([max(r["source"], r["destination"]) for r in routes] + [0])
+
+    print("// Generated by tools/cangwgen.py from %s, do not edit" % sys.argv[1])
+    print("#ifndef _CANGATEWAYROUTES_H_")
+    print("#define _CANGATEWAYROUTES_H_")
+    print()
+    print('#include "cangateway.h"')
+    print()
+    print("#define CAN_GATEWAY_ROUTE_COUNT %d" % len(routes))
+    print("#define CAN_GATEWAY_RATE_SLOTS  %d" % sum(1 for r in routes if r["interval"]))
+    print("#define CAN_GATEWAY_DEVICES     %d" % devices)
+    print()
+    print("static const canRoute gatewayRoutes[%s] = {" % ("CAN_GATEWAY_ROUTE_COUNT" if routes else "1"))
+    for route in routes:
+        flags = ["%d" % route["priority"]]
+        if route["rewrite"]:
+            flags.append("CAN_ROUTE_REWRITE")
+        if route["local"]:
+            flags.append("CAN_ROUTE_LOCAL")
+        slot = 0
+        if route["interval"]:
+            slot, slots = slots, slots + 1
+        rewrite = route["rewrite"] or route["id"]
+        print("    { 0x%08XUL, 0x%08XUL, %luUL, %d, %d, %s, %d },  // %d:%s -> %d:%s"
+              % (pack(*route["id"]), pack(*rewrite), route["interval"],
+                 route["source"], route["destination"], " | ".join(flags), slot,
+                 route["source"], name(route["id"]), route["destination"], name(rewrite)))
+    if not routes:
+        print("    { 0 }")
+    print("};")
+    print()
+    print()
+    print("#endif")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+"""Turns the binary stream of the frame logger (canlog.c) into a candump log or a pcap file.
+
+    tools/canlogdecode.py [-f candump|pcap] [-d device] [-i prefix] input [output]
+
+"input" is a capture of the UART, e.g. from "cat /dev/ttyUSB0 > capture.bin",
+and "-" reads standard input; the output goes to standard output unless
+named. The record layout is in canlog.h.
+
+The candump log ("candump -l", for canplayer and the can-utils) names
+device n "can<n>", or "<prefix><n>" with -i, and counts timestamps from
+the first record in the capture:
+
+    (0.000000) can0 18FEF100#FFFF7D1F00FFFFFF
+    (0.000412) can0 123#R
+
+A pcap file (LINKTYPE_CAN_SOCKETCAN, for Wireshark) has no interface
+field, so it takes the frames of one device only, -d (default 0). Lost
+frame records go to standard error in both formats, and so do records
+that do not decode, which are skipped.
+"""
+
+import argparse
+import struct
+import sys
+
+LOST = 0x80
+DEVICE = 0x90
+EVENT = 0x80
+
+IDE = 0x08
+EFF_FLAG = 0x80000000
+RTR_FLAG = 0x40000000
+LINKTYPE_CAN_SOCKETCAN = 227
+
+
+def cobs_decode(packet):
+    data = bytearray()
+    index = 0
+    while index < len(packet):
+        code = packet[index]
+        if code == 0 or index + code > len(packet):
+            raise ValueError("bad COBS code")
+        data += packet[index + 1:index + code]
+        index += code
+        if index < len(packet):
+            data.append(0)
+    return bytes(data)
+
+
+def records(stream):
+    """Decoded records; whatever comes before the first delimiter may have started halfway."""
+    packets = stream.split(b"\x00")
+    for number, packet in enumerate(packets[1:-1], 1):
+        if not packet:
+            continue
+        try:
+            yield cobs_decode(packet)
+        except ValueError as error:
+            print("record %d: %s" % (number, error), file=sys.stderr)
+
+
+def frames(stream):
+    """(device, time in microseconds, identifier, extended, rtr, dlc, data) per frame record."""
+    device = 0
+    time = 0
+    for record in records(stream):
+        header = record[0]
+        if header & EVENT:
+            if header & 0xF0 == DEVICE and len(record) == 1:
+                device = header & 0x0F
+            elif header == LOST and len(record) == 3:
+                print("can%d: %d frames lost" % (device, record[1] | record[2] << 8), file=sys.stderr)
+            else:
+                print("unknown event record %s" % record.hex(), file=sys.stderr)
+            continue
+
+        width = ((header >> 4) & 3) + 1
+        rtr = bool(header & 0x40)
+        dlc = header & 0x0F
+        length = 0 if rtr else min(dlc, 8)
+        if len(record) < 1 + width + 2:
+            print("short record %s" % record.hex(), file=sys.stderr)
+            continue
+        delta = int.from_bytes(record[1:1 + width], "little")
+        if width == 4 and delta & 0x80000000:
+            delta -= 1 << 32
+        position = 1 + width
+        extended = bool(record[position + 1] & IDE)
+        id_length = 4 if extended else 2
+        if len(record) != position + id_length + length:
+            print("bad record length %s" % record.hex(), file=sys.stderr)
+            continue
+        sidh, sidl = record[position], record[position + 1]
+        identifier = (sidh << 3) | (sidl >> 5)
+        if extended:
+            eid8, eid0 = record[position + 2], record[position + 3]
+            identifier = (identifier << 18) | ((sidl & 0x03) << 16) | (eid8 << 8) | eid0
+        time += delta
+        yield device, time, identifier, extended, rtr, dlc, record[position + id_length:]
+
+
+def write_candump(stream, output, prefix):
+    start = None
+    for device, time, identifier, extended, rtr, dlc, data in frames(stream):
+        if start is None:
+            start = time
+        seconds, micros = divmod(time - start, 1000000)
+        name = ("%08X" if extended else "%03X") % identifier
+        payload = "R" if rtr else data.hex().upper()
+        output.write(("(%d.%06d) %s%d %s#%s\n" % (seconds, micros, prefix, device, name, payload)).encode())
+
+
+def write_pcap(stream, output, wanted):
+    output.write(struct.pack("<IHHiIII", 0xA1B2C3D4, 2, 4, 0, 0, 65535, LINKTYPE_CAN_SOCKETCAN))
+    for device, time, identifier, extended, rtr, dlc, data in frames(stream):
+        if device != wanted:
+            continue
+        can_id = identifier | (EFF_FLAG if extended else 0) | (RTR_FLAG if rtr else 0)
+        seconds, micros = divmod(max(time, 0), 1000000)
+        packet = struct.pack(">IB3x", can_id, min(dlc, 8)) + data.ljust(8, b"\x00")
+        output.write(struct.pack("<IIII", seconds, micros, len(packet), len(packet)) + packet)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes a canlog.c capture.")
+    parser.add_argument("-f", "--format", choices=("candump", "pcap"), default="candump")
+    parser.add_argument("-d", "--device", type=int, default=0, help="device for pcap output")
+    parser.add_argument("-i", "--interface", default="can", help="interface name prefix for candump output")
+    parser.add_argument("input")
+    parser.add_argument("output", nargs="?", default="-")
+    arguments = parser.parse_args()
+
+    if arguments.input == "-":
+        stream = sys.stdin.buffer.read()
+    else:
+        with open(arguments.input, "rb") as file:
+            stream = file.read()
+    output = sys.stdout.buffer if arguments.output == "-" else open(arguments.output, "wb")
+
+    if arguments.format == "pcap":
+        write_pcap(stream, output, arguments.device)
+    else:
+        write_candump(stream, output, arguments.interface)
+    output.flush()
+
+
+if __name__ == "__main__":
+    main()